@@ -1,6 +1,8 @@
 #ifndef ABR_ALGO_HH
 #define ABR_ALGO_HH
 
+#include <utility>
+
 #include "media_formats.hh"
 #include "yaml.hh"
 
@@ -29,8 +31,18 @@ public:
   virtual ~ABRAlgo() {}
 
   virtual void video_chunk_acked(Chunk &&) {}
+
+  /* the rest of a chunk was cancelled; the part delivered before that is
+   * a throughput sample as good as a complete chunk by default */
+  virtual void video_chunk_abandoned(Chunk && c)
+  {
+    video_chunk_acked(std::move(c));
+  }
   virtual VideoFormat select_video_format() = 0;
 
+  /* memory held by the algorithm, including itself */
+  virtual size_t memory_bytes() const = 0;
+
   /* accessors */
   std::string abr_name() const { return abr_name_; }
 
@@ -26,6 +26,7 @@ public:
             const std::string & abr_name);
 
   VideoFormat select_video_format() override;
+  size_t memory_bytes() const override { return sizeof(*this); }
 
 private:
   /* Version of BOLA-BASIC */
@@ -10,6 +10,7 @@ public:
             const std::string & abr_name, const YAML::Node & abr_config);
 
   VideoFormat select_video_format() override;
+  size_t memory_bytes() const override { return sizeof(*this); }
 
 private:
   static constexpr double LOWER_RESERVOIR = 0.2;
@@ -1,5 +1,6 @@
 #include "mpc.hh"
 #include "ws_client.hh"
+#include "logger.hh"
 
 using namespace std;
 
@@ -96,8 +97,8 @@ void MPC::reinit()
         curr_ssims_[i][j] = ssim_db(
             channel->vssim(vformats[j], next_ts + vduration * (i - 1)));
       } catch (const exception & e) {
-        cerr << "Error occurs when getting the ssim of "
-             << next_ts + vduration * (i - 1) << " " << vformats[j] << endl;
+        LOG_WARNING << "Error occurs when getting the ssim of "
+                    << next_ts + vduration * (i - 1) << " " << vformats[j];
         curr_ssims_[i][j] = MIN_SSIM;
       }
     }
@@ -143,8 +144,8 @@ void MPC::reinit()
         curr_sending_time_[i][j] = get<1>(data_map.at(vformats[j]))
                                    * unit_sending_time_[i + num_past_chunks];
       } catch (const exception & e) {
-        cerr << "Error occurs when getting the video size of "
-             << next_ts + vduration * (i - 1) << " " << vformats[j] << endl;
+        LOG_WARNING << "Error occurs when getting the video size of "
+                    << next_ts + vduration * (i - 1) << " " << vformats[j];
         curr_sending_time_[i][j] = HIGH_SENDING_TIME;
       }
     }
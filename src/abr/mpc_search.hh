@@ -13,6 +13,10 @@ public:
 
   void video_chunk_acked(Chunk && c) override;
   VideoFormat select_video_format() override;
+  size_t memory_bytes() const override
+  {
+    return sizeof(*this) + past_chunks_.size() * sizeof(Chunk);
+  }
 
 private:
   static constexpr size_t MAX_NUM_PAST_CHUNKS = 5;
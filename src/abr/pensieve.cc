@@ -1,9 +1,9 @@
 #include "pensieve.hh"
 #include "ws_client.hh"
 #include "pid.hh"
-#include "system_runner.hh"
 #include "serialization.hh"
 #include "ipc_socket.hh"
+#include "logger.hh"
 #include "json.hpp"
 
 using namespace std;
@@ -31,18 +31,15 @@ Pensieve::Pensieve(const WebSocketClient & client,
     pensieve_path = abr_config["pensieve_path"].as<string>();
     nn_path = abr_config["nn_path"].as<string>();
   } else {
-    cerr << "Pensieve requires specifying paths in abr_config" << endl;
+    LOG_ERROR << "Pensieve requires specifying paths in abr_config";
     throw runtime_error("Pensieve config missing");
   }
 
-  /* start child process */
+  /* start child process; spawned rather than forked as the server might
+   * be running other threads (e.g., of the logger) */
   vector<string> prog_args { pensieve_path, nn_path, ipc_path };
 
-  pensieve_proc_ = make_unique<ChildProcess>(pensieve_path,
-    [&pensieve_path, &prog_args]() {
-      return ezexec(pensieve_path, prog_args);
-    }
-  );
+  pensieve_proc_ = make_unique<ChildProcess>(pensieve_path, prog_args);
 
   connection_ =  make_unique<FileDescriptor>(sock.accept());
 }
@@ -50,7 +47,7 @@ Pensieve::Pensieve(const WebSocketClient & client,
 Pensieve::~Pensieve()
 {
   if (not fs::remove(ipc_file_)) {
-    cerr << "Warning: file " << ipc_file_ << " cannot be removed" << endl;
+    LOG_WARNING << "file " << ipc_file_ << " cannot be removed";
   }
 }
 
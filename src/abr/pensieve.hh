@@ -15,6 +15,9 @@ public:
   void video_chunk_acked(Chunk && c) override;
   VideoFormat select_video_format() override;
 
+  /* the model runs in the Pensieve process */
+  size_t memory_bytes() const override { return sizeof(*this); }
+
 private:
   size_t next_br_index_ {};
   fs::path ipc_file_ {};
@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "ws_client.hh"
+#include "logger.hh"
 #include "json.hpp"
 
 using namespace std;
@@ -87,16 +88,16 @@ void Puffer::reinit()
         curr_ssims_[i][j] = ssim_db(
             channel->vssim(vformats[j], next_ts + vduration * (i - 1)));
       } catch (const exception & e) {
-        cerr << "Error occurs when getting the ssim of "
-             << next_ts + vduration * (i - 1) << " " << vformats[j] << endl;
+        LOG_WARNING << "Error occurs when getting the ssim of "
+                    << next_ts + vduration * (i - 1) << " " << vformats[j];
         curr_ssims_[i][j] = MIN_SSIM;
       }
 
       try {
         curr_sizes_[i][j] = get<1>(data_map.at(vformats[j]));
       } catch (const exception & e) {
-        cerr << "Error occurs when getting the sizes of "
-             << next_ts + vduration * (i - 1) << " " << vformats[j] << endl;
+        LOG_WARNING << "Error occurs when getting the sizes of "
+                    << next_ts + vduration * (i - 1) << " " << vformats[j];
         curr_sizes_[i][j] = -1;
       }
     }
@@ -30,6 +30,9 @@ protected:
   size_t max_num_past_chunks_ {MAX_NUM_PAST_CHUNKS};
   std::deque<Chunk> past_chunks_ {};
 
+  /* memory allocated by Puffer, excluding the object itself */
+  size_t heap_bytes() const { return past_chunks_.size() * sizeof(Chunk); }
+
   /* all the time durations are measured in sec */
   size_t max_lookahead_horizon_ {MAX_LOOKAHEAD_HORIZON};
   size_t lookahead_horizon_ {};
@@ -11,6 +11,11 @@ public:
   PufferRaw(const WebSocketClient & client,
             const std::string & abr_name, const YAML::Node & abr_config);
 
+  size_t memory_bytes() const override
+  {
+    return sizeof(*this) + heap_bytes();
+  }
+
 private:
   static constexpr double ST_VAR_COEFF = 0.7;
   static constexpr double HIGH_SENDING_TIME = 10000;
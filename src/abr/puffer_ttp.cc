@@ -1,5 +1,6 @@
 #include "puffer_ttp.hh"
 #include "ws_client.hh"
+#include "logger.hh"
 
 using namespace std;
 
@@ -7,12 +8,12 @@ PufferTTP::PufferTTP(const WebSocketClient & client,
                      const string & abr_name, const YAML::Node & abr_config)
   : Puffer(client, abr_name, abr_config)
 {
-  cerr << "abr_name = " << abr_name_ << endl;
+  LOG_INFO << "abr_name = " << abr_name_;
 
   /* load neural networks */
   if (abr_config["model_dir"]) {
     fs::path model_dir = abr_config["model_dir"].as<string>();
-    cerr << "model_dir = " << model_dir << endl;
+    LOG_INFO << "model_dir = " << model_dir;
 
     for (size_t i = 0; i < MAX_LOOKAHEAD_HORIZON; i++) {
       /* load PyTorch models */
@@ -21,6 +22,7 @@ PufferTTP::PufferTTP(const WebSocketClient & client,
       if (not ttp_modules_[i]) {
         throw runtime_error("Model " + model_path + " does not exist");
       }
+      model_bytes_ += fs::file_size(model_path);
 
       /* load normalization weights */
       ifstream ifs(model_dir / ("cpp-meta-" + to_string(i) + ".json"));
@@ -59,8 +61,8 @@ PufferTTP::PufferTTP(const WebSocketClient & client,
         throw runtime_error("invalid std params, should > 0");
       }
 
-      cerr << "blur_params: " << mean_val_ << ", "
-           << std_val_ << ", " << kernel_size_ << endl;
+      LOG_INFO << "blur_params: " << mean_val_ << ", "
+               << std_val_ << ", " << kernel_size_;
       gaussian_kernel_vals_.resize(kernel_size_);
       calculate_gaussian_values();
     }
@@ -69,6 +71,18 @@ PufferTTP::PufferTTP(const WebSocketClient & client,
   }
 }
 
+size_t PufferTTP::memory_bytes() const
+{
+  size_t ret = sizeof(*this) + heap_bytes() + model_bytes_
+               + gaussian_kernel_vals_.capacity() * sizeof(double);
+
+  for (size_t i = 0; i < MAX_LOOKAHEAD_HORIZON; i++) {
+    ret += (obs_mean_[i].capacity() + obs_std_[i].capacity()) * sizeof(double);
+  }
+
+  return ret;
+}
+
 void PufferTTP::normalize_in_place(size_t i, vector<double> & input)
 {
   assert(input.size() == obs_mean_[i].size());
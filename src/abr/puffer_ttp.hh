@@ -11,6 +11,9 @@ class PufferTTP : public Puffer
 public:
   PufferTTP(const WebSocketClient & client,
             const std::string & abr_name, const YAML::Node & abr_config);
+
+  size_t memory_bytes() const override;
+
 private:
   static constexpr double BAN_PROB_ = 0.5;
   static constexpr size_t TTP_INPUT_DIM = 62;
@@ -23,6 +26,9 @@ private:
 
   std::shared_ptr<torch::jit::script::Module> ttp_modules_[MAX_LOOKAHEAD_HORIZON];
 
+  /* size of the serialized models, as an estimate of their memory */
+  size_t model_bytes_ {0};
+
   /* stats of training data used for normalization */
   std::vector<double> obs_mean_[MAX_LOOKAHEAD_HORIZON];
   std::vector<double> obs_std_[MAX_LOOKAHEAD_HORIZON];
@@ -0,0 +1,169 @@
+#include "session_stats.hh"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+BufferEvent parse_buffer_event(const string & event)
+{
+  if (event == "startup") {
+    return BufferEvent::Startup;
+  } else if (event == "play") {
+    return BufferEvent::Play;
+  } else if (event == "rebuffer") {
+    return BufferEvent::Rebuffer;
+  }
+
+  return BufferEvent::Other;
+}
+
+void InvalidSessions::merge(const InvalidSessions & other)
+{
+  nonconsecutive += other.nonconsecutive;
+  long_rebuffer += other.long_rebuffer;
+  decoding_stalls += other.decoding_stalls;
+  no_startup += other.no_startup;
+}
+
+bool SessionState::valid_active_session(const uint64_t ts,
+                                        const double buffer,
+                                        const double cum_rebuf,
+                                        InvalidSessions & invalid)
+{
+  if (not valid_) {
+    return false;
+  }
+
+  /* verify that time is basically successive in the same session */
+  if (last_ts_ and ts - last_ts_ > 60 * 1000) {
+    invalid.nonconsecutive++;
+    valid_ = false;
+    return false;
+  }
+
+  /* detect sessions with long rebuffer durations */
+  if (last_low_buf_ and ts - *last_low_buf_ > 30 * 1000) {
+    invalid.long_rebuffer++;
+    valid_ = false;
+    return false;
+  }
+
+  /* detect sessions with stalls caused by slow video decoding */
+  if (last_buf_ and last_cum_rebuf_) {
+    if (buffer > 5 and *last_buf_ > 5 and cum_rebuf > *last_cum_rebuf_ + 0.25) {
+      invalid.decoding_stalls++;
+      valid_ = false;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void SessionState::add(const uint64_t ts, const BufferEvent event,
+                       const double buffer, const double cum_rebuf,
+                       InvalidSessions & invalid)
+{
+  if (not valid_active_session(ts, buffer, cum_rebuf, invalid)) {
+    return;
+  }
+
+  if (not min_play_time_ and event != BufferEvent::Startup) {
+    /* wait until "startup" is found */
+    return;
+  }
+
+  if (event == BufferEvent::Startup) {
+    min_play_time_ = ts;
+    min_cum_rebuf_ = cum_rebuf;
+    is_rebuffer_ = false;
+  } else if (event == BufferEvent::Rebuffer) {
+    if (not is_rebuffer_) {
+      num_rebuf_++;
+    }
+    is_rebuffer_ = true;
+  } else if (event == BufferEvent::Play) {
+    is_rebuffer_ = false;
+  }
+
+  if (not is_rebuffer_) {
+    if (not max_play_time_ or ts > *max_play_time_) {
+      max_play_time_ = ts;
+    }
+
+    if (not max_cum_rebuf_ or cum_rebuf > *max_cum_rebuf_) {
+      max_cum_rebuf_ = cum_rebuf;
+    }
+  }
+
+  last_ts_ = ts;
+  last_buf_ = buffer;
+  last_cum_rebuf_ = cum_rebuf;
+  if (buffer > 0.1) {
+    last_low_buf_.reset();
+  } else if (not last_low_buf_) {
+    last_low_buf_ = ts;
+  }
+}
+
+optional<SessionSummary> SessionState::finish(InvalidSessions & invalid) const
+{
+  if (not valid_) {
+    return nullopt;
+  }
+
+  if (not min_play_time_ or not max_play_time_ or
+      not min_cum_rebuf_ or not max_cum_rebuf_) {
+    invalid.no_startup++;
+    return nullopt;
+  }
+
+  SessionSummary summary;
+  summary.play_time = (*max_play_time_ - *min_play_time_) / 1000.0;
+  summary.cum_rebuf = *max_cum_rebuf_ - *min_cum_rebuf_;
+  summary.num_rebuf = num_rebuf_;
+  summary.startup_delay = *min_cum_rebuf_;
+  return summary;
+}
+
+void RatioEstimate::add(const double x, const double y)
+{
+  n_++;
+  sum_x_ += x;
+  sum_y_ += y;
+  sum_xx_ += x * x;
+  sum_xy_ += x * y;
+  sum_yy_ += y * y;
+}
+
+void RatioEstimate::merge(const RatioEstimate & other)
+{
+  n_ += other.n_;
+  sum_x_ += other.sum_x_;
+  sum_y_ += other.sum_y_;
+  sum_xx_ += other.sum_xx_;
+  sum_xy_ += other.sum_xy_;
+  sum_yy_ += other.sum_yy_;
+}
+
+double RatioEstimate::ratio() const
+{
+  return sum_x_ > 0 ? sum_y_ / sum_x_ : NAN;
+}
+
+double RatioEstimate::ci_half_width() const
+{
+  if (n_ < 2 or sum_x_ <= 0) {
+    return NAN;
+  }
+
+  /* sum((y_i - R x_i)^2), expanded so that it is computed from the sums */
+  const double r = ratio();
+  const double residual = max(0.0, sum_yy_ - 2 * r * sum_xy_
+                                   + r * r * sum_xx_);
+
+  const double mean_x = sum_x_ / n_;
+  const double se = sqrt(residual / (n_ * (n_ - 1.0))) / mean_x;
+  return 1.96 * se;
+}
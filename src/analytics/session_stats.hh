@@ -0,0 +1,102 @@
+#ifndef SESSION_STATS_HH
+#define SESSION_STATS_HH
+
+#include <cstdint>
+#include <string>
+#include <optional>
+
+/* the client_buffer events that drive the session state machine */
+enum class BufferEvent { Startup, Play, Rebuffer, Other };
+
+BufferEvent parse_buffer_event(const std::string & event);
+
+/* reasons for discarding a session, counted over a run */
+struct InvalidSessions
+{
+  uint64_t nonconsecutive {0};
+  uint64_t long_rebuffer {0};
+  uint64_t decoding_stalls {0};
+  uint64_t no_startup {0};
+
+  void merge(const InvalidSessions & other);
+};
+
+/* what a valid session amounts to (times in seconds) */
+struct SessionSummary
+{
+  double play_time {0};
+  double cum_rebuf {0};
+  unsigned int num_rebuf {0};
+  double startup_delay {0};
+};
+
+/* The per-session state machine of BufferStream in
+ * scripts/stream_processor.py, fed with the client_buffer events of one
+ * session (user, init_id, expt_id) in time order. A session ends once it has
+ * not had an event for SESSION_EXPIRY_MS. */
+class SessionState
+{
+public:
+  static constexpr uint64_t SESSION_EXPIRY_MS = 60 * 1000;
+
+  void add(const uint64_t ts, const BufferEvent event,
+           const double buffer, const double cum_rebuf,
+           InvalidSessions & invalid);
+
+  /* the summary of the ended session, unless it is invalid */
+  std::optional<SessionSummary> finish(InvalidSessions & invalid) const;
+
+  /* in ms; 0 before the first event */
+  uint64_t last_ts() const { return last_ts_; }
+
+private:
+  bool valid_ {true};
+
+  /* set once "startup" is seen */
+  std::optional<uint64_t> min_play_time_ {};
+  std::optional<uint64_t> max_play_time_ {};
+  std::optional<double> min_cum_rebuf_ {};
+  std::optional<double> max_cum_rebuf_ {};
+
+  bool is_rebuffer_ {true};
+  unsigned int num_rebuf_ {0};
+
+  uint64_t last_ts_ {0};
+  std::optional<double> last_buf_ {};
+  std::optional<double> last_cum_rebuf_ {};
+  std::optional<uint64_t> last_low_buf_ {};
+
+  bool valid_active_session(const uint64_t ts, const double buffer,
+                            const double cum_rebuf, InvalidSessions & invalid);
+};
+
+/* Estimates the ratio sum(y) / sum(x) of samples drawn in clusters, e.g.,
+ * the fraction of play time spent stalled over sessions (x: play time,
+ * y: stall time), with a confidence interval from the delta method. With
+ * x = 1, this is the mean of y. The sums are kept so that estimates of
+ * shards can be merged. */
+class RatioEstimate
+{
+public:
+  void add(const double x, const double y);
+  void merge(const RatioEstimate & other);
+
+  uint64_t count() const { return n_; }
+  double sum_x() const { return sum_x_; }
+  double sum_y() const { return sum_y_; }
+
+  double ratio() const;
+
+  /* half width of the 95% confidence interval of ratio() */
+  double ci_half_width() const;
+
+private:
+  uint64_t n_ {0};
+  double sum_x_ {0};
+  double sum_y_ {0};
+  double sum_xx_ {0};
+  double sum_xy_ {0};
+  double sum_yy_ {0};
+};
+
+#endif /* SESSION_STATS_HH */
@@ -0,0 +1,764 @@
+#include <cstdlib>
+#include <cmath>
+#include <getopt.h>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <deque>
+#include <queue>
+#include <optional>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "yaml-cpp/yaml.h"
+#include "filesystem.hh"
+#include "exception.hh"
+#include "session_stats.hh"
+
+using namespace std;
+
+/* sessions shorter than this are excluded, as in plot_ssim_rebuffer.py */
+static const double MIN_PLAY_TIME = 5;  /* seconds */
+
+/* sessions are spread over this many shards, whatever the number of
+ * threads */
+static const size_t NUM_SHARDS = 256;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options] <log file>...\n\n"
+  "Summarize the client_buffer.*.log and video_acked.*.log files written by\n"
+  "ws_media_server per scheme: stall ratio, SSIM and startup delay with 95%\n"
+  "confidence intervals, the way scripts/plot_ssim_rebuffer.py does\n\n"
+  "Options:\n"
+  "--expt <expt_cache.json>    name schemes \"abr+cc\" by the experiment\n"
+  "                            settings (see scripts/cache_expt_config.py);\n"
+  "                            otherwise by experiment ID\n"
+  "--threads <N>               number of threads (default: all cores)\n"
+  "--json                      print JSON instead of a table"
+  << endl;
+}
+
+/* a line of either log, with the fields the analysis needs */
+struct Event
+{
+  enum class Type { Buffer, Acked } type {Type::Buffer};
+  uint64_t ts {0};  /* ms */
+  uint32_t expt_id {0};
+  uint32_t user {0};  /* interned by UserNames */
+  uint64_t init_id {0};
+  BufferEvent event {BufferEvent::Other};
+  double buffer {0};
+  double cum_rebuf {0};
+  double ssim_index {0};  /* video_acked only */
+};
+
+/* a session is identified by (user, init_id, expt_id) */
+struct SessionKey
+{
+  uint32_t user;
+  uint32_t expt_id;
+  uint64_t init_id;
+
+  bool operator==(const SessionKey & other) const
+  {
+    return init_id == other.init_id and expt_id == other.expt_id
+           and user == other.user;
+  }
+};
+
+struct SessionKeyHash
+{
+  size_t operator()(const SessionKey & key) const
+  {
+    return hash<uint64_t>()(key.init_id * 0x9E3779B97F4A7C15
+                            ^ (uint64_t(key.user) << 32 | key.expt_id));
+  }
+};
+
+struct SchemeStats
+{
+  RatioEstimate stall {};          /* x: play time, y: stall time */
+  RatioEstimate ssim {};           /* x: chunks, y: sum of SSIM indices */
+  RatioEstimate startup_delay {};  /* x: 1, y: startup delay */
+  uint64_t num_rebuf {0};
+
+  void merge(const SchemeStats & other)
+  {
+    stall.merge(other.stall);
+    ssim.merge(other.ssim);
+    startup_delay.merge(other.startup_delay);
+    num_rebuf += other.num_rebuf;
+  }
+};
+
+/* key: expt ID */
+using ExptStats = map<uint32_t, SchemeStats>;
+
+/* split a CSV line into fields, without copying */
+static vector<string_view> split_fields(const string_view line)
+{
+  vector<string_view> fields;
+
+  size_t start = 0;
+  for (;;) {
+    const size_t end = line.find(',', start);
+    fields.emplace_back(line.substr(start, end - start));
+    if (end == string_view::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+
+  return fields;
+}
+
+static uint64_t to_uint(const string_view field)
+{
+  return stoull(string(field));
+}
+
+static double to_double(const string_view field)
+{
+  return stod(string(field));
+}
+
+/* assigns each user name a number, so that events and sessions do not
+ * carry a copy of the name */
+class UserNames
+{
+public:
+  uint32_t id(const string_view name)
+  {
+    name_.assign(name);  /* reuses its buffer */
+
+    const auto it = ids_.find(name_);
+    if (it != ids_.end()) {
+      return it->second;
+    }
+
+    const uint32_t id = ids_.size();
+    ids_.emplace(name_, id);
+    return id;
+  }
+
+private:
+  unordered_map<string, uint32_t> ids_ {};
+  string name_ {};
+};
+
+/* reads the events of a log file one at a time; the name of the file tells
+ * the kind of log */
+class LogReader
+{
+public:
+  LogReader(const fs::path & path, UserNames & users)
+    : path_(path), users_(users)
+  {
+    const string filename = path.filename().string();
+    if (filename.find("client_buffer") == 0) {
+      type_ = Event::Type::Buffer;
+      num_fields_ = 10;
+    } else if (filename.find("video_acked") == 0) {
+      type_ = Event::Type::Acked;
+      num_fields_ = 11;
+    } else {
+      throw runtime_error(path.string() + ": not a client_buffer or "
+                          "video_acked log");
+    }
+
+    input_.open(path);
+    if (not input_) {
+      throw runtime_error(path.string() + ": cannot open");
+    }
+  }
+
+  /* the next event, or nullopt at the end of the file */
+  optional<Event> next()
+  {
+    while (getline(input_, line_)) {
+      line_no_++;
+      if (auto e = parse(line_)) {
+        return e;
+      }
+
+      cerr << path_.string() << ":" << line_no_ << ": skipped malformed line"
+           << endl;
+    }
+
+    return nullopt;
+  }
+
+private:
+  fs::path path_;
+  UserNames & users_;
+  Event::Type type_ {Event::Type::Buffer};
+  size_t num_fields_ {0};
+
+  ifstream input_ {};
+  string line_ {};
+  uint64_t line_no_ {0};
+
+  optional<Event> parse(const string_view line) const
+  {
+    const auto fields = split_fields(line);
+    if (fields.size() != num_fields_) {
+      return nullopt;
+    }
+
+    Event e;
+    e.type = type_;
+
+    try {
+      e.ts = to_uint(fields[0]);
+
+      /* client_buffer: ts,channel,server_id,event,expt_id,user,
+       *                first_init_id,init_id,buffer,cum_rebuf
+       * video_acked: ts,channel,server_id,expt_id,user,first_init_id,
+       *              init_id,video_ts,ssim_index,buffer,cum_rebuffer */
+      if (type_ == Event::Type::Buffer) {
+        e.event = parse_buffer_event(string(fields[3]));
+        e.expt_id = to_uint(fields[4]);
+        e.user = users_.id(fields[5]);
+        e.init_id = to_uint(fields[7]);
+        e.buffer = to_double(fields[8]);
+        e.cum_rebuf = to_double(fields[9]);
+      } else {
+        e.expt_id = to_uint(fields[3]);
+        e.user = users_.id(fields[4]);
+        e.init_id = to_uint(fields[6]);
+        e.ssim_index = to_double(fields[8]);
+      }
+    } catch (const exception &) {
+      return nullopt;
+    }
+
+    return e;
+  }
+};
+
+/* merges the logs, each in time order (as written by a server), into one
+ * stream in time order; ties are broken by the order of the files */
+class LogMerger
+{
+public:
+  LogMerger(const vector<string> & paths, UserNames & users)
+  {
+    for (const auto & path : paths) {
+      readers_.emplace_back(path, users);
+    }
+
+    heads_.resize(readers_.size());
+    for (size_t i = 0; i < readers_.size(); i++) {
+      advance(i);
+    }
+  }
+
+  optional<Event> next()
+  {
+    if (queue_.empty()) {
+      return nullopt;
+    }
+
+    const size_t i = queue_.top().second;
+    queue_.pop();
+
+    Event e = *heads_[i];
+    advance(i);
+    return e;
+  }
+
+private:
+  /* deque, as a LogReader cannot be moved */
+  deque<LogReader> readers_ {};
+  vector<optional<Event>> heads_ {};
+
+  /* (ts, index) of the head event of each reader, earliest on top */
+  using Head = pair<uint64_t, size_t>;
+  priority_queue<Head, vector<Head>, greater<Head>> queue_ {};
+
+  void advance(const size_t i)
+  {
+    heads_[i] = readers_[i].next();
+    if (heads_[i]) {
+      queue_.emplace(heads_[i]->ts, i);
+    }
+  }
+};
+
+/* The sessions of a subset of keys, run through their state machines in time
+ * order and summarized per experiment as they expire. Only the sessions with
+ * events in the last SESSION_EXPIRY_MS are kept. */
+class Shard
+{
+public:
+  void add(const Event & e)
+  {
+    const SessionKey key {e.user, e.expt_id, e.init_id};
+
+    if (e.ts >= last_sweep_ts_ + SessionState::SESSION_EXPIRY_MS) {
+      expire(e.ts);
+      last_sweep_ts_ = e.ts;
+    }
+
+    /* SSIM of the received chunks */
+    if (e.type == Event::Type::Acked) {
+      if (e.ssim_index != 1) {
+        auto it = ssims_.find(key);
+        if (it != ssims_.end() and
+            e.ts - it->second.last_event_ts > SessionState::SESSION_EXPIRY_MS) {
+          finish_ssim(it->first, it->second);
+          ssims_.erase(it);
+          it = ssims_.end();
+        }
+
+        if (it == ssims_.end()) {
+          it = ssims_.emplace(key, SSIMSum()).first;
+        }
+
+        it->second.last_event_ts = e.ts;
+        it->second.chunks++;
+        it->second.sum += e.ssim_index;
+      }
+      return;
+    }
+
+    /* a session expires after a minute without events; a later event
+     * with the same key starts a new session */
+    auto it = sessions_.find(key);
+    if (it != sessions_.end() and
+        e.ts - it->second.last_event_ts > SessionState::SESSION_EXPIRY_MS) {
+      finish_session(it->first, it->second);
+      sessions_.erase(it);
+      it = sessions_.end();
+    }
+
+    if (it == sessions_.end()) {
+      it = sessions_.emplace(key, Session()).first;
+    }
+
+    it->second.last_event_ts = e.ts;
+    it->second.state.add(e.ts, e.event, e.buffer, e.cum_rebuf, invalid_);
+  }
+
+  /* end of the logs: finish the remaining sessions */
+  void finish()
+  {
+    expire(UINT64_MAX);
+  }
+
+  const ExptStats & stats() const { return stats_; }
+  const InvalidSessions & invalid() const { return invalid_; }
+
+private:
+  struct Session
+  {
+    SessionState state {};
+    uint64_t last_event_ts {0};
+  };
+
+  struct SSIMSum
+  {
+    uint64_t chunks {0};
+    double sum {0};  /* of SSIM indices */
+    uint64_t last_event_ts {0};
+  };
+
+  unordered_map<SessionKey, Session, SessionKeyHash> sessions_ {};
+  unordered_map<SessionKey, SSIMSum, SessionKeyHash> ssims_ {};
+  uint64_t last_sweep_ts_ {0};
+
+  ExptStats stats_ {};
+  InvalidSessions invalid_ {};
+
+  void finish_session(const SessionKey & key, const Session & session)
+  {
+    const auto summary = session.state.finish(invalid_);
+    if (not summary or summary->play_time < MIN_PLAY_TIME) {
+      return;
+    }
+
+    SchemeStats & s = stats_[key.expt_id];
+    s.stall.add(summary->play_time, summary->cum_rebuf);
+    s.startup_delay.add(1, summary->startup_delay);
+    s.num_rebuf += summary->num_rebuf;
+  }
+
+  void finish_ssim(const SessionKey & key, const SSIMSum & ssim)
+  {
+    stats_[key.expt_id].ssim.add(ssim.chunks, ssim.sum);
+  }
+
+  /* finish the sessions without events in SESSION_EXPIRY_MS before now,
+   * which no later event can extend */
+  void expire(const uint64_t now)
+  {
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+      if (now - it->second.last_event_ts > SessionState::SESSION_EXPIRY_MS) {
+        finish_session(it->first, it->second);
+        it = sessions_.erase(it);
+      } else {
+        it++;
+      }
+    }
+
+    for (auto it = ssims_.begin(); it != ssims_.end();) {
+      if (now - it->second.last_event_ts > SessionState::SESSION_EXPIRY_MS) {
+        finish_ssim(it->first, it->second);
+        it = ssims_.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+};
+
+/* A thread running the events of some shards, which are handed to it in
+ * batches; a bounded number of batches may wait, so that a slow worker
+ * holds back the reader rather than let the events pile up. */
+class Worker
+{
+public:
+  static constexpr size_t BATCH_SIZE = 4096;  /* events */
+  static constexpr size_t MAX_PENDING_BATCHES = 16;
+
+  struct Item
+  {
+    size_t shard;
+    Event event;
+  };
+
+  Worker(vector<Shard> & shards)
+    : thread_([this, &shards]() { run(shards); })
+  {}
+
+  ~Worker()
+  {
+    if (thread_.joinable()) {
+      stop();
+      thread_.join();
+    }
+  }
+
+  /* forbid copying Worker */
+  Worker(const Worker & other) = delete;
+  Worker & operator=(const Worker & other) = delete;
+
+  void add(const size_t shard, const Event & e)
+  {
+    batch_.push_back({shard, e});
+    if (batch_.size() >= BATCH_SIZE) {
+      flush();
+    }
+  }
+
+  /* hand over the rest and wait for the worker to run it */
+  void finish()
+  {
+    if (not thread_.joinable()) {
+      return;
+    }
+
+    flush();
+    stop();
+    thread_.join();
+
+    if (error_) {
+      rethrow_exception(error_);
+    }
+  }
+
+private:
+  vector<Item> batch_ {};
+
+  mutex mutex_ {};
+  condition_variable cv_ {};
+  deque<vector<Item>> pending_ {};
+  bool done_ {false};
+  exception_ptr error_ {};
+
+  thread thread_;  /* started last */
+
+  /* the worker returns once the pending batches are run */
+  void stop()
+  {
+    {
+      lock_guard<mutex> lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  void flush()
+  {
+    if (batch_.empty()) {
+      return;
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    cv_.wait(lock, [this]() {
+      return pending_.size() < MAX_PENDING_BATCHES or error_;
+    });
+    if (error_) {
+      rethrow_exception(error_);
+    }
+
+    pending_.emplace_back(move(batch_));
+    batch_ = {};
+    batch_.reserve(BATCH_SIZE);
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+  void run(vector<Shard> & shards)
+  {
+    try {
+      for (;;) {
+        vector<Item> items;
+        {
+          unique_lock<mutex> lock(mutex_);
+          cv_.wait(lock, [this]() { return not pending_.empty() or done_; });
+          if (pending_.empty()) {
+            return;
+          }
+
+          items = move(pending_.front());
+          pending_.pop_front();
+        }
+        cv_.notify_all();
+
+        for (const Item & item : items) {
+          shards[item.shard].add(item.event);
+        }
+      }
+    } catch (...) {
+      lock_guard<mutex> lock(mutex_);
+      error_ = current_exception();
+      cv_.notify_all();
+    }
+  }
+};
+
+/* "abr+cc" of an experiment, as get_abr_cc() in scripts/helpers.py */
+static string scheme_name(const YAML::Node & expt_config)
+{
+  const string cc = expt_config["cc"].as<string>();
+
+  if (expt_config["abr_name"]) {
+    return expt_config["abr_name"].as<string>() + "+" + cc;
+  }
+
+  string abr = expt_config["abr"].as<string>();
+  if (abr.find("puffer_ttp") != string::npos) {
+    const string model_dir = fs::path(
+        expt_config["abr_config"]["model_dir"].as<string>()).filename();
+
+    if (model_dir.find("bbr-2019") != string::npos or
+        model_dir.find("cubic-2019") != string::npos) {
+      abr = "puffer_ttp_cl";
+    } else {
+      abr = "puffer_ttp_static";
+    }
+  }
+
+  return abr + "+" + cc;
+}
+
+static double ssim_index_to_db(const double ssim_index)
+{
+  return -10 * log10(1 - ssim_index);
+}
+
+static void print_stats(const map<string, SchemeStats> & schemes,
+                        const bool json)
+{
+  if (json) {
+    /* NaN (e.g., a CI of a single session) is printed as null */
+    auto num = [](const double x) {
+      ostringstream out;
+      if (isnan(x)) {
+        out << "null";
+      } else {
+        out << setprecision(10) << x;
+      }
+      return out.str();
+    };
+
+    cout << "{";
+    bool first = true;
+    for (const auto & [name, s] : schemes) {
+      const double ssim = s.ssim.ratio();
+      const double ssim_hw = s.ssim.ci_half_width();
+
+      cout << (first ? "" : ",") << "\n  \"" << name << "\": {"
+           << "\"sessions\": " << s.stall.count()
+           << ", \"total_play\": " << num(s.stall.sum_x())
+           << ", \"total_rebuf\": " << num(s.stall.sum_y())
+           << ", \"num_rebuf\": " << s.num_rebuf
+           << ", \"stall_ratio\": " << num(s.stall.ratio())
+           << ", \"stall_ratio_ci\": " << num(s.stall.ci_half_width())
+           << ", \"ssim_chunks\": " << num(s.ssim.sum_x())
+           << ", \"ssim_index\": " << num(ssim)
+           << ", \"ssim_db\": " << num(ssim_index_to_db(ssim))
+           << ", \"ssim_db_ci\": [" << num(ssim_index_to_db(ssim - ssim_hw))
+           << ", " << num(ssim_index_to_db(ssim + ssim_hw)) << "]"
+           << ", \"startup_delay\": " << num(s.startup_delay.ratio())
+           << ", \"startup_delay_ci\": "
+           << num(s.startup_delay.ci_half_width()) << "}";
+      first = false;
+    }
+    cout << "\n}" << endl;
+    return;
+  }
+
+  cout << left << setw(32) << "scheme" << right
+       << setw(10) << "sessions" << setw(12) << "watch (h)"
+       << setw(22) << "stalled (%)" << setw(28) << "SSIM (dB)"
+       << setw(22) << "startup delay (s)" << "\n" << fixed;
+
+  for (const auto & [name, s] : schemes) {
+    const double ssim = s.ssim.ratio();
+    const double ssim_hw = s.ssim.ci_half_width();
+
+    ostringstream stall, ssim_db, startup;
+    stall << fixed << setprecision(3) << s.stall.ratio() * 100 << " ± "
+          << s.stall.ci_half_width() * 100;
+    ssim_db << fixed << setprecision(3) << ssim_index_to_db(ssim) << " ["
+            << ssim_index_to_db(ssim - ssim_hw) << ", "
+            << ssim_index_to_db(ssim + ssim_hw) << "]";
+    startup << fixed << setprecision(3) << s.startup_delay.ratio() << " ± "
+            << s.startup_delay.ci_half_width();
+
+    cout << left << setw(32) << name << right
+         << setw(10) << s.stall.count()
+         << setw(12) << setprecision(2) << s.stall.sum_x() / 3600
+         << setw(22) << stall.str() << setw(28) << ssim_db.str()
+         << setw(22) << startup.str() << "\n";
+  }
+
+  cout << flush;
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  string expt_path;
+  size_t num_threads = max(1u, thread::hardware_concurrency());
+  bool json = false;
+
+  const option cmd_line_opts[] = {
+    {"expt",    required_argument, nullptr, 'e'},
+    {"threads", required_argument, nullptr, 't'},
+    {"json",    no_argument,       nullptr, 'j'},
+    { nullptr,  0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "e:t:j", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+    case 'e':
+      expt_path = optarg;
+      break;
+    case 't':
+      num_threads = max(1, stoi(optarg));
+      break;
+    case 'j':
+      json = true;
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind == argc) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const vector<string> log_paths(argv + optind, argv + argc);
+
+  /* Read the logs as one stream in time order and route each event to the
+   * shard of its session, so that a session (which stays on a channel and
+   * server) is run in whole by one worker. The number of shards is fixed,
+   * so that the result does not depend on the number of threads. */
+  UserNames users;
+  LogMerger logs(log_paths, users);
+
+  vector<Shard> shards(NUM_SHARDS);
+  {
+    deque<Worker> workers;
+    for (size_t i = 0; i < num_threads; i++) {
+      workers.emplace_back(shards);
+    }
+
+    while (auto e = logs.next()) {
+      const size_t shard = SessionKeyHash()({e->user, e->expt_id, e->init_id})
+                           % NUM_SHARDS;
+      workers[shard % num_threads].add(shard, *e);
+    }
+
+    for (auto & worker : workers) {
+      worker.finish();
+    }
+  }
+
+  ExptStats expt_stats;
+  InvalidSessions invalid;
+  for (auto & shard : shards) {
+    shard.finish();
+    for (const auto & [expt_id, stats] : shard.stats()) {
+      expt_stats[expt_id].merge(stats);
+    }
+    invalid.merge(shard.invalid());
+  }
+
+  /* group experiments by scheme */
+  YAML::Node expt_configs;
+  if (not expt_path.empty()) {
+    expt_configs = YAML::LoadFile(expt_path);
+  }
+
+  map<string, SchemeStats> schemes;
+  for (const auto & [expt_id, stats] : expt_stats) {
+    string name = "expt_" + to_string(expt_id);
+    if (expt_path.empty()) {
+      /* keep the experiment ID */
+    } else if (expt_configs[to_string(expt_id)]) {
+      name = scheme_name(expt_configs[to_string(expt_id)]);
+    } else {
+      cerr << "Warning: expt ID " << expt_id << " not found in "
+           << expt_path << endl;
+    }
+
+    schemes[name].merge(stats);
+  }
+
+  cerr << "Invalid sessions: " << invalid.nonconsecutive << " nonconsecutive, "
+       << invalid.long_rebuffer << " long rebuffer, "
+       << invalid.decoding_stalls << " decoding stalls, "
+       << invalid.no_startup << " no startup" << endl;
+
+  print_stats(schemes, json);
+
+  return EXIT_SUCCESS;
+}
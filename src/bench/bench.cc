@@ -0,0 +1,264 @@
+#include "bench.hh"
+
+#include <unistd.h>
+#include <getopt.h>
+#include <ctime>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <optional>
+
+#include "json.hpp"
+#include "timestamp.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace std::chrono;
+using json = nlohmann::json;
+
+/* no run has more iterations */
+static const uint64_t MAX_ITERATIONS = 1000000000;
+
+static vector<pair<string, BenchFunction>> & benchmarks()
+{
+  static vector<pair<string, BenchFunction>> ret;
+  return ret;
+}
+
+void register_benchmark(const string & name, const BenchFunction & func)
+{
+  benchmarks().emplace_back(name, func);
+}
+
+namespace {
+
+struct Options
+{
+  string filter {};
+  double min_time {0.5};  /* seconds */
+  unsigned int repetitions {3};
+  string json_path {};
+};
+
+struct Result
+{
+  string name;
+  uint64_t iterations;
+  double real_ns;  /* per iteration */
+  double cpu_ns;   /* per iteration */
+  uint64_t bytes;  /* per iteration */
+  uint64_t items;  /* per iteration */
+};
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Options:\n"
+  "--filter, -f <substring>    run only the benchmarks whose names contain it\n"
+  "--min-time, -t <seconds>    minimum duration of a run (default: 0.5)\n"
+  "--repetitions, -r <n>       runs of which the fastest counts (default: 3)\n"
+  "--json, -j <path>           also write the results to path as JSON"
+  << endl;
+}
+
+optional<Options> parse_options(int argc, char * argv[])
+{
+  Options options;
+
+  const option cmd_line_opts[] = {
+    {"filter",      required_argument, nullptr, 'f'},
+    {"min-time",    required_argument, nullptr, 't'},
+    {"repetitions", required_argument, nullptr, 'r'},
+    {"json",        required_argument, nullptr, 'j'},
+    { nullptr,      0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "f:t:r:j:", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+    case 'f':
+      options.filter = optarg;
+      break;
+    case 't':
+      options.min_time = stod(optarg);
+      break;
+    case 'r':
+      options.repetitions = max(stoi(optarg), 1);
+      break;
+    case 'j':
+      options.json_path = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      return nullopt;
+    }
+  }
+
+  if (optind != argc) {
+    print_usage(argv[0]);
+    return nullopt;
+  }
+
+  return options;
+}
+
+/* run the body once with the given iterations */
+Result run_once(const string & name, const BenchFunction & func,
+                const uint64_t iterations)
+{
+  BenchState state(iterations);
+
+  const auto start = steady_clock::now();
+  const uint64_t cpu_start = thread_cpu_ns();
+  func(state);
+  const uint64_t cpu_ns = thread_cpu_ns() - cpu_start;
+  const double real_ns = duration<double, nano>(
+                           steady_clock::now() - start).count();
+
+  return {name, iterations, real_ns / iterations,
+          static_cast<double>(cpu_ns) / iterations,
+          state.bytes_per_iteration(), state.items_per_iteration()};
+}
+
+Result run_benchmark(const string & name, const BenchFunction & func,
+                     const Options & options)
+{
+  /* a first run warms up the caches and builds any fixtures used lazily */
+  uint64_t iterations = 1;
+  Result result = run_once(name, func, iterations);
+  result = run_once(name, func, iterations);
+
+  /* find the number of iterations that takes at least min_time */
+
+  while (result.real_ns * iterations < options.min_time * 1e9
+         and iterations < MAX_ITERATIONS) {
+    /* aim a little beyond min_time, but grow at most tenfold at once */
+    const double estimate = options.min_time * 1e9 * 1.4
+                            / max(result.real_ns, 1.0);
+    iterations = min(max(static_cast<uint64_t>(estimate), iterations + 1),
+                     min(iterations * 10, MAX_ITERATIONS));
+    result = run_once(name, func, iterations);
+  }
+
+  /* the fastest repetition is the least disturbed */
+  for (unsigned int i = 1; i < options.repetitions; i++) {
+    const Result repetition = run_once(name, func, iterations);
+    if (repetition.real_ns < result.real_ns) {
+      result = repetition;
+    }
+  }
+
+  return result;
+}
+
+string hostname()
+{
+  char name[256] = {};
+  CheckSystemCall("gethostname", gethostname(name, sizeof(name) - 1));
+  return name;
+}
+
+string local_date()
+{
+  const time_t now = time(nullptr);
+  tm local;
+  localtime_r(&now, &local);
+
+  char date[64];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &local);
+  return date;
+}
+
+void write_json(const string & path, const string & executable,
+                const vector<Result> & results)
+{
+  json output;
+
+  output["context"] = {
+    {"date", local_date()},
+    {"host_name", hostname()},
+    {"executable", executable},
+    {"num_cpus", thread::hardware_concurrency()},
+#ifdef NDEBUG
+    {"library_build_type", "release"},
+#else
+    {"library_build_type", "debug"},
+#endif
+  };
+
+  output["benchmarks"] = json::array();
+  for (const auto & result : results) {
+    json benchmark = {
+      {"name", result.name},
+      {"run_name", result.name},
+      {"run_type", "iteration"},
+      {"iterations", result.iterations},
+      {"real_time", result.real_ns},
+      {"cpu_time", result.cpu_ns},
+      {"time_unit", "ns"},
+    };
+
+    if (result.bytes) {
+      benchmark["bytes_per_second"] = result.bytes * 1e9 / result.real_ns;
+    }
+    if (result.items) {
+      benchmark["items_per_second"] = result.items * 1e9 / result.real_ns;
+    }
+
+    output["benchmarks"].push_back(benchmark);
+  }
+
+  ofstream(path) << output.dump(2) << endl;
+}
+
+}
+
+int run_benchmarks(int argc, char * argv[])
+{
+  const auto parsed_options = parse_options(argc, argv);
+  if (not parsed_options) {
+    return EXIT_FAILURE;
+  }
+  const Options & options = *parsed_options;
+
+  size_t name_width = 0;
+  for (const auto & [name, func] : benchmarks()) {
+    name_width = max(name_width, name.size());
+  }
+
+  cout << left << setw(name_width) << "benchmark" << right
+       << setw(14) << "time (ns)" << setw(14) << "CPU (ns)"
+       << setw(14) << "iterations" << setw(14) << "MB/s" << endl;
+
+  vector<Result> results;
+  for (const auto & [name, func] : benchmarks()) {
+    if (name.find(options.filter) == string::npos) {
+      continue;
+    }
+
+    results.emplace_back(run_benchmark(name, func, options));
+    const Result & result = results.back();
+
+    cout << left << setw(name_width) << name << right << fixed
+         << setprecision(1) << setw(14) << result.real_ns
+         << setw(14) << result.cpu_ns << setw(14) << result.iterations;
+    if (result.bytes) {
+      cout << setw(14) << result.bytes * 1e3 / result.real_ns;
+    }
+    cout << endl;
+  }
+
+  if (not options.json_path.empty()) {
+    write_json(options.json_path, argv[0], results);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#ifndef BENCH_HH
+#define BENCH_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+/* A minimal microbenchmark harness in the style of Google Benchmark: each
+ * benchmark runs its body for a number of iterations, which is grown until
+ * a run takes at least the minimum time; the fastest of a few repetitions of
+ * such runs is reported, as a table and optionally as JSON in the format of
+ * Google Benchmark (so existing tools can compare results over time). */
+class BenchState
+{
+public:
+  explicit BenchState(const uint64_t iterations) : iterations_(iterations) {}
+
+  uint64_t iterations() const { return iterations_; }
+
+  /* for throughput; per iteration */
+  void set_bytes_per_iteration(const uint64_t bytes) { bytes_ = bytes; }
+  void set_items_per_iteration(const uint64_t items) { items_ = items; }
+
+  uint64_t bytes_per_iteration() const { return bytes_; }
+  uint64_t items_per_iteration() const { return items_; }
+
+private:
+  uint64_t iterations_;
+  uint64_t bytes_ {0};
+  uint64_t items_ {0};
+};
+
+/* the body runs state.iterations() times; setup done before the loop in
+ * the function is included in the time, so keep it cheap or hoist it */
+using BenchFunction = std::function<void(BenchState &)>;
+
+void register_benchmark(const std::string & name, const BenchFunction & func);
+
+/* parse the options (--filter, --min-time, --repetitions, --json) and run
+ * the registered benchmarks; returns the exit status */
+int run_benchmarks(int argc, char * argv[]);
+
+/* keep the compiler from optimizing away a value or the writes to it */
+template<class T>
+inline void do_not_optimize(T & value)
+{
+  asm volatile("" : "+m"(value) : : "memory");
+}
+
+template<class T>
+inline void do_not_optimize(const T & value)
+{
+  asm volatile("" : : "m"(value) : "memory");
+}
+
+#endif /* BENCH_HH */
@@ -0,0 +1,73 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+
+#include "synthetic_media.hh"
+#include "exception.hh"
+
+using namespace std;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options] <media_dir> <channel>\n\n"
+  "Write a pre-recorded channel of synthetic media into <media_dir>/<channel>\n"
+  "and print its channel config (to add under channel_configs)\n\n"
+  "Options:\n"
+  "--chunks, -n <n>    number of video chunks (default: 10)\n"
+  "--seed, -s <seed>   seed of the random media (default: 0)"
+  << endl;
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  SyntheticMedia media;
+
+  const option cmd_line_opts[] = {
+    {"chunks", required_argument, nullptr, 'n'},
+    {"seed",   required_argument, nullptr, 's'},
+    { nullptr, 0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "n:s:", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+    case 'n':
+      media.num_chunks = stoul(optarg);
+      break;
+    case 's':
+      media.seed = stoul(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 2) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const fs::path media_dir = argv[optind];
+  const string channel = argv[optind + 1];
+
+  try {
+    YAML::Node config;
+    config[channel] = media.write(media_dir, channel);
+    cout << config << endl;
+  } catch (const exception & e) {
+    print_exception(argv[0], e);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "bench.hh"
+#include "synthetic_media.hh"
+#include "channel.hh"
+#include "ws_client.hh"
+#include "abr_algo.hh"
+#include "server_message.hh"
+#include "client_message.hh"
+#include "ws_frame.hh"
+#include "ws_message_parser.hh"
+#include "mp4_parser.hh"
+#include "formatter.hh"
+#include "inotify.hh"
+#include "poller.hh"
+#include "temp_dir.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* as in ws_media_server */
+static const size_t MAX_WS_FRAME_B = 100 * 1024;
+
+/* a client-vidack as sent by the player */
+static const string CLIENT_VIDACK =
+  R"({"type":"client-vidack","initId":1,"channel":"bench",)"
+  R"("format":"1280x720-22","timestamp":1801800,"byteOffset":102400,)"
+  R"("byteLength":102400,"totalByteLength":688128,"ssim":0.987654,)"
+  R"("videoBuffer":12.345,"audioBuffer":13.456,"cumRebuffer":0.678})";
+
+/* the synthetic channel served by the benchmarks, written on first use */
+class SyntheticChannel
+{
+public:
+  static constexpr const char * NAME = "bench";
+
+  SyntheticChannel()
+    : media_dir_((fs::temp_directory_path() / "puffer-bench").string())
+  {
+    const YAML::Node config = SyntheticMedia().write(media_dir_.name(), NAME);
+    channel_ = make_shared<Channel>(NAME, media_dir_.name(), config, inotify_);
+  }
+
+  ~SyntheticChannel()
+  {
+    fs::remove_all(fs::path(media_dir_.name()) / NAME);
+  }
+
+  const shared_ptr<Channel> & channel() const { return channel_; }
+
+  fs::path video_path(const VideoFormat & vf, const uint64_t ts) const
+  {
+    return fs::path(media_dir_.name()) / NAME / "ready" / vf.to_string()
+           / (to_string(ts) + ".m4s");
+  }
+
+  /* forbid copying SyntheticChannel */
+  SyntheticChannel(const SyntheticChannel & other) = delete;
+  const SyntheticChannel & operator=(const SyntheticChannel & other) = delete;
+
+private:
+  Poller poller_ {};
+  Inotify inotify_ {poller_};
+  TempDirectory media_dir_;
+  shared_ptr<Channel> channel_ {};
+};
+
+static const SyntheticChannel & synthetic_channel()
+{
+  static SyntheticChannel ret;
+  return ret;
+}
+
+static void ws_frame_to_string(BenchState & state, const size_t payload_size)
+{
+  const WSFrame frame {true, WSFrame::OpCode::Binary,
+                       string(payload_size, 'x')};
+
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    const string wire = frame.to_string();
+    do_not_optimize(wire);
+  }
+
+  state.set_bytes_per_iteration(payload_size);
+}
+
+static void ws_message_parser_parse(BenchState & state, const string & payload)
+{
+  /* frames from clients are masked */
+  const string wire = WSFrame {true, WSFrame::OpCode::Text, payload,
+                               0x12345678}.to_string();
+  WSMessageParser parser;
+
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    parser.parse(wire);
+    do_not_optimize(parser.front().payload());
+    parser.pop();
+  }
+
+  state.set_bytes_per_iteration(wire.size());
+}
+
+static void client_msg_parser_vidack(BenchState & state)
+{
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    ClientMsgParser parser(CLIENT_VIDACK);
+    const ClientVidAckMsg ack = parser.parse_client_vidack();
+    do_not_optimize(ack.byte_offset);
+  }
+
+  state.set_bytes_per_iteration(CLIENT_VIDACK.size());
+}
+
+static void server_video_msg_to_string(BenchState & state)
+{
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    const ServerVideoMsg msg(1, "bench", "1280x720-22", 1801800, 102400,
+                             688128, 0.987654, "0123456789abcdef", 0);
+    const string serialized = msg.to_string();
+    do_not_optimize(serialized);
+  }
+}
+
+/* the format of the largest chunks */
+static VideoFormat top_vformat(const Channel & channel)
+{
+  const auto & data_map = channel.vdata(*channel.init_vts());
+
+  return max_element(data_map.begin(), data_map.end(),
+    [](const auto & a, const auto & b) {
+      return get<1>(a.second) < get<1>(b.second);
+    })->first;
+}
+
+static void video_segment_read(BenchState & state)
+{
+  const auto & channel = synthetic_channel().channel();
+  const VideoFormat vf = top_vformat(*channel);
+  const mmap_t & data = channel->vdata(vf, 0);
+  const mmap_t & init = channel->vinit(vf);
+
+  string frame_payload;
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    VideoSegment segment(vf, data, init);
+
+    while (not segment.done()) {
+      frame_payload.clear();
+      segment.read(frame_payload, MAX_WS_FRAME_B);
+      do_not_optimize(frame_payload);
+    }
+  }
+
+  state.set_bytes_per_iteration(get<1>(data) + get<1>(init));
+}
+
+/* the loop of serving a video chunk in ws_media_server, without the ABR
+ * decision and the socket */
+static void serve_video_chunk(BenchState & state)
+{
+  const auto & channel = synthetic_channel().channel();
+  const VideoFormat vf = top_vformat(*channel);
+  const mmap_t & data = channel->vdata(vf, 0);
+  const double ssim = channel->vssim(vf, 0);
+  const string init_hash = channel->vinit_hash(vf);
+
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    VideoSegment segment(vf, data, nullopt);
+
+    while (not segment.done()) {
+      const ServerVideoMsg video_msg(1, channel->name(), vf.to_string(), 0,
+                                     segment.offset(), segment.length(),
+                                     ssim, init_hash, 0);
+      string frame_payload = video_msg.to_string();
+      segment.read(frame_payload, MAX_WS_FRAME_B - frame_payload.size());
+
+      const WSFrame frame {true, WSFrame::OpCode::Binary, move(frame_payload)};
+      const string wire = frame.to_string();
+      do_not_optimize(wire);
+    }
+  }
+
+  state.set_bytes_per_iteration(get<1>(data));
+}
+
+/* a client mid-stream: some chunks acked, some buffer, and the rest of the
+ * channel ahead (which bounds the lookahead of the MPC-style algorithms) */
+static void abr_select_video_format(BenchState & state, const string & abr,
+                                    const YAML::Node & abr_config)
+{
+  const auto & channel = synthetic_channel().channel();
+  const auto & vformats = channel->vformats();
+
+  WebSocketClient client(1, abr, abr_config);
+  client.init_channel(channel, *channel->init_vts(), *channel->init_ats());
+
+  const TCPInfo tcp_info {40, 20, 20000, 30000, 2000000, 0};
+  for (unsigned int i = 0; i < 5; i++) {
+    const uint64_t ts = i * channel->vduration();
+    const VideoFormat & vf = vformats.at(i * vformats.size() / 5);
+    const unsigned int size = get<1>(channel->vdata(vf, ts));
+
+    client.set_tcp_info(tcp_info);
+    client.video_chunk_acked(vf, channel->vssim(vf, ts), size,
+                             size * 1000 / tcp_info.delivery_rate);
+    client.set_curr_vformat(vf);
+  }
+
+  client.set_next_vts(*channel->init_vts());
+  client.set_video_playback_buf(8.5);
+  client.set_tcp_info(tcp_info);
+
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    const VideoFormat vf = client.select_video_format();
+    do_not_optimize(vf);
+  }
+}
+
+static void mp4_parser_parse(BenchState & state)
+{
+  const auto & channel = synthetic_channel().channel();
+  const VideoFormat vf = top_vformat(*channel);
+  const string path = synthetic_channel().video_path(vf, 0);
+
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    MP4::MP4Parser parser(path);
+    parser.parse();
+    do_not_optimize(parser);
+  }
+
+  state.set_bytes_per_iteration(fs::file_size(path));
+}
+
+/* a line of the client_buffer log */
+static const string CLIENT_BUFFER_FORMAT =
+  R"(client_buffer,channel={1},server_id={2} event="{3}",expt_id={4}i,)"
+  R"(user="{5}",first_init_id={6}i,init_id={7}i,buffer={8},cum_rebuf={9} {0})";
+
+static void formatter_parse(BenchState & state)
+{
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    Formatter formatter;
+    formatter.parse(CLIENT_BUFFER_FORMAT);
+    do_not_optimize(formatter);
+  }
+}
+
+static void formatter_format_to(BenchState & state)
+{
+  Formatter formatter;
+  formatter.parse(CLIENT_BUFFER_FORMAT);
+
+  const vector<string_view> values {
+    "1561234567890", "cbs", "3", "timer", "42", "someone@example.com",
+    "1234567", "1234569", "12.345", "0.678"};
+
+  string line;
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    line.clear();
+    formatter.format_to(line, values);
+    do_not_optimize(line);
+  }
+}
+
+/* the lookups of a chunk the server and the ABR algorithms do per format */
+static void channel_lookups(BenchState & state)
+{
+  const auto & channel = synthetic_channel().channel();
+  const auto & vformats = channel->vformats();
+  const uint64_t vts = *channel->vready_frontier();
+  const uint64_t ats = *channel->aready_frontier();
+  const AudioFormat & af = channel->aformats().front();
+
+  for (uint64_t i = 0; i < state.iterations(); i++) {
+    for (const auto & vf : vformats) {
+      do_not_optimize(channel->vdata(vf, vts));
+      do_not_optimize(channel->vssim(vf, vts));
+    }
+    do_not_optimize(channel->adata(af, ats));
+  }
+
+  state.set_items_per_iteration(vformats.size() * 2 + 1);
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  register_benchmark("WSFrame::to_string/256B",
+    [](BenchState & state) { ws_frame_to_string(state, 256); });
+  register_benchmark("WSFrame::to_string/100KiB",
+    [](BenchState & state) { ws_frame_to_string(state, MAX_WS_FRAME_B); });
+
+  register_benchmark("WSMessageParser::parse/client_vidack",
+    [](BenchState & state) { ws_message_parser_parse(state, CLIENT_VIDACK); });
+  register_benchmark("ClientMsgParser/client_vidack", client_msg_parser_vidack);
+
+  register_benchmark("ServerVideoMsg::to_string", server_video_msg_to_string);
+  register_benchmark("VideoSegment::read", video_segment_read);
+  register_benchmark("serve_video_chunk", serve_video_chunk);
+
+  /* pensieve runs a Python process and the TTP models are not in the tree */
+  for (const string abr : {"linear_bba", "mpc", "robust_mpc", "puffer_raw",
+                           "bola_basic_v1", "bola_basic_v2"}) {
+    register_benchmark("ABRAlgo::select_video_format/" + abr,
+      [abr](BenchState & state) {
+        abr_select_video_format(state, abr, YAML::Node());
+      });
+  }
+
+  /* the exhaustive search is exponential in the lookahead horizon */
+  register_benchmark("ABRAlgo::select_video_format/mpc_search",
+    [](BenchState & state) {
+      YAML::Node abr_config;
+      abr_config["max_lookahead_horizon"] = 3;
+      abr_select_video_format(state, "mpc_search", abr_config);
+    });
+
+  register_benchmark("MP4Parser::parse", mp4_parser_parse);
+
+  register_benchmark("Formatter::parse", formatter_parse);
+  register_benchmark("Formatter::format_to", formatter_format_to);
+
+  register_benchmark("Channel::lookups", channel_lookups);
+
+  try {
+    return run_benchmarks(argc, argv);
+  } catch (const exception & e) {
+    print_exception(argv[0], e);
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,215 @@
+#include "synthetic_media.hh"
+
+#include <fcntl.h>
+#include <cmath>
+#include <random>
+#include <fstream>
+#include <algorithm>
+
+#include "media_formats.hh"
+#include "mp4_file.hh"
+#include "box.hh"
+#include "mfhd_box.hh"
+#include "tfhd_box.hh"
+#include "tfdt_box.hh"
+#include "trun_box.hh"
+
+using namespace std;
+using namespace MP4;
+
+/* the defaults of Channel */
+static const unsigned int VIDEO_DURATION = 180180;  // 2.002s per chunk
+static const unsigned int AUDIO_DURATION = 432000;  // 4.8s per chunk
+static const unsigned int TIMESCALE = 90000;
+static const unsigned int FRAMES_PER_CHUNK = 60;
+
+static const unsigned int VIDEO_INIT_SIZE = 800;  /* bytes */
+static const unsigned int AUDIO_INIT_SIZE = 300;  /* bytes */
+
+static string random_bytes(const size_t size, mt19937 & rng)
+{
+  string ret(size, '\0');
+  for (size_t i = 0; i < size; i++) {
+    ret[i] = static_cast<char>(rng());
+  }
+  return ret;
+}
+
+static void write_file(const fs::path & path, const string & data)
+{
+  ofstream file(path, ios::binary | ios::trunc);
+  file << data;
+
+  if (not file) {
+    throw runtime_error("failed to write " + path.string());
+  }
+}
+
+/* size of a chunk of video of a format; a 1080p chunk is about 1.2 MB
+ * (5 Mbps) at CRF 23, and bitrate halves every 6 CRF */
+static unsigned int video_chunk_size(const VideoFormat & vf,
+                                     const double complexity)
+{
+  const double bytes = vf.width * vf.height * 0.6
+                       * pow(2.0, (23 - vf.crf) / 6.0) * complexity;
+  return max(static_cast<unsigned int>(bytes), FRAMES_PER_CHUNK);
+}
+
+/* SSIM of a chunk of video; lower for smaller and more compressed video */
+static double video_chunk_ssim(const VideoFormat & vf,
+                               const double complexity)
+{
+  const double distortion = 0.01 * pow(2.0, (vf.crf - 20) / 6.0)
+                            * sqrt(1080.0 / vf.height) * complexity;
+  return 1 - min(distortion, 0.5);
+}
+
+/* a media segment as mp4_fragment outputs, without styp and sidx */
+static void write_video_segment(const fs::path & path, const uint64_t ts,
+                                const unsigned int size, mt19937 & rng)
+{
+  MP4File mp4(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  /* the key frame takes a sixth of the chunk */
+  const unsigned int key_size = size / 6;
+  const unsigned int frame_size = (size - key_size) / (FRAMES_PER_CHUNK - 1);
+
+  vector<TrunBox::Sample> samples;
+  samples.push_back({0, key_size, 0, 0});
+  for (unsigned int i = 1; i < FRAMES_PER_CHUNK - 1; i++) {
+    samples.push_back({0, frame_size, 0, 0});
+  }
+  samples.push_back({0, size - key_size - frame_size * (FRAMES_PER_CHUNK - 2),
+                     0, 0});
+
+  auto mfhd_box = make_shared<MfhdBox>(
+      "mfhd",  // type
+      0,       // version
+      0,       // flags
+      ts / VIDEO_DURATION + 1  // sequence_number
+  );
+
+  auto tfhd_box = make_shared<TfhdBox>(
+      "tfhd",  // type
+      0,       // version
+      TfhdBox::default_base_is_moof |
+      TfhdBox::default_sample_duration_present,  // flags
+      1,       // track_id
+      VIDEO_DURATION / FRAMES_PER_CHUNK  // default_sample_duration
+  );
+
+  auto tfdt_box = make_shared<TfdtBox>(
+      "tfdt",  // type
+      1,       // version
+      0,       // flags
+      ts       // base_media_decode_time
+  );
+
+  auto trun_box = make_shared<TrunBox>(
+      "trun",  // type
+      0,       // version
+      TrunBox::data_offset_present | TrunBox::sample_size_present,  // flags
+      move(samples)  // samples
+  );
+
+  /* write boxes one by one to get the position of 'data_offset' */
+  const uint64_t moof_offset = mp4.curr_offset();
+  auto moof_box = make_shared<Box>("moof");
+  moof_box->write_size_type(mp4);
+  mfhd_box->write_box(mp4);
+
+  const uint64_t traf_offset = mp4.curr_offset();
+  auto traf_box = make_shared<Box>("traf");
+  traf_box->write_size_type(mp4);
+  tfhd_box->write_box(mp4);
+  tfdt_box->write_box(mp4);
+
+  const uint64_t trun_offset = mp4.curr_offset();
+  trun_box->write_box(mp4);
+
+  traf_box->fix_size_at(mp4, traf_offset);
+  moof_box->fix_size_at(mp4, moof_offset);
+
+  /* data_offset = size of moof + header size of mdat (8) */
+  const uint64_t moof_size = mp4.curr_offset() - moof_offset;
+  mp4.write_int32_at(static_cast<int32_t>(moof_size + 8),
+                    trun_offset + trun_box->data_offset_pos());
+
+  mp4.write_uint32(size + 8);
+  mp4.write_string("mdat", 4);
+  mp4.write(random_bytes(size, rng));
+}
+
+YAML::Node SyntheticMedia::write(const fs::path & media_dir,
+                                 const string & name) const
+{
+  const fs::path ready_dir = media_dir / name / "ready";
+  mt19937 rng(seed);
+
+  YAML::Node config;
+  config["live"] = false;
+
+  vector<VideoFormat> vformats;
+  for (const auto & [resolution, crfs] : video) {
+    for (const unsigned int crf : crfs) {
+      config["video"][resolution].push_back(crf);
+      vformats.emplace_back(resolution + "-" + to_string(crf));
+    }
+  }
+
+  vector<AudioFormat> aformats;
+  for (const auto & bitrate : audio) {
+    config["audio"].push_back(bitrate);
+    aformats.emplace_back(bitrate);
+  }
+
+  for (const auto & vf : vformats) {
+    fs::create_directories(ready_dir / vf.to_string());
+    fs::create_directories(ready_dir / (vf.to_string() + "-ssim"));
+
+    write_file(ready_dir / vf.to_string() / "init.mp4",
+               random_bytes(VIDEO_INIT_SIZE, rng));
+  }
+
+  /* scene complexity varies by chunk and scales every format alike */
+  uniform_real_distribution<double> complexity_dist(0.5, 1.5);
+
+  for (unsigned int i = 0; i < num_chunks; i++) {
+    const uint64_t ts = static_cast<uint64_t>(i) * VIDEO_DURATION;
+    const double complexity = complexity_dist(rng);
+
+    for (const auto & vf : vformats) {
+      const fs::path video_dir = ready_dir / vf.to_string();
+      const string filestem = to_string(ts);
+
+      write_video_segment(video_dir / (filestem + ".m4s"), ts,
+                          video_chunk_size(vf, complexity), rng);
+
+      write_file(ready_dir / (vf.to_string() + "-ssim") / (filestem + ".ssim"),
+                 to_string(video_chunk_ssim(vf, complexity)) + "\n");
+    }
+  }
+
+  /* audio covers the video */
+  const uint64_t last_vts = num_chunks ?
+      static_cast<uint64_t>(num_chunks - 1) * VIDEO_DURATION : 0;
+  const unsigned int num_audio_chunks = last_vts / AUDIO_DURATION + 1;
+
+  for (const auto & af : aformats) {
+    const fs::path audio_dir = ready_dir / af.to_string();
+    fs::create_directories(audio_dir);
+
+    write_file(audio_dir / "init.webm", random_bytes(AUDIO_INIT_SIZE, rng));
+
+    const size_t audio_chunk_size =
+        af.bitrate * 1000 / 8 * AUDIO_DURATION / TIMESCALE;
+
+    for (unsigned int i = 0; i < num_audio_chunks; i++) {
+      const uint64_t ts = static_cast<uint64_t>(i) * AUDIO_DURATION;
+      write_file(audio_dir / (to_string(ts) + ".chk"),
+                 random_bytes(audio_chunk_size, rng));
+    }
+  }
+
+  return config;
+}
@@ -0,0 +1,38 @@
+#ifndef SYNTHETIC_MEDIA_HH
+#define SYNTHETIC_MEDIA_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "filesystem.hh"
+#include "yaml.hh"
+
+/* A pre-recorded channel made of synthetic media, laid out in
+ * <media_dir>/<name>/ready/ the way the media pipeline leaves a real one, so
+ * that a Channel can be loaded (and the server benchmarked) without encoding
+ * any video. Video segments are well-formed fragmented MP4 (moof + mdat) of
+ * random payload, sized by resolution, CRF and a per-chunk scene complexity
+ * shared by all formats; SSIMs follow the same model. Init segments and audio
+ * chunks are random bytes of plausible sizes, as the server only forwards
+ * them. The output is a function of the seed. */
+struct SyntheticMedia
+{
+  /* in the formats of a channel config */
+  std::vector<std::pair<std::string, std::vector<unsigned int>>> video {
+    {"1920x1080", {20, 22, 24, 26}},
+    {"1280x720", {20, 22, 24, 26}},
+    {"854x480", {22, 24, 26}},
+    {"640x360", {24, 26}},
+    {"426x240", {26}},
+  };
+  std::vector<std::string> audio {"32k", "64k", "96k", "128k"};
+
+  unsigned int num_chunks {10};  /* of video */
+  uint32_t seed {0};
+
+  /* write the channel and return its channel config */
+  YAML::Node write(const fs::path & media_dir, const std::string & name) const;
+};
+
+#endif /* SYNTHETIC_MEDIA_HH */
@@ -0,0 +1,286 @@
+#include "viewer.hh"
+
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "serialization.hh"
+
+using namespace std;
+
+void ViewerStats::merge(const ViewerStats & other)
+{
+  inits += other.inits;
+  video_chunks += other.video_chunks;
+  audio_chunks += other.audio_chunks;
+  cancels += other.cancels;
+  media_bytes += other.media_bytes;
+  stalls += other.stalls;
+
+  play_s += other.play_s;
+  rebuffer_s += other.rebuffer_s;
+
+  for (const auto & [error_type, count] : other.errors) {
+    errors[error_type] += count;
+  }
+
+  startup_delay_ms.merge(other.startup_delay_ms);
+  chunk_delivery_ms.merge(other.chunk_delivery_ms);
+}
+
+double ViewerStats::rebuffer_ratio() const
+{
+  const double watch_s = play_s + rebuffer_s;
+  return watch_s > 0 ? rebuffer_s / watch_s : 0;
+}
+
+/* buffer lengths are reported in ms precision, as in puffer.js */
+static double round_ms(const double seconds)
+{
+  return round(seconds * 1000) / 1000;
+}
+
+Viewer::Viewer(const Config & config, ViewerStats & stats)
+  : config_(config), stats_(stats)
+{}
+
+json Viewer::buffer_info() const
+{
+  return {
+    {"initId", init_id_},
+    {"videoBuffer", round_ms(video_buffer_)},
+    {"audioBuffer", round_ms(audio_buffer_)},
+    {"cumRebuffer", round_ms(cum_rebuffer_)},
+  };
+}
+
+void Viewer::send_client_init()
+{
+  init_id_++;
+  cum_rebuffer_ = 0;
+
+  /* no init segment is cached, so the server prepends them to chunks */
+  const json msg = {
+    {"type", "client-init"},
+    {"initId", init_id_},
+    {"sessionKey", config_.session_key},
+    {"userName", config_.username},
+    {"channel", config_.channel},
+    {"os", config_.os},
+    {"browser", config_.browser},
+    {"screenWidth", config_.screen_width},
+    {"screenHeight", config_.screen_height},
+    {"cachedInits", json::array()},
+  };
+
+  outbox_.emplace_back(msg.dump());
+}
+
+void Viewer::send_client_info(const string & event)
+{
+  json msg = buffer_info();
+  msg["type"] = "client-info";
+  msg["event"] = event;
+
+  outbox_.emplace_back(msg.dump());
+}
+
+void Viewer::send_ack(const string & type, const json & metadata,
+                      const size_t byte_length)
+{
+  json msg = buffer_info();
+  msg["type"] = type;
+
+  msg["channel"] = metadata.at("channel");
+  msg["format"] = metadata.at("format");
+  msg["timestamp"] = metadata.at("timestamp");
+  msg["byteOffset"] = metadata.at("byteOffset");
+  msg["totalByteLength"] = metadata.at("totalByteLength");
+  msg["byteLength"] = byte_length;
+
+  if (type == "client-vidack") {
+    msg["ssim"] = metadata.at("ssim");
+  }
+
+  outbox_.emplace_back(msg.dump());
+}
+
+void Viewer::open(const uint64_t now_ms)
+{
+  init_sent_ms_ = now_ms;
+  last_advance_ms_ = now_ms;
+  send_client_init();
+}
+
+void Viewer::handle_message(const string & payload, const uint64_t now_ms)
+{
+  if (payload.size() < sizeof(uint16_t)) {
+    throw runtime_error("server message without metadata length");
+  }
+
+  const size_t metadata_length = get_uint16(payload.data());
+  const size_t data_offset = sizeof(uint16_t) + metadata_length;
+  if (payload.size() < data_offset) {
+    throw runtime_error("server message shorter than its metadata length");
+  }
+
+  const json metadata = json::parse(payload.begin() + sizeof(uint16_t),
+                                    payload.begin() + data_offset);
+  const string type = metadata.at("type").get<string>();
+
+  if (type == "server-error") {
+    const string error_type = metadata.at("errorType").get<string>();
+    stats_.errors[error_type]++;
+
+    /* fatal regardless of initId; a busy server would have a browser
+     * retry on another one */
+    if (error_type == "maintenance" or error_type == "limit" or
+        error_type == "busy") {
+      done_ = true;
+      return;
+    }
+  }
+
+  /* ignore the messages of an earlier client-init */
+  if (metadata.at("initId").get<unsigned int>() != init_id_) {
+    return;
+  }
+
+  if (type == "server-error") {
+    const string error_type = metadata.at("errorType").get<string>();
+
+    if (error_type == "reinit") {
+      /* request the same channel again, without resuming */
+      init_sent_ms_ = now_ms;
+      send_client_init();
+    } else if (error_type == "unavailable") {
+      done_ = true;
+    }
+  } else if (type == "server-init") {
+    handle_server_init(metadata);
+  } else if (type == "server-video") {
+    handle_media(metadata, payload.size() - data_offset, true, now_ms);
+  } else if (type == "server-audio") {
+    handle_media(metadata, payload.size() - data_offset, false, now_ms);
+  } else if (type == "server-cancel") {
+    /* the chunk will be sent again from its start */
+    stats_.cancels++;
+  } else {
+    throw runtime_error("unknown server message type: " + type);
+  }
+}
+
+void Viewer::handle_server_init(const json & metadata)
+{
+  timescale_ = metadata.at("timescale").get<unsigned int>();
+  video_duration_ = metadata.at("videoDuration").get<unsigned int>();
+  audio_duration_ = metadata.at("audioDuration").get<unsigned int>();
+
+  if (timescale_ == 0) {
+    throw runtime_error("server-init with a zero timescale");
+  }
+
+  /* client-init never asks to resume, so the playback starts over */
+  state_ = State::Startup;
+  video_buffer_ = 0;
+  audio_buffer_ = 0;
+  chunk_start_ms_ = 0;
+
+  stats_.inits++;
+}
+
+void Viewer::handle_media(const json & metadata, const size_t data_length,
+                          const bool video, const uint64_t now_ms)
+{
+  if (state_ == State::Idle) {
+    throw runtime_error("media received before server-init");
+  }
+
+  stats_.media_bytes += data_length;
+
+  const unsigned int byte_offset =
+    metadata.at("byteOffset").get<unsigned int>();
+  const unsigned int total_byte_length =
+    metadata.at("totalByteLength").get<unsigned int>();
+  const string ack_type = video ? "client-vidack" : "client-audack";
+
+  if (video and byte_offset == 0) {
+    chunk_start_ms_ = now_ms;
+  }
+
+  if (data_length + byte_offset != total_byte_length) {
+    /* ack every fragment but the last one right away */
+    send_ack(ack_type, metadata, data_length);
+    return;
+  }
+
+  if (video) {
+    video_buffer_ += static_cast<double>(video_duration_) / timescale_;
+    stats_.video_chunks++;
+    stats_.chunk_delivery_ms.add(now_ms - chunk_start_ms_);
+  } else {
+    audio_buffer_ += static_cast<double>(audio_duration_) / timescale_;
+    stats_.audio_chunks++;
+  }
+
+  /* the last fragment is acked once the chunk is in the buffer */
+  send_ack(ack_type, metadata, data_length);
+}
+
+void Viewer::advance(const uint64_t now_ms)
+{
+  const double elapsed_s = (now_ms - last_advance_ms_) / 1000.0;
+  last_advance_ms_ = now_ms;
+
+  switch (state_) {
+  case State::Idle:
+    return;
+
+  case State::Startup:
+    if (video_buffer_ > 0 and audio_buffer_ > 0) {
+      const uint64_t startup_delay_ms = now_ms - init_sent_ms_;
+      stats_.startup_delay_ms.add(startup_delay_ms);
+
+      /* the startup delay is reported via cumRebuffer */
+      cum_rebuffer_ += startup_delay_ms / 1000.0;
+      state_ = State::Playing;
+      send_client_info("startup");
+      last_info_ms_ = now_ms;
+    }
+
+    /* "timer" is only sent once the channel has started playing */
+    return;
+
+  case State::Playing: {
+    const double played = min({elapsed_s, video_buffer_, audio_buffer_});
+    video_buffer_ -= played;
+    audio_buffer_ -= played;
+    stats_.play_s += played;
+
+    if (played < elapsed_s) {
+      /* video or audio has run dry */
+      state_ = State::Rebuffering;
+      stats_.stalls++;
+      cum_rebuffer_ += elapsed_s - played;
+      stats_.rebuffer_s += elapsed_s - played;
+      send_client_info("rebuffer");
+    }
+    break;
+  }
+
+  case State::Rebuffering:
+    if (video_buffer_ > 0 and audio_buffer_ > 0) {
+      state_ = State::Playing;
+      send_client_info("play");
+    } else {
+      cum_rebuffer_ += elapsed_s;
+      stats_.rebuffer_s += elapsed_s;
+    }
+    break;
+  }
+
+  if (now_ms - last_info_ms_ >= INFO_INTERVAL_MS) {
+    send_client_info("timer");
+    last_info_ms_ = now_ms;
+  }
+}
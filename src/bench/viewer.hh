@@ -0,0 +1,133 @@
+#ifndef VIEWER_HH
+#define VIEWER_HH
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <map>
+
+#include "quantile_sketch.hh"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+/* what a group of viewers experienced over a period */
+struct ViewerStats
+{
+  uint64_t inits {0};         /* server-init not resuming a session */
+  uint64_t video_chunks {0};  /* complete ones */
+  uint64_t audio_chunks {0};
+  uint64_t cancels {0};       /* video chunks cancelled by the server */
+  uint64_t media_bytes {0};   /* payload of server-video and server-audio */
+  uint64_t stalls {0};        /* rebuffering events after startup */
+
+  double play_s {0};      /* time spent playing */
+  double rebuffer_s {0};  /* time spent rebuffering after startup */
+
+  /* server-error received, by errorType */
+  std::map<std::string, uint64_t> errors {};
+
+  /* from client-init to playing */
+  QuantileSketch startup_delay_ms {};
+
+  /* from the first to the last fragment of a video chunk */
+  QuantileSketch chunk_delivery_ms {};
+
+  void merge(const ViewerStats & other);
+
+  /* fraction of the watch time spent rebuffering (startup excluded) */
+  double rebuffer_ratio() const;
+};
+
+/* A headless player speaking the client side of the protocol of puffer.js
+ * over an open WebSocket: it sends client-init, acks every fragment (the
+ * last one of a chunk after the chunk has been "appended"), and reports
+ * startup, rebuffer, play and timer events in client-info. The playback
+ * buffers fill up with the duration of every complete chunk, and once both
+ * are nonempty they drain in real time, as a video element plays them.
+ * Time is passed in by the caller (in milliseconds), and the messages to
+ * send are left in outbox(). */
+class Viewer
+{
+public:
+  struct Config
+  {
+    std::string channel {};
+    std::string session_key {};
+    std::string username {};
+    std::string os {"Linux"};
+    std::string browser {"LoadGenerator"};
+    uint16_t screen_width {1920};
+    uint16_t screen_height {1080};
+  };
+
+  /* the interval of "timer" client-info, as in puffer.js */
+  static constexpr uint64_t INFO_INTERVAL_MS = 250;
+
+  Viewer(const Config & config, ViewerStats & stats);
+
+  /* the WebSocket is open: request the channel */
+  void open(const uint64_t now_ms);
+
+  /* handle a server message (binary: metadata length, metadata, data) */
+  void handle_message(const std::string & payload, const uint64_t now_ms);
+
+  /* play the buffers until now_ms; to be called every few tens of ms */
+  void advance(const uint64_t now_ms);
+
+  /* text messages to be sent to the server, in order */
+  std::deque<std::string> & outbox() { return outbox_; }
+
+  /* the server has asked the viewer to go away (e.g., "limit") */
+  bool done() const { return done_; }
+
+  bool playing() const { return state_ == State::Playing; }
+
+  double video_buffer() const { return video_buffer_; }
+  double audio_buffer() const { return audio_buffer_; }
+
+private:
+  enum class State { Idle, Startup, Playing, Rebuffering };
+
+  Config config_;
+  ViewerStats & stats_;
+
+  State state_ {State::Idle};
+  bool done_ {false};
+
+  unsigned int init_id_ {0};
+  uint64_t init_sent_ms_ {0};
+  uint64_t last_advance_ms_ {0};
+  uint64_t last_info_ms_ {0};
+
+  /* from server-init */
+  unsigned int timescale_ {1};
+  unsigned int video_duration_ {0};
+  unsigned int audio_duration_ {0};
+
+  /* in seconds */
+  double video_buffer_ {0};
+  double audio_buffer_ {0};
+  double cum_rebuffer_ {0};
+
+  /* arrival of the first fragment of the video chunk in progress */
+  uint64_t chunk_start_ms_ {0};
+
+  std::deque<std::string> outbox_ {};
+
+  void send_client_init();
+  void send_client_info(const std::string & event);
+
+  /* ack a fragment of server-video or server-audio */
+  void send_ack(const std::string & type, const json & metadata,
+                const size_t byte_length);
+
+  void handle_server_init(const json & metadata);
+  void handle_media(const json & metadata, const size_t data_length,
+                    const bool video, const uint64_t now_ms);
+
+  /* fields of every client-info and ack */
+  json buffer_info() const;
+};
+
+#endif /* VIEWER_HH */
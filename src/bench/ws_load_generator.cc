@@ -0,0 +1,736 @@
+#include <getopt.h>
+#include <sys/resource.h>
+#include <csignal>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+
+#include "viewer.hh"
+#include "socket.hh"
+#include "nb_secure_socket.hh"
+#include "address.hh"
+#include "poller.hh"
+#include "timerfd.hh"
+#include "http_request.hh"
+#include "http_response_parser.hh"
+#include "ws_frame.hh"
+#include "ws_message_parser.hh"
+#include "quantile_sketch.hh"
+#include "timestamp.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* the playback of every viewer is advanced (and the read tokens of shaped
+ * connections refilled) this often */
+static const int TICK_MS = 50;
+
+/* a nonce is not needed, as the server only hashes the key */
+static const string SEC_WEBSOCKET_KEY = "dGhlIHNhbXBsZSBub25jZQ==";
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options] <host> <port> <channel>\n\n"
+  "Emulate viewers of <channel> on a ws_media_server at <host>:<port>, each\n"
+  "on its own WebSocket, and report the throughput they receive, the delivery\n"
+  "time of video chunks, startup delays and stalls\n\n"
+  "Options:\n"
+  "--viewers, -n <n>           viewers to emulate (default: 100)\n"
+  "--ramp-up, -r <seconds>     time over which they connect (default: 10)\n"
+  "--duration, -d <seconds>    duration of the run (default: 60)\n"
+  "--interval, -i <seconds>    time between reports (default: 5)\n"
+  "--rate, -R <Mbps>           read each connection at no more than this rate\n"
+  "--tls, -t                   connect with TLS (without verifying certificates)\n"
+  "--session-key, -k <key>     sessionKey of client-init, which the server\n"
+  "                            authenticates against the database\n"
+  "--user, -u <name>           prefix of the userName of viewers\n"
+  "                            (default: load_generator)"
+  << endl;
+}
+
+namespace {
+
+struct Options
+{
+  string host {};
+  string port {};
+  unsigned int viewers {100};
+  double ramp_up_s {10};
+  double duration_s {60};
+  double interval_s {5};
+  double rate_mbps {0};  /* 0: not shaped */
+  bool tls {false};
+  Viewer::Config viewer {};
+};
+
+/* what the connections experienced over a period */
+struct ConnectionStats
+{
+  uint64_t attempts {0};
+  uint64_t opened {0};    /* the WebSocket handshake has completed */
+  uint64_t failed {0};    /* closed before the WebSocket was open */
+  uint64_t rejected {0};  /* told to go away by a server-error */
+  uint64_t dropped {0};   /* closed otherwise once open */
+  uint64_t bytes_received {0};  /* of the TCP payload */
+
+  /* from connect() to the response to the WebSocket handshake */
+  QuantileSketch handshake_ms {};
+
+  void merge(const ConnectionStats & other)
+  {
+    attempts += other.attempts;
+    opened += other.opened;
+    failed += other.failed;
+    rejected += other.rejected;
+    dropped += other.dropped;
+    bytes_received += other.bytes_received;
+    handshake_ms.merge(other.handshake_ms);
+  }
+};
+
+/* as WSServer, the generator is templated on the type of socket, and the
+ * parts of a connection that differ are specialized below */
+template<class SocketType>
+class LoadGenerator
+{
+public:
+  explicit LoadGenerator(const Options & options);
+
+  /* run for the duration and print the reports */
+  void run();
+
+  /* forbid copying LoadGenerator */
+  LoadGenerator(const LoadGenerator & other) = delete;
+  const LoadGenerator & operator=(const LoadGenerator & other) = delete;
+
+private:
+  struct Connection
+  {
+    enum class State { Connecting, Handshaking, Open, Closed };
+
+    State state {State::Connecting};
+    SocketType socket;
+    Viewer viewer;
+
+    uint64_t connect_ms {0};
+
+    HTTPResponseParser handshake_parser {};
+    WSMessageParser message_parser {};
+
+    /* only used with TCPSocket; NBSecureSocket buffers on its own */
+    std::string send_buffer {};
+
+    /* bytes that may be read, if shaped */
+    double read_tokens {0};
+
+    Connection(TCPSocket && sock, SSLContext & ssl_context,
+               const Viewer::Config & config, ViewerStats & stats);
+
+    /* forbid copying Connection */
+    Connection(const Connection & other) = delete;
+    Connection & operator=(const Connection & other) = delete;
+
+    /* the TCP connection has been established (and TLS set up) */
+    void connected();
+
+    std::string read(const size_t limit);
+    void send(std::string && data);
+    bool data_to_write() const;
+    void write();
+  };
+
+  Options options_;
+  Address server_addr_;
+
+  SSLContext ssl_context_ {};
+  Poller poller_ {};
+  Timerfd tick_timer_ {};
+
+  /* key: viewer ID */
+  std::map<uint64_t, std::unique_ptr<Connection>> connections_ {};
+  std::vector<uint64_t> closed_connections_ {};
+  uint64_t launched_ {0};
+
+  /* since the last report, and in total */
+  ViewerStats viewer_stats_ {};
+  ViewerStats total_viewer_stats_ {};
+  ConnectionStats conn_stats_ {};
+  ConnectionStats total_conn_stats_ {};
+
+  uint64_t start_ms_ {0};
+  uint64_t last_tick_ms_ {0};
+  uint64_t last_report_ms_ {0};
+
+  /* for the masking keys of client frames */
+  std::mt19937 mask_rng_ {std::random_device()()};
+  uint32_t masking_key() { return static_cast<uint32_t>(mask_rng_()); }
+
+  /* bytes a shaped connection may read at once */
+  double read_burst() const;
+
+  void open_connection();
+  void send_handshake(Connection & conn);
+  void handle_data(const uint64_t id, Connection & conn,
+                   const std::string & data);
+  void flush_outbox(Connection & conn);
+
+  /* stop polling the connection; it is destroyed after the poll() */
+  void close_connection(const uint64_t id);
+
+  void tick();
+  void report();
+  void final_report() const;
+};
+
+template<>
+LoadGenerator<TCPSocket>::Connection::Connection(TCPSocket && sock,
+                                                 SSLContext &,
+                                                 const Viewer::Config & config,
+                                                 ViewerStats & stats)
+  : socket(move(sock)), viewer(config, stats)
+{}
+
+template<>
+LoadGenerator<NBSecureSocket>::Connection::Connection(
+    TCPSocket && sock, SSLContext & ssl_context,
+    const Viewer::Config & config, ViewerStats & stats)
+  : socket(ssl_context.new_secure_socket(move(sock))), viewer(config, stats)
+{
+  socket.connect();
+}
+
+template<>
+void LoadGenerator<TCPSocket>::Connection::connected()
+{
+  /* throws if the nonblocking connect() has failed */
+  socket.verify_no_errors();
+}
+
+template<>
+void LoadGenerator<NBSecureSocket>::Connection::connected()
+{
+  /* the poller has completed the TLS handshake by now */
+}
+
+template<>
+string LoadGenerator<TCPSocket>::Connection::read(const size_t limit)
+{
+  return socket.read(limit);
+}
+
+template<>
+string LoadGenerator<NBSecureSocket>::Connection::read(const size_t)
+{
+  /* whole TLS records have been read (hence shaping is per 16 KB) */
+  return socket.ezread();
+}
+
+template<>
+void LoadGenerator<TCPSocket>::Connection::send(string && data)
+{
+  send_buffer.append(data);
+}
+
+template<>
+void LoadGenerator<NBSecureSocket>::Connection::send(string && data)
+{
+  socket.ezwrite(move(data));
+}
+
+template<>
+bool LoadGenerator<TCPSocket>::Connection::data_to_write() const
+{
+  return not send_buffer.empty();
+}
+
+template<>
+bool LoadGenerator<NBSecureSocket>::Connection::data_to_write() const
+{
+  return socket.something_to_write();
+}
+
+template<>
+void LoadGenerator<TCPSocket>::Connection::write()
+{
+  /* set write_all to false because socket might be unable to write all */
+  const string_view buffer_view = send_buffer;
+  const auto view_it = socket.write(buffer_view, false);
+  send_buffer.erase(0, view_it - buffer_view.cbegin());
+}
+
+template<>
+void LoadGenerator<NBSecureSocket>::Connection::write()
+{
+  /* the poller writes out what was given to ezwrite() */
+}
+
+template<class SocketType>
+LoadGenerator<SocketType>::LoadGenerator(const Options & options)
+  : options_(options), server_addr_(options.host, options.port)
+{
+  poller_.add_action(Poller::Action(tick_timer_, Direction::In,
+    [this]()->Result {
+      if (tick_timer_.expirations() > 0) {
+        tick();
+      }
+
+      return ResultType::Continue;
+    }
+  ), "load_generator.tick");
+}
+
+template<class SocketType>
+double LoadGenerator<SocketType>::read_burst() const
+{
+  /* two ticks' worth, but no less than a TLS record, which is read whole */
+  return max(options_.rate_mbps * 1e6 / 8 * TICK_MS / 1000 * 2, 16384.0);
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::open_connection()
+{
+  const uint64_t id = launched_++;
+  conn_stats_.attempts++;
+
+  TCPSocket sock;
+  sock.set_blocking(false);
+
+  try {
+    sock.connect(server_addr_);
+  } catch (const unix_error & e) {
+    if (e.error_code() != EINPROGRESS) {
+      conn_stats_.failed++;
+      return;
+    }
+  }
+
+  Viewer::Config config = options_.viewer;
+  config.username += "-" + to_string(id);
+
+  Connection & conn = *connections_.emplace(id,
+    make_unique<Connection>(move(sock), ssl_context_, config, viewer_stats_)
+  ).first->second;
+
+  conn.connect_ms = timestamp_ms();
+  conn.read_tokens = read_burst();
+
+  poller_.add_action(Poller::Action(conn.socket, Direction::Out,
+    [this, &conn]()->Result {
+      if (conn.state == Connection::State::Connecting) {
+        conn.connected();
+        send_handshake(conn);
+      }
+
+      conn.write();
+      return ResultType::Continue;
+    },
+    [&conn]()->bool {
+      return conn.state == Connection::State::Connecting or
+             conn.data_to_write();
+    },
+    [this, id]() { close_connection(id); },
+    false
+  ), "load_generator.write");
+
+  poller_.add_action(Poller::Action(conn.socket, Direction::In,
+    [this, id, &conn]()->Result {
+      const size_t limit = options_.rate_mbps > 0 ?
+                           max(conn.read_tokens, 1.0) : BUFFER_SIZE;
+      const string data = conn.read(limit);
+      if (data.empty()) {
+        /* EOF */
+        close_connection(id);
+        return ResultType::Continue;
+      }
+
+      conn_stats_.bytes_received += data.size();
+      conn.read_tokens -= data.size();
+
+      handle_data(id, conn, data);
+      return ResultType::Continue;
+    },
+    [this, &conn]()->bool {
+      return conn.state != Connection::State::Connecting and
+             (options_.rate_mbps == 0 or conn.read_tokens > 0);
+    },
+    [this, id]() { close_connection(id); },
+    false
+  ), "load_generator.read");
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::send_handshake(Connection & conn)
+{
+  HTTPRequest request;
+  request.set_first_line("GET / HTTP/1.1");
+  request.add_header(HTTPHeader{"Host", options_.host + ":" + options_.port});
+  request.add_header(HTTPHeader{"Upgrade", "websocket"});
+  request.add_header(HTTPHeader{"Connection", "Upgrade"});
+  request.add_header(HTTPHeader{"Sec-WebSocket-Key", SEC_WEBSOCKET_KEY});
+  request.add_header(HTTPHeader{"Sec-WebSocket-Version", "13"});
+  request.add_header(HTTPHeader{"Origin", "https://" + options_.host});
+  request.done_with_headers();
+  request.read_in_body("");
+
+  conn.handshake_parser.new_request_arrived(request);
+  conn.send(request.str());
+  conn.state = Connection::State::Handshaking;
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::handle_data(const uint64_t id,
+                                            Connection & conn,
+                                            const string & data)
+{
+  const uint64_t now_ms = timestamp_ms();
+
+  if (conn.state == Connection::State::Handshaking) {
+    /* the server sends nothing after the response until client-init */
+    conn.handshake_parser.parse(data);
+    if (conn.handshake_parser.empty()) {
+      return;
+    }
+
+    const HTTPResponse & response = conn.handshake_parser.front();
+    if (response.status_code() != "101") {
+      throw runtime_error("WebSocket handshake rejected: "
+                          + response.first_line());
+    }
+    conn.handshake_parser.pop();
+
+    conn.state = Connection::State::Open;
+    conn_stats_.opened++;
+    conn_stats_.handshake_ms.add(now_ms - conn.connect_ms);
+
+    conn.viewer.open(now_ms);
+    flush_outbox(conn);
+    return;
+  }
+
+  conn.message_parser.parse(data);
+
+  while (not conn.message_parser.empty()) {
+    const WSMessage message = move(conn.message_parser.front());
+    conn.message_parser.pop();
+
+    switch (message.type()) {
+    case WSMessage::Type::Binary:
+      conn.viewer.handle_message(message.payload(), now_ms);
+      break;
+
+    case WSMessage::Type::Close:
+      close_connection(id);
+      return;
+
+    case WSMessage::Type::Ping:
+      conn.send(WSFrame{true, WSFrame::OpCode::Pong, "",
+                        masking_key()}.to_string());
+      break;
+
+    default:
+      break;
+    }
+
+    if (conn.viewer.done()) {
+      close_connection(id);
+      return;
+    }
+  }
+
+  flush_outbox(conn);
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::flush_outbox(Connection & conn)
+{
+  auto & outbox = conn.viewer.outbox();
+
+  while (not outbox.empty()) {
+    /* frames from clients are masked */
+    const WSFrame frame {true, WSFrame::OpCode::Text, move(outbox.front()),
+                         masking_key()};
+    outbox.pop_front();
+    conn.send(frame.to_string());
+  }
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::close_connection(const uint64_t id)
+{
+  auto it = connections_.find(id);
+  if (it == connections_.end()) {
+    return;
+  }
+
+  Connection & conn = *it->second;
+  if (conn.state == Connection::State::Closed) {
+    return;
+  }
+
+  if (conn.state != Connection::State::Open) {
+    conn_stats_.failed++;
+  } else if (conn.viewer.done()) {
+    conn_stats_.rejected++;
+  } else {
+    conn_stats_.dropped++;
+  }
+
+  conn.state = Connection::State::Closed;
+  poller_.remove_fd(conn.socket.fd_num());
+  closed_connections_.emplace_back(id);
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::tick()
+{
+  const uint64_t now_ms = timestamp_ms();
+  const double tick_s = (now_ms - last_tick_ms_) / 1000.0;
+  last_tick_ms_ = now_ms;
+
+  /* spread the connections over the ramp-up */
+  const double elapsed_s = (now_ms - start_ms_) / 1000.0;
+  const uint64_t target = options_.ramp_up_s > 0 ?
+    min<uint64_t>(options_.viewers,
+                  ceil(options_.viewers * elapsed_s / options_.ramp_up_s)) :
+    options_.viewers;
+
+  while (launched_ < target) {
+    open_connection();
+  }
+
+  for (auto & [id, conn] : connections_) {
+    if (conn->state == Connection::State::Closed) {
+      continue;
+    }
+
+    /* NBSecureSocket stops reading at EOF without calling back */
+    if (conn->socket.eof()) {
+      close_connection(id);
+      continue;
+    }
+
+    if (options_.rate_mbps > 0) {
+      conn->read_tokens = min(conn->read_tokens
+                              + options_.rate_mbps * 1e6 / 8 * tick_s,
+                              read_burst());
+    }
+
+    if (conn->state == Connection::State::Open) {
+      conn->viewer.advance(now_ms);
+      flush_outbox(*conn);
+    }
+  }
+
+  if (now_ms - last_report_ms_ >= options_.interval_s * 1000) {
+    report();
+  }
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::report()
+{
+  const uint64_t now_ms = timestamp_ms();
+  const double period_s = max(now_ms - last_report_ms_, uint64_t(1)) / 1000.0;
+  last_report_ms_ = now_ms;
+
+  unsigned int open = 0, playing = 0;
+  for (const auto & [id, conn] : connections_) {
+    if (conn->state == Connection::State::Open) {
+      open++;
+      playing += conn->viewer.playing();
+    }
+  }
+
+  const ViewerStats & vs = viewer_stats_;
+  const QuantileSketch & delivery = vs.chunk_delivery_ms;
+
+  cout << fixed << setprecision(1)
+       << "[" << setw(6) << (now_ms - start_ms_) / 1000.0 << " s] "
+       << open << " open, " << playing << " playing, "
+       << conn_stats_.failed << " failed, " << conn_stats_.rejected
+       << " rejected, " << conn_stats_.dropped << " dropped | "
+       << conn_stats_.bytes_received * 8 / period_s / 1e6 << " Mbps | "
+       << vs.video_chunks << " chunks, delivery p50/p90/p99 "
+       << setprecision(0) << delivery.quantile(0.5) << "/"
+       << delivery.quantile(0.9) << "/" << delivery.quantile(0.99) << " ms | "
+       << vs.stalls << " stalls, rebuffer " << setprecision(2)
+       << vs.rebuffer_ratio() * 100 << "%" << endl;
+
+  total_viewer_stats_.merge(viewer_stats_);
+  total_conn_stats_.merge(conn_stats_);
+  viewer_stats_ = ViewerStats();
+  conn_stats_ = ConnectionStats();
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::final_report() const
+{
+  const ViewerStats & vs = total_viewer_stats_;
+  const ConnectionStats & cs = total_conn_stats_;
+  const double run_s = max(last_report_ms_ - start_ms_, uint64_t(1)) / 1000.0;
+
+  const auto quantiles = [](const QuantileSketch & sketch) {
+    ostringstream out;
+    out << fixed << setprecision(0) << sketch.quantile(0.5) << "/"
+        << sketch.quantile(0.9) << "/" << sketch.quantile(0.99) << " ms";
+    return out.str();
+  };
+
+  cout << "\nviewers: " << cs.attempts << " attempted, " << cs.opened
+       << " opened, " << cs.failed << " failed, " << cs.rejected
+       << " rejected, " << cs.dropped << " dropped\n"
+       << fixed << setprecision(1)
+       << "received: " << cs.bytes_received * 8 / run_s / 1e6
+       << " Mbps on average (" << vs.media_bytes / 1e6 << " MB of media)\n"
+       << "handshake p50/p90/p99: " << quantiles(cs.handshake_ms) << "\n"
+       << "startup delay p50/p90/p99: " << quantiles(vs.startup_delay_ms)
+       << "\n"
+       << "video chunks: " << vs.video_chunks << ", delivery p50/p90/p99: "
+       << quantiles(vs.chunk_delivery_ms) << ", " << vs.cancels
+       << " cancelled\n"
+       << "audio chunks: " << vs.audio_chunks << "\n"
+       << "stalls: " << vs.stalls << ", rebuffer ratio: " << setprecision(2)
+       << vs.rebuffer_ratio() * 100 << "% of " << setprecision(1)
+       << vs.play_s + vs.rebuffer_s << " s watched" << endl;
+
+  for (const auto & [error_type, count] : vs.errors) {
+    cout << "server-error " << error_type << ": " << count << endl;
+  }
+}
+
+template<class SocketType>
+void LoadGenerator<SocketType>::run()
+{
+  start_ms_ = last_tick_ms_ = last_report_ms_ = timestamp_ms();
+  const uint64_t end_ms = start_ms_ + options_.duration_s * 1000;
+
+  tick_timer_.start(TICK_MS, TICK_MS);
+  tick();
+
+  while (timestamp_ms() < end_ms) {
+    const auto ret = poller_.poll(TICK_MS);
+    if (ret.result == Poller::Result::Type::Exit) {
+      break;
+    }
+
+    /* the actions of closed connections have been removed by now */
+    for (const uint64_t id : closed_connections_) {
+      connections_.erase(id);
+    }
+    closed_connections_.clear();
+  }
+
+  /* the last period, unless it has just been reported */
+  if (timestamp_ms() - last_report_ms_ >= TICK_MS) {
+    report();
+  }
+  final_report();
+}
+
+/* every viewer holds a file descriptor */
+void raise_open_files_limit()
+{
+  rlimit limit;
+  CheckSystemCall("getrlimit", getrlimit(RLIMIT_NOFILE, &limit));
+  limit.rlim_cur = limit.rlim_max;
+  CheckSystemCall("setrlimit", setrlimit(RLIMIT_NOFILE, &limit));
+}
+
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  Options options;
+  options.viewer.username = "load_generator";
+
+  const option cmd_line_opts[] = {
+    {"viewers",     required_argument, nullptr, 'n'},
+    {"ramp-up",     required_argument, nullptr, 'r'},
+    {"duration",    required_argument, nullptr, 'd'},
+    {"interval",    required_argument, nullptr, 'i'},
+    {"rate",        required_argument, nullptr, 'R'},
+    {"tls",         no_argument,       nullptr, 't'},
+    {"session-key", required_argument, nullptr, 'k'},
+    {"user",        required_argument, nullptr, 'u'},
+    { nullptr,      0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "n:r:d:i:R:tk:u:",
+                                cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+    case 'n':
+      options.viewers = stoul(optarg);
+      break;
+    case 'r':
+      options.ramp_up_s = stod(optarg);
+      break;
+    case 'd':
+      options.duration_s = stod(optarg);
+      break;
+    case 'i':
+      options.interval_s = max(stod(optarg), TICK_MS / 1000.0);
+      break;
+    case 'R':
+      options.rate_mbps = stod(optarg);
+      break;
+    case 't':
+      options.tls = true;
+      break;
+    case 'k':
+      options.viewer.session_key = optarg;
+      break;
+    case 'u':
+      options.viewer.username = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 3) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  options.host = argv[optind];
+  options.port = argv[optind + 1];
+  options.viewer.channel = argv[optind + 2];
+
+  try {
+    /* ignore SIGPIPE of writes to connections the server has closed */
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+      throw runtime_error("signal: failed to ignore SIGPIPE");
+    }
+
+    raise_open_files_limit();
+
+    if (options.tls) {
+      LoadGenerator<NBSecureSocket>(options).run();
+    } else {
+      LoadGenerator<TCPSocket>(options).run();
+    }
+  } catch (const exception & e) {
+    print_exception(argv[0], e);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,6 +1,8 @@
 #include "channel.hh"
 
 #include <fcntl.h>
+#include <cinttypes>
+#include <cstdio>
 #include <fstream>
 #include <algorithm>
 
@@ -191,11 +193,32 @@ bool Channel::aready(const uint64_t ts) const
   return true;
 }
 
+/* 64-bit FNV-1a hash of the mmapped content as a hex string */
+static string content_hash(const mmap_t & data_size)
+{
+  const auto & [data, size] = data_size;
+
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<uint8_t>(data.get()[i]);
+    hash *= 0x100000001b3;
+  }
+
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016" PRIx64, hash);
+  return hex;
+}
+
 mmap_t Channel::vinit(const VideoFormat & format) const
 {
   return vinit_.at(format);
 }
 
+string Channel::vinit_hash(const VideoFormat & format) const
+{
+  return vinit_hash_.at(format);
+}
+
 mmap_t Channel::vdata(const VideoFormat & format, const uint64_t ts) const
 {
   return vdata_.at(ts).at(format);
@@ -221,6 +244,11 @@ mmap_t Channel::ainit(const AudioFormat & format) const
   return ainit_.at(format);
 }
 
+string Channel::ainit_hash(const AudioFormat & format) const
+{
+  return ainit_hash_.at(format);
+}
+
 mmap_t Channel::adata(const AudioFormat & format, const uint64_t ts) const
 {
   return adata_.at(ts).at(format);
@@ -246,6 +274,31 @@ mmap_t mmap_file(const string & filepath)
   }
 }
 
+size_t Channel::mapped_bytes() const
+{
+  size_t total_bytes = 0;
+
+  for (const auto & [vf, data_size] : vinit_) {
+    total_bytes += get<1>(data_size);
+  }
+  for (const auto & [af, data_size] : ainit_) {
+    total_bytes += get<1>(data_size);
+  }
+
+  for (const auto & [ts, formats] : vdata_) {
+    for (const auto & [vf, data_size] : formats) {
+      total_bytes += get<1>(data_size);
+    }
+  }
+  for (const auto & [ts, formats] : adata_) {
+    for (const auto & [af, data_size] : formats) {
+      total_bytes += get<1>(data_size);
+    }
+  }
+
+  return total_bytes;
+}
+
 void Channel::munmap_video(const uint64_t ts)
 {
   uint64_t clean_window_ts = (clean_window_chunk_.value() - 1) * vduration_;
@@ -385,7 +438,9 @@ void Channel::do_mmap_video(const fs::path & filepath, const VideoFormat & vf)
   string filestem = filepath.stem();
 
   if (filestem == "init") {
-    vinit_.emplace(vf, data_size);
+    if (vinit_.emplace(vf, data_size).second) {
+      vinit_hash_.emplace(vf, content_hash(data_size));
+    }
   } else {
     if (filepath.extension() == ".m4s") {
       uint64_t ts = stoull(filestem);
@@ -438,7 +493,9 @@ void Channel::do_mmap_audio(const fs::path & filepath, const AudioFormat & af)
   string filestem = filepath.stem();
 
   if (filestem == "init") {
-    ainit_.emplace(af, data_size);
+    if (ainit_.emplace(af, data_size).second) {
+      ainit_hash_.emplace(af, content_hash(data_size));
+    }
   } else {
     if (filepath.extension() == ".chk") {
       uint64_t ts = stoull(filestem);
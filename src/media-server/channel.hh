@@ -39,15 +39,21 @@ public:
   void enforce_moving_live_edge();
 
   mmap_t vinit(const VideoFormat & format) const;
+  /* content hash of an init segment, used by clients to cache it */
+  std::string vinit_hash(const VideoFormat & format) const;
   mmap_t vdata(const VideoFormat & format, const uint64_t ts) const;
   const std::map<VideoFormat, mmap_t> & vdata(const uint64_t ts) const;
   double vssim(const VideoFormat & format, const uint64_t ts) const;
   const std::map<VideoFormat, double> & vssim(const uint64_t ts) const;
 
   mmap_t ainit(const AudioFormat & format) const;
+  std::string ainit_hash(const AudioFormat & format) const;
   mmap_t adata(const AudioFormat & format, const uint64_t ts) const;
   const std::map<AudioFormat, mmap_t> & adata(const uint64_t ts) const;
 
+  /* size of the media segments mapped into memory */
+  size_t mapped_bytes() const;
+
   unsigned int timescale() const { return timescale_; }
   unsigned int vduration() const { return vduration_; }
   unsigned int aduration() const { return aduration_; }
@@ -85,6 +91,8 @@ private:
   std::vector<AudioFormat> aformats_ {};
   std::map<VideoFormat, mmap_t> vinit_ {};
   std::map<AudioFormat, mmap_t> ainit_ {};
+  std::map<VideoFormat, std::string> vinit_hash_ {};
+  std::map<AudioFormat, std::string> ainit_hash_ {};
   std::map<uint64_t, std::map<VideoFormat, mmap_t>> vdata_ {};
   std::map<uint64_t, std::map<VideoFormat, double>> vssim_ {};
   std::map<uint64_t, std::map<AudioFormat, mmap_t>> adata_ {};
@@ -0,0 +1,1075 @@
+#include <cstdint>
+#include <cmath>
+#include <fcntl.h>
+
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <algorithm>
+
+#include "client_handler.hh"
+#include "util.hh"
+#include "strict_conversions.hh"
+#include "timestamp.hh"
+#include "exception.hh"
+#include "file_descriptor.hh"
+#include "server_message.hh"
+#include "client_message.hh"
+#include "media_formats.hh"
+#include "logger.hh"
+
+using namespace std;
+
+YAML::Node config;
+map<string, shared_ptr<Channel>> channels;
+SlotMap<WebSocketClient> clients;
+
+static const size_t MAX_WS_FRAME_B = 100 * 1024;  /* 10 KB */
+
+optional<double> pacing_multiplier;
+
+bool abandon_video_chunks = false;
+static const uint64_t MIN_ABANDON_ELAPSED_MS = 500;  /* before measuring */
+
+optional<size_t> send_buffer_budget;
+uint64_t send_budget_refusals = 0;
+
+uint64_t init_bytes_sent = 0;
+uint64_t init_bytes_saved = 0;
+
+bool enable_logging = false;
+fs::path log_dir;
+string server_id;
+string expt_id;
+static map<string, FileDescriptor> log_fds;  /* map log name to fd */
+static const unsigned int MAX_LOG_FILESIZE = 100 * 1024 * 1024;  /* 100 MB */
+
+map<string, StreamAggregate> stream_aggregates;
+
+map<string, DeliveryPhaseAggregate> delivery_phases;
+static uint64_t next_chunk_tag = 1;  /* tags the frames of a chunk */
+
+bool cpu_accounting = false;
+map<string, CPUAggregate> cpu_usage;
+
+double event_log_sample_rate = 1.0;
+
+unique_ptr<TTPShardWriter> ttp_shard_writer;
+unique_ptr<FlightRecorder> flight_recorder;
+unique_ptr<SessionRecorder> session_recorder;
+
+MetricsRegistry metrics;
+
+bool draining = false;
+
+/* sample sessions rather than events, so that every logged session is
+ * complete */
+bool log_events_of(const WebSocketClient & client)
+{
+  if (event_log_sample_rate >= 1) {
+    return true;
+  }
+
+  /* scramble the first init ID into a uniform number in [0, 1) */
+  const uint64_t hash = client.first_init_id().value() * 0x9E3779B97F4A7C15;
+  return static_cast<double>(hash >> 11) / (UINT64_C(1) << 53)
+         < event_log_sample_rate;
+}
+
+/* record an event of the client in the flight recorder, if enabled */
+void record_event(const WebSocketClient & client,
+                  const FlightRecorder::EventType type,
+                  const FlightRecorder::Fields & fields,
+                  const uint16_t aux)
+{
+  if (flight_recorder) {
+    flight_recorder->record(type, client.connection_id(),
+                            client.init_id().value_or(0), fields, aux);
+  }
+}
+
+uint64_t seconds_to_ms(const double seconds)
+{
+  return seconds > 0 ? llround(seconds * 1000) : 0;
+}
+
+/* update the client's cumulative rebuffering, adding its increase to the
+ * stall time of the channel */
+void update_cum_rebuffer(WebSocketClient & client, const double cum_rebuffer)
+{
+  if (enable_logging and cum_rebuffer > client.cum_rebuffer()) {
+    stream_aggregates[client.channel()->name()].stall_time +=
+      cum_rebuffer - client.cum_rebuffer();
+  }
+
+  client.set_cum_rebuffer(cum_rebuffer);
+}
+
+/* return "connection_id,username" or "connection_id," (unknown username) */
+string client_signature(const uint64_t connection_id)
+{
+  const WebSocketClient * client = clients.find(connection_id);
+  if (client) {
+    return client->signature();
+  } else {
+    return to_string(connection_id) + ",";
+  }
+}
+
+void append_to_log(const string & log_stem, const string & log_line)
+{
+  if (not enable_logging) {
+    throw runtime_error("append_to_log: enable_logging must be true");
+  }
+
+  string log_name = log_stem + "." + server_id + ".log";
+  string log_path = log_dir / log_name;
+
+  /* find or create a file descriptor for the log */
+  auto log_it = log_fds.find(log_name);
+  if (log_it == log_fds.end()) {
+    log_it = log_fds.emplace(log_name, FileDescriptor(CheckSystemCall(
+        "open (" + log_path + ")",
+        open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)))).first;
+  }
+
+  /* append a line to log */
+  FileDescriptor & fd = log_it->second;
+  fd.write(log_line + "\n");
+
+  /* rotate log if filesize is too large */
+  if (fd.curr_offset() > MAX_LOG_FILESIZE) {
+    fs::rename(log_path, log_path + ".old");
+    LOG_INFO << "Renamed " << log_path << " to " << log_path + ".old";
+
+    /* create new fd before closing old one */
+    FileDescriptor new_fd(CheckSystemCall(
+        "open (" + log_path + ")",
+        open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)));
+    fd.close();  /* reader is notified and safe to open new fd immediately */
+
+    log_it->second = move(new_fd);
+  }
+}
+
+/* return the init segment to prepend to a chunk, or nothing if the client
+ * has cached it already */
+optional<mmap_t> fetch_init(WebSocketClient & client,
+                            const string & format, const string & hash,
+                            const mmap_t & init)
+{
+  if (client.init_cached(format, hash)) {
+    init_bytes_saved += get<1>(init);
+    return nullopt;
+  }
+
+  /* the client caches every init segment it receives */
+  client.add_cached_init(format, hash);
+  init_bytes_sent += get<1>(init);
+
+  return init;
+}
+
+/* the counters of chunks served per format, registered on first use so that
+ * serving a chunk only increments one */
+Counter & chunks_served(const VideoFormat & vformat)
+{
+  static map<VideoFormat, Counter *> counters;
+
+  Counter * & counter = counters[vformat];
+  if (not counter) {
+    counter = &metrics.counter(
+      "puffer_chunks_served_total", "Chunks served by format",
+      {{"type", "video"}, {"format", vformat.to_string()}});
+  }
+  return *counter;
+}
+
+Counter & chunks_served(const AudioFormat & aformat)
+{
+  static map<AudioFormat, Counter *> counters;
+
+  Counter * & counter = counters[aformat];
+  if (not counter) {
+    counter = &metrics.counter(
+      "puffer_chunks_served_total", "Chunks served by format",
+      {{"type", "audio"}, {"format", aformat.to_string()}});
+  }
+  return *counter;
+}
+
+void serve_video_to_client(WSServerBase & server,
+                           WebSocketClient & client)
+{
+  const auto channel = client.channel();
+  uint64_t next_vts = client.next_vts().value();
+  const uint64_t decision_ts = timestamp_us();
+
+  /* save TCP info before client.select_video_format() */
+  TCPInfo tcpi = server.get_tcp_info(client.connection_id());
+  client.set_tcp_info(tcpi);
+  record_event(client, FlightRecorder::EventType::TCPInfo,
+               {tcpi.cwnd, tcpi.in_flight, tcpi.min_rtt, tcpi.rtt,
+                tcpi.delivery_rate});
+  if (session_recorder) {
+    session_recorder->record_tcp_info(client.connection_id(), tcpi);
+  }
+
+  /* select a video format using ABR algorithm */
+  static Histogram & abr_seconds = metrics.histogram(
+      "puffer_abr_decision_seconds", "Time to select the format of a chunk",
+      latency_buckets(), {{"type", "video"}});
+  const uint64_t abr_start_us = timestamp_us();
+  const VideoFormat & next_vformat = client.select_video_format();
+  abr_seconds.observe((timestamp_us() - abr_start_us) / 1e6);
+  double ssim = channel->vssim(next_vts).at(next_vformat);
+
+  /* check if a new init segment is needed */
+  optional<mmap_t> init_mmap;
+  const string init_hash = channel->vinit_hash(next_vformat);
+  if (not client.curr_vformat() or
+      next_vformat != *client.curr_vformat()) {
+    init_mmap = fetch_init(client, next_vformat.to_string(), init_hash,
+                           channel->vinit(next_vformat));
+  }
+
+  /* construct the next segment to send */
+  const auto data_mmap = channel->vdata(next_vformat, next_vts);
+  VideoSegment next_vsegment {next_vformat, data_mmap, init_mmap};
+
+  if (pacing_multiplier) {
+    const double vduration_s = static_cast<double>(channel->vduration())
+                               / channel->timescale();
+    const double bitrate = get<1>(data_mmap) / vduration_s;  /* bytes/s */
+
+    try {
+      server.set_pacing_rate(client.connection_id(),
+                             *pacing_multiplier * bitrate);
+    } catch (const exception & e) {
+      /* e.g., SO_MAX_PACING_RATE is not supported by the kernel */
+      print_exception("set_pacing_rate", e);
+      LOG_WARNING << "disabled pacing";
+      pacing_multiplier.reset();
+    }
+  }
+
+  /* time the stages of delivering the chunk */
+  auto & timeline = client.chunk_timeline();
+  if (enable_logging) {
+    timeline = ChunkTimeline();
+    timeline->tag = next_chunk_tag++;
+    timeline->video_ts = next_vts;
+    timeline->decision_ts = decision_ts;
+    timeline->queued_ts = timestamp_us();
+  }
+
+  /* divide the next segment into WebSocket frames and send */
+  while (not next_vsegment.done()) {
+    ServerVideoMsg video_msg(client.init_id().value(),
+                             channel->name(),
+                             next_vformat.to_string(),
+                             next_vts,
+                             next_vsegment.offset(),
+                             next_vsegment.length(),
+                             ssim, init_hash,
+                             init_mmap ? get<1>(*init_mmap) : 0);
+    string frame_payload = video_msg.to_string();
+    next_vsegment.read(frame_payload, MAX_WS_FRAME_B - frame_payload.size());
+
+    WSFrame frame {true, WSFrame::OpCode::Binary, move(frame_payload)};
+    server.queue_frame(client.connection_id(), frame,
+                       WSServerBase::Priority::Low,
+                       timeline ? timeline->tag : 0);
+
+    client.video_frame_queued();
+    if (timeline) {
+      timeline->frames++;
+    }
+  }
+
+  record_event(client, FlightRecorder::EventType::VideoSent,
+               {next_vts,
+                static_cast<uint64_t>(next_vformat.width) << 32
+                | static_cast<uint64_t>(next_vformat.height) << 16
+                | static_cast<uint64_t>(next_vformat.crf),
+                get<1>(data_mmap) + (init_mmap ? get<1>(*init_mmap) : 0),
+                static_cast<uint64_t>(llround(max(ssim, 0.0) * 1000000)),
+                seconds_to_ms(client.video_playback_buf())},
+               init_mmap.has_value());
+
+  /* finish sending */
+  client.set_next_vts(next_vts + channel->vduration());
+  client.set_curr_vformat(next_vformat);
+  client.set_last_video_send_ts(timestamp_ms());
+
+  chunks_served(next_vformat).inc();
+
+  LOG_DEBUG << client.signature() << ": channel " << channel->name()
+            << ", video " << next_vts << " " << next_vformat << " " << ssim;
+
+  if (enable_logging) {
+    stream_aggregates[channel->name()].add_video_sent(
+        get<1>(data_mmap), ssim, tcpi.delivery_rate, tcpi.rtt);
+  }
+
+  if (enable_logging and log_events_of(client)) {
+    string log_line = to_string(timestamp_ms()) + "," + channel->name() + ","
+      + server_id + "," + expt_id + "," + client.username() + ","
+      + to_string(client.first_init_id().value()) + ","
+      + to_string(client.init_id().value()) + ","
+      + to_string(next_vts) + ","
+      + next_vformat.to_string() + ","
+      + to_string(get<1>(data_mmap)) + "," + to_string(ssim)
+      + "," + to_string(tcpi.cwnd) + "," + to_string(tcpi.in_flight) + ","
+      + to_string(tcpi.min_rtt) + "," + to_string(tcpi.rtt) + ","
+      + to_string(tcpi.delivery_rate) + ","
+      + double_to_string(client.video_playback_buf(), 3) + ","
+      + double_to_string(client.cum_rebuffer(), 3);
+    append_to_log("video_sent", log_line);
+  }
+}
+
+void serve_audio_to_client(WSServerBase & server,
+                           WebSocketClient & client)
+{
+  const auto channel = client.channel();
+  uint64_t next_ats = client.next_ats().value();
+
+  /* select an audio format using ABR algorithm */
+  static Histogram & abr_seconds = metrics.histogram(
+      "puffer_abr_decision_seconds", "Time to select the format of a chunk",
+      latency_buckets(), {{"type", "audio"}});
+  const uint64_t abr_start_us = timestamp_us();
+  const AudioFormat & next_aformat = client.select_audio_format();
+  abr_seconds.observe((timestamp_us() - abr_start_us) / 1e6);
+
+  /* check if a new init segment is needed */
+  optional<mmap_t> init_mmap;
+  const string init_hash = channel->ainit_hash(next_aformat);
+  if (not client.curr_aformat() or
+      next_aformat != *client.curr_aformat()) {
+    init_mmap = fetch_init(client, next_aformat.to_string(), init_hash,
+                           channel->ainit(next_aformat));
+  }
+
+  /* construct the next segment to send */
+  const auto data_mmap = channel->adata(next_aformat, next_ats);
+  AudioSegment next_asegment {next_aformat, data_mmap, init_mmap};
+
+  /* divide the next segment into WebSocket frames and send */
+  while (not next_asegment.done()) {
+    ServerAudioMsg audio_msg(client.init_id().value(),
+                             channel->name(),
+                             next_aformat.to_string(),
+                             next_ats,
+                             next_asegment.offset(),
+                             next_asegment.length(),
+                             init_hash,
+                             init_mmap ? get<1>(*init_mmap) : 0);
+    string frame_payload = audio_msg.to_string();
+    next_asegment.read(frame_payload, MAX_WS_FRAME_B - frame_payload.size());
+
+    WSFrame frame {true, WSFrame::OpCode::Binary, move(frame_payload)};
+    server.queue_frame(client.connection_id(), frame,
+                       WSServerBase::Priority::High);
+  }
+
+  record_event(client, FlightRecorder::EventType::AudioSent,
+               {next_ats, static_cast<uint64_t>(next_aformat.bitrate),
+                get<1>(data_mmap) + (init_mmap ? get<1>(*init_mmap) : 0)},
+               init_mmap.has_value());
+
+  /* finish sending */
+  client.set_next_ats(next_ats + channel->aduration());
+  client.set_curr_aformat(next_aformat);
+
+  chunks_served(next_aformat).inc();
+
+  LOG_DEBUG << client.signature() << ": channel " << channel->name()
+            << ", audio " << next_ats << " " << next_aformat;
+}
+
+void send_server_init(WSServerBase & server, WebSocketClient & client,
+                      const bool can_resume)
+{
+  const auto channel = client.channel();
+
+  ServerInitMsg init(client.init_id().value(), channel->name(),
+                     channel->vcodec(), channel->acodec(),
+                     channel->timescale(),
+                     channel->vduration(), channel->aduration(),
+                     client.next_vts().value(), client.next_ats().value(),
+                     can_resume);
+  WSFrame frame {true, WSFrame::OpCode::Binary, init.to_string()};
+
+  /* drop previously queued frames before sending server-init */
+  server.clear_buffer(client.connection_id());
+
+  server.queue_frame(client.connection_id(), frame);
+
+  record_event(client, FlightRecorder::EventType::Init,
+               {client.next_vts().value(), client.next_ats().value()},
+               can_resume);
+}
+
+void send_server_error(WSServerBase & server, WebSocketClient & client,
+                       const ServerErrorMsg::Type error_type)
+{
+  ServerErrorMsg err_msg(client.init_id() ? *client.init_id() : 0, error_type);
+  WSFrame frame {true, WSFrame::OpCode::Binary, err_msg.to_string()};
+
+  server.queue_frame(client.connection_id(), frame);
+
+  record_event(client, FlightRecorder::EventType::Error, {},
+               static_cast<uint16_t>(error_type));
+
+  /* reset the client and wait for client-init */
+  client.reset_channel();
+}
+
+/* cancel the rest of the video chunk in flight, tell the client to discard
+ * it and serve its timestamp again; return the number of bytes cancelled */
+size_t abandon_video_chunk(WSServerBase & server, WebSocketClient & client)
+{
+  if (not client.last_video_send_ts() or not client.curr_vformat()) {
+    return 0;
+  }
+
+  /* frames already handed to the socket can no longer be taken back */
+  const size_t queued_frames = server.queued_frames(
+    client.connection_id(), WSServerBase::Priority::Low);
+  const size_t cancelled_bytes = server.cancel_frames(
+    client.connection_id(), WSServerBase::Priority::Low);
+  if (cancelled_bytes == 0) {
+    return 0;
+  }
+  const size_t cancelled_frames = queued_frames - server.queued_frames(
+    client.connection_id(), WSServerBase::Priority::Low);
+
+  const auto channel = client.channel();
+  const uint64_t vts = client.next_vts().value() - channel->vduration();
+  const VideoFormat vformat = *client.curr_vformat();
+  const uint64_t elapsed_ms = timestamp_ms() - *client.last_video_send_ts();
+  const unsigned int acked_bytes = client.video_acked_bytes();
+
+  /* the cancelled chunk might have carried the init segment */
+  client.remove_cached_init(vformat.to_string(), channel->vinit_hash(vformat));
+
+  ServerCancelMsg cancel(client.init_id().value(), channel->name(),
+                         vformat.to_string(), vts);
+  WSFrame frame {true, WSFrame::OpCode::Binary, cancel.to_string()};
+  server.queue_frame(client.connection_id(), frame);
+
+  client.video_chunk_abandoned(vts, channel->vssim(vts).at(vformat),
+                               acked_bytes, elapsed_ms, cancelled_frames);
+
+  record_event(client, FlightRecorder::EventType::Abandon,
+               {vts, cancelled_bytes, acked_bytes, elapsed_ms});
+
+  LOG_DEBUG << client.signature() << ": abandoned video " << vts << " "
+            << vformat << " after " << acked_bytes << " acked bytes in " << elapsed_ms
+            << " ms (" << cancelled_bytes << " bytes cancelled)";
+
+  return cancelled_bytes;
+}
+
+/* refuse to queue new chunks once the send buffer budget is used up */
+bool within_send_budget(const WSServerBase & server)
+{
+  if (send_buffer_budget and server.queued_bytes() >= *send_buffer_budget) {
+    send_budget_refusals++;
+    return false;
+  }
+
+  return true;
+}
+
+void serve_client(WSServerBase & server, WebSocketClient & client)
+{
+  CPUTimer timer(client.cpu(), CPUAccount::Serve);
+
+  /* a draining server only flushes what has been queued */
+  if (draining or not client.is_channel_initialized()) {
+    return;
+  }
+
+  const auto channel = client.channel();
+
+  /* notify the client that the requested channel is not available */
+  if (not channel->ready_to_serve()) {
+    send_server_error(server, client, ServerErrorMsg::Type::Unavailable);
+    LOG_INFO << client.signature() << ": requested channel "
+             << channel->name() << " is not available";
+    return;
+  }
+
+  uint64_t next_vts = client.next_vts().value();
+  uint64_t next_ats = client.next_ats().value();
+
+  if (channel->live()) {
+    /* reinit client if clean frontiers of live streaming have caught up */
+    if ((channel->vclean_frontier() and
+         next_vts <= *channel->vclean_frontier()) or
+        (channel->aclean_frontier() and
+         next_ats <= *channel->aclean_frontier())) {
+      send_server_error(server, client, ServerErrorMsg::Type::Reinit);
+      LOG_INFO << client.signature() << ": reinitialize laggy client";
+      return;
+    }
+  } else {
+    /* reinit client if a non-live channel is set to repeat playing */
+    if (channel->repeat()) {
+      if (next_vts > channel->vready_frontier() or
+          next_ats > channel->aready_frontier()) {
+        send_server_error(server, client, ServerErrorMsg::Type::Reinit);
+        LOG_INFO << client.signature() << ": reinitialize client intentionally "
+                 << "as 'repeat' is set to true";
+        return;
+      }
+    }
+  }
+
+  if (client.audio_playback_buf() <= WebSocketClient::MAX_BUFFER_S and
+      client.audio_in_flight().value() == 0 and channel->aready_to_serve(next_ats)
+      and next_ats <= next_vts and within_send_budget(server)) {
+    serve_audio_to_client(server, client);
+  }
+
+  if (client.video_playback_buf() <= WebSocketClient::MAX_BUFFER_S and
+      client.video_in_flight().value() == 0 and channel->vready_to_serve(next_vts)
+      and within_send_budget(server)) {
+    serve_video_to_client(server, client);
+  }
+}
+
+/* move the CPU time spent on a client since last accounted into the
+ * aggregate of its ABR algorithm */
+void account_client_cpu(WSServerBase & server, WebSocketClient & client)
+{
+  if (not cpu_accounting) {
+    return;
+  }
+
+  CPUAccount & cpu = client.cpu();
+  cpu.ns[CPUAccount::Socket] +=
+    server.take_socket_cpu_ns(client.connection_id());
+
+  cpu_usage[client.abr_name()].add(cpu);
+  cpu = {};
+}
+
+bool resume_connection(WSServerBase & server,
+                       WebSocketClient & client,
+                       const ClientInitMsg & msg,
+                       const shared_ptr<Channel> & channel)
+{
+  /* check if requested timestamps exist */
+  if (not msg.next_vts or not msg.next_ats) {
+    return false;
+  }
+
+  uint64_t requested_vts = *msg.next_vts;
+  uint64_t requested_ats = *msg.next_ats;
+
+  /* check if the requested timestamps are ready to serve */
+  if (not channel->vready_to_serve(requested_vts) or
+      not channel->aready_to_serve(requested_ats)) {
+    return false;
+  }
+
+  /* reinitialize the client */
+  client.init_channel(channel, requested_vts, requested_ats);
+  send_server_init(server, client, true /* can resume */);
+
+  LOG_INFO << client.signature() << ": connection resumed";
+  return true;
+}
+
+void handle_client_init(WSServerBase & server, WebSocketClient & client,
+                        const ClientInitMsg & msg)
+{
+  /* always set client's init_id when a client-init is received */
+  client.set_init_id(msg.init_id);
+
+  /* queued chunks (with their init segments) are dropped on client-init */
+  client.set_cached_inits(msg.cached_inits);
+
+  /* invalid channel request */
+  auto it = channels.find(msg.channel);
+  if (it == channels.end()) {
+    send_server_error(server, client, ServerErrorMsg::Type::Unavailable);
+    LOG_INFO << client.signature() << ": requested channel "
+             << msg.channel << " is not found";
+    return;
+  }
+
+  const auto channel = it->second;
+
+  /* reply that the channel is not ready */
+  if (not channel->ready_to_serve()) {
+    send_server_error(server, client, ServerErrorMsg::Type::Unavailable);
+    LOG_INFO << client.signature() << ": requested channel "
+             << msg.channel << " is not ready";
+    return;
+  }
+
+  /* record client-init */
+  if (enable_logging and log_events_of(client)) {
+    string log_line = to_string(timestamp_ms()) + "," + msg.channel
+      + "," + server_id + ",init," + expt_id + "," + client.username() + ","
+      + to_string(client.first_init_id().value()) + ","
+      + to_string(msg.init_id) + ",0,0" /* buffer cum_rebuf */;
+    append_to_log("client_buffer", log_line);
+  }
+
+  if (enable_logging) {
+    /* record system information */
+    string log_line = to_string(timestamp_ms()) + "," + server_id + ","
+      + expt_id + "," + client.username() + ","
+      + to_string(client.first_init_id().value()) + ","
+      + to_string(msg.init_id) + ","
+      + client.address().ip() + ","
+      + client.os() + "," + client.browser() + ","
+      + to_string(client.screen_width()) + ","
+      + to_string(client.screen_height());
+    append_to_log("client_sysinfo", log_line);
+  }
+
+  /* check if the streaming can be resumed */
+  if (resume_connection(server, client, msg, channel)) {
+    return;
+  }
+
+  uint64_t init_vts = channel->init_vts().value();
+  uint64_t init_ats = channel->init_ats().value();
+
+  client.init_channel(channel, init_vts, init_ats);
+  send_server_init(server, client, false /* initialize rather than resume */);
+
+  LOG_INFO << client.signature() << ": connection initialized";
+}
+
+void handle_client_info(WebSocketClient & client, const ClientInfoMsg & msg)
+{
+  if (not client.is_channel_initialized()) {
+    return;
+  }
+
+  if (msg.init_id != client.init_id().value()) {
+    LOG_WARNING << client.signature() << ": ignored messages with "
+                << "invalid init_id (but should not have received)";
+    return;
+  }
+
+  client.set_video_playback_buf(msg.video_buffer);
+  client.set_audio_playback_buf(msg.audio_buffer);
+
+  record_event(client, FlightRecorder::EventType::ClientInfo,
+               {seconds_to_ms(msg.video_buffer),
+                seconds_to_ms(msg.audio_buffer),
+                seconds_to_ms(msg.cum_rebuffer)},
+               static_cast<uint16_t>(msg.event));
+
+  /* keep what led to a stall before it is overwritten */
+  if (flight_recorder and msg.event == ClientInfoMsg::Event::Rebuffer) {
+    flight_recorder->auto_dump("rebuffer", client.connection_id());
+  }
+
+  /* msg.cum_rebuffer is startup delay when event is Startup */
+  if (msg.event == ClientInfoMsg::Event::Startup) {
+    client.set_cum_rebuffer(msg.cum_rebuffer);
+    client.set_startup_delay(msg.cum_rebuffer);
+  } else {
+    update_cum_rebuffer(client, msg.cum_rebuffer);
+  }
+
+  if (enable_logging) {
+    auto & aggregate = stream_aggregates[client.channel()->name()];
+
+    if (msg.event == ClientInfoMsg::Event::Timer) {
+      /* the 4 Hz timer samples the buffer level uniformly in time */
+      aggregate.add_buffer_level(msg.video_buffer);
+    } else if (msg.event == ClientInfoMsg::Event::Startup) {
+      aggregate.startups++;
+      aggregate.startup_delay_sum += msg.cum_rebuffer;
+    } else if (msg.event == ClientInfoMsg::Event::Rebuffer) {
+      aggregate.rebuffers++;
+    }
+  }
+
+  /* the client might not have received all the init segments sent yet */
+  if (msg.cached_inits) {
+    for (const auto & [format, hash] : *msg.cached_inits) {
+      client.add_cached_init(format, hash);
+    }
+  }
+
+  /* check if client's screen size has changed */
+  if (msg.screen_width and msg.screen_height) {
+    client.set_screen_size(*msg.screen_width, *msg.screen_height);
+
+    /* record system information */
+    if (enable_logging) {
+      string log_line = to_string(timestamp_ms()) + "," + server_id + ","
+        + expt_id + "," + client.username() + ","
+        + to_string(client.first_init_id().value()) + ","
+        + to_string(msg.init_id) + ","
+        + client.address().ip() + ","
+        + client.os() + "," + client.browser() + ","
+        + to_string(*msg.screen_width) + ","
+        + to_string(*msg.screen_height);
+      append_to_log("client_sysinfo", log_line);
+    }
+  }
+
+  /* execute the code below only if logging is enabled */
+  if (enable_logging and log_events_of(client)) {
+    const auto channel_name = client.channel()->name();
+
+    /* record client-info */
+    string log_line = to_string(timestamp_ms()) + "," + channel_name + ","
+      + server_id + "," + msg.event_str + "," + expt_id + ","
+      + client.username() + ","
+      + to_string(client.first_init_id().value()) + ","
+      + to_string(msg.init_id) + ","
+      + double_to_string(msg.video_buffer, 3) + ","
+      + double_to_string(msg.cum_rebuffer, 3);
+    append_to_log("client_buffer", log_line);
+  }
+}
+
+/* abandon the video chunk in flight if, at the throughput measured so far,
+ * its remaining bytes would not arrive before the playback buffer runs out
+ * but the smallest format of the same chunk would arrive sooner */
+void maybe_abandon_video_chunk(WSServerBase & server,
+                               WebSocketClient & client,
+                               const ClientVidAckMsg & msg)
+{
+  const auto channel = client.channel();
+
+  if (not client.last_video_send_ts() or not client.curr_vformat() or
+      msg.video_format != *client.curr_vformat() or
+      msg.timestamp + channel->vduration() != client.next_vts().value()) {
+    return;
+  }
+
+  const uint64_t elapsed_ms = timestamp_ms() - *client.last_video_send_ts();
+  const unsigned int acked_bytes = client.video_acked_bytes();
+  if (elapsed_ms < MIN_ABANDON_ELAPSED_MS or acked_bytes == 0 or
+      acked_bytes >= msg.total_byte_length) {
+    return;
+  }
+
+  const double rate = static_cast<double>(acked_bytes) / elapsed_ms;
+  const double remaining_ms = (msg.total_byte_length - acked_bytes) / rate;
+  if (remaining_ms < client.video_playback_buf() * 1000) {
+    return;
+  }
+
+  /* size of the smallest format, including an init segment */
+  size_t min_size = SIZE_MAX;
+  for (const auto & vformat : channel->vformats()) {
+    min_size = min(min_size, get<1>(channel->vdata(vformat, msg.timestamp))
+                             + get<1>(channel->vinit(vformat)));
+  }
+
+  if (min_size / rate < remaining_ms) {
+    abandon_video_chunk(server, client);
+  }
+}
+
+/* a frame of the video chunk in flight was written to the kernel */
+void chunk_frame_written(WSServerBase & server, WebSocketClient & client,
+                         const uint64_t tag, const bool last_byte)
+{
+  auto & timeline = client.chunk_timeline();
+  if (not timeline or timeline->tag != tag) {
+    return;
+  }
+
+  if (not last_byte) {
+    if (not timeline->first_write_ts) {
+      timeline->first_write_ts = timestamp_us();
+    }
+    return;
+  }
+
+  if (++timeline->frames_written < timeline->frames) {
+    return;
+  }
+
+  timeline->last_write_ts = timestamp_us();
+
+  /* the last byte is acked once everything the kernel holds now is */
+  const uint64_t connection_id = client.connection_id();
+  timeline->kernel_ack_target = server.get_tcp_info(connection_id).bytes_acked
+                                + server.send_queue_bytes(connection_id);
+}
+
+/* timestamp the kernel's ack of the last byte of the chunks in flight */
+void sample_kernel_acks(WSServerBase & server)
+{
+  for (const auto & [connection_id, client] : clients) {
+    auto & timeline = client.chunk_timeline();
+    if (timeline and timeline->awaiting_kernel_ack() and
+        server.get_tcp_info(connection_id).bytes_acked
+        >= timeline->kernel_ack_target) {
+      timeline->kernel_ack_ts = timestamp_us();
+    }
+  }
+}
+
+/* the client acked the video chunk in flight: log its timeline */
+void finish_chunk_timeline(WebSocketClient & client, const uint64_t video_ts)
+{
+  auto & timeline = client.chunk_timeline();
+  if (not timeline or timeline->video_ts != video_ts) {
+    return;
+  }
+
+  timeline->client_ack_ts = timestamp_us();
+
+  /* the kernel's ack arrived after the last sample */
+  if (timeline->awaiting_kernel_ack()) {
+    timeline->kernel_ack_ts = timeline->client_ack_ts;
+  }
+
+  if (timeline->complete()) {
+    const auto channel_name = client.channel()->name();
+    delivery_phases[channel_name].add(*timeline);
+
+    if (log_events_of(client)) {
+      string log_line = to_string(timestamp_ms()) + "," + channel_name + ","
+        + server_id + "," + expt_id + "," + client.username() + ","
+        + to_string(client.first_init_id().value()) + ","
+        + to_string(client.init_id().value()) + ","
+        + to_string(video_ts);
+
+      for (const uint64_t phase_us : timeline->phases()) {
+        log_line += "," + double_to_string(phase_us / 1000.0, 3);
+      }
+
+      append_to_log("video_timeline", log_line);
+    }
+  }
+
+  timeline.reset();
+}
+
+void handle_client_video_ack(WSServerBase & server,
+                             WebSocketClient & client,
+                             const ClientVidAckMsg & msg)
+{
+  if (not client.is_channel_initialized()) {
+    return;
+  }
+  auto channel = client.channel();
+
+  if (msg.init_id != client.init_id().value()) {
+    LOG_WARNING << client.signature() << ": ignored messages with "
+                << "invalid init_id (but should not have received)";
+    return;
+  }
+
+  client.set_video_playback_buf(msg.video_buffer);
+  client.set_audio_playback_buf(msg.audio_buffer);
+  update_cum_rebuffer(client, msg.cum_rebuffer);
+
+  record_event(client, FlightRecorder::EventType::VideoAck,
+               {msg.timestamp, msg.byte_offset + msg.byte_length,
+                msg.total_byte_length, seconds_to_ms(msg.video_buffer),
+                seconds_to_ms(msg.cum_rebuffer)});
+
+  /* acks of an abandoned chunk may arrive until its replacement starts */
+  if (client.abandoned_acks() > 0) {
+    client.set_abandoned_acks(client.abandoned_acks() - 1);
+    return;
+  }
+
+  client.video_frame_acked();
+
+  client.set_video_acked_bytes(msg.byte_offset + msg.byte_length);
+
+  /* only interested in the event when the last segment is acked */
+  if (msg.byte_offset + msg.byte_length != msg.total_byte_length) {
+    if (abandon_video_chunks) {
+      maybe_abandon_video_chunk(server, client, msg);
+    }
+
+    return;
+  }
+
+  client.set_video_acked_bytes(0);
+
+  /* allow sending another chunk */
+  client.set_client_next_vts(msg.timestamp + channel->vduration());
+
+  /* record transmission time */
+  if (client.last_video_send_ts()) {
+    uint64_t trans_time = timestamp_ms() - *client.last_video_send_ts();
+
+    /* look up media chunk size (excluding the size of init chunk size) */
+    const auto data_mmap = channel->vdata(msg.video_format, msg.timestamp);
+    auto media_chunk_size = get<1>(data_mmap);
+
+    /* notify the ABR algorithm that a video chunk is acked */
+    client.video_chunk_acked(msg.video_format, msg.ssim,
+                             media_chunk_size, trans_time);
+
+    if (ttp_shard_writer and client.tcp_info()) {
+      ttp_shard_writer->add_chunk(
+          client.connection_id(), msg.init_id, msg.timestamp,
+          channel->vduration(), *client.last_video_send_ts(),
+          {narrow_cast<uint32_t>(media_chunk_size),
+           narrow_cast<uint32_t>(trans_time),
+           *client.tcp_info()});
+    }
+
+    finish_chunk_timeline(client, msg.timestamp);
+
+    client.set_last_video_send_ts(nullopt);
+    client.set_tcp_info(nullopt);
+  } else {
+    LOG_ERROR << client.signature() << ": server didn't send video but "
+              << "received VideoAck";
+    return;
+  }
+
+  /* record client's received video */
+  if (enable_logging) {
+    stream_aggregates[msg.channel].add_video_acked(msg.ssim);
+  }
+
+  if (enable_logging and log_events_of(client)) {
+    string log_line = to_string(timestamp_ms()) + "," + msg.channel + ","
+      + server_id + "," + expt_id + "," + client.username() + ","
+      + to_string(client.first_init_id().value()) + ","
+      + to_string(msg.init_id) + ","
+      + to_string(msg.timestamp) + ","
+      + to_string(msg.ssim) + "," + double_to_string(msg.video_buffer, 3) + ","
+      + double_to_string(msg.cum_rebuffer, 3);
+    append_to_log("video_acked", log_line);
+  }
+}
+
+void handle_client_audio_ack(WebSocketClient & client,
+                             const ClientAudAckMsg & msg)
+{
+  if (not client.is_channel_initialized()) {
+    return;
+  }
+
+  if (msg.init_id != client.init_id().value()) {
+    LOG_WARNING << client.signature() << ": ignored messages with "
+                << "invalid init_id (but should not have received)";
+    return;
+  }
+
+  client.set_video_playback_buf(msg.video_buffer);
+  client.set_audio_playback_buf(msg.audio_buffer);
+  update_cum_rebuffer(client, msg.cum_rebuffer);
+
+  record_event(client, FlightRecorder::EventType::AudioAck,
+               {msg.timestamp, msg.byte_offset + msg.byte_length,
+                msg.total_byte_length, seconds_to_ms(msg.audio_buffer),
+                seconds_to_ms(msg.cum_rebuffer)});
+
+  /* only interested in the event when the last segment is acked */
+  if (msg.byte_offset + msg.byte_length != msg.total_byte_length) {
+    return;
+  }
+
+  /* allow sending another chunk */
+  client.set_client_next_ats(msg.timestamp + client.channel()->aduration());
+}
+
+/* handle a message from the client and try serving media to it; the user
+ * is authenticated with the session key in the first client-init */
+void handle_client_message(WSServerBase & server, WebSocketClient & client,
+                           const string & payload,
+                           const function<bool(const string &)> & authenticate)
+{
+  const uint64_t connection_id = client.connection_id();
+  client.set_last_msg_recv_ts(timestamp_ms());
+
+  CPUTimer timer(client.cpu(), CPUAccount::Message);
+
+  ClientMsgParser msg_parser(payload);
+  if (msg_parser.msg_type() == ClientMsgParser::Type::Init) {
+    ClientInitMsg msg = msg_parser.parse_client_init();
+
+    /* authenticate user */
+    if (not client.is_authenticated()) {
+      if (authenticate(msg.session_key)) {
+        client.set_authenticated(true);
+
+        /* set client's username and IP */
+        client.set_session_key(msg.session_key);
+        client.set_username(msg.username);
+        client.set_address(server.peer_addr(connection_id));
+
+        /* set client's system info (OS, browser and screen size) */
+        client.set_os(msg.os);
+        client.set_browser(msg.browser);
+        client.set_screen_size(msg.screen_width, msg.screen_height);
+
+        LOG_INFO << connection_id << ": authentication succeeded";
+        LOG_INFO << client.signature() << ": " << client.browser()
+                 << " on " << client.os() << ", "
+                 << client.address().str();
+      } else {
+        LOG_INFO << connection_id << ": authentication failed";
+        server.close_connection(connection_id);
+        return;
+      }
+    }
+
+    /* handle client-init and initialize client's channel */
+    handle_client_init(server, client, msg);
+  } else {
+    /* parse a message other than client-init only if user is authed */
+    if (not client.is_authenticated()) {
+      LOG_INFO << connection_id << ": ignored messages from a "
+               << "non-authenticated user";
+      server.close_connection(connection_id);
+      return;
+    }
+
+    switch (msg_parser.msg_type()) {
+    case ClientMsgParser::Type::Info:
+      handle_client_info(client, msg_parser.parse_client_info());
+      break;
+    case ClientMsgParser::Type::VideoAck:
+      handle_client_video_ack(server, client, msg_parser.parse_client_vidack());
+      break;
+    case ClientMsgParser::Type::AudioAck:
+      handle_client_audio_ack(client, msg_parser.parse_client_audack());
+      break;
+    default:
+      throw runtime_error("invalid client message");
+    }
+  }
+
+  /* try serving media to this client */
+  serve_client(server, client);
+}
+
+void create_channels(Inotify & inotify)
+{
+  fs::path media_dir = config["media_dir"].as<string>();
+
+  set<string> channel_set = load_channels(config);
+  for (const auto & channel_name : channel_set) {
+    /* exceptions might be thrown from the lambda callbacks in the channel */
+    try {
+      auto channel = make_shared<Channel>(
+          channel_name, media_dir,
+          config["channel_configs"][channel_name], inotify);
+      channels.emplace(channel_name, move(channel));
+    } catch (const exception & e) {
+      LOG_ERROR << "exceptions in channel " << channel_name << ": "
+                << e.what();
+    }
+  }
+}
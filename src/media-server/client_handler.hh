@@ -0,0 +1,127 @@
+#ifndef CLIENT_HANDLER_HH
+#define CLIENT_HANDLER_HH
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <memory>
+#include <optional>
+#include <functional>
+
+#include "filesystem.hh"
+#include "inotify.hh"
+#include "channel.hh"
+#include "ws_server.hh"
+#include "ws_client.hh"
+#include "abr_algo.hh"
+#include "slot_map.hh"
+#include "yaml.hh"
+#include "stream_aggregate.hh"
+#include "ttp_shard.hh"
+#include "delivery_timeline.hh"
+#include "cpu_account.hh"
+#include "flight_recorder.hh"
+#include "session_record.hh"
+#include "metrics.hh"
+
+/* Serving the clients of ws_media_server: handling their messages and
+ * sending them media over a WSServerBase, which is the WebSocket server of
+ * ws_media_server or the ReplayServer of ws_media_replay. The state below is
+ * set up by the main() of either program. */
+
+extern YAML::Node config;
+/* key: channel name */
+extern std::map<std::string, std::shared_ptr<Channel>> channels;
+extern SlotMap<WebSocketClient> clients;  /* key: connection ID */
+
+/* if set, pace each client at a multiple of its selected video bitrate */
+extern std::optional<double> pacing_multiplier;
+
+/* cancel the rest of a video chunk that is projected to stall playback */
+extern bool abandon_video_chunks;
+
+/* soft cap on the bytes queued for all clients of this process */
+extern std::optional<size_t> send_buffer_budget;
+extern uint64_t send_budget_refusals;  /* counted since last logged */
+
+/* bytes of init segments sent, and skipped as cached by clients */
+extern uint64_t init_bytes_sent;
+extern uint64_t init_bytes_saved;
+
+/* for logging */
+extern bool enable_logging;
+extern fs::path log_dir;  /* base directory for logging */
+extern std::string server_id;
+extern std::string expt_id;
+
+/* per-minute aggregates of the streams of each channel (key) */
+extern std::map<std::string, StreamAggregate> stream_aggregates;
+
+/* per-minute durations of the phases of delivering video chunks on each
+ * channel (key), timed if logging is enabled */
+extern std::map<std::string, DeliveryPhaseAggregate> delivery_phases;
+
+/* per-minute CPU time spent on the clients of each ABR algorithm, if
+ * cpu_accounting is set */
+extern bool cpu_accounting;
+extern std::map<std::string, CPUAggregate> cpu_usage;  /* key: ABR name */
+
+/* fraction of sessions whose per-chunk events (video_sent, video_acked and
+ * client_buffer) are logged; the aggregates cover all sessions */
+extern double event_log_sample_rate;
+
+/* training data of the TTP, written if "ttp_shard_dir" is set */
+extern std::unique_ptr<TTPShardWriter> ttp_shard_writer;
+
+/* recent events of every client, kept if "flight_recorder_dir" is set */
+extern std::unique_ptr<FlightRecorder> flight_recorder;
+
+/* client messages of a sample of sessions, written for replaying them if
+ * "session_recording_dir" is set */
+extern std::unique_ptr<SessionRecorder> session_recorder;
+
+/* exported on a local port if "metrics_base_port" is set */
+extern MetricsRegistry metrics;
+
+/* set once the listener is handed off on hot restart: only what has been
+ * queued is still sent */
+extern bool draining;
+
+/* record an event of the client in the flight recorder, if enabled */
+void record_event(const WebSocketClient & client,
+                  const FlightRecorder::EventType type,
+                  const FlightRecorder::Fields & fields = {},
+                  const uint16_t aux = 0);
+
+/* return "connection_id,username" or "connection_id," (unknown username) */
+std::string client_signature(const uint64_t connection_id);
+
+/* append a line to the log <log_stem>.<server_id>.log in log_dir */
+void append_to_log(const std::string & log_stem, const std::string & log_line);
+
+/* cancel the rest of the video chunk in flight, tell the client to discard
+ * it and serve its timestamp again; return the number of bytes cancelled */
+size_t abandon_video_chunk(WSServerBase & server, WebSocketClient & client);
+
+/* move the CPU time spent on a client since last accounted into the
+ * aggregate of its ABR algorithm */
+void account_client_cpu(WSServerBase & server, WebSocketClient & client);
+
+/* a frame of the video chunk in flight was written to the kernel */
+void chunk_frame_written(WSServerBase & server, WebSocketClient & client,
+                         const uint64_t tag, const bool last_byte);
+
+/* timestamp the kernel's ack of the last byte of the chunks in flight */
+void sample_kernel_acks(WSServerBase & server);
+
+/* handle a message from the client and try serving media to it; the user
+ * is authenticated with the session key in the first client-init */
+void handle_client_message(
+  WSServerBase & server, WebSocketClient & client,
+  const std::string & payload,
+  const std::function<bool(const std::string &)> & authenticate);
+
+/* create the channels of config */
+void create_channels(Inotify & inotify);
+
+#endif /* CLIENT_HANDLER_HH */
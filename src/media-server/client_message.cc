@@ -2,6 +2,17 @@
 
 using namespace std;
 
+static CachedInits parse_cached_inits(const json & cached_inits)
+{
+  CachedInits ret;
+
+  for (const auto & init : cached_inits) {
+    ret.emplace(init.at("format").get<string>(), init.at("hash").get<string>());
+  }
+
+  return ret;
+}
+
 ClientInitMsg::ClientInitMsg(const json & msg)
 {
   init_id = msg.at("initId").get<unsigned int>();
@@ -25,6 +36,11 @@ ClientInitMsg::ClientInitMsg(const json & msg)
   if (it != msg.end()) {
     next_ats = it->get<uint64_t>();
   }
+
+  it = msg.find("cachedInits");
+  if (it != msg.end()) {
+    cached_inits = parse_cached_inits(*it);
+  }
 }
 
 ClientInfoMsg::ClientInfoMsg(const json & msg)
@@ -57,6 +73,11 @@ ClientInfoMsg::ClientInfoMsg(const json & msg)
   if (it != msg.end()) {
     screen_height = it->get<uint16_t>();
   }
+
+  it = msg.find("cachedInits");
+  if (it != msg.end()) {
+    cached_inits = parse_cached_inits(*it);
+  }
 }
 
 ClientAckMsg::ClientAckMsg(const json & msg)
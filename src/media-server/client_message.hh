@@ -6,12 +6,17 @@
 #include <optional>
 #include <exception>
 #include <memory>
+#include <set>
+#include <utility>
 
 #include "media_formats.hh"
 #include "json.hpp"
 
 using json = nlohmann::json;
 
+/* init segments cached by the client: (format, content hash) */
+using CachedInits = std::set<std::pair<std::string, std::string>>;
+
 class ClientMsg
 {
 protected:
@@ -44,6 +49,9 @@ public:
   /* next timestamps to expect; used to resume connection only */
   std::optional<uint64_t> next_vts {};
   std::optional<uint64_t> next_ats {};
+
+  /* init segments that need not be sent again */
+  CachedInits cached_inits {};
 };
 
 class ClientInfoMsg : public ClientMsg
@@ -69,6 +77,9 @@ public:
   /* user's screen size might have changed while watching */
   std::optional<uint16_t> screen_width {};
   std::optional<uint16_t> screen_height {};
+
+  /* present only if the client's init segment cache has changed */
+  std::optional<CachedInits> cached_inits {};
 };
 
 class ClientAckMsg : public ClientMsg
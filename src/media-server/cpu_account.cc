@@ -0,0 +1,26 @@
+#include "cpu_account.hh"
+
+using namespace std;
+
+bool CPUTimer::enabled_ = false;
+CPUTimer * CPUTimer::current_ = nullptr;
+
+uint64_t CPUAccount::total_ns() const
+{
+  uint64_t ret = 0;
+  for (const uint64_t category_ns : ns) {
+    ret += category_ns;
+  }
+  return ret;
+}
+
+void CPUAggregate::add(const CPUAccount & account)
+{
+  clients++;
+
+  for (size_t i = 0; i < account.ns.size(); i++) {
+    total.ns[i] += account.ns[i];
+    client_us[i].add(account.ns[i] / 1000.0);
+  }
+  client_us.back().add(account.total_ns() / 1000.0);
+}
@@ -0,0 +1,97 @@
+#ifndef CPU_ACCOUNT_HH
+#define CPU_ACCOUNT_HH
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include "quantile_sketch.hh"
+#include "timestamp.hh"
+
+/* CPU time of the server thread spent on behalf of a client, by what it was
+ * spent on, in nanoseconds */
+struct CPUAccount
+{
+  enum Category {
+    ABR = 0,  /* selecting formats and updating the ABR algorithm */
+    Message,  /* parsing and handling the messages of the client */
+    Serve,    /* preparing and queueing media (excluding ABR) */
+    Socket,   /* reading from and writing to the socket, including TLS */
+    NUM_CATEGORIES
+  };
+
+  static constexpr std::array<const char *, NUM_CATEGORIES> CATEGORY_NAMES {
+    "abr", "message", "serve", "socket"};
+
+  std::array<uint64_t, NUM_CATEGORIES> ns {};
+
+  uint64_t total_ns() const;
+};
+
+/* Charges the thread CPU time from its construction to its destruction to a
+ * category of an account, once enabled (reading the clock is a system call).
+ * Timers nest: an inner timer pauses the outer one, so each nanosecond is
+ * charged exactly once. Not thread-safe. */
+class CPUTimer
+{
+public:
+  CPUTimer(CPUAccount & account, const CPUAccount::Category category)
+    : counter_(account.ns[category]), running_(enabled_)
+  {
+    if (not running_) {
+      return;
+    }
+
+    start_ns_ = thread_cpu_ns();
+    parent_ = current_;
+    if (parent_) {
+      parent_->counter_ += start_ns_ - parent_->start_ns_;
+    }
+    current_ = this;
+  }
+
+  ~CPUTimer()
+  {
+    if (not running_) {
+      return;
+    }
+
+    const uint64_t now = thread_cpu_ns();
+    counter_ += now - start_ns_;
+
+    current_ = parent_;
+    if (parent_) {
+      parent_->start_ns_ = now;
+    }
+  }
+
+  static void enable() { enabled_ = true; }
+
+  /* forbid copying CPUTimer */
+  CPUTimer(const CPUTimer & other) = delete;
+  const CPUTimer & operator=(const CPUTimer & other) = delete;
+
+private:
+  static bool enabled_;
+  static CPUTimer * current_;  /* innermost running timer */
+
+  uint64_t & counter_;
+  bool running_;
+  CPUTimer * parent_ {nullptr};
+  uint64_t start_ns_ {0};  /* since which the time is charged to counter_ */
+};
+
+/* CPU time of the clients of one ABR algorithm over a minute */
+struct CPUAggregate
+{
+  uint64_t clients {0};
+  CPUAccount total {};
+
+  /* per-client CPU time of each category, and of all (the last) */
+  std::vector<QuantileSketch> client_us =
+    std::vector<QuantileSketch>(CPUAccount::NUM_CATEGORIES + 1);
+
+  void add(const CPUAccount & account);
+};
+
+#endif /* CPU_ACCOUNT_HH */
@@ -0,0 +1,38 @@
+#include "delivery_timeline.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+bool ChunkTimeline::complete() const
+{
+  return decision_ts and queued_ts and first_write_ts and last_write_ts
+         and kernel_ack_ts and client_ack_ts;
+}
+
+array<uint64_t, ChunkTimeline::NUM_PHASES> ChunkTimeline::phases() const
+{
+  const array<uint64_t, NUM_PHASES + 1> stages {
+    decision_ts, queued_ts, first_write_ts, last_write_ts, kernel_ack_ts,
+    client_ack_ts};
+
+  /* stages are timestamped in order, but a phase is never negative even
+   * if sampling the kernel put its ack after the client's */
+  array<uint64_t, NUM_PHASES> ret;
+  for (size_t i = 0; i < ret.size(); i++) {
+    ret[i] = stages[i + 1] - min(stages[i + 1], stages[i]);
+  }
+
+  return ret;
+}
+
+void DeliveryPhaseAggregate::add(const ChunkTimeline & timeline)
+{
+  const auto phases = timeline.phases();
+
+  chunks++;
+  for (size_t i = 0; i < phases.size(); i++) {
+    total_us[i] += phases[i];
+    us[i].add(phases[i]);
+  }
+}
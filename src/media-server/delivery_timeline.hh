@@ -0,0 +1,68 @@
+#ifndef DELIVERY_TIMELINE_HH
+#define DELIVERY_TIMELINE_HH
+
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include "quantile_sketch.hh"
+
+/* When a video chunk passed each stage on its way to the client, in
+ * microseconds, to attribute its transmission time to the phases between
+ * them: the server's ABR and send queue, the socket, the network and the
+ * client */
+struct ChunkTimeline
+{
+  enum Phase {
+    ABR = 0,  /* decision -> first frame queued */
+    Queue,    /* first frame queued -> first byte written to the kernel */
+    Write,    /* first byte -> last byte written to the kernel */
+    Network,  /* last byte written -> acked to the kernel */
+    Client,   /* acked to the kernel -> acked by the client */
+    NUM_PHASES
+  };
+
+  static constexpr std::array<const char *, NUM_PHASES> PHASE_NAMES {
+    "abr", "queue", "write", "network", "client"};
+
+  uint64_t tag {0};  /* of the frames of the chunk in the WebSocket server */
+  uint64_t video_ts {0};
+
+  unsigned int frames {0};          /* queued */
+  unsigned int frames_written {0};  /* whose last byte has been written */
+
+  uint64_t decision_ts {0};
+  uint64_t queued_ts {0};
+  uint64_t first_write_ts {0};
+  uint64_t last_write_ts {0};
+  uint64_t kernel_ack_ts {0};
+  uint64_t client_ack_ts {0};
+
+  /* TCP bytes_acked once the last byte of the chunk is acked */
+  uint64_t kernel_ack_target {0};
+
+  /* waiting to see the last byte acked by the kernel */
+  bool awaiting_kernel_ack() const
+  {
+    return last_write_ts and not kernel_ack_ts;
+  }
+
+  /* whether every stage has been timestamped */
+  bool complete() const;
+
+  /* duration of each phase; only valid if complete() */
+  std::array<uint64_t, NUM_PHASES> phases() const;
+};
+
+/* distribution of the durations of each phase over the chunks of a minute */
+struct DeliveryPhaseAggregate
+{
+  uint64_t chunks {0};
+  std::array<uint64_t, ChunkTimeline::NUM_PHASES> total_us {};
+  std::vector<QuantileSketch> us =
+    std::vector<QuantileSketch>(ChunkTimeline::NUM_PHASES);
+
+  void add(const ChunkTimeline & timeline);
+};
+
+#endif /* DELIVERY_TIMELINE_HH */
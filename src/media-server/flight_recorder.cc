@@ -0,0 +1,218 @@
+#include "flight_recorder.hh"
+
+#include <csignal>
+#include <fcntl.h>
+#include <system_error>
+
+#include "serialization.hh"
+#include "exception.hh"
+#include "logger.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+static const size_t MAX_CONTROL_REQUEST_LEN = 64;
+
+static uint64_t round_up_to_power_of_two(const size_t n)
+{
+  uint64_t ret = 1;
+  while (ret < n) {
+    ret <<= 1;
+  }
+  return ret;
+}
+
+FlightRecorder::FlightRecorder(const fs::path & dump_dir,
+                               const uint32_t server_id,
+                               const size_t capacity)
+  : dump_dir_(dump_dir), server_id_(server_id),
+    events_(round_up_to_power_of_two(max<size_t>(capacity, 1))),
+    mask_(events_.size() - 1)
+{
+  fs::create_directories(dump_dir_);
+}
+
+optional<fs::path> FlightRecorder::dump(const string & reason,
+                                        const uint64_t connection_id)
+{
+  const uint64_t num_events = min<uint64_t>(recorded_, events_.size());
+
+  string events;
+  uint32_t num_dumped = 0;
+
+  /* from the oldest event still in the ring */
+  for (uint64_t i = recorded_ - num_events; i < recorded_; i++) {
+    const Event & event = events_[i & mask_];
+    if (connection_id != ALL_CONNECTIONS and
+        event.connection_id != connection_id) {
+      continue;
+    }
+
+    events += put_field(event.ts_us);
+    events += put_field(event.connection_id);
+    events += put_field(event.init_id);
+    events += put_field(event.type);
+    events += put_field(event.aux);
+    for (const uint64_t field : event.fields) {
+      events += put_field(field);
+    }
+
+    num_dumped++;
+  }
+
+  if (num_dumped == 0) {
+    return nullopt;
+  }
+
+  const uint64_t now = timestamp_ms();
+
+  string header("PUFFFLT\0", 8);
+  header += put_field(VERSION);
+  header += put_field(server_id_);
+  header += put_field(now);
+  header += put_field(connection_id);
+  header += put_field(recorded_);
+  header += put_field(num_dumped);
+
+  const fs::path dump_path = dump_dir_ / ("flight." + to_string(server_id_)
+    + "." + to_string(now) + "." + to_string(dump_seq_++) + "." + reason
+    + ".bin");
+
+  /* readers only ever see complete dumps */
+  const fs::path partial_path = dump_path.string() + ".partial";
+  {
+    FileDescriptor fd(CheckSystemCall("open (" + partial_path.string() + ")",
+      open(partial_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)));
+    fd.write(header);
+    fd.write(events);
+  }
+  fs::rename(partial_path, dump_path);
+
+  dumps_.emplace_back(dump_path);
+  while (dumps_.size() > MAX_DUMPS) {
+    error_code ec;
+    fs::remove(dumps_.front(), ec);
+    dumps_.pop_front();
+  }
+
+  LOG_INFO << "Flight recorder: dumped " << num_dumped << " events to "
+           << dump_path.string();
+  return dump_path;
+}
+
+void FlightRecorder::auto_dump(const string & reason,
+                               const uint64_t connection_id)
+{
+  const uint64_t now = timestamp_ms();
+  if (last_auto_dump_ts_ and
+      now < *last_auto_dump_ts_ + MIN_AUTO_DUMP_INTERVAL_MS) {
+    return;
+  }
+
+  last_auto_dump_ts_ = now;
+
+  try {
+    dump(reason, connection_id);
+  } catch (const exception & e) {
+    LOG_WARNING << "Flight recorder: failed to dump: " << e.what();
+  }
+}
+
+void FlightRecorder::add_triggers(Poller & poller)
+{
+  /* SIGUSR1 is blocked by the caller and read from a signalfd */
+  signal_fd_ = make_unique<SignalFD>(SignalMask({SIGUSR1}));
+
+  poller.add_action(Poller::Action(signal_fd_->fd(), Direction::In,
+    [this]()->Result {
+      signal_fd_->read_signal();
+
+      try {
+        dump("signal");
+      } catch (const exception & e) {
+        LOG_WARNING << "Flight recorder: failed to dump: " << e.what();
+      }
+
+      return ResultType::Continue;
+    }
+  ), "flight_recorder.signal");
+
+  /* the socket file might be left by the old (or a crashed) server */
+  const fs::path control_path = dump_dir_ / ("flight_recorder."
+                                             + to_string(server_id_) + ".sock");
+  fs::remove(control_path);
+  control_listener_.bind(control_path);
+  control_listener_.listen();
+  control_listener_.set_blocking(false);
+
+  poller.add_action(Poller::Action(control_listener_, Direction::In,
+    [this, &poller]()->Result {
+      for (const uint64_t id : closed_control_connections_) {
+        control_connections_.erase(id);
+      }
+      closed_control_connections_.clear();
+
+      /* the client may have given up on the connection already */
+      optional<FileDescriptor> fd;
+      try {
+        fd = control_listener_.accept();
+      } catch (const exception & e) {
+        LOG_WARNING << "Flight recorder: failed to accept: " << e.what();
+        return ResultType::Continue;
+      }
+
+      const uint64_t id = control_connections_.emplace(
+        ControlConnection {move(*fd)});
+      ControlConnection & conn = control_connections_.at(id);
+      conn.fd.set_blocking(false);
+
+      poller.add_action(Poller::Action(conn.fd, Direction::In,
+        [this, &poller, &conn, id]()->Result {
+          const string data = conn.fd.read(MAX_CONTROL_REQUEST_LEN);
+          conn.request += data;
+
+          const size_t eol = conn.request.find('\n');
+          if (eol == string::npos and not data.empty() and
+              conn.request.size() < MAX_CONTROL_REQUEST_LEN) {
+            return ResultType::Continue;
+          }
+
+          /* the reply is short enough for the socket buffer */
+          if (eol != string::npos) {
+            try {
+              conn.fd.write(handle_control_request(conn.request.substr(0, eol))
+                            + "\n");
+            } catch (const exception & e) {
+              LOG_WARNING << "Flight recorder: control request failed: "
+                          << e.what();
+            }
+          }
+
+          poller.remove_fd(conn.fd.fd_num());
+          closed_control_connections_.emplace_back(id);
+          return ResultType::CancelAll;
+        },
+        [] { return true; },
+        /* the poller drops the fd on an error or hangup */
+        [this, id]() { closed_control_connections_.emplace_back(id); },
+        false /* a failed request must not fail the server */
+      ), "flight_recorder.control");
+
+      return ResultType::Continue;
+    }
+  ), "flight_recorder.accept");
+}
+
+string FlightRecorder::handle_control_request(const string & request)
+{
+  uint64_t connection_id = ALL_CONNECTIONS;
+
+  if (request.compare(0, 5, "dump ") == 0) {
+    connection_id = stoull(request.substr(5));
+  } else if (request != "dump") {
+    return "error: unknown request";
+  }
+
+  const auto dump_path = dump("request", connection_id);
+  return dump_path ? dump_path->string() : "error: no events";
+}
@@ -0,0 +1,148 @@
+#ifndef FLIGHT_RECORDER_HH
+#define FLIGHT_RECORDER_HH
+
+#include <cstdint>
+#include <array>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <optional>
+
+#include "filesystem.hh"
+#include "poller.hh"
+#include "signalfd.hh"
+#include "ipc_socket.hh"
+#include "slot_map.hh"
+#include "timestamp.hh"
+
+/* Keeps the most recent events of the clients of a server in a fixed-size
+ * ring of binary records in memory, so that what the server did for a
+ * session before a stall can be examined afterwards. Recording an event
+ * only copies 64 bytes into the ring; nothing is written out unless the
+ * ring is dumped into dump_dir:
+ *   - entirely, on SIGUSR1 (which must be blocked before any thread starts);
+ *   - upon a request to the control socket flight_recorder.<server ID>.sock
+ *     in dump_dir: "dump\n" or "dump <connection ID>\n", answered with the
+ *     path of the dump;
+ *   - for a single connection, when the client reports rebuffering (at most
+ *     once every MIN_AUTO_DUMP_INTERVAL_MS).
+ * scripts/flight_recorder.py prints dumps.
+ *
+ * All integers in a dump are in network byte order. A dump named
+ * flight.<server ID>.<time in ms>.<sequence>.<reason>.bin is a header:
+ *   magic "PUFFFLT\0", version (u32), server ID (u32), time in ms (u64),
+ *   connection ID or UINT64_MAX for all (u64), number of events ever
+ *   recorded (u64), number of events in the dump (u32)
+ * followed by the events, the oldest first, each of EVENT_SIZE bytes:
+ *   timestamp in us (u64), connection ID (u64), init ID (u32), type (u16),
+ *   aux (u16), fields (5 x u64)
+ * where the meaning of aux and the fields depends on the type (below). */
+class FlightRecorder
+{
+public:
+  static constexpr uint32_t VERSION = 1;
+  static constexpr size_t HEADER_SIZE = 44;
+  static constexpr size_t EVENT_SIZE = 64;
+
+  static constexpr uint64_t ALL_CONNECTIONS = UINT64_MAX;
+
+  enum class EventType : uint16_t {
+    Open = 1,    /* no fields */
+    Close,       /* no fields */
+    Init,        /* server-init: next vts, next ats; aux: 1 if resumed */
+    TCPInfo,     /* before the ABR decision: cwnd, in_flight, min_rtt (us),
+                    rtt (us), delivery_rate (bytes/s) */
+    VideoSent,   /* ABR decision and chunk queued: vts,
+                    width << 32 | height << 16 | crf, bytes, SSIM (micro-dB),
+                    video buffer (ms); aux: 1 if the init segment is sent */
+    AudioSent,   /* ats, bitrate (kbps), bytes; aux as VideoSent */
+    VideoAck,    /* vts, bytes acked, total bytes, video buffer (ms),
+                    cumulative rebuffer (ms) */
+    AudioAck,    /* ats, bytes acked, total bytes, audio buffer (ms),
+                    cumulative rebuffer (ms) */
+    ClientInfo,  /* video buffer (ms), audio buffer (ms), cumulative
+                    rebuffer (ms); aux: ClientInfoMsg::Event */
+    Abandon,     /* vts, bytes cancelled, bytes acked, ms since sent */
+    Error,       /* aux: ServerErrorMsg::Type */
+  };
+
+  using Fields = std::array<uint64_t, 5>;
+
+  /* keep the last capacity events, rounded up to a power of two */
+  FlightRecorder(const fs::path & dump_dir, const uint32_t server_id,
+                 const size_t capacity);
+
+  void record(const EventType type, const uint64_t connection_id,
+              const uint32_t init_id, const Fields & fields = {},
+              const uint16_t aux = 0)
+  {
+    Event & event = events_[recorded_ & mask_];
+    event.ts_us = timestamp_us();
+    event.connection_id = connection_id;
+    event.init_id = init_id;
+    event.type = static_cast<uint16_t>(type);
+    event.aux = aux;
+    event.fields = fields;
+    recorded_++;
+  }
+
+  /* write the events of a connection (or all) to a new dump; return its
+   * path, or nothing if the connection has no events */
+  std::optional<fs::path> dump(const std::string & reason,
+                               const uint64_t connection_id = ALL_CONNECTIONS);
+
+  /* dump a connection unless an automatic dump happened too recently */
+  void auto_dump(const std::string & reason, const uint64_t connection_id);
+
+  /* dump on SIGUSR1 and on requests to the control socket */
+  void add_triggers(Poller & poller);
+
+  /* forbid copying FlightRecorder */
+  FlightRecorder(const FlightRecorder & other) = delete;
+  const FlightRecorder & operator=(const FlightRecorder & other) = delete;
+
+private:
+  static constexpr uint64_t MIN_AUTO_DUMP_INTERVAL_MS = 10000;
+  static constexpr size_t MAX_DUMPS = 200;  /* older dumps are removed */
+
+  struct Event
+  {
+    uint64_t ts_us {0};
+    uint64_t connection_id {0};
+    uint32_t init_id {0};
+    uint16_t type {0};
+    uint16_t aux {0};
+    Fields fields {};
+  };
+
+  fs::path dump_dir_;
+  uint32_t server_id_;
+
+  std::vector<Event> events_;
+  uint64_t mask_;
+  uint64_t recorded_ {0};  /* the next event goes to recorded_ & mask_ */
+
+  uint64_t dump_seq_ {0};
+  std::deque<fs::path> dumps_ {};  /* written by this process, oldest first */
+  std::optional<uint64_t> last_auto_dump_ts_ {};  /* in ms */
+
+  /* triggers */
+  std::unique_ptr<SignalFD> signal_fd_ {};
+  IPCSocket control_listener_ {};
+
+  struct ControlConnection
+  {
+    FileDescriptor fd;
+    std::string request {};
+  };
+
+  /* closed connections are erased upon the next accept, as in
+   * MetricsServer */
+  SlotMap<ControlConnection> control_connections_ {};
+  std::vector<uint64_t> closed_control_connections_ {};
+
+  std::string handle_control_request(const std::string & request);
+};
+
+#endif /* FLIGHT_RECORDER_HH */
@@ -0,0 +1,84 @@
+#include "replay_server.hh"
+
+#include <stdexcept>
+
+#include "serialization.hh"
+#include "timestamp.hh"
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+void ReplayServer::open(const uint64_t connection_id,
+                        deque<TCPInfo> && tcp_infos)
+{
+  Connection & conn = connections_[connection_id];
+  conn = {};
+  conn.tcp_infos = move(tcp_infos);
+}
+
+void ReplayServer::erase(const uint64_t connection_id)
+{
+  connections_.erase(connection_id);
+}
+
+bool ReplayServer::closed(const uint64_t connection_id) const
+{
+  return connections_.at(connection_id).closed;
+}
+
+string ReplayServer::take_transcript()
+{
+  string ret = move(transcript_);
+  transcript_.clear();
+  return ret;
+}
+
+bool ReplayServer::queue_frame(const uint64_t connection_id,
+                               const WSFrame & frame, const Priority,
+                               const uint64_t)
+{
+  if (connections_.at(connection_id).closed) {
+    return false;
+  }
+
+  /* a server message is the length of its metadata, then the metadata */
+  const string & payload = frame.payload();
+  if (payload.size() < sizeof(uint16_t)) {
+    throw runtime_error("server message without metadata length");
+  }
+
+  const size_t metadata_length = get_uint16(payload.data());
+  if (payload.size() < sizeof(uint16_t) + metadata_length) {
+    throw runtime_error("server message shorter than its metadata length");
+  }
+
+  const string metadata = payload.substr(sizeof(uint16_t), metadata_length);
+
+  /* list only the first fragment of a chunk */
+  const json fields = json::parse(metadata);
+  if (fields.value("byteOffset", 0) != 0) {
+    return true;
+  }
+
+  transcript_ += to_string(timestamp_ms()) + " " + to_string(connection_id)
+                 + " " + metadata + "\n";
+  return true;
+}
+
+void ReplayServer::close_connection(const uint64_t connection_id)
+{
+  connections_.at(connection_id).closed = true;
+}
+
+TCPInfo ReplayServer::get_tcp_info(const uint64_t connection_id) const
+{
+  const Connection & conn = connections_.at(connection_id);
+
+  if (not conn.tcp_infos.empty()) {
+    conn.last_tcp_info = conn.tcp_infos.front();
+    conn.tcp_infos.pop_front();
+  }
+
+  return conn.last_tcp_info;
+}
@@ -0,0 +1,78 @@
+#ifndef REPLAY_SERVER_HH
+#define REPLAY_SERVER_HH
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <map>
+
+#include "ws_server.hh"
+#include "ws_frame.hh"
+#include "address.hh"
+#include "socket.hh"
+
+/* Stands in for the WebSocket server of ws_media_server when recorded
+ * sessions are replayed (in ws_media_replay). The mocked sockets write every
+ * frame out as soon as it is queued, so nothing is ever left to cancel or to
+ * count against the send buffer budget; the TCP info of a connection is
+ * taken from the samples recorded with its session, one per call in order.
+ * The server messages are kept as a transcript, one line each:
+ *   <time in ms> <connection ID> <metadata>
+ * where only the first fragment of a chunk is listed. */
+class ReplayServer : public WSServerBase
+{
+public:
+  ReplayServer() {}
+
+  /* a connection with the TCP info samples of its session */
+  void open(const uint64_t connection_id, std::deque<TCPInfo> && tcp_infos);
+  void erase(const uint64_t connection_id);
+
+  /* the server closed the connection */
+  bool closed(const uint64_t connection_id) const;
+
+  /* take the transcript since last taken */
+  std::string take_transcript();
+
+  /* WSServerBase */
+  void set_pacing_rate(const uint64_t, const uint64_t) override {}
+
+  bool queue_frame(const uint64_t connection_id, const WSFrame & frame,
+                   const Priority priority = Priority::High,
+                   const uint64_t tag = 0) override;
+  size_t cancel_frames(const uint64_t, const Priority) override { return 0; }
+  size_t queued_frames(const uint64_t, const Priority) const override
+  {
+    return 0;
+  }
+  void clear_buffer(const uint64_t) override {}
+
+  Address peer_addr(const uint64_t) const override
+  {
+    return {"127.0.0.1", 0};
+  }
+
+  size_t queued_bytes() const override { return 0; }
+
+  void close_connection(const uint64_t connection_id) override;
+
+  /* the next recorded sample; the last one once they run out */
+  TCPInfo get_tcp_info(const uint64_t connection_id) const override;
+
+  unsigned int send_queue_bytes(const uint64_t) const override { return 0; }
+  uint64_t take_socket_cpu_ns(const uint64_t) override { return 0; }
+
+private:
+  struct Connection
+  {
+    /* consumed by get_tcp_info() */
+    mutable std::deque<TCPInfo> tcp_infos {};
+    mutable TCPInfo last_tcp_info {};
+    bool closed {false};
+  };
+
+  std::map<uint64_t, Connection> connections_ {};
+  std::string transcript_ {};
+};
+
+#endif /* REPLAY_SERVER_HH */
@@ -114,11 +114,12 @@ int run_ws_media_servers()
 
   const bool enable_logging = config["enable_logging"].as<bool>();
 
-  /* will run log reporters only if enable_logging is true */
-  auto log_reporter = src_path / "monitoring/log_reporter";
+  /* will run the log reporter only if enable_logging is true */
+  auto log_reporter = src_path / "monitoring/host_log_reporter";
   vector<string> log_stems {
     "server_info", "active_streams", "client_buffer", "client_sysinfo",
-    "video_sent", "video_acked"};
+    "video_sent", "video_acked", "queue_delay", "stream_minute",
+    "poller_dispatch", "video_timeline", "delivery_phase", "cpu_usage"};
 
   /* Remove ipc directory prior to starting Media Server */
   string ipc_dir = "pensieve_ipc";
@@ -153,24 +154,17 @@ int run_ws_media_servers()
       vector<string> args { ws_media_server, yaml_config,
                             to_string(server_id), to_string(expt_id) };
       proc_manager.run_as_child(ws_media_server, args);
-
-      /* run log_reporter */
-      if (enable_logging) {
-        fs::path log_dir = config["log_dir"].as<string>();
-
-        for (const auto & log_stem : log_stems) {
-          string log_format = log_dir / (log_stem + ".conf");
-          string log_path = log_dir / (log_stem + "." + to_string(server_id)
-                                       + ".log");
-
-          vector<string> log_args { log_reporter, yaml_config,
-                                    log_format, log_path };
-          proc_manager.run_as_child(log_reporter, log_args);
-        }
-      }
     }
   }
 
+  /* run a single log reporter for the logs of all servers on this host */
+  if (enable_logging) {
+    vector<string> log_args { log_reporter, yaml_config,
+                              to_string(server_id) };
+    log_args.insert(log_args.end(), log_stems.begin(), log_stems.end());
+    proc_manager.run_as_child(log_reporter, log_args);
+  }
+
   return proc_manager.wait();
 
 }
@@ -50,7 +50,9 @@ ServerVideoMsg::ServerVideoMsg(const unsigned int init_id,
                                const uint64_t timestamp,
                                const unsigned int byte_offset,
                                const unsigned int total_byte_length,
-                               const double ssim)
+                               const double ssim,
+                               const string & init_hash,
+                               const unsigned int init_length)
 {
   msg_ = {
     {"type", "server-video"},
@@ -60,7 +62,9 @@ ServerVideoMsg::ServerVideoMsg(const unsigned int init_id,
     {"timestamp", timestamp},
     {"byteOffset", byte_offset},
     {"totalByteLength", total_byte_length},
-    {"ssim", ssim}
+    {"ssim", ssim},
+    {"initHash", init_hash},
+    {"initLength", init_length}
   };
 }
 
@@ -69,7 +73,9 @@ ServerAudioMsg::ServerAudioMsg(const unsigned int init_id,
                                const string & format,
                                const uint64_t timestamp,
                                const unsigned int byte_offset,
-                               const unsigned int total_byte_length)
+                               const unsigned int total_byte_length,
+                               const string & init_hash,
+                               const unsigned int init_length)
 {
   msg_ = {
     {"type", "server-audio"},
@@ -78,7 +84,23 @@ ServerAudioMsg::ServerAudioMsg(const unsigned int init_id,
     {"format", format},
     {"timestamp", timestamp},
     {"byteOffset", byte_offset},
-    {"totalByteLength", total_byte_length}
+    {"totalByteLength", total_byte_length},
+    {"initHash", init_hash},
+    {"initLength", init_length}
+  };
+}
+
+ServerCancelMsg::ServerCancelMsg(const unsigned int init_id,
+                                 const string & channel,
+                                 const string & format,
+                                 const uint64_t timestamp)
+{
+  msg_ = {
+    {"type", "server-cancel"},
+    {"initId", init_id},
+    {"channel", channel},
+    {"format", format},
+    {"timestamp", timestamp}
   };
 }
 
@@ -104,6 +126,10 @@ ServerErrorMsg::ServerErrorMsg(const unsigned int init_id,
     error_message = "Sorry, this server has reached the limit of concurrent "
       "viewers; our research study only allows up to 500 people to watch "
       "Puffer at a time (see FAQ). Please refresh or try again later.";
+  } else if (error_type == Type::Busy) {
+    error_type_str = "busy";
+    error_message = "This server is busy right now; "
+      "connecting you to another one...";
   }
 
   msg_ = {
@@ -39,6 +39,9 @@ public:
                 const bool can_resume);
 };
 
+/* init_hash identifies the init segment of the format, which is prepended
+ * to the chunk only if init_length > 0; otherwise the client supplies it
+ * from its cache when it needs one */
 class ServerVideoMsg : public ServerMsg
 {
 public:
@@ -48,7 +51,9 @@ public:
                  const uint64_t timestamp,
                  const unsigned int byte_offset,
                  const unsigned int total_byte_length,
-                 const double ssim);
+                 const double ssim,
+                 const std::string & init_hash,
+                 const unsigned int init_length);
 };
 
 class ServerAudioMsg : public ServerMsg
@@ -59,7 +64,19 @@ public:
                  const std::string & format,
                  const uint64_t timestamp,
                  const unsigned int byte_offset,
-                 const unsigned int total_byte_length);
+                 const unsigned int total_byte_length,
+                 const std::string & init_hash,
+                 const unsigned int init_length);
+};
+
+/* the rest of a video chunk will not be sent; discard what has arrived */
+class ServerCancelMsg : public ServerMsg
+{
+public:
+  ServerCancelMsg(const unsigned int init_id,
+                  const std::string & channel,
+                  const std::string & format,
+                  const uint64_t timestamp);
 };
 
 class ServerErrorMsg : public ServerMsg
@@ -69,7 +86,8 @@ public:
     Maintenance, /* server is under maintenance */
     Reinit,      /* channel needs to be reinitialized */
     Unavailable, /* channel is not available */
-    Limit        /* limit on number of concurrent viewers */
+    Limit,       /* limit on number of concurrent viewers */
+    Busy         /* server near capacity; retry on another server */
   };
 
   ServerErrorMsg(const unsigned int init_id, const Type error_type);
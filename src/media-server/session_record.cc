@@ -0,0 +1,214 @@
+#include "session_record.hh"
+
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+
+#include "json.hpp"
+#include "timestamp.hh"
+#include "exception.hh"
+
+using namespace std;
+using json = nlohmann::json;
+
+static const string SESSION_MAGIC = "puffer-session";
+
+static string abr_config_to_string(const YAML::Node & abr_config)
+{
+  YAML::Emitter out;
+  out << YAML::Flow << abr_config;
+  return out.c_str();
+}
+
+/* blank the credentials and the identity of the user in client-init */
+static string redact_client_init(const string & payload)
+{
+  /* leave what the server would fail to parse as it is */
+  json msg = json::parse(payload, nullptr, false);
+  if (not msg.is_object() or msg.value("type", "") != "client-init") {
+    return payload;
+  }
+
+  msg["sessionKey"] = "";
+  msg["userName"] = "";
+  return msg.dump();
+}
+
+Session read_session(const fs::path & path)
+{
+  ifstream in(path, ios::binary);
+  if (not in) {
+    throw runtime_error("cannot open session " + path.string());
+  }
+
+  const auto malformed = [&path](const string & what) {
+    return runtime_error("malformed session " + path.string() + ": " + what);
+  };
+
+  Session session;
+
+  string magic, key;
+  unsigned int version = 0;
+  if (not (in >> magic >> version) or magic != SESSION_MAGIC) {
+    throw malformed("not a session");
+  }
+  if (version != Session::VERSION) {
+    throw malformed("unsupported version " + to_string(version));
+  }
+
+  if (not (in >> key >> session.abr_name) or key != "abr") {
+    throw malformed("missing abr");
+  }
+
+  string abr_config;
+  if (not (in >> key) or key != "abr_config" or
+      not getline(in >> ws, abr_config)) {
+    throw malformed("missing abr_config");
+  }
+  session.abr_config = YAML::Load(abr_config);
+
+  SessionEvent event;
+  string type;
+  while (in >> event.ts >> type) {
+    if (type == "open") {
+      event.type = SessionEvent::Type::Open;
+    } else if (type == "close") {
+      event.type = SessionEvent::Type::Close;
+    } else if (type == "message") {
+      event.type = SessionEvent::Type::Message;
+
+      size_t length = 0;
+      if (not (in >> length) or in.get() != ' ') {
+        throw malformed("bad message length");
+      }
+
+      event.payload.resize(length);
+      if (not in.read(event.payload.data(), length) or in.get() != '\n') {
+        throw malformed("truncated message");
+      }
+    } else if (type == "tcp_info") {
+      event.type = SessionEvent::Type::TCPInfo;
+
+      TCPInfo & tcpi = event.tcp_info;
+      if (not (in >> tcpi.cwnd >> tcpi.in_flight >> tcpi.min_rtt >> tcpi.rtt
+                  >> tcpi.delivery_rate >> tcpi.bytes_acked)) {
+        throw malformed("bad tcp_info");
+      }
+    } else {
+      throw malformed("unknown event " + type);
+    }
+
+    session.events.emplace_back(move(event));
+    event = {};
+  }
+
+  if (not in.eof()) {
+    throw malformed("bad event");
+  }
+
+  return session;
+}
+
+SessionRecorder::SessionRecorder(const fs::path & dir, const string & server_id,
+                                 const string & abr_name,
+                                 const YAML::Node & abr_config,
+                                 const double sample_rate)
+  : dir_(dir), server_id_(server_id),
+    header_(SESSION_MAGIC + " " + to_string(Session::VERSION) + "\n"
+            + "abr " + abr_name + "\n"
+            + "abr_config " + abr_config_to_string(abr_config) + "\n"),
+    sample_rate_(sample_rate)
+{
+  fs::create_directories(dir_);
+}
+
+SessionRecorder::~SessionRecorder()
+{
+  for (const auto & [connection_id, session] : sessions_) {
+    try {
+      flush(session);
+    } catch (const exception & e) {
+      print_exception("SessionRecorder", e);
+    }
+  }
+}
+
+void SessionRecorder::open(const uint64_t connection_id)
+{
+  /* scramble the connection ID into a uniform number in [0, 1) */
+  const uint64_t hash = connection_id * 0x9E3779B97F4A7C15;
+  if (static_cast<double>(hash >> 11) / (UINT64_C(1) << 53) >= sample_rate_) {
+    return;
+  }
+
+  const uint64_t now = timestamp_ms();
+  const fs::path path = dir_ / ("session." + server_id_ + "."
+    + to_string(connection_id) + "." + to_string(now) + ".txt");
+
+  SessionFile & session = sessions_.emplace_at(connection_id,
+    FileDescriptor(CheckSystemCall("open (" + path.string() + ")",
+      ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644))));
+
+  session.buffer = header_;
+  append(connection_id, to_string(now) + " open\n");
+}
+
+void SessionRecorder::record_message(const uint64_t connection_id,
+                                     const string & payload)
+{
+  if (not sessions_.find(connection_id)) {
+    return;
+  }
+
+  /* only client-init carries anything to blank */
+  const string recorded = payload.find("client-init") != string::npos ?
+                          redact_client_init(payload) : payload;
+
+  append(connection_id, to_string(timestamp_ms()) + " message "
+         + to_string(recorded.size()) + " " + recorded + "\n");
+}
+
+void SessionRecorder::record_tcp_info(const uint64_t connection_id,
+                                      const TCPInfo & tcp_info)
+{
+  if (not sessions_.find(connection_id)) {
+    return;
+  }
+
+  append(connection_id, to_string(timestamp_ms()) + " tcp_info "
+         + to_string(tcp_info.cwnd) + " " + to_string(tcp_info.in_flight) + " "
+         + to_string(tcp_info.min_rtt) + " " + to_string(tcp_info.rtt) + " "
+         + to_string(tcp_info.delivery_rate) + " "
+         + to_string(tcp_info.bytes_acked) + "\n");
+}
+
+void SessionRecorder::close(const uint64_t connection_id)
+{
+  SessionFile * session = sessions_.find(connection_id);
+  if (not session) {
+    return;
+  }
+
+  session->buffer += to_string(timestamp_ms()) + " close\n";
+  flush(*session);
+  sessions_.erase(connection_id);
+}
+
+void SessionRecorder::append(const uint64_t connection_id, const string & line)
+{
+  SessionFile * session = sessions_.find(connection_id);
+  if (not session) {
+    return;
+  }
+
+  session->buffer += line;
+  if (session->buffer.size() >= BUFFER_BYTES) {
+    flush(*session);
+  }
+}
+
+void SessionRecorder::flush(SessionFile & session)
+{
+  session.fd.write(session.buffer);
+  session.buffer.clear();
+}
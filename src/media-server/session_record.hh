@@ -0,0 +1,98 @@
+#ifndef SESSION_RECORD_HH
+#define SESSION_RECORD_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "filesystem.hh"
+#include "file_descriptor.hh"
+#include "slot_map.hh"
+#include "socket.hh"
+#include "yaml.hh"
+
+/* A session recorded by ws_media_server for replaying it offline: what the
+ * client sent and the TCP info the ABR algorithm saw. A session file named
+ * session.<server ID>.<connection ID>.<time of open in ms>.txt starts with
+ *   puffer-session <version>
+ *   abr <ABR name>
+ *   abr_config <ABR config in YAML flow style>
+ * followed by one event per line, in the order of recording:
+ *   <time in ms> open
+ *   <time in ms> message <length> <payload of the client message>
+ *   <time in ms> tcp_info <cwnd> <in_flight> <min_rtt> <rtt>
+ *                         <delivery_rate> <bytes_acked>
+ *   <time in ms> close
+ * where the payload is followed by a newline after exactly <length> bytes,
+ * and a tcp_info is recorded before every ABR decision on video. The
+ * session key and the username in client-init are blanked. */
+struct SessionEvent
+{
+  enum class Type { Open, Message, TCPInfo, Close };
+
+  uint64_t ts {0};  /* in ms */
+  Type type {Type::Open};
+  std::string payload {};  /* Message */
+  TCPInfo tcp_info {};     /* TCPInfo */
+};
+
+struct Session
+{
+  static constexpr unsigned int VERSION = 1;
+
+  std::string abr_name {};
+  YAML::Node abr_config {};
+  std::vector<SessionEvent> events {};
+};
+
+/* throw if the file is not a well-formed session */
+Session read_session(const fs::path & path);
+
+/* Writes the sessions of a sample of connections into a directory, each
+ * buffered in memory and appended to its file every BUFFER_BYTES */
+class SessionRecorder
+{
+public:
+  static constexpr size_t BUFFER_BYTES = 64 * 1024;
+
+  /* record the fraction sample_rate of the connections */
+  SessionRecorder(const fs::path & dir, const std::string & server_id,
+                  const std::string & abr_name, const YAML::Node & abr_config,
+                  const double sample_rate);
+
+  /* flush the sessions still open */
+  ~SessionRecorder();
+
+  void open(const uint64_t connection_id);
+  void record_message(const uint64_t connection_id,
+                      const std::string & payload);
+  void record_tcp_info(const uint64_t connection_id, const TCPInfo & tcp_info);
+  void close(const uint64_t connection_id);
+
+  /* forbid copying SessionRecorder */
+  SessionRecorder(const SessionRecorder & other) = delete;
+  const SessionRecorder & operator=(const SessionRecorder & other) = delete;
+
+private:
+  struct SessionFile
+  {
+    FileDescriptor fd;
+    std::string buffer {};
+
+    explicit SessionFile(FileDescriptor && file) : fd(std::move(file)) {}
+  };
+
+  fs::path dir_;
+  std::string server_id_;
+  std::string header_;
+  double sample_rate_;
+
+  /* key: connection ID; only the sampled connections */
+  SlotMap<SessionFile> sessions_ {};
+
+  /* append an event line to the session of the connection, if recorded */
+  void append(const uint64_t connection_id, const std::string & line);
+  void flush(SessionFile & session);
+};
+
+#endif /* SESSION_RECORD_HH */
@@ -0,0 +1,30 @@
+#include "stream_aggregate.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+void StreamAggregate::add_video_sent(const uint64_t bytes, const double ssim,
+                                     const uint64_t tcp_delivery_rate,
+                                     const uint32_t tcp_rtt)
+{
+  video_sent++;
+  video_sent_bytes += bytes;
+  ssim_sent_sum += ssim;
+
+  delivery_rate.add(tcp_delivery_rate);
+  rtt.add(tcp_rtt);
+}
+
+void StreamAggregate::add_video_acked(const double ssim)
+{
+  video_acked++;
+  ssim_acked_sum += ssim;
+}
+
+void StreamAggregate::add_buffer_level(const double buffer)
+{
+  const auto bin = upper_bound(BUFFER_BOUNDS.begin(), BUFFER_BOUNDS.end(),
+                               buffer);
+  buffer_hist.at(bin - BUFFER_BOUNDS.begin())++;
+}
@@ -0,0 +1,42 @@
+#ifndef STREAM_AGGREGATE_HH
+#define STREAM_AGGREGATE_HH
+
+#include <cstdint>
+#include <array>
+
+#include "quantile_sketch.hh"
+
+/* Aggregates of the streams of one channel over a minute, which is all that
+ * most dashboards need from the per-chunk video_sent, video_acked and
+ * client_buffer events */
+struct StreamAggregate
+{
+  /* upper bounds (in seconds) of the bins of the buffer-level histogram;
+   * a last bin counts the levels beyond */
+  static constexpr std::array<double, 5> BUFFER_BOUNDS {1, 2, 5, 10, 15};
+
+  uint64_t video_sent {0};
+  uint64_t video_sent_bytes {0};
+  double ssim_sent_sum {0};
+
+  uint64_t video_acked {0};
+  double ssim_acked_sum {0};
+
+  uint64_t startups {0};
+  double startup_delay_sum {0};  /* in seconds */
+  uint64_t rebuffers {0};
+  double stall_time {0};         /* in seconds */
+
+  std::array<uint64_t, BUFFER_BOUNDS.size() + 1> buffer_hist {};
+
+  QuantileSketch delivery_rate {};  /* bytes per second */
+  QuantileSketch rtt {};            /* in microseconds */
+
+  void add_video_sent(const uint64_t bytes, const double ssim,
+                      const uint64_t tcp_delivery_rate,
+                      const uint32_t tcp_rtt);
+  void add_video_acked(const double ssim);
+  void add_buffer_level(const double buffer);
+};
+
+#endif /* STREAM_AGGREGATE_HH */
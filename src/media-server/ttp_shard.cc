@@ -0,0 +1,190 @@
+#include "ttp_shard.hh"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "exception.hh"
+#include "serialization.hh"
+#include "strict_conversions.hh"
+#include "timestamp.hh"
+#include "logger.hh"
+
+using namespace std;
+
+static const string PARTIAL_SUFFIX = ".partial";
+
+static string put_chunk(const TTPChunk & chunk)
+{
+  return put_field(chunk.size) + put_field(chunk.trans_time)
+         + put_field(chunk.tcp_info.cwnd) + put_field(chunk.tcp_info.in_flight)
+         + put_field(chunk.tcp_info.min_rtt) + put_field(chunk.tcp_info.rtt)
+         + put_field(chunk.tcp_info.delivery_rate);
+}
+
+TTPShardWriter::TTPShardWriter(const fs::path & shard_dir,
+                               const uint32_t server_id,
+                               const uint32_t expt_id,
+                               const uint64_t max_shard_bytes,
+                               const uint64_t max_shard_age_ms)
+  : shard_dir_(shard_dir), server_id_(server_id), expt_id_(expt_id),
+    max_shard_bytes_(max_shard_bytes), max_shard_age_ms_(max_shard_age_ms)
+{
+  fs::create_directories(shard_dir_);
+
+  /* shards left partial by a previous server that did not exit cleanly;
+   * the name of a partial shard ends with the PID of its writer, which may
+   * still be draining after a hot restart */
+  const string prefix = "ttp." + to_string(server_id_) + ".";
+  for (const auto & entry : fs::directory_iterator(shard_dir_)) {
+    const string name = entry.path().filename().string();
+    if (name.compare(0, prefix.size(), prefix) != 0 or
+        entry.path().extension() != PARTIAL_SUFFIX) {
+      continue;
+    }
+
+    /* ttp.<server ID>.<creation time>.<PID>.shard.partial */
+    const fs::path shard_name = entry.path().stem();
+    const string pid_str = shard_name.stem().extension().string();
+    if (pid_str.size() > 1) {
+      const pid_t pid = stoi(pid_str.substr(1));
+      if (kill(pid, 0) == 0 or errno != ESRCH) {
+        continue;
+      }
+    }
+
+    recover_partial_shard(entry.path());
+  }
+}
+
+TTPShardWriter::~TTPShardWriter()
+{
+  try {
+    complete_shard();
+  } catch (const exception & e) {
+    print_exception("TTPShardWriter", e);
+  }
+}
+
+void TTPShardWriter::add_chunk(const uint64_t connection_id,
+                               const uint32_t init_id,
+                               const uint64_t video_ts,
+                               const uint64_t vduration,
+                               const uint64_t sent_ts,
+                               const TTPChunk & chunk)
+{
+  /* the history consists of consecutive chunks of the same session */
+  History & history = histories_[connection_id];
+  if (history.init_id != init_id or history.next_vts != video_ts) {
+    history.init_id = init_id;
+    history.chunks.clear();
+  }
+
+  const uint32_t num_past = narrow_cast<uint32_t>(history.chunks.size());
+
+  buffer_ += put_field(sent_ts) + put_field(connection_id)
+             + put_field(video_ts) + put_field(init_id) + put_field(num_past)
+             + put_chunk(chunk);
+  for (const auto & past_chunk : history.chunks) {
+    buffer_ += put_chunk(past_chunk);
+  }
+  buffer_.append((PAST_CHUNKS - num_past) * CHUNK_SIZE, '\0');
+
+  history.next_vts = video_ts + vduration;
+  history.chunks.push_front(chunk);
+  if (history.chunks.size() > PAST_CHUNKS) {
+    history.chunks.pop_back();
+  }
+
+  if (buffer_.size() >= MAX_BUFFER_SIZE) {
+    flush();
+  }
+}
+
+void TTPShardWriter::remove_connection(const uint64_t connection_id)
+{
+  histories_.erase(connection_id);
+}
+
+void TTPShardWriter::flush()
+{
+  write_buffer();
+
+  if (shard_fd_ and (shard_bytes_ >= max_shard_bytes_ or
+      timestamp_ms() >= shard_start_ts_ + max_shard_age_ms_)) {
+    complete_shard();
+  }
+}
+
+void TTPShardWriter::write_buffer()
+{
+  if (buffer_.empty()) {
+    return;
+  }
+
+  if (not shard_fd_) {
+    open_shard();
+  }
+
+  shard_fd_->write(buffer_);
+  shard_bytes_ += buffer_.size();
+  buffer_.clear();
+}
+
+void TTPShardWriter::open_shard()
+{
+  /* unique names even if shards are rotated within a millisecond */
+  shard_start_ts_ = max(timestamp_ms(), shard_start_ts_ + 1);
+  shard_path_ = shard_dir_ / ("ttp." + to_string(server_id_) + "."
+                              + to_string(shard_start_ts_) + "."
+                              + to_string(getpid()) + ".shard");
+
+  const string partial_path = shard_path_.string() + PARTIAL_SUFFIX;
+  shard_fd_.emplace(CheckSystemCall("open (" + partial_path + ")",
+      open(partial_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)));
+
+  string header = "PUFFTTP";
+  header += '\0';
+  header += put_field(VERSION) + put_field(PAST_CHUNKS)
+            + put_field(server_id_) + put_field(expt_id_);
+  shard_fd_->write(header);
+  shard_bytes_ = header.size();
+}
+
+void TTPShardWriter::complete_shard()
+{
+  write_buffer();
+
+  if (not shard_fd_) {
+    return;
+  }
+
+  shard_fd_->close();
+  shard_fd_.reset();
+
+  /* readers only ever see complete shards */
+  fs::rename(shard_path_.string() + PARTIAL_SUFFIX, shard_path_);
+  LOG_INFO << "Completed TTP shard " << shard_path_.string() << " ("
+           << (shard_bytes_ - HEADER_SIZE) / RECORD_SIZE << " records)";
+}
+
+void TTPShardWriter::recover_partial_shard(const fs::path & partial_path)
+{
+  const uint64_t size = fs::file_size(partial_path);
+  if (size < HEADER_SIZE) {
+    fs::remove(partial_path);
+    return;
+  }
+
+  const uint64_t num_records = (size - HEADER_SIZE) / RECORD_SIZE;
+  fs::resize_file(partial_path, HEADER_SIZE + num_records * RECORD_SIZE);
+
+  fs::path shard_path = partial_path;
+  shard_path.replace_extension();
+  fs::rename(partial_path, shard_path);
+
+  LOG_INFO << "Recovered partial TTP shard " << shard_path.string() << " ("
+           << num_records << " records)";
+}
@@ -0,0 +1,108 @@
+#ifndef TTP_SHARD_HH
+#define TTP_SHARD_HH
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <map>
+#include <optional>
+
+#include "filesystem.hh"
+#include "file_descriptor.hh"
+#include "socket.hh"
+
+/* a video chunk as the TTP sees it */
+struct TTPChunk
+{
+  uint32_t size {0};        /* bytes */
+  uint32_t trans_time {0};  /* ms from sending to the client's ack */
+  TCPInfo tcp_info {};      /* before sending the chunk */
+};
+
+/* Writes training data of the TTP (scripts/ttp.py) directly: one record per
+ * acked video chunk, already joined with the TCP info when it was sent and
+ * with the chunks preceding it in the session. Records are appended to
+ * binary shards that are rotated by size and age; a shard is named
+ * ttp.<server ID>.<creation time in ms>.<PID of its writer>.shard once
+ * complete and carries a ".partial" suffix until then.
+ * scripts/ttp_shards.py loads them.
+ *
+ * All integers are in network byte order. A shard is a header:
+ *   magic "PUFFTTP\0", version (u32), PAST_CHUNKS (u32), server ID (u32),
+ *   expt ID (u32)
+ * followed by records of RECORD_SIZE bytes:
+ *   sent_ts in ms (u64), connection ID (u64), video_ts (u64), init ID (u32),
+ *   number of past chunks (u32), the chunk, then PAST_CHUNKS past chunks,
+ *   the most recent first; past chunks beyond their number are zeroed
+ * where a chunk is size (u32), trans_time (u32), cwnd (u32),
+ * in_flight (u32), min_rtt (u32), rtt (u32), delivery_rate (u64). */
+class TTPShardWriter
+{
+public:
+  static constexpr uint32_t VERSION = 1;
+  static constexpr uint32_t PAST_CHUNKS = 8;  /* Model.PAST_CHUNKS */
+
+  static constexpr size_t HEADER_SIZE = 24;
+  static constexpr size_t CHUNK_SIZE = 32;
+  static constexpr size_t RECORD_SIZE = 32 + (1 + PAST_CHUNKS) * CHUNK_SIZE;
+
+  /* complete the leftover partial shards of this server first */
+  TTPShardWriter(const fs::path & shard_dir,
+                 const uint32_t server_id, const uint32_t expt_id,
+                 const uint64_t max_shard_bytes,
+                 const uint64_t max_shard_age_ms);
+
+  /* flush and complete the current shard */
+  ~TTPShardWriter();
+
+  /* the video chunk at video_ts sent at sent_ts was acked */
+  void add_chunk(const uint64_t connection_id, const uint32_t init_id,
+                 const uint64_t video_ts, const uint64_t vduration,
+                 const uint64_t sent_ts, const TTPChunk & chunk);
+
+  /* forget the history of a closed connection */
+  void remove_connection(const uint64_t connection_id);
+
+  /* write the buffered records, and rotate the shard if it is due */
+  void flush();
+
+  /* forbid copying TTPShardWriter */
+  TTPShardWriter(const TTPShardWriter & other) = delete;
+  const TTPShardWriter & operator=(const TTPShardWriter & other) = delete;
+
+private:
+  /* records are buffered up to this size before being written */
+  static constexpr size_t MAX_BUFFER_SIZE = 64 * 1024;
+
+  fs::path shard_dir_;
+  uint32_t server_id_;
+  uint32_t expt_id_;
+  uint64_t max_shard_bytes_;
+  uint64_t max_shard_age_ms_;
+
+  /* the shard being written */
+  fs::path shard_path_ {};
+  std::optional<FileDescriptor> shard_fd_ {};
+  uint64_t shard_start_ts_ {0};
+  uint64_t shard_bytes_ {0};
+
+  std::string buffer_ {};
+
+  /* consecutive acked chunks of each connection, the most recent first */
+  struct History
+  {
+    uint32_t init_id {0};
+    uint64_t next_vts {0};
+    std::deque<TTPChunk> chunks {};
+  };
+  std::map<uint64_t, History> histories_ {};  /* key: connection ID */
+
+  void write_buffer();
+  void open_shard();
+  void complete_shard();
+
+  /* truncate a partial shard to its last whole record and complete it */
+  static void recover_partial_shard(const fs::path & partial_path);
+};
+
+#endif /* TTP_SHARD_HH */
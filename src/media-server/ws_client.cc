@@ -36,6 +36,11 @@ void WebSocketClient::reset_helper()
 
   last_video_send_ts_.reset();
   tcp_info_.reset();
+  chunk_timeline_.reset();
+
+  video_acked_bytes_ = 0;
+  video_frames_unacked_ = 0;
+  abandoned_acks_ = 0;
 }
 
 void WebSocketClient::init_channel(const shared_ptr<Channel> & channel,
@@ -110,6 +115,8 @@ void WebSocketClient::video_chunk_acked(const VideoFormat & format,
                                         const unsigned int chunk_size,
                                         const uint64_t transmission_time)
 {
+  CPUTimer timer(cpu_, CPUAccount::ABR);
+
   try {
     const auto & ti = tcp_info_.value();
 
@@ -123,8 +130,56 @@ void WebSocketClient::video_chunk_acked(const VideoFormat & format,
   }
 }
 
+void WebSocketClient::video_chunk_abandoned(const uint64_t vts,
+                                            const double ssim,
+                                            const unsigned int acked_size,
+                                            const uint64_t transmission_time,
+                                            const unsigned int cancelled_frames)
+{
+  /* no throughput sample if nothing of the chunk has been acked */
+  if (acked_size > 0 and transmission_time > 0) {
+    CPUTimer timer(cpu_, CPUAccount::ABR);
+
+    try {
+      const auto & ti = tcp_info_.value();
+
+      abr_algo_->video_chunk_abandoned({
+        curr_vformat_.value(), ssim, acked_size, transmission_time,
+        ti.cwnd, ti.in_flight, ti.min_rtt, ti.rtt, ti.delivery_rate
+      });
+    } catch (const exception & e) {
+      print_exception("video_chunk_abandoned", e);
+      throw runtime_error("Error: video_chunk_abandoned failed with "
+                          + abr_name_);
+    }
+  }
+
+  next_vts_ = vts;
+
+  /* the client discards the partial chunk including its init segment */
+  curr_vformat_.reset();
+
+  last_video_send_ts_.reset();
+  tcp_info_.reset();
+  chunk_timeline_.reset();
+
+  video_acked_bytes_ = 0;
+  abandoned_acks_ = video_frames_unacked_ - min(cancelled_frames,
+                                                video_frames_unacked_);
+  video_frames_unacked_ = 0;
+}
+
+void WebSocketClient::video_frame_acked()
+{
+  if (video_frames_unacked_ > 0) {
+    video_frames_unacked_--;
+  }
+}
+
 VideoFormat WebSocketClient::select_video_format()
 {
+  CPUTimer timer(cpu_, CPUAccount::ABR);
+
   try {
     return abr_algo_->select_video_format();
   } catch (const exception & e) {
@@ -135,6 +190,8 @@ VideoFormat WebSocketClient::select_video_format()
 
 AudioFormat WebSocketClient::select_audio_format()
 {
+  CPUTimer timer(cpu_, CPUAccount::ABR);
+
   double buf = min(max(audio_playback_buf_, 0.0), MAX_BUFFER_S);
 
   const auto & channel = channel_.lock();
@@ -200,6 +257,17 @@ AudioFormat WebSocketClient::select_audio_format()
   return aformats[ret_idx];
 }
 
+size_t WebSocketClient::memory_bytes() const
+{
+  size_t ret = sizeof(*this) + abr_algo_->memory_bytes();
+
+  for (const auto & [format, hash] : cached_inits_) {
+    ret += sizeof(CachedInits::value_type) + format.capacity() + hash.capacity();
+  }
+
+  return ret;
+}
+
 void WebSocketClient::init_abr_algo()
 {
   if (abr_name_ == "linear_bba") {
@@ -9,9 +9,12 @@
 #include "address.hh"
 #include "channel.hh"
 #include "server_message.hh"
+#include "client_message.hh"
 #include "media_formats.hh"
 #include "yaml.hh"
 #include "socket.hh"
+#include "delivery_timeline.hh"
+#include "cpu_account.hh"
 
 class ABRAlgo;
 
@@ -41,6 +44,7 @@ public:
 
   /* accessors */
   uint64_t connection_id() const { return connection_id_; }
+  std::string abr_name() const { return abr_name_; }
 
   std::shared_ptr<Channel> channel() const { return channel_.lock(); }
 
@@ -85,6 +89,19 @@ public:
   std::optional<uint64_t> last_video_send_ts() const { return last_video_send_ts_; }
   std::optional<TCPInfo> tcp_info() const { return tcp_info_; }
 
+  /* stages of delivering the video chunk in flight, if being timed */
+  std::optional<ChunkTimeline> & chunk_timeline() { return chunk_timeline_; }
+
+  /* CPU time spent on the client since it was last reported */
+  CPUAccount & cpu() { return cpu_; }
+
+  bool init_cached(const std::string & format, const std::string & hash) const {
+    return cached_inits_.count({format, hash}) > 0;
+  }
+
+  unsigned int video_acked_bytes() const { return video_acked_bytes_; }
+  unsigned int abandoned_acks() const { return abandoned_acks_; }
+
   /* mutators */
   void set_init_id(const unsigned int init_id);
 
@@ -118,14 +135,42 @@ public:
   void set_last_video_send_ts(const std::optional<uint64_t> send_ts) { last_video_send_ts_ = send_ts; }
   void set_tcp_info(const std::optional<TCPInfo> tcp_info) { tcp_info_ = tcp_info; }
 
+  void set_cached_inits(const CachedInits & cached_inits) { cached_inits_ = cached_inits; }
+  void add_cached_init(const std::string & format, const std::string & hash) {
+    cached_inits_.emplace(format, hash);
+  }
+  void remove_cached_init(const std::string & format, const std::string & hash) {
+    cached_inits_.erase({format, hash});
+  }
+
+  void set_video_acked_bytes(const unsigned int bytes) { video_acked_bytes_ = bytes; }
+  void set_abandoned_acks(const unsigned int acks) { abandoned_acks_ = acks; }
+
+  /* a frame of the video chunk in flight was queued, or acked */
+  void video_frame_queued() { video_frames_unacked_++; }
+  void video_frame_acked();
+
   /* ABR related */
   void video_chunk_acked(const VideoFormat & format,
                          const double ssim,
                          const unsigned int chunk_size,
                          const uint64_t transmission_time);
+
+  /* the video chunk in flight at timestamp vts was abandoned with
+   * cancelled_frames of its frames never sent; serve vts again and ignore
+   * the acks of the frames that were sent but not acked yet */
+  void video_chunk_abandoned(const uint64_t vts,
+                             const double ssim,
+                             const unsigned int acked_size,
+                             const uint64_t transmission_time,
+                             const unsigned int cancelled_frames);
+
   VideoFormat select_video_format();
   AudioFormat select_audio_format();
 
+  /* memory held by the client and its ABR algorithm */
+  size_t memory_bytes() const;
+
   static constexpr double MAX_BUFFER_S = 15.0;  /* seconds */
 
 private:
@@ -136,6 +181,8 @@ private:
   YAML::Node abr_config_;
   std::unique_ptr<ABRAlgo> abr_algo_ {nullptr};
 
+  CPUAccount cpu_ {};
+
   /* WebSocketClient has no interest in managing the ownership of channel */
   std::weak_ptr<Channel> channel_;
 
@@ -183,6 +230,19 @@ private:
   std::optional<uint64_t> last_video_send_ts_ {};
   /* TCP info before sending a video chunk */
   std::optional<TCPInfo> tcp_info_ {};
+  /* stages of delivering the video chunk in flight */
+  std::optional<ChunkTimeline> chunk_timeline_ {};
+
+  /* init segments the client has, advertised or sent since client-init */
+  CachedInits cached_inits_ {};
+
+  /* bytes of the video chunk in flight acked by the client so far */
+  unsigned int video_acked_bytes_ {0};
+  /* frames of the video chunk in flight sent but not acked yet */
+  unsigned int video_frames_unacked_ {0};
+  /* acks of an abandoned video chunk still to be ignored; they can only
+   * precede the acks of its replacement, at the same timestamp */
+  unsigned int abandoned_acks_ {0};
 
   /* (re)instantiate abr_algo_ */
   void init_abr_algo();
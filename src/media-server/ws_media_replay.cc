@@ -0,0 +1,197 @@
+#include <cstdint>
+#include <cstdlib>
+#include <getopt.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <optional>
+#include <chrono>
+
+#include "exception.hh"
+#include "strict_conversions.hh"
+#include "timestamp.hh"
+#include "poller.hh"
+#include "inotify.hh"
+#include "ws_client.hh"
+#include "client_handler.hh"
+#include "session_record.hh"
+#include "replay_server.hh"
+#include "logger.hh"
+
+using namespace std;
+
+/* the client handlers of ws_media_server, serving recorded sessions through
+ * a ReplayServer on the recorded clock */
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name
+  << " [options] <YAML configuration> <session>...\n\n"
+  "Replay sessions recorded by ws_media_server (in session_recording_dir)\n"
+  "against the channels of the configuration, at the recorded times and with\n"
+  "the recorded TCP info, and print the server messages sent to them\n\n"
+  "Options:\n"
+  "--abr, -a <name>    ABR algorithm (default config) instead of the recorded\n"
+  "--repeat, -r <n>    replay n times, checking that the server messages are\n"
+  "                    the same each time, and report the time per client\n"
+  "                    message (default: 1)"
+  << endl;
+}
+
+/* replay a session as connection_id; return the number of client messages
+ * handled before the session or the connection was closed */
+size_t replay_session(ReplayServer & server, const Session & session,
+                      const uint64_t connection_id,
+                      const optional<string> & abr_name)
+{
+  deque<TCPInfo> tcp_infos;
+  for (const auto & event : session.events) {
+    if (event.type == SessionEvent::Type::TCPInfo) {
+      tcp_infos.emplace_back(event.tcp_info);
+    }
+  }
+  server.open(connection_id, move(tcp_infos));
+
+  /* every recorded user had a valid session key */
+  const auto authenticate = [](const string &) { return true; };
+
+  size_t num_messages = 0;
+  for (const auto & event : session.events) {
+    set_fixed_timestamp_ns(event.ts * MILLION);
+
+    if (event.type == SessionEvent::Type::Open) {
+      if (abr_name) {
+        clients.emplace_at(connection_id, connection_id, *abr_name,
+                           YAML::Node());
+      } else {
+        clients.emplace_at(connection_id, connection_id, session.abr_name,
+                           session.abr_config);
+      }
+    } else if (event.type == SessionEvent::Type::Message) {
+      num_messages++;
+
+      try {
+        handle_client_message(server, clients.at(connection_id),
+                              event.payload, authenticate);
+      } catch (const exception & e) {
+        LOG_WARNING << client_signature(connection_id)
+                    << ": warning in message callback: " << e.what();
+        server.close_connection(connection_id);
+      }
+
+      if (server.closed(connection_id)) {
+        break;
+      }
+    } else if (event.type == SessionEvent::Type::Close) {
+      break;
+    }
+  }
+
+  clients.erase(connection_id);
+  server.erase(connection_id);
+
+  return num_messages;
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  optional<string> abr_name;
+  unsigned int repeat = 1;
+
+  const option cmd_line_opts[] = {
+    {"abr",    required_argument, nullptr, 'a'},
+    {"repeat", required_argument, nullptr, 'r'},
+    { nullptr, 0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "a:r:", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+    case 'a':
+      abr_name = optarg;
+      break;
+    case 'r':
+      repeat = max(stoul(optarg), 1ul);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind > argc - 2) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    config = YAML::LoadFile(argv[optind]);
+
+    /* only warnings by default, as the replay is also a benchmark */
+    set_log_level(config["log_level"] ?
+                  parse_log_level(config["log_level"].as<string>()) :
+                  LogLevel::Warning);
+
+    vector<Session> sessions;
+    for (int i = optind + 1; i < argc; i++) {
+      sessions.emplace_back(read_session(argv[i]));
+    }
+
+    /* the channels are never updated during a replay */
+    Poller poller;
+    Inotify inotify(poller);
+    create_channels(inotify);
+
+    ReplayServer server;
+    string transcript;
+    size_t num_messages = 0;
+
+    /* as in ws_media_server, clients are created after the first log line
+     * has started the thread of the logger */
+    LOG_INFO << "Replaying " << sessions.size() << " sessions";
+
+    const auto start = chrono::steady_clock::now();
+
+    for (unsigned int pass = 0; pass < repeat; pass++) {
+      for (size_t i = 0; i < sessions.size(); i++) {
+        num_messages += replay_session(server, sessions[i], i, abr_name);
+      }
+
+      string pass_transcript = server.take_transcript();
+      if (pass == 0) {
+        transcript = move(pass_transcript);
+      } else if (pass_transcript != transcript) {
+        throw runtime_error("replay " + to_string(pass + 1)
+                            + " differs from the first");
+      }
+    }
+
+    const double elapsed_ms = chrono::duration<double, milli>(
+      chrono::steady_clock::now() - start).count();
+
+    cout << transcript << flush;
+
+    cerr << "Replayed " << sessions.size() << " sessions ("
+         << num_messages / repeat << " client messages) " << repeat
+         << " times in " << double_to_string(elapsed_ms, 3) << " ms ("
+         << double_to_string(num_messages ? elapsed_ms * 1000 / num_messages
+                                          : 0, 3)
+         << " us per client message)" << endl;
+  } catch (const exception & e) {
+    print_exception(argv[0], e);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -4,13 +4,16 @@
 #include <cmath>
 #include <fcntl.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <map>
 #include <memory>
 #include <random>
 #include <algorithm>
+#include <functional>
 #include <pqxx/pqxx>
 
 #include "util.hh"
@@ -23,9 +26,23 @@
 #include "client_message.hh"
 #include "ws_server.hh"
 #include "ws_client.hh"
+#include "client_handler.hh"
+#include "ipc_socket.hh"
+#include "slot_map.hh"
 #include "media_formats.hh"
 #include "yaml.hh"
 #include "abr_algo.hh"
+#include "stream_aggregate.hh"
+#include "ttp_shard.hh"
+#include "delivery_timeline.hh"
+#include "cpu_account.hh"
+#include "flight_recorder.hh"
+#include "session_record.hh"
+#include "signalfd.hh"
+#include "metrics.hh"
+#include "metrics_server.hh"
+#include "poller_watchdog.hh"
+#include "logger.hh"
 
 using namespace std;
 using namespace PollerShortNames;
@@ -36,24 +53,45 @@ using WebSocketServer = WebSocketTCPServer;
 using WebSocketServer = WebSocketSecureServer;
 #endif
 
-/* global variables */
-YAML::Node config;
-static map<string, shared_ptr<Channel>> channels;  /* key: channel name */
-static map<uint64_t, WebSocketClient> clients;  /* key: connection ID */
-
-static const size_t MAX_WS_FRAME_B = 100 * 1024;  /* 10 KB */
+/* global variables; those shared with the client handlers (and
+ * ws_media_replay) are in client_handler.cc */
 static const unsigned int MAX_IDLE_MS = 60000; /* clean idle connections */
 
 static const unsigned int MAX_CONNECTION_NUM = 10; /* max connections */
 
-/* for logging */
-static bool enable_logging = false;
-static fs::path log_dir;  /* base directory for logging */
-static string server_id;
-static string expt_id;
-static map<string, FileDescriptor> log_fds;  /* map log name to fd */
-static const unsigned int MAX_LOG_FILESIZE = 100 * 1024 * 1024;  /* 100 MB */
-static uint64_t last_minute = 0;  /* in ms; multiple of 60000 */
+/* clients demoted and evicted to stay within the send buffer budget, counted
+ * since last logged */
+static uint64_t send_budget_demotions = 0;
+static uint64_t send_budget_evictions = 0;
+
+/* admission control: besides the hard cap of "max_connections" clients, a
+ * new client is told that the server is busy (to retry elsewhere) if one more
+ * client of average load is projected to exceed "max_egress_mbps" or
+ * "max_cpu_utilization" (of the thread serving all clients), or while the
+ * send buffer budget is used up */
+static size_t max_connections = MAX_CONNECTION_NUM;
+static optional<double> max_egress_mbps;
+static optional<double> max_cpu_utilization;
+/* the load measured every second by the slow timer */
+static double egress_mbps = 0;
+static double cpu_utilization = 0;  /* fraction of a CPU */
+static uint64_t load_sample_ns = 0;
+static uint64_t load_sample_bytes_written = 0;
+static uint64_t load_sample_cpu_ns = 0;
+static size_t load_sample_clients = 0;  /* clients generating the load */
+/* counted since last logged */
+static uint64_t admission_refusals = 0;
+
+static uint64_t last_minute = 0;  /* ms; multiple of 60000; for logging */
+
+static const size_t DEFAULT_FLIGHT_RECORDER_EVENTS = 65536;  /* 4 MB */
+
+/* for hot restart */
+static fs::path hot_restart_path;  /* Unix socket to hand off the listener */
+/* for each step of a handoff, after which the old server keeps serving */
+static const unsigned int HOT_RESTART_TIMEOUT_MS = 1000;
+static uint64_t drain_start_ts = 0;  /* in ms */
+static const unsigned int MAX_DRAIN_MS = 30000; /* force close afterwards */
 
 void print_usage(const string & program_name)
 {
@@ -62,284 +100,406 @@ void print_usage(const string & program_name)
   << endl;
 }
 
-/* return "connection_id,username" or "connection_id," (unknown username) */
-string client_signature(const uint64_t connection_id)
+void log_active_streams(const uint64_t this_minute)
 {
-  const auto client_it = clients.find(connection_id);
-  if (client_it != clients.end()) {
-    return client_it->second.signature();
-  } else {
-    return to_string(connection_id) + ",";
+  assert(enable_logging);
+
+  /* channel name -> count */
+  map<string, unsigned int> active_streams_count;
+
+  for (const auto & [connection_id, client] : clients) {
+    const auto channel = client.channel();
+
+    if (channel) {
+      string channel_name = channel->name();
+
+      auto map_it = active_streams_count.find(channel_name);
+      if (map_it == active_streams_count.end()) {
+        active_streams_count.emplace(channel_name, 1);
+      } else {
+        map_it->second += 1;
+      }
+    }
+  }
+
+  for (const auto & [channel_name, count] : active_streams_count) {
+    string log_line = to_string(this_minute) + "," + channel_name + ","
+      + server_id + "," + expt_id + "," + to_string(count);
+    append_to_log("active_streams", log_line);
   }
 }
 
-void append_to_log(const string & log_stem, const string & log_line)
+size_t resident_bytes()
 {
-  if (not enable_logging) {
-    throw runtime_error("append_to_log: enable_logging must be true");
-  }
+  ifstream statm("/proc/self/statm");
+  size_t size_pages = 0, resident_pages = 0;
+  statm >> size_pages >> resident_pages;
 
-  string log_name = log_stem + "." + server_id + ".log";
-  string log_path = log_dir / log_name;
+  return resident_pages * sysconf(_SC_PAGESIZE);
+}
 
-  /* find or create a file descriptor for the log */
-  auto log_it = log_fds.find(log_name);
-  if (log_it == log_fds.end()) {
-    log_it = log_fds.emplace(log_name, FileDescriptor(CheckSystemCall(
-        "open (" + log_path + ")",
-        open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)))).first;
+/* media segments mapped by all channels; the pages are shared with other
+ * servers and only resident once read */
+size_t channels_memory_bytes()
+{
+  size_t total_bytes = 0;
+  for (const auto & [channel_name, channel] : channels) {
+    total_bytes += channel->mapped_bytes();
   }
+  return total_bytes;
+}
 
-  /* append a line to log */
-  FileDescriptor & fd = log_it->second;
-  fd.write(log_line + "\n");
+size_t clients_memory_bytes()
+{
+  size_t total_bytes = 0;
+  for (const auto & [connection_id, client] : clients) {
+    total_bytes += client.memory_bytes();
+  }
+  return total_bytes;
+}
 
-  /* rotate log if filesize is too large */
-  if (fd.curr_offset() > MAX_LOG_FILESIZE) {
-    fs::rename(log_path, log_path + ".old");
-    cerr << "Renamed " << log_path << " to " << log_path + ".old" << endl;
+/* memory held on behalf of each client: the client and its ABR algorithm,
+ * its connection with its buffers, and a share of OpenSSL's heap */
+double memory_per_client(const WebSocketServer::MemoryUsage & usage)
+{
+  if (clients.empty()) {
+    return 0;
+  }
 
-    /* create new fd before closing old one */
-    FileDescriptor new_fd(CheckSystemCall(
-        "open (" + log_path + ")",
-        open(log_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)));
-    fd.close();  /* reader is notified and safe to open new fd immediately */
+  const size_t total_bytes = clients_memory_bytes() + usage.connections
+    + usage.send_queues + usage.receive_buffers + usage.tls_buffers
+    + openssl_heap_bytes();
 
-    log_it->second = move(new_fd);
-  }
+  return static_cast<double>(total_bytes) / clients.size();
 }
 
-void serve_video_to_client(WebSocketServer & server,
-                           WebSocketClient & client)
+void log_server_info(const uint64_t this_minute, WebSocketServer & server)
 {
-  const auto channel = client.channel();
-  uint64_t next_vts = client.next_vts().value();
+  /* the tag "server_id" is used to avoid data point overwriting;
+   * the field "server_id" is used to count distinct values, i.e., the number
+   * of running servers, as a workaround until InfluxDB supports DISTINCT
+   * function to operate on tags */
+  string log_line = to_string(this_minute) + "," + server_id + "," + server_id
+    + "," + to_string(server.queued_bytes())
+    + "," + to_string(server.peak_queued_bytes())
+    + "," + to_string(send_buffer_budget.value_or(0))
+    + "," + to_string(send_budget_refusals)
+    + "," + to_string(send_budget_demotions)
+    + "," + to_string(send_budget_evictions)
+    + "," + to_string(init_bytes_sent)
+    + "," + to_string(init_bytes_saved);
+
+  /* memory by subsystem */
+  const auto usage = server.memory_usage();
+  log_line += "," + to_string(resident_bytes())
+    + "," + to_string(channels_memory_bytes())
+    + "," + to_string(clients_memory_bytes())
+    + "," + to_string(usage.connections)
+    + "," + to_string(usage.send_queues)
+    + "," + to_string(usage.receive_buffers)
+    + "," + to_string(usage.tls_buffers)
+    + "," + to_string(openssl_heap_bytes())
+    + "," + to_string(clients.size())
+    + "," + to_string(static_cast<uint64_t>(memory_per_client(usage)));
+
+  /* load against capacity */
+  log_line += "," + double_to_string(egress_mbps, 3)
+    + "," + double_to_string(cpu_utilization, 3)
+    + "," + to_string(admission_refusals);
 
-  /* save TCP info before client.select_video_format() */
-  TCPInfo tcpi = server.get_tcp_info(client.connection_id());
-  client.set_tcp_info(tcpi);
+  append_to_log("server_info", log_line);
 
-  /* select a video format using ABR algorithm */
-  const VideoFormat & next_vformat = client.select_video_format();
-  double ssim = channel->vssim(next_vts).at(next_vformat);
+  server.reset_peak_queued_bytes();
+  send_budget_refusals = 0;
+  send_budget_demotions = 0;
+  send_budget_evictions = 0;
+  init_bytes_sent = 0;
+  init_bytes_saved = 0;
+  admission_refusals = 0;
+}
 
-  /* check if a new init segment is needed */
-  optional<mmap_t> init_mmap;
-  if (not client.curr_vformat() or
-      next_vformat != *client.curr_vformat()) {
-    init_mmap = channel->vinit(next_vformat);
+/* when over the send buffer budget, demote the clients furthest over their
+ * fair share of it by abandoning their video chunks in flight, so that the
+ * ABR picks again (at a lower rate); evict those with nothing to abandon */
+void enforce_send_budget(WebSocketServer & server)
+{
+  if (not send_buffer_budget or server.queued_bytes() <= *send_buffer_budget
+      or clients.empty()) {
+    return;
   }
 
-  /* construct the next segment to send */
-  const auto data_mmap = channel->vdata(next_vformat, next_vts);
-  VideoSegment next_vsegment {next_vformat, data_mmap, init_mmap};
+  const size_t fair_share = *send_buffer_budget / clients.size();
 
-  /* divide the next segment into WebSocket frames and send */
-  while (not next_vsegment.done()) {
-    ServerVideoMsg video_msg(client.init_id().value(),
-                             channel->name(),
-                             next_vformat.to_string(),
-                             next_vts,
-                             next_vsegment.offset(),
-                             next_vsegment.length(),
-                             ssim);
-    string frame_payload = video_msg.to_string();
-    next_vsegment.read(frame_payload, MAX_WS_FRAME_B - frame_payload.size());
-
-    WSFrame frame {true, WSFrame::OpCode::Binary, move(frame_payload)};
-    server.queue_frame(client.connection_id(), frame);
+  /* (bytes over fair share, connection ID) */
+  vector<pair<size_t, uint64_t>> over_budget;
+  for (const auto & [connection_id, client] : clients) {
+    const size_t buffer_bytes = server.buffer_bytes(connection_id);
+    if (buffer_bytes > fair_share) {
+      over_budget.emplace_back(buffer_bytes - fair_share, connection_id);
+    }
   }
 
-  /* finish sending */
-  client.set_next_vts(next_vts + channel->vduration());
-  client.set_curr_vformat(next_vformat);
-  client.set_last_video_send_ts(timestamp_ms());
+  sort(over_budget.begin(), over_budget.end(), greater<>());
 
-  cerr << client.signature() << ": channel " << channel->name()
-       << ", video " << next_vts << " " << next_vformat << " " << ssim << endl;
+  /* demote first */
+  vector<uint64_t> to_evict;
+  for (const auto & [excess, connection_id] : over_budget) {
+    if (server.queued_bytes() <= *send_buffer_budget) {
+      break;
+    }
 
-  if (enable_logging) {
-    string log_line = to_string(timestamp_ms()) + "," + channel->name() + ","
-      + server_id + "," + expt_id + "," + client.username() + ","
-      + to_string(client.first_init_id().value()) + ","
-      + to_string(client.init_id().value()) + ","
-      + to_string(next_vts) + ","
-      + next_vformat.to_string() + ","
-      + to_string(get<1>(data_mmap)) + "," + to_string(ssim)
-      + "," + to_string(tcpi.cwnd) + "," + to_string(tcpi.in_flight) + ","
-      + to_string(tcpi.min_rtt) + "," + to_string(tcpi.rtt) + ","
-      + to_string(tcpi.delivery_rate) + ","
-      + double_to_string(client.video_playback_buf(), 3) + ","
-      + double_to_string(client.cum_rebuffer(), 3);
-    append_to_log("video_sent", log_line);
+    if (abandon_video_chunk(server, clients.at(connection_id)) > 0) {
+      send_budget_demotions++;
+    } else {
+      to_evict.emplace_back(connection_id);
+    }
   }
-}
 
-void serve_audio_to_client(WebSocketServer & server,
-                           WebSocketClient & client)
-{
-  const auto channel = client.channel();
-  uint64_t next_ats = client.next_ats().value();
+  /* the bytes of evicted connections are freed once they are closed */
+  size_t queued_bytes = server.queued_bytes();
+  for (const uint64_t connection_id : to_evict) {
+    if (queued_bytes <= *send_buffer_budget) {
+      break;
+    }
 
-  /* select an audio format using ABR algorithm */
-  const AudioFormat & next_aformat = client.select_audio_format();
+    queued_bytes -= min(queued_bytes,
+                        size_t {server.buffer_bytes(connection_id)});
 
-  /* check if a new init segment is needed */
-  optional<mmap_t> init_mmap;
-  if (not client.curr_aformat() or
-      next_aformat != *client.curr_aformat()) {
-    init_mmap = channel->ainit(next_aformat);
+    LOG_INFO << clients.at(connection_id).signature()
+             << ": evicted over the send buffer budget";
+    account_client_cpu(server, clients.at(connection_id));
+    clients.erase(connection_id);
+    server.clean_idle_connection(connection_id);
+    send_budget_evictions++;
   }
+}
 
-  /* construct the next segment to send */
-  const auto data_mmap = channel->adata(next_aformat, next_ats);
-  AudioSegment next_asegment {next_aformat, data_mmap, init_mmap};
-
-  /* divide the next segment into WebSocket frames and send */
-  while (not next_asegment.done()) {
-    ServerAudioMsg audio_msg(client.init_id().value(),
-                             channel->name(),
-                             next_aformat.to_string(),
-                             next_ats,
-                             next_asegment.offset(),
-                             next_asegment.length());
-    string frame_payload = audio_msg.to_string();
-    next_asegment.read(frame_payload, MAX_WS_FRAME_B - frame_payload.size());
+void log_queue_delay(const uint64_t this_minute, WebSocketServer & server)
+{
+  /* the high-priority queue carries audio (and the few control messages) */
+  const vector<pair<string, WebSocketServer::Priority>> classes {
+    {"audio", WebSocketServer::Priority::High},
+    {"video", WebSocketServer::Priority::Low}};
+
+  for (const auto & [class_name, priority] : classes) {
+    const auto & stats =
+      server.queue_delays().at(static_cast<size_t>(priority));
+    if (stats.frames == 0) {
+      continue;
+    }
 
-    WSFrame frame {true, WSFrame::OpCode::Binary, move(frame_payload)};
-    server.queue_frame(client.connection_id(), frame);
+    const double mean_ms = stats.total_us / 1000.0 / stats.frames;
+    string log_line = to_string(this_minute) + "," + server_id + ","
+      + class_name + "," + to_string(stats.frames) + ","
+      + double_to_string(mean_ms, 3) + ","
+      + double_to_string(stats.max_us / 1000.0, 3);
+    append_to_log("queue_delay", log_line);
   }
 
-  /* finish sending */
-  client.set_next_ats(next_ats + channel->aduration());
-  client.set_curr_aformat(next_aformat);
-
-  cerr << client.signature() << ": channel " << channel->name()
-       << ", audio " << next_ats << " " << next_aformat << endl;
+  server.reset_queue_delays();
 }
 
-void send_server_init(WebSocketServer & server, WebSocketClient & client,
-                      const bool can_resume)
+void log_poller_dispatch(const uint64_t this_minute, Poller & poller)
 {
-  const auto channel = client.channel();
+  /* share of the wall-clock time spent in the callbacks of each action */
+  const uint64_t elapsed_us = timestamp_us() - poller.dispatch_stats_start_us();
 
-  ServerInitMsg init(client.init_id().value(), channel->name(),
-                     channel->vcodec(), channel->acodec(),
-                     channel->timescale(),
-                     channel->vduration(), channel->aduration(),
-                     client.next_vts().value(), client.next_ats().value(),
-                     can_resume);
-  WSFrame frame {true, WSFrame::OpCode::Binary, init.to_string()};
+  for (const auto & stats : poller.dispatch_stats()) {
+    if (stats.calls == 0) {
+      continue;
+    }
 
-  /* drop previously queued frames before sending server-init */
-  server.clear_buffer(client.connection_id());
+    string log_line = to_string(this_minute) + "," + server_id + ","
+      + stats.name + "," + to_string(stats.calls) + ","
+      + double_to_string(stats.total_us / 1000.0, 3) + ","
+      + double_to_string(stats.max_us / 1000.0, 3) + ","
+      + double_to_string(static_cast<double>(stats.total_us) / elapsed_us, 5);
+    append_to_log("poller_dispatch", log_line);
+  }
 
-  server.queue_frame(client.connection_id(), frame);
+  poller.reset_dispatch_stats();
 }
 
-void send_server_error(WebSocketServer & server, WebSocketClient & client,
-                       const ServerErrorMsg::Type error_type)
+void log_delivery_phases(const uint64_t this_minute)
 {
-  ServerErrorMsg err_msg(client.init_id() ? *client.init_id() : 0, error_type);
-  WSFrame frame {true, WSFrame::OpCode::Binary, err_msg.to_string()};
+  for (const auto & [channel_name, aggregate] : delivery_phases) {
+    for (size_t i = 0; i < ChunkTimeline::NUM_PHASES; i++) {
+      string log_line = to_string(this_minute) + "," + channel_name + ","
+        + server_id + "," + expt_id + ","
+        + ChunkTimeline::PHASE_NAMES[i] + ","
+        + to_string(aggregate.chunks) + ","
+        + double_to_string(aggregate.total_us[i] / 1000.0 / aggregate.chunks,
+                           3);
+
+      for (const double q : {0.5, 0.9, 0.99}) {
+        log_line += "," + double_to_string(
+                            aggregate.us[i].quantile(q) / 1000.0, 3);
+      }
 
-  server.queue_frame(client.connection_id(), frame);
+      append_to_log("delivery_phase", log_line);
+    }
+  }
 
-  /* reset the client and wait for client-init */
-  client.reset_channel();
+  delivery_phases.clear();
 }
 
-void serve_client(WebSocketServer & server, WebSocketClient & client)
+void log_cpu_usage(const uint64_t this_minute, WebSocketServer & server)
 {
-  if (not client.is_channel_initialized()) {
-    return;
+  /* clients still connected are accounted up to now */
+  for (const auto & [connection_id, client] : clients) {
+    account_client_cpu(server, client);
   }
 
-  const auto channel = client.channel();
+  for (const auto & [abr_name, aggregate] : cpu_usage) {
+    for (size_t i = 0; i <= CPUAccount::NUM_CATEGORIES; i++) {
+      const bool total = i == CPUAccount::NUM_CATEGORIES;
+      const uint64_t cpu_ns = total ? aggregate.total.total_ns()
+                                    : aggregate.total.ns[i];
+
+      string log_line = to_string(this_minute) + "," + server_id + ","
+        + expt_id + "," + abr_name + ","
+        + (total ? "total" : CPUAccount::CATEGORY_NAMES[i]) + ","
+        + to_string(aggregate.clients) + ","
+        + double_to_string(cpu_ns / 1e6, 3);
+
+      /* CPU time per client */
+      for (const double q : {0.5, 0.9, 0.99}) {
+        log_line += "," + double_to_string(
+                            aggregate.client_us[i].quantile(q) / 1000.0, 3);
+      }
 
-  /* notify the client that the requested channel is not available */
-  if (not channel->ready_to_serve()) {
-    send_server_error(server, client, ServerErrorMsg::Type::Unavailable);
-    cerr << client.signature() << ": requested channel "
-         << channel->name() << " is not available" << endl;
-    return;
+      append_to_log("cpu_usage", log_line);
+    }
   }
 
-  uint64_t next_vts = client.next_vts().value();
-  uint64_t next_ats = client.next_ats().value();
+  cpu_usage.clear();
+}
 
-  if (channel->live()) {
-    /* reinit client if clean frontiers of live streaming have caught up */
-    if ((channel->vclean_frontier() and
-         next_vts <= *channel->vclean_frontier()) or
-        (channel->aclean_frontier() and
-         next_ats <= *channel->aclean_frontier())) {
-      send_server_error(server, client, ServerErrorMsg::Type::Reinit);
-      cerr << client.signature() << ": reinitialize laggy client" << endl;
-      return;
+void log_stream_aggregates(const uint64_t this_minute)
+{
+  for (const auto & [channel_name, aggregate] : stream_aggregates) {
+    string log_line = to_string(this_minute) + "," + channel_name + ","
+      + server_id + "," + expt_id + ","
+      + to_string(aggregate.video_sent) + ","
+      + to_string(aggregate.video_sent_bytes) + ","
+      + double_to_string(aggregate.ssim_sent_sum, 3) + ","
+      + to_string(aggregate.video_acked) + ","
+      + double_to_string(aggregate.ssim_acked_sum, 3) + ","
+      + to_string(aggregate.startups) + ","
+      + double_to_string(aggregate.startup_delay_sum, 3) + ","
+      + to_string(aggregate.rebuffers) + ","
+      + double_to_string(aggregate.stall_time, 3);
+
+    for (const double q : {0.1, 0.5, 0.9}) {
+      log_line += "," + to_string(static_cast<uint64_t>(
+                            aggregate.delivery_rate.quantile(q)));
     }
-  } else {
-    /* reinit client if a non-live channel is set to repeat playing */
-    if (channel->repeat()) {
-      if (next_vts > channel->vready_frontier() or
-          next_ats > channel->aready_frontier()) {
-        send_server_error(server, client, ServerErrorMsg::Type::Reinit);
-        cerr << client.signature() << ": reinitialize client intentionally "
-             << "as 'repeat' is set to true" << endl;
-        return;
-      }
+
+    for (const double q : {0.5, 0.9}) {
+      log_line += "," + to_string(static_cast<uint64_t>(
+                            aggregate.rtt.quantile(q)));
     }
+
+    for (const uint64_t count : aggregate.buffer_hist) {
+      log_line += "," + to_string(count);
+    }
+
+    append_to_log("stream_minute", log_line);
   }
 
-  if (client.audio_playback_buf() <= WebSocketClient::MAX_BUFFER_S and
-      client.audio_in_flight().value() == 0 and channel->aready_to_serve(next_ats)
-      and next_ats <= next_vts) {
-    serve_audio_to_client(server, client);
+  stream_aggregates.clear();
+}
+
+/* close connections that have flushed their queued chunks so that clients
+ * reconnect (and resume) on the new server; return true once fully drained */
+bool drain_connections(WebSocketServer & server)
+{
+  const bool drain_timeout = timestamp_ms() - drain_start_ts > MAX_DRAIN_MS;
+  set<uint64_t> connections_to_close;
+
+  for (const auto & [connection_id, client] : clients) {
+    if (drain_timeout or server.buffer_bytes(connection_id) == 0) {
+      connections_to_close.emplace(connection_id);
+    }
   }
 
-  if (client.video_playback_buf() <= WebSocketClient::MAX_BUFFER_S and
-      client.video_in_flight().value() == 0 and channel->vready_to_serve(next_vts)) {
-    serve_video_to_client(server, client);
+  for (const uint64_t connection_id : connections_to_close) {
+    clients.erase(connection_id);
+
+    if (drain_timeout) {
+      server.clean_idle_connection(connection_id);
+    } else {
+      server.close_connection(connection_id);
+    }
   }
+
+  if (drain_timeout and server.num_connections() > 0) {
+    LOG_INFO << "Drain timed out with " << server.num_connections()
+             << " connections left";
+    return true;
+  }
+
+  return server.num_connections() == 0;
 }
 
-void log_active_streams(const uint64_t this_minute)
+/* measure the egress and the CPU utilization since the last sample */
+void sample_load(const WebSocketServer & server)
 {
-  assert(enable_logging);
-
-  /* channel name -> count */
-  map<string, unsigned int> active_streams_count;
+  const uint64_t now_ns = timestamp_ns();
+  const uint64_t bytes_written = server.bytes_written();
+  const uint64_t cpu_ns = thread_cpu_ns();
+
+  if (load_sample_ns > 0 and now_ns > load_sample_ns) {
+    const double elapsed_ns = now_ns - load_sample_ns;
+    /* bits per nanosecond are Gbps */
+    egress_mbps = (bytes_written - load_sample_bytes_written) * 8 * 1000
+                  / elapsed_ns;
+    cpu_utilization = (cpu_ns - load_sample_cpu_ns) / elapsed_ns;
+  }
 
-  for (const auto & client_pair : clients) {
-    const auto channel = client_pair.second.channel();
+  load_sample_ns = now_ns;
+  load_sample_bytes_written = bytes_written;
+  load_sample_cpu_ns = cpu_ns;
+  load_sample_clients = clients.size();
+}
 
-    if (channel) {
-      string channel_name = channel->name();
+/* the reason to turn away a new client, if the server is near capacity */
+optional<string> over_capacity(const WebSocketServer & server)
+{
+  /* project the load of the clients now plus one from the average load of
+   * the clients when it was sampled, so that the clients admitted since
+   * (e.g., in a burst of reconnections) count too */
+  const double scale = load_sample_clients == 0 ?
+    1 : static_cast<double>(clients.size() + 1) / load_sample_clients;
+
+  if (max_egress_mbps and egress_mbps * scale > *max_egress_mbps) {
+    return "egress of " + double_to_string(egress_mbps * scale, 1)
+           + " Mbps projected";
+  }
 
-      auto map_it = active_streams_count.find(channel_name);
-      if (map_it == active_streams_count.end()) {
-        active_streams_count.emplace(channel_name, 1);
-      } else {
-        map_it->second += 1;
-      }
-    }
+  if (max_cpu_utilization and cpu_utilization * scale > *max_cpu_utilization) {
+    return "CPU utilization of " + double_to_string(cpu_utilization * scale, 3)
+           + " projected";
   }
 
-  for (const auto & [channel_name, count] : active_streams_count) {
-    string log_line = to_string(this_minute) + "," + channel_name + ","
-      + server_id + "," + expt_id + "," + to_string(count);
-    append_to_log("active_streams", log_line);
+  if (send_buffer_budget and server.queued_bytes() >= *send_buffer_budget) {
+    return "send buffer budget used up";
   }
+
+  return nullopt;
 }
 
-void log_server_info(const uint64_t this_minute)
+/* turn a new connection away with an error before creating its client,
+ * whose ABR algorithm might be costly to set up */
+void refuse_connection(WebSocketServer & server, const uint64_t connection_id,
+                       const ServerErrorMsg::Type error_type)
 {
-  /* the tag "server_id" is used to avoid data point overwriting;
-   * the field "server_id" is used to count distinct values, i.e., the number
-   * of running servers, as a workaround until InfluxDB supports DISTINCT
-   * function to operate on tags */
-  string log_line = to_string(this_minute) + "," + server_id + "," + server_id;
-  append_to_log("server_info", log_line);
+  ServerErrorMsg err_msg(0, error_type);
+  WSFrame frame {true, WSFrame::OpCode::Binary, err_msg.to_string()};
+
+  server.queue_frame(connection_id, frame);
+  server.close_connection(connection_id);
+  admission_refusals++;
 }
 
 void start_slow_timer(Timerfd & slow_timer, WebSocketServer & server)
@@ -356,6 +516,12 @@ void start_slow_timer(Timerfd & slow_timer, WebSocketServer & server)
         return ResultType::Continue;
       }
 
+      /* exit once the new server has taken over all the clients */
+      if (draining and drain_connections(server)) {
+        LOG_INFO << "Finished draining; exiting";
+        return ResultType::Exit;
+      }
+
       /* mark channel as not available if live edge not advanced for a while */
       if (enforce_moving_live_edge) {
         for (const auto & channel_it : channels) {
@@ -365,21 +531,34 @@ void start_slow_timer(Timerfd & slow_timer, WebSocketServer & server)
 
       set<uint64_t> connections_to_clean;
 
-      for (auto & [connection_id, client] : clients) {
+      for (const auto & [connection_id, client] : clients) {
         /* have not received messages from client for a while */
         const auto elapsed = timestamp_ms() - client.last_msg_recv_ts();
 
         if (elapsed > MAX_IDLE_MS) {
           connections_to_clean.emplace(connection_id);
-          cerr << client.signature() << ": cleaned idle connection" << endl;
+          LOG_INFO << client.signature() << ": cleaned idle connection";
           continue;
         }
       }
 
       /* connections can be safely cleaned now */
       for (const uint64_t connection_id : connections_to_clean) {
+        account_client_cpu(server, clients.at(connection_id));
         clients.erase(connection_id);
         server.clean_idle_connection(connection_id);
+
+        if (ttp_shard_writer) {
+          ttp_shard_writer->remove_connection(connection_id);
+        }
+      }
+
+      enforce_send_budget(server);
+      sample_load(server);
+
+      /* lose at most a second of training data on a crash */
+      if (ttp_shard_writer) {
+        ttp_shard_writer->flush();
       }
 
       if (enable_logging) {
@@ -391,293 +570,160 @@ void start_slow_timer(Timerfd & slow_timer, WebSocketServer & server)
           last_minute = this_minute;
         } else if (this_minute > last_minute) {
           /* server info: server heartbeats, etc. */
-          log_server_info(this_minute);
+          log_server_info(this_minute, server);
 
           /* write active_streams count to file */
           log_active_streams(this_minute);
 
+          /* time frames spent in the send queues, per traffic class */
+          log_queue_delay(this_minute, server);
+
+          /* aggregates of the per-chunk events, per channel */
+          log_stream_aggregates(this_minute);
+
+          /* where the transmission time of video chunks went */
+          log_delivery_phases(this_minute);
+
+          /* log CPU time per ABR algorithm and client */
+          log_cpu_usage(this_minute, server);
+
+          /* time spent in each (named) action of the event loop */
+          log_poller_dispatch(this_minute, server.poller());
+
           last_minute = this_minute;
         }
       }
 
       return ResultType::Continue;
     }
-  ));
+  ), "slow_timer");
 }
 
-bool resume_connection(WebSocketServer & server,
-                       WebSocketClient & client,
-                       const ClientInitMsg & msg,
-                       const shared_ptr<Channel> & channel)
+bool auth_client(const string & session_key, pqxx::nontransaction & db_work)
 {
-  /* check if requested timestamps exist */
-  if (not msg.next_vts or not msg.next_ats) {
-    return false;
-  }
-
-  uint64_t requested_vts = *msg.next_vts;
-  uint64_t requested_ats = *msg.next_ats;
+  try {
+    pqxx::result r = db_work.exec_prepared("auth", session_key);
 
-  /* check if the requested timestamps are ready to serve */
-  if (not channel->vready_to_serve(requested_vts) or
-      not channel->aready_to_serve(requested_ats)) {
-    return false;
+    if (r.size() == 1 and r[0].size() == 1) {
+      /* returned record is valid containing only true or false */
+      return r[0][0].as<bool>();
+    }
+  } catch (const exception & e) {
+    print_exception("auth_client", e);
   }
 
-  /* reinitialize the client */
-  client.init_channel(channel, requested_vts, requested_ats);
-  send_server_init(server, client, true /* can resume */);
-
-  cerr << client.signature() << ": connection resumed" << endl;
-  return true;
+  return false;
 }
 
-void handle_client_init(WebSocketServer & server, WebSocketClient & client,
-                        const ClientInitMsg & msg)
+void validate_id(const string & id)
 {
-  /* always set client's init_id when a client-init is received */
-  client.set_init_id(msg.init_id);
-
-  /* invalid channel request */
-  auto it = channels.find(msg.channel);
-  if (it == channels.end()) {
-    send_server_error(server, client, ServerErrorMsg::Type::Unavailable);
-    cerr << client.signature() << ": requested channel "
-         << msg.channel << " is not found" << endl;
-    return;
-  }
-
-  const auto channel = it->second;
+  int id_int = -1;
 
-  /* reply that the channel is not ready */
-  if (not channel->ready_to_serve()) {
-    send_server_error(server, client, ServerErrorMsg::Type::Unavailable);
-    cerr << client.signature() << ": requested channel "
-         << msg.channel << " is not ready" << endl;
-    return;
+  try {
+    id_int = stoi(id);
+  } catch (const exception &) {
+    throw runtime_error("server ID and expt ID must be positive integers");
   }
 
-  /* record client-init */
-  if (enable_logging) {
-    string log_line = to_string(timestamp_ms()) + "," + msg.channel
-      + "," + server_id + ",init," + expt_id + "," + client.username() + ","
-      + to_string(client.first_init_id().value()) + ","
-      + to_string(msg.init_id) + ",0,0" /* buffer cum_rebuf */;
-    append_to_log("client_buffer", log_line);
-
-    /* record system information */
-    log_line = to_string(timestamp_ms()) + "," + server_id + ","
-      + expt_id + "," + client.username() + ","
-      + to_string(client.first_init_id().value()) + ","
-      + to_string(msg.init_id) + ","
-      + client.address().ip() + ","
-      + client.os() + "," + client.browser() + ","
-      + to_string(client.screen_width()) + ","
-      + to_string(client.screen_height());
-    append_to_log("client_sysinfo", log_line);
-  }
-
-  /* check if the streaming can be resumed */
-  if (resume_connection(server, client, msg, channel)) {
-    return;
+  if (id_int <= 0) {
+    throw runtime_error("server ID and expt ID must be positive integers");
   }
-
-  uint64_t init_vts = channel->init_vts().value();
-  uint64_t init_ats = channel->init_ats().value();
-
-  client.init_channel(channel, init_vts, init_ats);
-  send_server_init(server, client, false /* initialize rather than resume */);
-
-  cerr << client.signature() << ": connection initialized" << endl;
 }
 
-void handle_client_info(WebSocketClient & client, const ClientInfoMsg & msg)
+/* try taking over the listening socket of a running server (hot restart) */
+/* a new server introduces itself to the running server of its server ID */
+string hot_restart_hello()
 {
-  if (not client.is_channel_initialized()) {
-    return;
-  }
-
-  if (msg.init_id != client.init_id().value()) {
-    cerr << client.signature() << ": warning: ignored messages with "
-         << "invalid init_id (but should not have received)" << endl;
-    return;
-  }
+  return "ws_media_server " + server_id + "\n";
+}
 
-  client.set_video_playback_buf(msg.video_buffer);
-  client.set_audio_playback_buf(msg.audio_buffer);
-  client.set_cum_rebuffer(msg.cum_rebuffer);
+/* sent by the new server once it holds the listening socket */
+static const string HOT_RESTART_ACK = "ack\n";
 
-  /* msg.cum_rebuffer is startup delay when event is Startup */
-  if (msg.event == ClientInfoMsg::Event::Startup) {
-    client.set_startup_delay(msg.cum_rebuffer);
+optional<FileDescriptor> take_over_listener()
+{
+  if (hot_restart_path.empty() or not fs::exists(hot_restart_path)) {
+    return nullopt;
   }
 
-  /* check if client's screen size has changed */
-  if (msg.screen_width and msg.screen_height) {
-    client.set_screen_size(*msg.screen_width, *msg.screen_height);
+  try {
+    IPCSocket sock;
+    sock.connect(hot_restart_path);
+    sock.write(hot_restart_hello());
 
-    /* record system information */
-    if (enable_logging) {
-      string log_line = to_string(timestamp_ms()) + "," + server_id + ","
-        + expt_id + "," + client.username() + ","
-        + to_string(client.first_init_id().value()) + ","
-        + to_string(msg.init_id) + ","
-        + client.address().ip() + ","
-        + client.os() + "," + client.browser() + ","
-        + to_string(*msg.screen_width) + ","
-        + to_string(*msg.screen_height);
-      append_to_log("client_sysinfo", log_line);
-    }
-  }
+    FileDescriptor listener_fd = recv_fd(sock);
 
-  /* execute the code below only if logging is enabled */
-  if (enable_logging) {
-    const auto channel_name = client.channel()->name();
-
-    /* record client-info */
-    string log_line = to_string(timestamp_ms()) + "," + channel_name + ","
-      + server_id + "," + msg.event_str + "," + expt_id + ","
-      + client.username() + ","
-      + to_string(client.first_init_id().value()) + ","
-      + to_string(msg.init_id) + ","
-      + double_to_string(msg.video_buffer, 3) + ","
-      + double_to_string(msg.cum_rebuffer, 3);
-    append_to_log("client_buffer", log_line);
+    /* the running server stops listening only after the ack */
+    sock.write(HOT_RESTART_ACK);
+    return listener_fd;
+  } catch (const exception & e) {
+    /* no server is running behind a stale socket file */
+    print_exception("take_over_listener", e);
+    return nullopt;
   }
 }
 
-void handle_client_video_ack(WebSocketClient & client,
-                             const ClientVidAckMsg & msg)
+WebSocketServer create_server(const Address & listener_addr,
+                              const string & cc_name)
 {
-  if (not client.is_channel_initialized()) {
-    return;
-  }
-  auto channel = client.channel();
-
-  if (msg.init_id != client.init_id().value()) {
-    cerr << client.signature() << ": warning: ignored messages with "
-         << "invalid init_id (but should not have received)" << endl;
-    return;
-  }
-
-  client.set_video_playback_buf(msg.video_buffer);
-  client.set_audio_playback_buf(msg.audio_buffer);
-  client.set_cum_rebuffer(msg.cum_rebuffer);
-
-  /* only interested in the event when the last segment is acked */
-  if (msg.byte_offset + msg.byte_length != msg.total_byte_length) {
-    return;
-  }
-
-  /* allow sending another chunk */
-  client.set_client_next_vts(msg.timestamp + channel->vduration());
-
-  /* record transmission time */
-  if (client.last_video_send_ts()) {
-    uint64_t trans_time = timestamp_ms() - *client.last_video_send_ts();
-
-    /* look up media chunk size (excluding the size of init chunk size) */
-    const auto data_mmap = channel->vdata(msg.video_format, msg.timestamp);
-    auto media_chunk_size = get<1>(data_mmap);
-
-    /* notify the ABR algorithm that a video chunk is acked */
-    client.video_chunk_acked(msg.video_format, msg.ssim,
-                             media_chunk_size, trans_time);
-    client.set_last_video_send_ts(nullopt);
-    client.set_tcp_info(nullopt);
-  } else {
-    cerr << client.signature() << ": error: server didn't send video but "
-         << "received VideoAck" << endl;
-    return;
+  auto listener_fd = take_over_listener();
+  if (listener_fd) {
+    LOG_INFO << "Took over the listening socket from the running server";
+    return WebSocketServer(TCPSocket(move(*listener_fd)), cc_name);
   }
 
-  /* record client's received video */
-  if (enable_logging) {
-    string log_line = to_string(timestamp_ms()) + "," + msg.channel + ","
-      + server_id + "," + expt_id + "," + client.username() + ","
-      + to_string(client.first_init_id().value()) + ","
-      + to_string(msg.init_id) + ","
-      + to_string(msg.timestamp) + ","
-      + to_string(msg.ssim) + "," + double_to_string(msg.video_buffer, 3) + ","
-      + double_to_string(msg.cum_rebuffer, 3);
-    append_to_log("video_acked", log_line);
-  }
+  return WebSocketServer(listener_addr, cc_name);
 }
 
-void handle_client_audio_ack(WebSocketClient & client,
-                             const ClientAudAckMsg & msg)
+/* hand off the listening socket to the next server of this server ID (and
+ * user) that connects to hot_restart_path, then start draining the existing
+ * connections; keep serving if the handoff fails */
+void start_hot_restart_listener(IPCSocket & hot_restart_socket,
+                                WebSocketServer & server)
 {
-  if (not client.is_channel_initialized()) {
-    return;
-  }
+  /* the socket file might be left by the old (or a crashed) server */
+  fs::remove(hot_restart_path);
+  hot_restart_socket.bind(hot_restart_path);
+  hot_restart_socket.listen();
 
-  if (msg.init_id != client.init_id().value()) {
-    cerr << client.signature() << ": warning: ignored messages with "
-         << "invalid init_id (but should not have received)" << endl;
-    return;
-  }
+  server.poller().add_action(Poller::Action(hot_restart_socket, Direction::In,
+    [&hot_restart_socket, &server]()->Result {
+      try {
+        FileDescriptor new_server = hot_restart_socket.accept();
+        set_read_timeout(new_server, HOT_RESTART_TIMEOUT_MS);
 
-  client.set_video_playback_buf(msg.video_buffer);
-  client.set_audio_playback_buf(msg.audio_buffer);
-  client.set_cum_rebuffer(msg.cum_rebuffer);
+        if (peer_uid(new_server) != geteuid()) {
+          throw runtime_error("peer is run by another user");
+        }
 
-  /* only interested in the event when the last segment is acked */
-  if (msg.byte_offset + msg.byte_length != msg.total_byte_length) {
-    return;
-  }
+        const string hello = hot_restart_hello();
+        if (new_server.read_exactly(hello.size()) != hello) {
+          throw runtime_error("peer is not a ws_media_server of server ID "
+                              + server_id);
+        }
 
-  /* allow sending another chunk */
-  client.set_client_next_ats(msg.timestamp + client.channel()->aduration());
-}
+        send_fd(new_server, server.listener_socket());
 
-void create_channels(Inotify & inotify)
-{
-  fs::path media_dir = config["media_dir"].as<string>();
-
-  set<string> channel_set = load_channels(config);
-  for (const auto & channel_name : channel_set) {
-    /* exceptions might be thrown from the lambda callbacks in the channel */
-    try {
-      auto channel = make_shared<Channel>(
-          channel_name, media_dir,
-          config["channel_configs"][channel_name], inotify);
-      channels.emplace(channel_name, move(channel));
-    } catch (const exception & e) {
-      cerr << "Error: exceptions in channel " << channel_name << ": "
-           << e.what() << endl;
-    }
-  }
-}
+        if (new_server.read_exactly(HOT_RESTART_ACK.size())
+            != HOT_RESTART_ACK) {
+          throw runtime_error("peer did not ack the listening socket");
+        }
+      } catch (const exception & e) {
+        LOG_WARNING << "Failed to hand off the listening socket ("
+                    << e.what() << "); still serving";
+        return ResultType::Continue;
+      }
 
-bool auth_client(const string & session_key, pqxx::nontransaction & db_work)
-{
-  try {
-    pqxx::result r = db_work.exec_prepared("auth", session_key);
+      /* the new server owns the listener and hot_restart_path from now on */
+      server.stop_listening();
+      draining = true;
+      drain_start_ts = timestamp_ms();
 
-    if (r.size() == 1 and r[0].size() == 1) {
-      /* returned record is valid containing only true or false */
-      return r[0][0].as<bool>();
+      LOG_INFO << "Handed off the listening socket; draining "
+               << clients.size() << " clients";
+      return ResultType::CancelAll;
     }
-  } catch (const exception & e) {
-    print_exception("auth_client", e);
-  }
-
-  return false;
-}
-
-void validate_id(const string & id)
-{
-  int id_int = -1;
-
-  try {
-    id_int = stoi(id);
-  } catch (const exception &) {
-    throw runtime_error("server ID and expt ID must be positive integers");
-  }
-
-  if (id_int <= 0) {
-    throw runtime_error("server ID and expt ID must be positive integers");
-  }
+  ), "hot_restart");
 }
 
 int run_websocket_server(pqxx::nontransaction & db_work)
@@ -711,24 +757,114 @@ int run_websocket_server(pqxx::nontransaction & db_work)
   /* run each server on a different port */
   const uint16_t port = config["ws_base_port"].as<uint16_t>() + server_id_int;
 
-  WebSocketServer server {{ip, port}, cc_name};
+  WebSocketServer server = create_server({ip, port}, cc_name);
+
+  /* bytes each connection may write per round of the egress scheduler */
+  if (config["send_quantum"]) {
+    server.set_send_quantum(config["send_quantum"].as<size_t>());
+  }
+
+  /* a backlog deep enough to ride out reconnection storms, drained in
+   * batches of "accept_batch" per round of the event loop */
+  server.set_listen_backlog(config["listen_backlog"] ?
+                            config["listen_backlog"].as<int>() : 1024);
+  if (config["accept_batch"]) {
+    server.set_accept_batch(config["accept_batch"].as<unsigned int>());
+  }
+
+  /* admission control */
+  if (config["max_connections"]) {
+    max_connections = config["max_connections"].as<size_t>();
+  }
+
+  if (config["max_egress_mbps"]) {
+    max_egress_mbps = config["max_egress_mbps"].as<double>();
+  }
+
+  if (config["max_cpu_utilization"]) {
+    max_cpu_utilization = config["max_cpu_utilization"].as<double>();
+  }
+
+  if (config["pacing_multiplier"]) {
+    pacing_multiplier = config["pacing_multiplier"].as<double>();
+  }
+
+  if (config["send_buffer_budget"]) {
+    send_buffer_budget = config["send_buffer_budget"].as<size_t>();
+  }
+
+  if (config["abandon_video_chunks"]) {
+    abandon_video_chunks = config["abandon_video_chunks"].as<bool>();
+  }
+
+  if (config["event_log_sample_rate"]) {
+    event_log_sample_rate = config["event_log_sample_rate"].as<double>();
+  }
+
+  /* joined per-chunk records for training the TTP, rotated by size and
+   * age (256 MB and an hour by default) */
+  if (config["ttp_shard_dir"]) {
+    const uint64_t max_mb = config["ttp_shard_max_mb"] ?
+      config["ttp_shard_max_mb"].as<uint64_t>() : 256;
+    const uint64_t max_minutes = config["ttp_shard_max_minutes"] ?
+      config["ttp_shard_max_minutes"].as<uint64_t>() : 60;
+
+    ttp_shard_writer = make_unique<TTPShardWriter>(
+      config["ttp_shard_dir"].as<string>(), server_id_int,
+      expt_id.empty() ? 0 : stoi(expt_id),
+      max_mb * 1024 * 1024, max_minutes * 60 * 1000);
+  }
+
+  /* a ring of recent client events, dumped into the directory on SIGUSR1,
+   * on requests to its control socket and when a client rebuffers */
+  if (config["flight_recorder_dir"]) {
+    const size_t num_events = config["flight_recorder_events"] ?
+      config["flight_recorder_events"].as<size_t>() :
+      DEFAULT_FLIGHT_RECORDER_EVENTS;
+
+    flight_recorder = make_unique<FlightRecorder>(
+      config["flight_recorder_dir"].as<string>(), server_id_int, num_events);
+    flight_recorder->add_triggers(server.poller());
+  }
+
+  /* the client messages and TCP info of a sample of sessions, to replay
+   * them with ws_media_replay */
+  if (config["session_recording_dir"]) {
+    const double sample_rate = config["session_recording_sample_rate"] ?
+      config["session_recording_sample_rate"].as<double>() : 1.0;
+
+    session_recorder = make_unique<SessionRecorder>(
+      config["session_recording_dir"].as<string>(), server_id, abr_name,
+      abr_config, sample_rate);
+  }
+
+  /* attribute the CPU time of the server thread to clients and ABR
+   * algorithms, logged per minute */
+  if (enable_logging and config["cpu_accounting"]) {
+    cpu_accounting = config["cpu_accounting"].as<bool>();
+  }
+
+  if (cpu_accounting) {
+    CPUTimer::enable();
+    server.enable_socket_cpu_accounting();
+  }
 
   const bool portal_debug = config["portal_settings"]["debug"].as<bool>();
 
   /* workaround using compiler macros (CXXFLAGS='-DNONSECURE') to create a
    * server with non-secure socket; secure socket is used by default */
   #ifdef NONSECURE
-  cerr << "Launching non-secure WebSocket server on port " << port << endl;
+  LOG_INFO << "Launching non-secure WebSocket server on port " << port;
   if (not portal_debug) {
-    cerr << "Error in YAML config: 'debug' must be true in 'portal_settings'" << endl;
+    LOG_ERROR << "Error in YAML config: 'debug' must be true in 'portal_settings'";
     return EXIT_FAILURE;
   }
   #else
   server.ssl_context().use_private_key_file(config["ssl_private_key"].as<string>());
   server.ssl_context().use_certificate_file(config["ssl_certificate"].as<string>());
-  cerr << "Launching secure WebSocket server on port " << port << endl;
+  LOG_INFO << "Launching secure WebSocket server on port " << port;
   if (portal_debug) {
-    cerr << "Error in YAML config: 'debug' must be false in 'portal_settings'" << endl;
+    LOG_ERROR << "Error in YAML config: 'debug' must be false in 'portal_settings'";
     return EXIT_FAILURE;
   }
   #endif
@@ -743,68 +879,17 @@ int run_websocket_server(pqxx::nontransaction & db_work)
     {
       try {
         WebSocketClient & client = clients.at(connection_id);
-        client.set_last_msg_recv_ts(timestamp_ms());
-
-        ClientMsgParser msg_parser(ws_msg.payload());
-        if (msg_parser.msg_type() == ClientMsgParser::Type::Init) {
-          ClientInitMsg msg = msg_parser.parse_client_init();
-
-          /* authenticate user */
-          if (not client.is_authenticated()) {
-            if (auth_client(msg.session_key, db_work)) {
-              client.set_authenticated(true);
-
-              /* set client's username and IP */
-              client.set_session_key(msg.session_key);
-              client.set_username(msg.username);
-              client.set_address(server.peer_addr(connection_id));
-
-              /* set client's system info (OS, browser and screen size) */
-              client.set_os(msg.os);
-              client.set_browser(msg.browser);
-              client.set_screen_size(msg.screen_width, msg.screen_height);
-
-              cerr << connection_id << ": authentication succeeded" << endl;
-              cerr << client.signature() << ": " << client.browser() << " on "
-                   << client.os() << ", " << client.address().str() << endl;
-            } else {
-              cerr << connection_id << ": authentication failed" << endl;
-              server.close_connection(connection_id);
-              return;
-            }
-          }
-
-          /* handle client-init and initialize client's channel */
-          handle_client_init(server, client, msg);
-        } else {
-          /* parse a message other than client-init only if user is authed */
-          if (not client.is_authenticated()) {
-            cerr << connection_id << ": ignored messages from a "
-                 << "non-authenticated user" << endl;
-            server.close_connection(connection_id);
-            return;
-          }
-
-          switch (msg_parser.msg_type()) {
-          case ClientMsgParser::Type::Info:
-            handle_client_info(client, msg_parser.parse_client_info());
-            break;
-          case ClientMsgParser::Type::VideoAck:
-            handle_client_video_ack(client, msg_parser.parse_client_vidack());
-            break;
-          case ClientMsgParser::Type::AudioAck:
-            handle_client_audio_ack(client, msg_parser.parse_client_audack());
-            break;
-          default:
-            throw runtime_error("invalid client message");
-          }
+        if (session_recorder) {
+          session_recorder->record_message(connection_id, ws_msg.payload());
         }
 
-        /* try serving media to this client */
-        serve_client(server, client);
+        handle_client_message(server, client, ws_msg.payload(),
+          [&db_work](const string & session_key) {
+            return auth_client(session_key, db_work);
+          });
       } catch (const exception & e) {
-        cerr << client_signature(connection_id)
-             << ": warning in message callback: " << e.what() << endl;
+        LOG_WARNING << client_signature(connection_id)
+                    << ": warning in message callback: " << e.what();
         server.close_connection(connection_id);
       }
     }
@@ -814,51 +899,144 @@ int run_websocket_server(pqxx::nontransaction & db_work)
     [&server, &abr_name, &abr_config](const uint64_t connection_id)
     {
       try {
-        cerr << connection_id << ": connection opened" << endl;
+        LOG_INFO << connection_id << ": connection opened";
 
         /* check if number of connections already exceeds the limit */
-        if (clients.size() >= MAX_CONNECTION_NUM) {
-          cerr << connection_id << ": rejected over-limit connection" << endl;
+        if (clients.size() >= max_connections) {
+          LOG_INFO << connection_id << ": rejected over-limit connection";
+          refuse_connection(server, connection_id,
+                            ServerErrorMsg::Type::Limit);
+          return;
+        }
 
-          WebSocketClient tmp_client(connection_id, abr_name, abr_config);
-          send_server_error(server, tmp_client, ServerErrorMsg::Type::Limit);
-          server.close_connection(connection_id);
+        /* or if admitting one more would overload the server */
+        if (const auto reason = over_capacity(server)) {
+          LOG_INFO << connection_id << ": rejected connection; " << *reason;
+          refuse_connection(server, connection_id, ServerErrorMsg::Type::Busy);
           return;
         }
 
         /* create a new WebSocketClient */
-        clients.emplace(
-            piecewise_construct,
-            forward_as_tuple(connection_id),
-            forward_as_tuple(connection_id, abr_name, abr_config));
+        record_event(clients.emplace_at(connection_id, connection_id,
+                                        abr_name, abr_config),
+                     FlightRecorder::EventType::Open);
+        if (session_recorder) {
+          session_recorder->open(connection_id);
+        }
       } catch (const exception & e) {
-        cerr << client_signature(connection_id)
-             << ": warning in open callback: " << e.what() << endl;
+        LOG_WARNING << client_signature(connection_id)
+                    << ": warning in open callback: " << e.what();
         server.close_connection(connection_id);
       }
     }
   );
 
   server.set_close_callback(
-    [](const uint64_t connection_id)
+    [&server](const uint64_t connection_id)
     {
       try {
+        WebSocketClient * client = clients.find(connection_id);
+        if (client) {
+          record_event(*client, FlightRecorder::EventType::Close);
+          account_client_cpu(server, *client);
+        }
+
         clients.erase(connection_id);
-        cerr << connection_id << ": connection closed" << endl;
+        if (ttp_shard_writer) {
+          ttp_shard_writer->remove_connection(connection_id);
+        }
+        if (session_recorder) {
+          session_recorder->close(connection_id);
+        }
+        LOG_INFO << connection_id << ": connection closed";
       } catch (const exception & e) {
-        cerr << client_signature(connection_id)
-             << ": warning in close callback: " << e.what() << endl;
+        LOG_WARNING << client_signature(connection_id)
+                    << ": warning in close callback: " << e.what();
       }
     }
   );
 
+  /* allow a newer server to take over without dropping connections */
+  IPCSocket hot_restart_socket;
+  if (not hot_restart_path.empty()) {
+    start_hot_restart_listener(hot_restart_socket, server);
+  }
+
+  /* serve Prometheus metrics to local scrapers on a port per server */
+  server.set_metrics(metrics);
+
+  metrics.gauge("puffer_memory_bytes", "Memory held by each subsystem",
+                channels_memory_bytes, {{"subsystem", "channels"}});
+  metrics.gauge("puffer_memory_bytes", "Memory held by each subsystem",
+                clients_memory_bytes, {{"subsystem", "clients"}});
+  metrics.gauge("puffer_memory_bytes", "Memory held by each subsystem",
+                openssl_heap_bytes, {{"subsystem", "openssl"}});
+  metrics.gauge("puffer_resident_bytes", "Resident memory of the server",
+                resident_bytes);
+  metrics.gauge("puffer_memory_per_client_bytes",
+                "Memory held on behalf of each client",
+                [&server]() {
+                  return memory_per_client(server.recent_memory_usage());
+                });
+
+  unique_ptr<MetricsServer> metrics_server;
+  if (config["metrics_base_port"]) {
+    const uint16_t metrics_port =
+      config["metrics_base_port"].as<uint16_t>() + server_id_int;
+    metrics_server = make_unique<MetricsServer>(
+      server.poller(), Address("127.0.0.1", metrics_port), metrics);
+  }
+
   /* start a slow timer to perform some tasks */
   Timerfd slow_timer;
   start_slow_timer(slow_timer, server);
 
   slow_timer.start(1000, 1000);  /* slow timer fires every second */
 
-  return server.loop();
+  /* time the delivery of video chunks to attribute their transmission time
+   * to the server, the network and the client */
+  Timerfd delivery_timer;
+  if (enable_logging) {
+    server.set_frame_write_callback(
+      [&server](const uint64_t connection_id, const uint64_t tag,
+                const bool last_byte)
+      {
+        WebSocketClient * client = clients.find(connection_id);
+        if (client) {
+          chunk_frame_written(server, *client, tag, last_byte);
+        }
+      }
+    );
+
+    server.poller().add_action(Poller::Action(delivery_timer, Direction::In,
+      [&delivery_timer, &server]()->Result {
+        if (delivery_timer.expirations() > 0) {
+          sample_kernel_acks(server);
+        }
+        return ResultType::Continue;
+      }
+    ), "delivery_timer");
+
+    const int sample_ms = config["delivery_timeline_sample_ms"] ?
+      config["delivery_timeline_sample_ms"].as<int>() : 10;
+    delivery_timer.start(sample_ms, sample_ms);
+  }
+
+  /* report the action and stack trace of event-loop iterations that stall
+   * every client of this server */
+  unique_ptr<PollerWatchdog> watchdog;
+  if (config["stall_threshold_ms"]) {
+    watchdog = make_unique<PollerWatchdog>(
+      server.poller(), config["stall_threshold_ms"].as<uint64_t>());
+  }
+
+  const int ret = server.loop();
+
+  /* complete the last shard while the logger is still running */
+  ttp_shard_writer.reset();
+  session_recorder.reset();
+
+  return ret;
 }
 
 int main(int argc, char * argv[])
@@ -874,20 +1052,44 @@ int main(int argc, char * argv[])
 
   /* load YAML settings */
   config = YAML::LoadFile(argv[1]);
+
+  /* block SIGUSR1 before the logger thread starts (on the first log line),
+   * so that only the flight recorder's signalfd receives it */
+  if (config["flight_recorder_dir"]) {
+    SignalMask({SIGUSR1}).set_as_mask();
+  }
+
+  /* account for the memory of OpenSSL before it allocates any, e.g., to
+   * connect to the database */
+  if (not track_openssl_heap()) {
+    LOG_WARNING << "Unable to track the memory allocated by OpenSSL";
+  }
+
+  /* diagnostics below this level ("info" by default) are discarded */
+  if (config["log_level"]) {
+    set_log_level(parse_log_level(config["log_level"].as<string>()));
+  }
+
   enable_logging = config["enable_logging"].as<bool>();
   if (enable_logging) {
-    cerr << "Logging is enabled" << endl;
+    LOG_INFO << "Logging is enabled";
     log_dir = config["log_dir"].as<string>();
   } else {
-    cerr << "Logging is disabled" << endl;
+    LOG_INFO << "Logging is disabled";
   }
 
   server_id = argv[2];
   validate_id(server_id);
 
+  /* hot restart is enabled only if a directory for the socket is given */
+  if (config["hot_restart_dir"]) {
+    hot_restart_path = fs::path(config["hot_restart_dir"].as<string>())
+                       / ("ws_media_server." + server_id + ".sock");
+  }
+
   if (enable_logging) {
     if (argc != 4) {
-      cerr << "expt ID must be provided if enable_logging is true" << endl;
+      LOG_ERROR << "expt ID must be provided if enable_logging is true";
       return EXIT_FAILURE;
     }
 
@@ -903,7 +1105,7 @@ int main(int argc, char * argv[])
   /* connect to the database for user authentication */
   string db_conn_str = postgres_connection_string(config["postgres_connection"]);
   pqxx::connection db_conn(db_conn_str);
-  cerr << "Connected to PostgreSQL at " << db_conn.hostname() << endl;
+  LOG_INFO << "Connected to PostgreSQL at " << db_conn.hostname();
 
   /* prepare a statement to check if the session_key in client-init is valid */
   db_conn.prepare("auth", "SELECT EXISTS(SELECT 1 FROM django_session WHERE "
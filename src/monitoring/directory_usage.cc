@@ -0,0 +1,218 @@
+#include "directory_usage.hh"
+
+#include <vector>
+#include <system_error>
+
+using namespace std;
+
+static const uint32_t WATCH_MASK = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO
+                                   | IN_MOVED_FROM | IN_DELETE;
+
+/* is path dir itself or under it */
+static bool in_subtree(const string & path, const string & dir)
+{
+  return path.compare(0, dir.size(), dir) == 0 and
+         (path.size() == dir.size() or path[dir.size()] == '/');
+}
+
+DirectoryUsage::DirectoryUsage(const fs::path & root, Inotify & inotify)
+  : root_(root), inotify_(inotify)
+{
+  add_directory(root_.string());
+}
+
+DirectoryUsage::Usage DirectoryUsage::usage(const fs::path & dir) const
+{
+  const string prefix = dir.string();
+  Usage ret;
+
+  /* a subtree sorts contiguously, except that siblings such as "dir-x"
+   * sort between "dir" and "dir/x" */
+  for (auto it = dirs_.lower_bound(prefix);
+       it != dirs_.end() and it->first.compare(0, prefix.size(), prefix) == 0;
+       ++it) {
+    if (in_subtree(it->first, prefix)) {
+      ret.files += it->second.files.size();
+      ret.bytes += it->second.bytes;
+    }
+  }
+
+  return ret;
+}
+
+map<string, DirectoryUsage::Usage> DirectoryUsage::subdirectory_usage() const
+{
+  map<string, Usage> ret;
+
+  const string prefix = root_.string() + "/";
+  for (const auto & [dir, directory] : dirs_) {
+    if (dir.compare(0, prefix.size(), prefix) != 0) {
+      continue;
+    }
+
+    const string subdir = dir.substr(prefix.size(),
+                                     dir.find('/', prefix.size())
+                                     - prefix.size());
+    Usage & usage = ret[subdir];
+    usage.files += directory.files.size();
+    usage.bytes += directory.bytes;
+  }
+
+  return ret;
+}
+
+void DirectoryUsage::reconcile_next()
+{
+  if (dirs_.empty()) {
+    return;
+  }
+
+  auto it = dirs_.upper_bound(last_reconciled_);
+  if (it == dirs_.end()) {
+    it = dirs_.begin();
+  }
+
+  last_reconciled_ = it->first;
+  list_directory(last_reconciled_);
+}
+
+void DirectoryUsage::add_directory(const string & dir)
+{
+  if (dirs_.count(dir)) {
+    return;
+  }
+
+  /* watch before listing, so that no file is missed in between */
+  int wd;
+  try {
+    wd = inotify_.add_watch(dir, WATCH_MASK,
+      [this](const inotify_event & event, const string & path) {
+        handle_event(event, path);
+      }
+    );
+  } catch (const exception &) {
+    /* dir was removed before its creation was noticed */
+    return;
+  }
+
+  dirs_[dir].wd = wd;
+  list_directory(dir);
+}
+
+void DirectoryUsage::remove_directory(const string & dir, const bool unwatch)
+{
+  for (auto it = dirs_.lower_bound(dir);
+       it != dirs_.end() and it->first.compare(0, dir.size(), dir) == 0; ) {
+    if (not in_subtree(it->first, dir)) {
+      ++it;
+      continue;
+    }
+
+    /* the kernel drops the watch of a deleted directory by itself */
+    if (unwatch) {
+      try {
+        inotify_.rm_watch(it->second.wd);
+      } catch (const exception &) {
+        /* the directory is gone already */
+      }
+    }
+
+    it = dirs_.erase(it);
+  }
+}
+
+void DirectoryUsage::list_directory(const string & dir)
+{
+  auto dir_it = dirs_.find(dir);
+  if (dir_it == dirs_.end()) {
+    return;
+  }
+
+  Directory & directory = dir_it->second;
+  directory.files.clear();
+  directory.bytes = 0;
+
+  error_code ec;
+  vector<string> subdirs;
+
+  for (fs::directory_iterator it(dir, ec), end; not ec and it != end;
+       it.increment(ec)) {
+    error_code status_ec;
+    if (fs::is_directory(it->symlink_status(status_ec))) {
+      subdirs.emplace_back(it->path().string());
+    } else {
+      update_file(directory, it->path());
+    }
+  }
+
+  if (ec) {
+    /* dir has been removed (its event is on the way) */
+    remove_directory(dir, true);
+    return;
+  }
+
+  /* directories created without our noticing */
+  for (const auto & subdir : subdirs) {
+    add_directory(subdir);
+  }
+}
+
+void DirectoryUsage::update_file(Directory & directory, const fs::path & path)
+{
+  const string name = path.filename().string();
+
+  error_code ec;
+  const auto status = fs::status(path, ec);
+  const uint64_t size = fs::is_regular_file(status) ?
+                        fs::file_size(path, ec) : 0;
+
+  if (ec or not fs::is_regular_file(status)) {
+    remove_file(directory, name);
+    return;
+  }
+
+  auto [it, inserted] = directory.files.emplace(name, size);
+  if (not inserted) {
+    directory.bytes -= it->second;
+    it->second = size;
+  }
+  directory.bytes += size;
+}
+
+void DirectoryUsage::remove_file(Directory & directory, const string & name)
+{
+  auto it = directory.files.find(name);
+  if (it != directory.files.end()) {
+    directory.bytes -= it->second;
+    directory.files.erase(it);
+  }
+}
+
+void DirectoryUsage::handle_event(const inotify_event & event,
+                                  const string & dir)
+{
+  auto dir_it = dirs_.find(dir);
+  if (dir_it == dirs_.end() or event.len == 0) {
+    return;
+  }
+
+  const fs::path path = fs::path(dir) / event.name;
+
+  if (event.mask & IN_ISDIR) {
+    if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+      add_directory(path.string());
+    } else if (event.mask & IN_MOVED_FROM) {
+      remove_directory(path.string(), true);
+    } else if (event.mask & IN_DELETE) {
+      remove_directory(path.string(), false);
+    }
+
+    return;
+  }
+
+  if (event.mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+    update_file(dir_it->second, path);
+  } else if (event.mask & (IN_MOVED_FROM | IN_DELETE)) {
+    remove_file(dir_it->second, event.name);
+  }
+}
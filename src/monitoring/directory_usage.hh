@@ -0,0 +1,77 @@
+#ifndef DIRECTORY_USAGE_HH
+#define DIRECTORY_USAGE_HH
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <unordered_map>
+
+#include "filesystem.hh"
+#include "inotify.hh"
+
+/* Counts the regular files and their bytes in each directory of a tree,
+ * kept up to date from inotify events rather than by walking the tree.
+ * Files are stat'ed when they are created, closed after writing or moved
+ * in, so a file still being written counts with its size when last seen.
+ * Events can be missed (e.g., if the inotify queue overflows), so
+ * reconcile_next() lists one directory at a time again to correct it. */
+class DirectoryUsage
+{
+public:
+  struct Usage
+  {
+    uint64_t files {0};
+    uint64_t bytes {0};
+  };
+
+  /* watch every directory under root with (a dedicated) inotify */
+  DirectoryUsage(const fs::path & root, Inotify & inotify);
+
+  /* usage of the subtree of dir, which is root or a directory under it */
+  Usage usage(const fs::path & dir) const;
+
+  /* usage of the subtree of each directory immediately under root */
+  std::map<std::string, Usage> subdirectory_usage() const;
+
+  /* list the directory after the last one reconciled and correct its
+   * counters; repeated calls reconcile every directory in turn */
+  void reconcile_next();
+
+  /* forbid copying DirectoryUsage */
+  DirectoryUsage(const DirectoryUsage & other) = delete;
+  const DirectoryUsage & operator=(const DirectoryUsage & other) = delete;
+
+private:
+  struct Directory
+  {
+    int wd {-1};
+    std::unordered_map<std::string, uint64_t> files {};  /* name -> size */
+    uint64_t bytes {0};
+  };
+
+  fs::path root_;
+  Inotify & inotify_;
+
+  /* key: path of a directory; ordered so that a subtree is contiguous */
+  std::map<std::string, Directory> dirs_ {};
+
+  /* the directory reconciled last */
+  std::string last_reconciled_ {};
+
+  /* watch and list dir and the directories under it */
+  void add_directory(const std::string & dir);
+
+  /* stop tracking dir and the directories under it */
+  void remove_directory(const std::string & dir, const bool unwatch);
+
+  /* replace the counters of dir with a listing of it */
+  void list_directory(const std::string & dir);
+
+  /* stat the file and count it if it is a regular file */
+  void update_file(Directory & directory, const fs::path & path);
+  void remove_file(Directory & directory, const std::string & name);
+
+  void handle_event(const inotify_event & event, const std::string & dir);
+};
+
+#endif /* DIRECTORY_USAGE_HH */
@@ -3,6 +3,7 @@
 #include <fstream>
 #include <map>
 #include <ctime>
+#include <memory>
 
 #include "util.hh"
 #include "yaml.hh"
@@ -15,11 +16,15 @@
 #include "timestamp.hh"
 #include "tokenize.hh"
 #include "influxdb_client.hh"
+#include "directory_usage.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
 static const int TIMER_PERIOD_MS = 60000;  /* 1 minute */
+/* each channel's working directory lists one of its directories again per
+ * period, rather than walking the whole tree at once */
+static const int RECONCILE_PERIOD_MS = 1000;
 static fs::path media_dir;
 
 void print_usage(const string & program_name)
@@ -133,47 +138,66 @@ void report_video_size(const string & channel_name,
   );
 }
 
-void report_backlog(const set<string> & channel_set,
+void report_backlog(const map<string, unique_ptr<DirectoryUsage>> & usages,
                     Poller & poller,
                     Timerfd & timer,
                     InfluxDBClient & influxdb_client)
 {
   poller.add_action(Poller::Action(timer, Direction::In,
-    [&channel_set, &timer, &influxdb_client]() {
+    [&usages, &timer, &influxdb_client]() {
       /* must read the timerfd, and check if timer has fired */
       if (timer.expirations() == 0) {
         return ResultType::Continue;
       }
 
-      for (const auto & channel_name : channel_set) {
+      const string ts = to_string(timestamp_ms());
+
+      for (const auto & [channel_name, usage] : usages) {
         fs::path channel_path = media_dir / channel_name;
-        string working_dir = channel_path / "working";
-        string canonical_dir = channel_path / "working/video-canonical";
-
-        unsigned int working_cnt = 0;
-        for (const auto & entry : fs::recursive_directory_iterator(working_dir)) {
-          if (fs::is_regular_file(entry)) {
-            working_cnt++;
-          }
-        }
 
-        unsigned int canonical_cnt = 0;
-        for (const auto & entry : fs::recursive_directory_iterator(canonical_dir)) {
-          if (fs::is_regular_file(entry)) {
-            canonical_cnt++;
-          }
-        }
+        const auto working = usage->usage(channel_path / "working");
+        const auto canonical =
+          usage->usage(channel_path / "working/video-canonical");
 
         string log_line = "backlog,channel=" + channel_name
-          + " working_cnt=" + to_string(working_cnt)
-          + "i,canonical_cnt=" + to_string(canonical_cnt)
-          + "i " + to_string(timestamp_ms());
+          + " working_cnt=" + to_string(working.files)
+          + "i,canonical_cnt=" + to_string(canonical.files)
+          + "i,working_bytes=" + to_string(working.bytes)
+          + "i,canonical_bytes=" + to_string(canonical.bytes)
+          + "i " + ts;
         influxdb_client.post(log_line);
+
+        /* e.g., video-raw, video-canonical, audio-raw, 1280x720-20 */
+        for (const auto & [dir, dir_usage] : usage->subdirectory_usage()) {
+          log_line = "storage,channel=" + channel_name + ",dir=" + dir
+            + " files=" + to_string(dir_usage.files)
+            + "i,bytes=" + to_string(dir_usage.bytes) + "i " + ts;
+          influxdb_client.post(log_line);
+        }
+      }
+
+      return ResultType::Continue;
+    }
+  ), "backlog");
+}
+
+void reconcile_usages(const map<string, unique_ptr<DirectoryUsage>> & usages,
+                      Poller & poller,
+                      Timerfd & timer)
+{
+  poller.add_action(Poller::Action(timer, Direction::In,
+    [&usages, &timer]() {
+      if (timer.expirations() == 0) {
+        return ResultType::Continue;
+      }
+
+      for (const auto & usage : usages) {
+        usage.second->reconcile_next();
       }
 
       return ResultType::Continue;
     }
-  ));
+  ), "reconcile");
 }
 
 int main(int argc, char * argv[])
@@ -205,7 +229,8 @@ int main(int argc, char * argv[])
       {influx["host"].as<string>(), to_string(influx["port"].as<uint16_t>())},
       influx["dbname"].as<string>(),
       influx["user"].as<string>(),
-      safe_getenv(influx["password"].as<string>()));
+      safe_getenv(influx["password"].as<string>()),
+      influxdb_client_options(influx, "file_reporter"));
 
   for (const auto & channel_name : channel_set) {
     const auto & channel_config = config["channel_configs"][channel_name];
@@ -226,9 +251,22 @@ int main(int argc, char * argv[])
     }
   }
 
+  /* count the files and bytes in each channel's working directory from
+   * inotify events; a separate inotify, as a path can have one watch only */
+  Inotify usage_inotify(poller);
+  map<string, unique_ptr<DirectoryUsage>> usages;  /* key: channel name */
+  for (const auto & channel_name : channel_set) {
+    usages.emplace(channel_name, make_unique<DirectoryUsage>(
+        media_dir / channel_name / "working", usage_inotify));
+  }
+
+  Timerfd reconcile_timer;
+  reconcile_usages(usages, poller, reconcile_timer);
+  reconcile_timer.start(RECONCILE_PERIOD_MS, RECONCILE_PERIOD_MS);
+
   /* create a periodic timer that fires every minute to report backlog sizes */
   Timerfd timer;
-  report_backlog(channel_set, poller, timer, influxdb_client);
+  report_backlog(usages, poller, timer, influxdb_client);
   timer.start(TIMER_PERIOD_MS, TIMER_PERIOD_MS);
 
   for (;;) {
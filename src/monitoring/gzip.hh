@@ -0,0 +1,10 @@
+#ifndef GZIP_HH
+#define GZIP_HH
+
+#include <string>
+#include <string_view>
+
+/* compress data into the gzip format (e.g., for Content-Encoding: gzip) */
+std::string gzip_compress(const std::string_view data);
+
+#endif /* GZIP_HH */
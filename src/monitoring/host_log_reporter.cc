@@ -0,0 +1,534 @@
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <charconv>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "util.hh"
+#include "yaml-cpp/yaml.h"
+#include "inotify.hh"
+#include "poller.hh"
+#include "file_descriptor.hh"
+#include "filesystem.hh"
+#include "timerfd.hh"
+#include "timestamp.hh"
+#include "exception.hh"
+#include "log_parser.hh"
+#include "influxdb_client.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* post the shared batch once it reaches either threshold */
+static const size_t MAX_BATCH_BYTES = 512 * 1024;  /* 512 KB */
+static const uint64_t MAX_BATCH_DELAY_MS = 1000;
+static const int BATCH_CHECK_PERIOD_MS = 100;
+
+/* read at most this much of a log per event, so that a busy log cannot
+ * starve the others */
+static const size_t MAX_READ_BYTES = 8 * BUFFER_SIZE;
+
+static const int STATS_PERIOD_MS = 60000;  /* 1 minute */
+static const unsigned int DEFAULT_PARSE_THREADS = 2;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " <YAML configuration> <number of servers> "
+  "<log stem>..." << endl;
+}
+
+/* the data points parsed from every log, merged into one batch per
+ * timestamp precision (a post has a single precision) */
+class SharedBatch
+{
+public:
+  void append(const string & precision, const string & points)
+  {
+    lock_guard<mutex> lock(mutex_);
+    batches_[precision] += points;
+    bytes_ += points.size();
+  }
+
+  size_t bytes() const
+  {
+    lock_guard<mutex> lock(mutex_);
+    return bytes_;
+  }
+
+  /* return the batches keyed by precision and start new ones */
+  map<string, string> take()
+  {
+    lock_guard<mutex> lock(mutex_);
+    bytes_ = 0;
+    return move(batches_);
+  }
+
+private:
+  mutable mutex mutex_ {};
+  map<string, string> batches_ {};
+  size_t bytes_ {0};
+};
+
+/* a log of one server, e.g., video_sent.3.log; the event loop reads it and
+ * a parsing thread parses what was read, one thread at a time */
+class LogSource
+{
+public:
+  LogSource(const string & stem, const string & server_id,
+            const string & log_path, const string & format_string)
+    : stem_(stem), server_id_(server_id), log_path_(log_path),
+      parser_(format_string, is_crucial(stem))
+  {}
+
+  const string & stem() const { return stem_; }
+  const string & server_id() const { return server_id_; }
+  const string & log_path() const { return log_path_; }
+
+  /* (event loop) open the log, skipping its content if from_end */
+  void open(const bool from_end)
+  {
+    fd_ = make_unique<FileDescriptor>(CheckSystemCall(
+        "open (" + log_path_ + ")", ::open(log_path_.c_str(), O_RDONLY)));
+    if (from_end) {
+      fd_->seek(0, SEEK_END);
+    }
+  }
+
+  /* (event loop) queue the new content for parsing; return whether the
+   * source needs to be handed to a parsing thread */
+  bool read()
+  {
+    string content;
+    while (content.size() < MAX_READ_BYTES) {
+      const string chunk = fd_->read();
+      if (chunk.empty()) {
+        break;
+      }
+      content += chunk;
+    }
+
+    if (content.empty()) {
+      return false;
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    if (pending_.empty()) {
+      pending_since_ = timestamp_ms();
+    }
+    pending_ += content;
+
+    if (scheduled_) {
+      return false;
+    }
+
+    scheduled_ = true;
+    return true;
+  }
+
+  /* (event loop) whether the log path is a new file rather than the one
+   * opened, i.e., the log was rotated rather than just closed */
+  bool replaced() const
+  {
+    struct stat path_stat, fd_stat;
+    if (stat(log_path_.c_str(), &path_stat) != 0) {
+      return false;  /* not created yet */
+    }
+    CheckSystemCall("fstat", fstat(fd_->fd_num(), &fd_stat));
+
+    return path_stat.st_ino != fd_stat.st_ino or
+           path_stat.st_dev != fd_stat.st_dev;
+  }
+
+  /* (event loop) bytes in the log not read yet; none if it was truncated */
+  uint64_t unread_bytes()
+  {
+    const uint64_t size = fd_->filesize();
+    const uint64_t offset = fd_->curr_offset();
+    return size > offset ? size - offset : 0;
+  }
+
+  /* (parsing thread) parse the pending content into batch; return false,
+   * and release the source, once nothing is pending */
+  bool parse_pending(SharedBatch & batch)
+  {
+    string content;
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (pending_.empty()) {
+        scheduled_ = false;
+        return false;
+      }
+
+      content = move(pending_);
+      pending_ = string {};
+    }
+
+    partial_ += content;
+
+    uint64_t lines = 0;
+    optional<uint64_t> last_ts;
+    try {
+      const size_t consumed = parser_.parse(partial_);
+      lines = parser_.batch_lines();
+      last_ts = last_line_ts(string_view(partial_).substr(0, consumed));
+      partial_.erase(0, consumed);
+
+      batch.append(parser_.precision(), parser_.take_batch());
+    } catch (const exception & e) {
+      /* drop what was read rather than stopping every log */
+      print_exception(log_path_.c_str(), e);
+      parser_.take_batch();
+      partial_.clear();
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    lines_ += lines;
+    if (last_ts) {
+      last_line_ts_ = *last_ts;
+    }
+
+    return true;
+  }
+
+  struct Stats
+  {
+    uint64_t lines;          /* parsed since the last stats */
+    size_t pending_bytes;    /* read but not parsed yet */
+    uint64_t pending_ms;     /* age of the oldest content not parsed yet */
+    uint64_t last_line_ts;   /* timestamp of the last line parsed */
+  };
+
+  /* (event loop) */
+  Stats take_stats()
+  {
+    lock_guard<mutex> lock(mutex_);
+
+    Stats stats {lines_, pending_.size(),
+                 pending_.empty() ? 0 : timestamp_ms() - pending_since_,
+                 last_line_ts_};
+    lines_ = 0;
+    return stats;
+  }
+
+  int wd {-1};
+  bool rotated {false};
+
+private:
+  string stem_;
+  string server_id_;
+  string log_path_;
+
+  /* accessed by the event loop only */
+  unique_ptr<FileDescriptor> fd_ {};
+
+  /* accessed by the parsing thread that holds the source only */
+  LogParser parser_;
+  string partial_ {};  /* an incomplete line */
+
+  /* shared, guarded by mutex_ */
+  mutex mutex_ {};
+  string pending_ {};
+  uint64_t pending_since_ {0};
+  bool scheduled_ {false};  /* held by a parsing thread */
+  uint64_t lines_ {0};
+  uint64_t last_line_ts_ {0};
+
+  /* enforce uniqueness for the crucial measurements below */
+  static bool is_crucial(const string & stem)
+  {
+    return stem == "client_buffer" or stem == "video_acked"
+           or stem == "video_sent" or stem == "video_timeline";
+  }
+
+  /* the timestamp (first value) of the last line in lines */
+  static optional<uint64_t> last_line_ts(const string_view lines)
+  {
+    if (lines.size() < 2) {
+      return nullopt;
+    }
+
+    const size_t prev_newline = lines.rfind('\n', lines.size() - 2);
+    const size_t start = prev_newline == string_view::npos ?
+                         0 : prev_newline + 1;
+
+    uint64_t ts;
+    const auto [ptr, ec] = from_chars(lines.data() + start,
+                                      lines.data() + lines.size(), ts);
+    if (ec != errc()) {
+      return nullopt;
+    }
+
+    return ts;
+  }
+};
+
+/* threads that parse the content read from sources */
+class ParsePool
+{
+public:
+  ParsePool(const unsigned int num_threads, SharedBatch & batch)
+    : batch_(batch)
+  {
+    for (unsigned int i = 0; i < num_threads; i++) {
+      threads_.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~ParsePool()
+  {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+
+    for (auto & thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void submit(LogSource & source)
+  {
+    {
+      lock_guard<mutex> lock(mutex_);
+      queue_.push_back(&source);
+    }
+    cv_.notify_one();
+  }
+
+  /* forbid copying ParsePool */
+  ParsePool(const ParsePool & other) = delete;
+  const ParsePool & operator=(const ParsePool & other) = delete;
+
+private:
+  SharedBatch & batch_;
+
+  mutex mutex_ {};
+  condition_variable cv_ {};
+  deque<LogSource *> queue_ {};
+  bool stop_ {false};
+
+  vector<thread> threads_ {};
+
+  void work()
+  {
+    for (;;) {
+      LogSource * source;
+      {
+        unique_lock<mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ or not queue_.empty(); });
+        if (stop_) {
+          return;
+        }
+
+        source = queue_.front();
+        queue_.pop_front();
+      }
+
+      while (source->parse_pending(batch_)) {}
+    }
+  }
+};
+
+/* (re)open a log and watch it; a log is rotated when the server closes it
+ * after creating a new one */
+void watch_source(LogSource & source, Inotify & inotify, ParsePool & pool,
+                  const bool from_end)
+{
+  source.open(from_end);
+
+  source.wd = inotify.add_watch(source.log_path(), IN_MODIFY | IN_CLOSE_WRITE,
+    [&source, &pool](const inotify_event & event, const string &) {
+      if (event.mask & IN_MODIFY) {
+        if (source.read()) {
+          pool.submit(source);
+        }
+      } else if (event.mask & IN_CLOSE_WRITE) {
+        source.rotated = true;
+      }
+    }
+  );
+}
+
+string source_stats_line(LogSource & source, const uint64_t now)
+{
+  const auto stats = source.take_stats();
+
+  return "log_reporter,stem=" + source.stem()
+    + ",server_id=" + source.server_id()
+    + " lines=" + to_string(stats.lines)
+    + "i,unread_bytes=" + to_string(source.unread_bytes())
+    + "i,pending_bytes=" + to_string(stats.pending_bytes)
+    + "i,pending_ms=" + to_string(stats.pending_ms)
+    + "i,lag_ms=" + to_string(stats.last_line_ts ?
+                              now - min(now, stats.last_line_ts) : 0)
+    + "i " + to_string(now);
+}
+
+int tail_loop(const YAML::Node & config, vector<unique_ptr<LogSource>> & sources)
+{
+  Poller poller;
+  Inotify inotify(poller);
+
+  const auto & influx = config["influxdb_connection"];
+  InfluxDBClient influxdb_client(
+      poller,
+      {influx["host"].as<string>(), to_string(influx["port"].as<uint16_t>())},
+      influx["dbname"].as<string>(),
+      influx["user"].as<string>(),
+      safe_getenv(influx["password"].as<string>()),
+      influxdb_client_options(influx, "host_log_reporter"));
+  influxdb_client.set_gzip(true);
+
+  const unsigned int num_threads = config["log_reporter_threads"] ?
+    config["log_reporter_threads"].as<unsigned int>() : DEFAULT_PARSE_THREADS;
+
+  SharedBatch batch;
+  ParsePool pool(num_threads, batch);
+
+  /* post the shared batch once it is large enough or old enough */
+  uint64_t last_post_ts = timestamp_ms();
+  Timerfd batch_timer;
+  poller.add_action(Poller::Action(batch_timer, Direction::In,
+    [&]()->Result {
+      if (batch_timer.expirations() == 0) {
+        return ResultType::Continue;
+      }
+
+      const uint64_t now = timestamp_ms();
+      if (batch.bytes() >= MAX_BATCH_BYTES or
+          now - last_post_ts >= MAX_BATCH_DELAY_MS) {
+        for (auto & [precision, points] : batch.take()) {
+          if (not points.empty()) {
+            influxdb_client.post(points, precision);
+          }
+        }
+        last_post_ts = now;
+      }
+
+      for (auto & source : sources) {
+        /* a read is capped at MAX_READ_BYTES; resume it without waiting
+         * for the next write to the log */
+        if (not source->rotated) {
+          if (source->unread_bytes() > 0 and source->read()) {
+            pool.submit(*source);
+          }
+          continue;
+        }
+
+        /* reopen the logs that were rotated, from their beginning */
+        source->rotated = false;
+        if (not source->replaced()) {
+          continue;
+        }
+
+        /* finish the old log first, to its end */
+        while (source->unread_bytes() > 0) {
+          if (source->read()) {
+            pool.submit(*source);
+          }
+        }
+
+        inotify.rm_watch(source->wd);
+        watch_source(*source, inotify, pool, false);
+
+        if (source->read()) {
+          pool.submit(*source);
+        }
+      }
+
+      return ResultType::Continue;
+    }
+  ), "batch_timer");
+  batch_timer.start(BATCH_CHECK_PERIOD_MS, BATCH_CHECK_PERIOD_MS);
+
+  /* how far behind each log is */
+  Timerfd stats_timer;
+  poller.add_action(Poller::Action(stats_timer, Direction::In,
+    [&]()->Result {
+      if (stats_timer.expirations() > 0) {
+        const uint64_t now = timestamp_ms();
+        string points;
+        for (auto & source : sources) {
+          points += source_stats_line(*source, now) + "\n";
+        }
+        influxdb_client.post(points);
+      }
+
+      return ResultType::Continue;
+    }
+  ), "stats_timer");
+  stats_timer.start(STATS_PERIOD_MS, STATS_PERIOD_MS);
+
+  for (auto & source : sources) {
+    watch_source(*source, inotify, pool, true);
+  }
+
+  for (;;) {
+    auto ret = poller.poll(-1);
+    if (ret.result != Poller::Result::Type::Success) {
+      return ret.exit_status;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  if (argc < 4) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  YAML::Node config = YAML::LoadFile(argv[1]);
+  if (not config["enable_logging"].as<bool>()) {
+    cerr << "Error: logging is not enabled yet" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const fs::path log_dir = config["log_dir"].as<string>();
+  const unsigned int num_servers = stoi(argv[2]);
+
+  vector<unique_ptr<LogSource>> sources;
+  for (int i = 3; i < argc; i++) {
+    const string log_stem = argv[i];
+
+    /* read a line specifying log format and pass into the log parsers */
+    ifstream format_ifstream(log_dir / (log_stem + ".conf"));
+    string format_string;
+    getline(format_ifstream, format_string);
+
+    for (unsigned int server_id = 1; server_id <= num_servers; server_id++) {
+      const string log_path = log_dir / (log_stem + "."
+                                         + to_string(server_id) + ".log");
+
+      /* create an empty log if it does not exist */
+      FileDescriptor touch(CheckSystemCall("open (" + log_path + ")",
+                           open(log_path.c_str(), O_WRONLY | O_CREAT, 0644)));
+      touch.close();
+
+      sources.emplace_back(make_unique<LogSource>(
+          log_stem, to_string(server_id), log_path, format_string));
+    }
+  }
+
+  /* read new lines from all logs and post to InfluxDB */
+  return tail_loop(config, sources);
+}
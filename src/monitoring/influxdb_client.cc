@@ -1,64 +1,240 @@
 #include "influxdb_client.hh"
 
+#include <csignal>
 #include <iostream>
-#include "http_request.hh"
+#include <algorithm>
+#include "exception.hh"
+#include "timestamp.hh"
+#include "gzip.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
+/* delay before reconnecting, doubled after each failed attempt */
+static const int MIN_BACKOFF_MS = 100;
+static const int MAX_BACKOFF_MS = 30000;
+
+static const int STATS_PERIOD_MS = 60000;  /* 1 minute */
+
+InfluxDBClientOptions influxdb_client_options(const YAML::Node & influx,
+                                              const string & name)
+{
+  InfluxDBClientOptions options;
+  options.name = name;
+
+  if (influx["max_buffer_mb"]) {
+    options.max_buffer_bytes = influx["max_buffer_mb"].as<size_t>() << 20;
+  }
+
+  if (influx["spool_dir"]) {
+    options.spool_dir = fs::path(influx["spool_dir"].as<string>()) / name;
+  }
+
+  if (influx["max_spool_mb"]) {
+    options.max_spool_bytes = influx["max_spool_mb"].as<size_t>() << 20;
+  }
+
+  return options;
+}
+
 InfluxDBClient::InfluxDBClient(Poller & poller,
                                const Address & address,
                                const string & database,
                                const string & user,
-                               const string & password)
+                               const string & password,
+                               const InfluxDBClientOptions & options)
+  : poller_(poller), influxdb_addr_(address), database_(database),
+    user_(user), password_(password), name_(options.name),
+    max_buffer_bytes_(options.max_buffer_bytes), backoff_ms_(MIN_BACKOFF_MS)
 {
-  influxdb_addr_ = address;
-  sock_.connect(influxdb_addr_);
+  /* writing to a connection closed by InfluxDB must fail with EPIPE
+   * rather than kill the process */
+  if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+    throw runtime_error("signal: failed to ignore SIGPIPE");
+  }
+
+  /* a stand-in for the writes when parsing their responses */
+  write_request_.set_first_line("POST /write HTTP/1.1");
+  write_request_.add_header(HTTPHeader{"Content-Length", "0"});
+  write_request_.done_with_headers();
 
-  database_ = database;
-  user_ = user;
-  password_ = password;
+  if (not options.spool_dir.empty()) {
+    spool_ = make_unique<Spool>(options.spool_dir, options.max_spool_bytes,
+                                options.spool_segment_bytes);
+  }
 
-  poller.add_action(Poller::Action(sock_, Direction::In,
+  poller_.add_action(Poller::Action(reconnect_timer_, Direction::In,
     [this]()->Result {
-      /* must read HTTP responses from InfluxDB, then basically ignore them */
-      const string response = sock_.read();
-      if (response.empty()) {
-        throw runtime_error("peer socket in InfluxDB has closed");
+      if (reconnect_timer_.expirations() > 0 and not sock_) {
+        reconnects_++;
+        connect();
       }
 
       return ResultType::Continue;
     }
-  ));
+  ), "influxdb_client.reconnect");
 
-  poller.add_action(Poller::Action(sock_, Direction::Out,
+  if (not name_.empty()) {
+    poller_.add_action(Poller::Action(stats_timer_, Direction::In,
+      [this]()->Result {
+        if (stats_timer_.expirations() > 0) {
+          post_stats();
+        }
+
+        return ResultType::Continue;
+      }
+    ), "influxdb_client.stats");
+    stats_timer_.start(STATS_PERIOD_MS, STATS_PERIOD_MS);
+  }
+
+  connect();
+}
+
+void InfluxDBClient::connect()
+{
+  closed_sock_.reset();
+
+  sock_ = make_unique<TCPSocket>();
+  sock_->set_blocking(false);
+
+  try {
+    sock_->connect(influxdb_addr_);
+  } catch (const unix_error & e) {
+    if (e.error_code() != EINPROGRESS) {
+      print_exception("InfluxDBClient", e);
+      disconnect();
+      return;
+    }
+  }
+
+  connecting_ = true;
+  responses_ = make_unique<HTTPResponseParser>();
+
+  /* an error in either action (or on the socket) closes the connection */
+  poller_.add_action(Poller::Action(*sock_, Direction::In,
     [this]()->Result {
+      const string data = sock_->read();
+      if (data.empty()) {
+        throw runtime_error("InfluxDB closed the connection");
+      }
+
+      responses_->parse(data);
+      while (not responses_->empty()) {
+        handle_response(responses_->front());
+        responses_->pop();
+      }
+
+      refill();
+      return ResultType::Continue;
+    },
+    [this]()->bool {
+      return not connecting_;
+    },
+    [this]() { disconnect(); },
+    false
+  ), "influxdb_client.read");
+
+  poller_.add_action(Poller::Action(*sock_, Direction::Out,
+    [this]()->Result {
+      if (connecting_) {
+        /* throws if the connection has failed */
+        sock_->verify_no_errors();
+        sock_->register_write();
+        connecting_ = false;
+
+        cerr << "InfluxDBClient: connected to " << influxdb_addr_.str()
+             << endl;
+        refill();
+      }
+
       while (not buffer_.empty()) {
-        const string & data = buffer_.front();
+        const string & data = buffer_.front().data;
         /* convert to string_view to avoid copy */
         string_view data_view = data;
 
         /* set write_all to false because socket might be unable to write all */
-        const auto view_it = sock_.write(
-            data_view.substr(buffer_offset_), false);
+        string_view::const_iterator view_it;
+        try {
+          view_it = sock_->write(data_view.substr(buffer_offset_), false);
+        } catch (const unix_error & e) {
+          if (e.error_code() == EAGAIN or e.error_code() == EWOULDBLOCK) {
+            break;
+          }
+          throw;
+        }
 
         if (view_it != data_view.cend()) {
           /* save the offset of the remaining string */
           buffer_offset_ = view_it - data_view.cbegin();
           break;
         } else {
-          /* move onto the next item in the deque */
+          /* await the response to this write */
           buffer_offset_ = 0;
+          in_flight_.emplace_back(move(buffer_.front()));
           buffer_.pop_front();
+          responses_->new_request_arrived(write_request_);
         }
       }
 
       return ResultType::Continue;
     },
     [this]()->bool {
-      return not buffer_.empty();
-    }
-  ));
+      return connecting_ or not buffer_.empty();
+    },
+    [this]() { disconnect(); },
+    false
+  ), "influxdb_client.write");
+}
+
+void InfluxDBClient::disconnect()
+{
+  if (not sock_) {
+    return;
+  }
+
+  poller_.remove_fd(sock_->fd_num());
+  closed_sock_ = move(sock_);
+  connecting_ = false;
+  responses_.reset();
+
+  /* resend the posts without a response, in their original order */
+  buffer_offset_ = 0;
+  while (not in_flight_.empty()) {
+    buffer_.emplace_front(move(in_flight_.back()));
+    in_flight_.pop_back();
+  }
+
+  cerr << "InfluxDBClient: disconnected from " << influxdb_addr_.str()
+       << "; reconnecting in " << backoff_ms_ << " ms" << endl;
+
+  reconnect_timer_.start(backoff_ms_);
+  backoff_ms_ = min(backoff_ms_ * 2, MAX_BACKOFF_MS);
+}
+
+void InfluxDBClient::handle_response(const HTTPResponse & response)
+{
+  if (in_flight_.empty()) {
+    throw runtime_error("InfluxDB responded to no write");
+  }
+
+  const string status = response.status_code();
+  if (status.at(0) == '2') {
+    delivered_++;
+  } else if (status.at(0) == '4') {
+    /* the write itself is bad, so retrying would not help */
+    rejected_++;
+    cerr << "InfluxDBClient: write rejected (" << response.first_line()
+         << "): " << response.body() << endl;
+  } else {
+    /* leave the write in flight to be resent after reconnecting */
+    throw runtime_error("InfluxDB failed a write: " + response.first_line());
+  }
+
+  buffer_bytes_ -= in_flight_.front().data.size();
+  in_flight_.pop_front();
+
+  /* InfluxDB is healthy again */
+  backoff_ms_ = MIN_BACKOFF_MS;
 }
 
 void InfluxDBClient::post(const string & payload,
@@ -71,9 +247,108 @@ void InfluxDBClient::post(const string & payload,
   request.add_header(HTTPHeader{"Host", influxdb_addr_.str()});
   request.add_header(HTTPHeader{"Content-Type",
                                 "application/x-www-form-urlencoded"});
-  request.add_header(HTTPHeader{"Content-Length",
-                                to_string(payload.size())});
+
+  const string body = gzip_ ? gzip_compress(payload) : payload;
+  if (gzip_) {
+    request.add_header(HTTPHeader{"Content-Encoding", "gzip"});
+  }
+
+  request.add_header(HTTPHeader{"Content-Length", to_string(body.size())});
   request.done_with_headers();
-  request.read_in_body(payload);
-  buffer_.emplace_back(request.str());
+  request.read_in_body(body);
+  enqueue({request.str(), timestamp_ms()});
+}
+
+void InfluxDBClient::enqueue(Request && request)
+{
+  posted_++;
+
+  const size_t size = request.data.size();
+
+  /* keep the order of posts: once spooling, spool until the spool drains */
+  if ((spool_ and not spool_->empty()) or
+      (buffer_bytes_ > 0 and buffer_bytes_ + size > max_buffer_bytes_)) {
+    if (spool_) {
+      spool_->push(request.posted_ts, request.data);
+    } else {
+      dropped_++;
+      dropped_bytes_ += size;
+    }
+    return;
+  }
+
+  buffer_bytes_ += size;
+  buffer_.emplace_back(move(request));
+}
+
+void InfluxDBClient::refill()
+{
+  /* leave the posts on disk until they can be written */
+  if (not spool_ or not sock_ or connecting_) {
+    return;
+  }
+
+  while (buffer_bytes_ < max_buffer_bytes_ and not spool_->empty()) {
+    auto record = spool_->pop();
+    buffer_bytes_ += record->data.size();
+    buffer_.push_back({move(record->data), record->ts});
+  }
+}
+
+InfluxDBClient::Stats InfluxDBClient::stats() const
+{
+  Stats stats {};
+  stats.posted = posted_;
+  stats.delivered = delivered_;
+  stats.rejected = rejected_;
+  stats.dropped = dropped_;
+  stats.dropped_bytes = dropped_bytes_;
+  stats.reconnects = reconnects_;
+  stats.buffer_bytes = buffer_bytes_;
+
+  if (spool_) {
+    stats.dropped += spool_->dropped_records();
+    stats.dropped_bytes += spool_->dropped_bytes();
+    stats.spool_bytes = spool_->bytes();
+  }
+
+  /* posts are delivered in order, so the oldest one comes first */
+  optional<uint64_t> oldest_ts;
+  if (not in_flight_.empty()) {
+    oldest_ts = in_flight_.front().posted_ts;
+  } else if (not buffer_.empty()) {
+    oldest_ts = buffer_.front().posted_ts;
+  } else if (spool_) {
+    oldest_ts = spool_->front_ts();
+  }
+
+  if (oldest_ts) {
+    const uint64_t now = timestamp_ms();
+    stats.lag_ms = now > *oldest_ts ? now - *oldest_ts : 0;
+  }
+
+  return stats;
+}
+
+bool InfluxDBClient::idle() const
+{
+  return in_flight_.empty() and buffer_.empty()
+         and (not spool_ or spool_->empty());
+}
+
+void InfluxDBClient::post_stats()
+{
+  const Stats s = stats();
+
+  post("influxdb_client,name=" + name_
+       + " posted=" + to_string(s.posted)
+       + "i,delivered=" + to_string(s.delivered)
+       + "i,rejected=" + to_string(s.rejected)
+       + "i,dropped=" + to_string(s.dropped)
+       + "i,dropped_bytes=" + to_string(s.dropped_bytes)
+       + "i,reconnects=" + to_string(s.reconnects)
+       + "i,buffer_bytes=" + to_string(s.buffer_bytes)
+       + "i,spool_bytes=" + to_string(s.spool_bytes)
+       + "i,lag_ms=" + to_string(s.lag_ms)
+       + "i " + to_string(timestamp_ms()));
 }
@@ -1,9 +1,39 @@
 #include <string>
 #include <deque>
+#include <memory>
 
+#include "yaml-cpp/yaml.h"
 #include "socket.hh"
 #include "poller.hh"
+#include "timerfd.hh"
+#include "http_request.hh"
+#include "http_response_parser.hh"
+#include "spool.hh"
 
+struct InfluxDBClientOptions
+{
+  /* if nonempty, tags the stats that the client posts about itself */
+  std::string name {};
+
+  /* posts that have not been delivered are held in memory up to this size */
+  size_t max_buffer_bytes {64 * 1024 * 1024};
+
+  /* beyond that, they spill to a spool in this directory (dropped if empty) */
+  std::string spool_dir {};
+  size_t max_spool_bytes {1024 * 1024 * 1024};
+  size_t spool_segment_bytes {16 * 1024 * 1024};
+};
+
+/* read the optional settings in "influxdb_connection"; the spool lives in
+ * a subdirectory called name */
+InfluxDBClientOptions influxdb_client_options(const YAML::Node & influx,
+                                              const std::string & name);
+
+/* Posts data points to InfluxDB over a persistent HTTP connection. A post is
+ * kept until InfluxDB has responded to it, and resent after reconnecting
+ * (with exponential backoff) if the connection fails. While InfluxDB is down
+ * or slow, posts accumulate in a bounded buffer and then in an on-disk spool,
+ * which is replayed in order once InfluxDB returns. */
 class InfluxDBClient
 {
 public:
@@ -11,19 +41,99 @@ public:
                  const Address & address,
                  const std::string & database,
                  const std::string & user,
-                 const std::string & password);
+                 const std::string & password,
+                 const InfluxDBClientOptions & options = {});
 
   void post(const std::string & payload,
             const std::string & precision = "ms");
 
+  /* compress the payloads of subsequent posts with gzip */
+  void set_gzip(const bool gzip) { gzip_ = gzip; }
+
+  struct Stats
+  {
+    uint64_t posted;
+    uint64_t delivered;
+    uint64_t rejected;       /* refused by InfluxDB with a 4xx status */
+    uint64_t dropped;        /* for lack of buffer or spool space */
+    uint64_t dropped_bytes;
+    uint64_t reconnects;
+    size_t buffer_bytes;
+    size_t spool_bytes;
+    uint64_t lag_ms;         /* age of the oldest post not yet delivered */
+  };
+
+  Stats stats() const;
+
+  /* whether every post has been delivered, rejected or dropped */
+  bool idle() const;
+
 private:
+  struct Request
+  {
+    std::string data;
+    uint64_t posted_ts;  /* in ms */
+  };
+
+  Poller & poller_;
   Address influxdb_addr_ {};
-  TCPSocket sock_ {};
 
   std::string database_ {};
   std::string user_ {};
   std::string password_ {};
 
-  std::deque<std::string> buffer_ {};
+  std::string name_ {};
+  size_t max_buffer_bytes_ {0};
+
+  bool gzip_ {false};
+
+  /* null while disconnected */
+  std::unique_ptr<TCPSocket> sock_ {};
+  bool connecting_ {false};
+
+  /* the last closed socket is kept open until the next connect, so that its
+   * fd number is not reused while the poller still holds actions on it */
+  std::unique_ptr<TCPSocket> closed_sock_ {};
+
+  Timerfd reconnect_timer_ {};
+  int backoff_ms_;
+
+  /* every write is answered in order; responses are matched to in_flight_ */
+  HTTPRequest write_request_ {};
+  std::unique_ptr<HTTPResponseParser> responses_ {};
+
+  /* posts written to InfluxDB and awaiting a response */
+  std::deque<Request> in_flight_ {};
+
+  /* posts waiting to be written */
+  std::deque<Request> buffer_ {};
   size_t buffer_offset_ {0};
+
+  /* bytes in buffer_ and in_flight_ */
+  size_t buffer_bytes_ {0};
+
+  /* newer than everything in buffer_ when not empty */
+  std::unique_ptr<Spool> spool_ {};
+
+  Timerfd stats_timer_ {};
+
+  uint64_t posted_ {0};
+  uint64_t delivered_ {0};
+  uint64_t rejected_ {0};
+  uint64_t dropped_ {0};
+  uint64_t dropped_bytes_ {0};
+  uint64_t reconnects_ {0};
+
+  void connect();
+  void disconnect();
+
+  void enqueue(Request && request);
+
+  /* move posts from the spool into the buffer while there is room */
+  void refill();
+
+  void handle_response(const HTTPResponse & response);
+
+  /* post the stats as a data point of the measurement "influxdb_client" */
+  void post_stats();
 };
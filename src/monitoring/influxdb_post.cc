@@ -0,0 +1,84 @@
+#include <cstdlib>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include "poller.hh"
+#include "file_descriptor.hh"
+#include "strict_conversions.hh"
+#include "influxdb_client.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " <port> <spool dir> <max buffer bytes>\n\n"
+  "Post each line read from stdin to InfluxDB at localhost:<port>, and exit\n"
+  "once stdin is closed and every line has been delivered"
+  << endl;
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  if (argc != 4) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  InfluxDBClientOptions options;
+  options.spool_dir = argv[2];
+  options.max_buffer_bytes = narrow_cast<size_t>(stoull(argv[3]));
+  options.spool_segment_bytes = options.max_buffer_bytes;
+
+  Poller poller;
+  InfluxDBClient influxdb_client(poller, {"127.0.0.1", argv[1]},
+                                 "test", "user", "password", options);
+
+  FileDescriptor input(STDIN_FILENO);
+  string buf;
+
+  auto read_input = [&input, &buf, &influxdb_client]() {
+    buf += input.read();
+
+    size_t pos;
+    while ((pos = buf.find('\n')) != string::npos) {
+      influxdb_client.post(buf.substr(0, pos));
+      buf.erase(0, pos + 1);
+    }
+  };
+
+  poller.add_action(Poller::Action(input, Direction::In,
+    [&read_input]()->Result {
+      read_input();
+      return ResultType::Continue;
+    },
+    [] { return true; },
+    /* the poller drops a pipe on POLLHUP; read what the writer has left */
+    [&input, &read_input]() {
+      while (not input.eof()) {
+        read_input();
+      }
+    }
+  ));
+
+  while (not (input.eof() and influxdb_client.idle())) {
+    auto ret = poller.poll(-1);
+    if (ret.result != Poller::Result::Type::Success) {
+      return ret.exit_status;
+    }
+  }
+
+  const auto stats = influxdb_client.stats();
+  cerr << "posted " << stats.posted << ", delivered " << stats.delivered
+       << ", dropped " << stats.dropped << ", reconnects " << stats.reconnects
+       << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+#include "log_parser.hh"
+
+#include <cstring>
+#include <charconv>
+#include <stdexcept>
+
+#include "timestamp.hh"
+
+using namespace std;
+
+LogParser::LogParser(const string & format_string,
+                     const bool unique_timestamps)
+  : unique_timestamps_(unique_timestamps)
+{
+  formatter_.parse(format_string);
+  measurement_ = format_string.substr(0, format_string.find(','));
+}
+
+size_t LogParser::parse(const string_view buf)
+{
+  size_t start = 0;
+
+  for (;;) {
+    const char * newline = static_cast<const char *>(
+      memchr(buf.data() + start, '\n', buf.size() - start));
+    if (not newline) {
+      break;
+    }
+
+    const size_t end = newline - buf.data();
+    parse_line(buf.substr(start, end - start));
+    start = end + 1;
+  }
+
+  return start;
+}
+
+void LogParser::parse_line(const string_view line)
+{
+  values_.clear();
+
+  size_t start = 0;
+  for (;;) {
+    const size_t comma = line.find(',', start);
+    if (comma == string_view::npos) {
+      values_.emplace_back(line.substr(start));
+      break;
+    }
+
+    values_.emplace_back(line.substr(start, comma - start));
+    start = comma + 1;
+  }
+
+  const size_t point_start = batch_.size();
+  formatter_.format_to(batch_, values_);
+
+  if (unique_timestamps_) {
+    enforce_unique(point_start);
+  }
+
+  batch_ += '\n';
+  batch_lines_++;
+}
+
+void LogParser::enforce_unique(const size_t point_start)
+{
+  const size_t last_space = batch_.rfind(' ');
+  if (last_space == string::npos or last_space < point_start) {
+    throw runtime_error("enforce_unique: no timestamp in " +
+                        batch_.substr(point_start));
+  }
+
+  uint64_t orig_ts_ms;
+  const char * ts_begin = batch_.data() + last_space + 1;
+  const char * ts_end = batch_.data() + batch_.size();
+  const auto [ptr, ec] = from_chars(ts_begin, ts_end, orig_ts_ms);
+  if (ec != errc() or ptr != ts_end) {
+    throw runtime_error("enforce_unique: invalid timestamp " +
+                        batch_.substr(last_space + 1));
+  }
+
+  const uint64_t orig_ts_ns = orig_ts_ms * MILLION;  /* ms -> ns */
+
+  /* pop if ts in ms < orig_new_ts in ms */
+  while (not unique_ns_.empty()) {
+    const auto ts_ns = unique_ns_.front();
+    if (ts_ns / MILLION < orig_ts_ms) {
+      unique_ns_.pop_front();
+    } else {
+      break;
+    }
+  }
+
+  /* increment the last ts in unique_ns_ by 1 ns */
+  uint64_t new_ts_ns = orig_ts_ns;
+  if (not unique_ns_.empty()) {
+    const auto ts_ns = unique_ns_.back();
+
+    if ((ts_ns + 1) / MILLION != orig_ts_ms) {
+      throw runtime_error("enforce_unique: " + to_string(ts_ns) +
+                          ", " + to_string(new_ts_ns));
+    }
+
+    new_ts_ns = ts_ns + 1;
+  }
+  unique_ns_.push_back(new_ts_ns);
+
+  /* the whole batch is in precision ns */
+  batch_.resize(last_space + 1);
+  batch_ += to_string(new_ts_ns);
+}
+
+string LogParser::take_batch()
+{
+  string batch = move(batch_);
+  batch_ = string {};
+  batch_lines_ = 0;
+
+  return batch;
+}
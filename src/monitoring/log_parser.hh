@@ -0,0 +1,59 @@
+#ifndef LOG_PARSER_HH
+#define LOG_PARSER_HH
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+
+#include "formatter.hh"
+
+/* Converts CSV lines in a log into InfluxDB line protocol with a Formatter,
+ * accumulating the data points into a batch to post. Each line is scanned in
+ * place and formatted straight into the batch, in time linear in its length.
+ * With unique timestamps, data points with the same timestamp in ms are
+ * kept apart by incrementing them by 1 ns, and the batch is in precision ns;
+ * otherwise timestamps are left untouched in precision ms. */
+class LogParser
+{
+public:
+  LogParser(const std::string & format_string, const bool unique_timestamps);
+
+  /* parse the complete lines at the front of buf; return the number of bytes
+   * consumed, i.e., up to and including the last newline */
+  size_t parse(const std::string_view buf);
+
+  /* parse a single line without its trailing newline */
+  void parse_line(const std::string_view line);
+
+  std::string measurement() const { return measurement_; }
+
+  /* number of comma-separated values that each line must have at least */
+  size_t num_values() const { return formatter_.num_values(); }
+  std::string precision() const { return unique_timestamps_ ? "ns" : "ms"; }
+
+  size_t batch_bytes() const { return batch_.size(); }
+  size_t batch_lines() const { return batch_lines_; }
+
+  /* return the batch of data points and start a new one */
+  std::string take_batch();
+
+private:
+  Formatter formatter_ {};
+  std::string measurement_ {};
+
+  bool unique_timestamps_;
+  std::deque<uint64_t> unique_ns_ {};
+
+  /* reused for the values of every line */
+  std::vector<std::string_view> values_ {};
+
+  std::string batch_ {};
+  size_t batch_lines_ {0};
+
+  /* rewrite the timestamp (in ms) of the data point at the end of batch_ */
+  void enforce_unique(const size_t point_start);
+};
+
+#endif /* LOG_PARSER_HH */
@@ -2,8 +2,6 @@
 #include <fcntl.h>
 
 #include <iostream>
-#include <vector>
-#include <deque>
 #include <string>
 #include <fstream>
 
@@ -13,17 +11,17 @@
 #include "poller.hh"
 #include "file_descriptor.hh"
 #include "filesystem.hh"
-#include "tokenize.hh"
+#include "timerfd.hh"
 #include "exception.hh"
-#include "formatter.hh"
+#include "log_parser.hh"
 #include "influxdb_client.hh"
-#include "timestamp.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
-/* payload data format to post to DB (a "format string" in a vector) */
-static Formatter formatter;
+/* post a batch once it reaches either threshold */
+static const size_t MAX_BATCH_BYTES = 512 * 1024;  /* 512 KB */
+static const int MAX_BATCH_DELAY_MS = 1000;
 
 void print_usage(const string & program_name)
 {
@@ -32,57 +30,17 @@ void print_usage(const string & program_name)
   << endl;
 }
 
-tuple<string, string> enforce_unique(const string & line,
-                                     deque<uint64_t> & unique_ns)
-{
-  auto last_space = line.rfind(' ');
-  string before_last_space = line.substr(0, last_space);
-  string orig_ts_str = line.substr(last_space + 1);
-
-  const uint64_t orig_ts_ns = stoll(orig_ts_str) * MILLION;  /* ms -> ns */
-
-  /* pop if ts in ms < orig_new_ts in ms */
-  while (not unique_ns.empty()) {
-    const auto ts_ns = unique_ns.front();
-    if (ts_ns / MILLION < orig_ts_ns / MILLION) {
-      unique_ns.pop_front();
-    } else {
-      break;
-    }
-  }
-
-  /* increment the last ts in unique_ns by 1 ns */
-  uint64_t new_ts_ns = orig_ts_ns;
-  if (not unique_ns.empty()) {
-    const auto ts_ns = unique_ns.back();
-
-    if ((ts_ns + 1) / MILLION != new_ts_ns / MILLION) {
-      throw runtime_error("enforce_unique: " + to_string(ts_ns) +
-                          ", " + to_string(new_ts_ns));
-    }
-
-    new_ts_ns = ts_ns + 1;
-  }
-  unique_ns.push_back(new_ts_ns);
-
-  if (new_ts_ns == orig_ts_ns) {
-    /* no duplicate timestamp exists */
-    return make_tuple(line, "ms");
-  } else {
-    /* duplicate timestamp exists; post the incremented timestamp */
-    string new_line = before_last_space + " " + to_string(new_ts_ns);
-    return make_tuple(new_line, "ns");
-  }
-}
-
 int tail_loop(const YAML::Node & config, const string & log_path,
-              const string & measurement)
+              const string & format_string)
 {
+  const string measurement = format_string.substr(0, format_string.find(','));
+
   /* enforce uniqueness for the crucial measurements below */
   bool crucial_measurements = (measurement == "client_buffer" ||
                                measurement == "video_acked" ||
-                               measurement == "video_sent");
-  deque<uint64_t> unique_ns;
+                               measurement == "video_sent" ||
+                               measurement == "video_timeline");
+  LogParser parser(format_string, crucial_measurements);
 
   Poller poller;
   Inotify inotify(poller);
@@ -93,10 +51,31 @@ int tail_loop(const YAML::Node & config, const string & log_path,
       {influx["host"].as<string>(), to_string(influx["port"].as<uint16_t>())},
       influx["dbname"].as<string>(),
       influx["user"].as<string>(),
-      safe_getenv(influx["password"].as<string>()));
+      safe_getenv(influx["password"].as<string>()),
+      influxdb_client_options(influx, fs::path(log_path).stem()));
+  influxdb_client.set_gzip(true);
+
+  auto flush = [&parser, &influxdb_client]() {
+    if (parser.batch_lines() > 0) {
+      influxdb_client.post(parser.take_batch(), parser.precision());
+    }
+  };
+
+  /* post a partial batch at least every MAX_BATCH_DELAY_MS */
+  Timerfd flush_timer;
+  poller.add_action(Poller::Action(flush_timer, Direction::In,
+    [&flush_timer, &flush]()->Result {
+      if (flush_timer.expirations() > 0) {
+        flush();
+      }
+
+      return ResultType::Continue;
+    }
+  ));
+  flush_timer.start(MAX_BATCH_DELAY_MS, MAX_BATCH_DELAY_MS);
 
   bool log_rotated = false;  /* whether log rotation happened */
-  string buf;  /* used to assemble content read from the log into lines */
+  string buf;  /* holds an incomplete line read from the log */
 
   for (;;) {
     FileDescriptor fd(CheckSystemCall("open (" + log_path + ")",
@@ -104,8 +83,7 @@ int tail_loop(const YAML::Node & config, const string & log_path,
     fd.seek(0, SEEK_END);
 
     int wd = inotify.add_watch(log_path, IN_MODIFY | IN_CLOSE_WRITE,
-      [&log_rotated, &buf, &fd, &influxdb_client,
-       crucial_measurements, &unique_ns]
+      [&log_rotated, &buf, &fd, &parser, &flush]
       (const inotify_event & event, const string &) {
         if (event.mask & IN_MODIFY) {
           string new_content = fd.read();
@@ -113,35 +91,21 @@ int tail_loop(const YAML::Node & config, const string & log_path,
             /* return if nothing more to read */
             return;
           }
-          buf += new_content;
-
-          /* find new lines iteratively */
-          size_t pos = 0;
-          string payload;
-
-          while ((pos = buf.find("\n")) != string::npos) {
-            const string & line = buf.substr(0, pos);
-            vector<string> values = split(line, ",");
-
-            /* enforce data uniqueness for crucial measurements */
-            if (crucial_measurements) {
-              auto [new_line, precision] = enforce_unique(
-                  formatter.format(values), unique_ns);
-              if (precision == "ms") {
-                payload += new_line + "\n";
-              } else {
-                /* post data points with other time precisions immediately */
-                influxdb_client.post(new_line, precision);
-              }
-            } else {
-              payload += formatter.format(values) + "\n";
-            }
-
-            buf = buf.substr(pos + 1);
+
+          /* parse complete lines in place and keep the rest */
+          size_t consumed;
+          if (buf.empty()) {
+            consumed = parser.parse(new_content);
+            buf = new_content.substr(consumed);
+          } else {
+            buf += new_content;
+            consumed = parser.parse(buf);
+            buf.erase(0, consumed);
           }
 
-          /* post aggregated lines (with time precision 'ms') */
-          influxdb_client.post(payload);
+          if (parser.batch_bytes() >= MAX_BATCH_BYTES) {
+            flush();
+          }
         } else if (event.mask & IN_CLOSE_WRITE) {
           /* old log was closed; open and watch new log in next loop */
           log_rotated = true;
@@ -188,15 +152,11 @@ int main(int argc, char * argv[])
                        open(log_path.c_str(), O_WRONLY | O_CREAT, 0644)));
   touch.close();
 
-  /* read a line specifying log format and pass into string formatter */
+  /* read a line specifying log format and pass into the log parser */
   ifstream format_ifstream(log_format);
   string format_string;
   getline(format_ifstream, format_string);
-  formatter.parse(format_string);
-
-  auto comma_pos = format_string.find(',');
-  string measurement = format_string.substr(0, comma_pos);
 
   /* read new lines from logs and post to InfluxDB */
-  return tail_loop(config, log_path, measurement);
+  return tail_loop(config, log_path, format_string);
 }
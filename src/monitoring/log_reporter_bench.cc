@@ -0,0 +1,105 @@
+#include <cstdlib>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <chrono>
+
+#include "file_descriptor.hh"
+#include "log_parser.hh"
+#include "gzip.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* same thresholds as log_reporter */
+static const size_t MAX_BATCH_BYTES = 512 * 1024;  /* 512 KB */
+
+void print_usage(const string & program_name)
+{
+  cerr << "Usage: " << program_name << " <log format> [number of lines]"
+       << endl;
+}
+
+/* a synthetic log with the number of columns the format expects; a few lines
+ * share each timestamp to exercise enforcing unique timestamps */
+string make_log(const size_t num_columns, const size_t num_lines)
+{
+  string log;
+  const uint64_t start_ts = 1500000000000;
+
+  for (size_t i = 0; i < num_lines; i++) {
+    log += to_string(start_ts + i / 4);
+
+    for (size_t col = 1; col < num_columns; col++) {
+      log += "," + to_string((i * 7919 + col * 104729) % 100000);
+    }
+
+    log += '\n';
+  }
+
+  return log;
+}
+
+/* feed the log in reads of BUFFER_SIZE like log_reporter does; return the
+ * number of seconds taken */
+double run(LogParser & parser, const string & log, const bool gzip,
+           size_t & batch_bytes, size_t & posted_bytes)
+{
+  batch_bytes = 0;
+  posted_bytes = 0;
+
+  const auto start = steady_clock::now();
+
+  string buf;
+  for (size_t pos = 0; pos < log.size(); pos += BUFFER_SIZE) {
+    buf += log.substr(pos, BUFFER_SIZE);
+    buf.erase(0, parser.parse(buf));
+
+    if (parser.batch_bytes() >= MAX_BATCH_BYTES or
+        pos + BUFFER_SIZE >= log.size()) {
+      const string batch = parser.take_batch();
+      batch_bytes += batch.size();
+      posted_bytes += gzip ? gzip_compress(batch).size() : batch.size();
+    }
+  }
+
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+int main(int argc, char * argv[])
+{
+  if (argc < 1) {
+    abort();
+  }
+
+  if (argc != 2 and argc != 3) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  ifstream format_ifstream(argv[1]);
+  string format_string;
+  getline(format_ifstream, format_string);
+
+  const size_t num_lines = argc == 3 ? stoull(argv[2]) : 1000000;
+
+  for (const bool unique : {false, true}) {
+    for (const bool gzip : {false, true}) {
+      LogParser parser(format_string, unique);
+      const string log = make_log(parser.num_values(), num_lines);
+
+      size_t batch_bytes, posted_bytes;
+      const double seconds = run(parser, log, gzip, batch_bytes, posted_bytes);
+
+      cout << parser.measurement() << " precision=" << parser.precision()
+           << " gzip=" << (gzip ? "on" : "off") << ": "
+           << static_cast<uint64_t>(num_lines / seconds) << " lines/s, "
+           << log.size() / seconds / 1e6 << " MB/s of log, "
+           << batch_bytes << " bytes of points posted as "
+           << posted_bytes << " bytes" << endl;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+#include "spool.hh"
+
+#include <fcntl.h>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "exception.hh"
+
+using namespace std;
+
+/* each record is a header (timestamp and data length) followed by the data */
+static const size_t HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+static const string SEGMENT_EXTENSION = ".seg";
+
+static string make_header(const uint64_t ts, const uint32_t length)
+{
+  string header(HEADER_SIZE, '\0');
+  memcpy(header.data(), &ts, sizeof(ts));
+  memcpy(header.data() + sizeof(ts), &length, sizeof(length));
+  return header;
+}
+
+static void parse_header(const string & header, uint64_t & ts,
+                         uint32_t & length)
+{
+  memcpy(&ts, header.data(), sizeof(ts));
+  memcpy(&length, header.data() + sizeof(ts), sizeof(length));
+}
+
+Spool::Spool(const fs::path & dir, const size_t max_bytes,
+             const size_t segment_bytes)
+  : dir_(dir), max_bytes_(max_bytes), segment_bytes_(segment_bytes)
+{
+  fs::create_directories(dir_);
+  recover();
+}
+
+fs::path Spool::segment_path(const uint64_t seq) const
+{
+  /* zero-pad so that segments sort by name as well */
+  string name = to_string(seq);
+  name.insert(0, 20 - min<size_t>(name.size(), 20), '0');
+  return dir_ / (name + SEGMENT_EXTENSION);
+}
+
+void Spool::recover()
+{
+  vector<uint64_t> seqs;
+  for (const auto & entry : fs::directory_iterator(dir_)) {
+    const fs::path & path = entry.path();
+    if (fs::is_regular_file(path) and path.extension() == SEGMENT_EXTENSION) {
+      seqs.emplace_back(stoull(path.stem().string()));
+    }
+  }
+  sort(seqs.begin(), seqs.end());
+
+  for (const uint64_t seq : seqs) {
+    const string path = segment_path(seq);
+    FileDescriptor fd(CheckSystemCall("open (" + path + ")",
+                                      open(path.c_str(), O_RDONLY)));
+    const uint64_t filesize = fd.filesize();
+
+    /* count the complete records; a record cut short by a crash is ignored */
+    Segment segment {seq, 0, 0, 0};
+    while (segment.bytes + HEADER_SIZE <= filesize) {
+      uint64_t ts;
+      uint32_t length;
+      parse_header(fd.read_exactly(HEADER_SIZE), ts, length);
+
+      if (segment.bytes + HEADER_SIZE + length > filesize) {
+        break;
+      }
+
+      if (segment.records == 0) {
+        segment.front_ts = ts;
+      }
+
+      fd.inc_offset(length);
+      segment.bytes += HEADER_SIZE + length;
+      segment.records++;
+    }
+
+    if (segment.records == 0) {
+      fs::remove(path);
+      continue;
+    }
+
+    records_ += segment.records;
+    bytes_ += segment.bytes;
+    segments_.emplace_back(segment);
+  }
+
+  if (not seqs.empty()) {
+    next_seq_ = seqs.back() + 1;
+  }
+
+  if (records_ > 0) {
+    cerr << "Spool: recovered " << records_ << " records (" << bytes_
+         << " bytes) from " << dir_ << endl;
+  }
+}
+
+void Spool::push(const uint64_t ts, const string_view data)
+{
+  const size_t size = HEADER_SIZE + data.size();
+  if (size > max_bytes_) {
+    dropped_records_++;
+    dropped_bytes_ += size;
+    return;
+  }
+
+  while (bytes_ + size > max_bytes_) {
+    drop_front_segment();
+  }
+
+  /* start a new segment if the last one is full or no longer appendable */
+  if (not writer_ or segments_.back().bytes >= segment_bytes_) {
+    const uint64_t seq = next_seq_++;
+    const string path = segment_path(seq);
+    writer_.emplace(CheckSystemCall("open (" + path + ")",
+        open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)));
+    segments_.push_back({seq, 0, 0, ts});
+  }
+
+  writer_->write(make_header(ts, data.size()));
+  if (not data.empty()) {
+    writer_->write(data);
+  }
+
+  Segment & segment = segments_.back();
+  segment.bytes += size;
+  segment.records++;
+
+  bytes_ += size;
+  records_++;
+}
+
+optional<Spool::Record> Spool::pop()
+{
+  if (segments_.empty()) {
+    return nullopt;
+  }
+
+  Segment & segment = segments_.front();
+
+  if (not reader_) {
+    /* seal the segment being written before reading it */
+    if (segments_.size() == 1) {
+      writer_.reset();
+    }
+
+    const string path = segment_path(segment.seq);
+    reader_.emplace(CheckSystemCall("open (" + path + ")",
+                                    open(path.c_str(), O_RDONLY)));
+  }
+
+  Record record;
+  uint32_t length;
+  parse_header(reader_->read_exactly(HEADER_SIZE), record.ts, length);
+  record.data = reader_->read_exactly(length);
+
+  const size_t size = HEADER_SIZE + length;
+  segment.bytes -= size;
+  segment.records--;
+  bytes_ -= size;
+  records_--;
+
+  if (segment.records == 0) {
+    reader_.reset();
+    fs::remove(segment_path(segment.seq));
+    segments_.pop_front();
+  } else {
+    /* peek at the timestamp of the next record */
+    uint32_t next_length;
+    parse_header(reader_->read_exactly(HEADER_SIZE),
+                 segment.front_ts, next_length);
+    reader_->inc_offset(-static_cast<int64_t>(HEADER_SIZE));
+  }
+
+  return record;
+}
+
+optional<uint64_t> Spool::front_ts() const
+{
+  if (segments_.empty()) {
+    return nullopt;
+  }
+
+  return segments_.front().front_ts;
+}
+
+void Spool::drop_front_segment()
+{
+  if (segments_.empty()) {
+    throw runtime_error("Spool: no segment to drop");
+  }
+
+  const Segment & segment = segments_.front();
+  if (segments_.size() == 1) {
+    writer_.reset();
+  }
+  reader_.reset();
+
+  fs::remove(segment_path(segment.seq));
+
+  dropped_records_ += segment.records;
+  dropped_bytes_ += segment.bytes;
+  records_ -= segment.records;
+  bytes_ -= segment.bytes;
+
+  segments_.pop_front();
+}
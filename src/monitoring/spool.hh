@@ -0,0 +1,80 @@
+#ifndef SPOOL_HH
+#define SPOOL_HH
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <optional>
+
+#include "filesystem.hh"
+#include "file_descriptor.hh"
+
+/* An on-disk FIFO of timestamped records, kept in a directory as a log of
+ * numbered segment files. Records left by a previous process are picked up
+ * on construction. When a push would exceed max_bytes, the oldest segments
+ * are dropped to make room. */
+class Spool
+{
+public:
+  struct Record
+  {
+    uint64_t ts {0};
+    std::string data {};
+  };
+
+  Spool(const fs::path & dir, const size_t max_bytes,
+        const size_t segment_bytes);
+
+  void push(const uint64_t ts, const std::string_view data);
+
+  /* remove and return the oldest record */
+  std::optional<Record> pop();
+
+  bool empty() const { return records_ == 0; }
+  size_t records() const { return records_; }
+  size_t bytes() const { return bytes_; }
+
+  /* timestamp of the oldest record */
+  std::optional<uint64_t> front_ts() const;
+
+  uint64_t dropped_records() const { return dropped_records_; }
+  uint64_t dropped_bytes() const { return dropped_bytes_; }
+
+private:
+  struct Segment
+  {
+    uint64_t seq;
+    size_t bytes;       /* bytes of the records not yet popped */
+    size_t records;     /* records not yet popped */
+    uint64_t front_ts;  /* timestamp of the first record not yet popped */
+  };
+
+  fs::path dir_;
+  size_t max_bytes_;
+  size_t segment_bytes_;
+
+  std::deque<Segment> segments_ {};
+  uint64_t next_seq_ {0};
+
+  /* appends to the last segment; closed before the segment is read */
+  std::optional<FileDescriptor> writer_ {};
+
+  /* reads the first segment */
+  std::optional<FileDescriptor> reader_ {};
+
+  size_t records_ {0};
+  size_t bytes_ {0};
+
+  uint64_t dropped_records_ {0};
+  uint64_t dropped_bytes_ {0};
+
+  fs::path segment_path(const uint64_t seq) const;
+
+  /* scan the segments left in dir_ */
+  void recover();
+
+  void drop_front_segment();
+};
+
+#endif /* SPOOL_HH */
@@ -0,0 +1,133 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "metrics_server.hh"
+
+#include <iostream>
+#include <optional>
+
+#include "exception.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+MetricsServer::MetricsServer(Poller & poller, const Address & address,
+                             const MetricsRegistry & registry)
+  : poller_(poller), registry_(registry)
+{
+  listener_.set_blocking(false);
+  listener_.set_reuseaddr();
+  /* a hot-restarted server binds the port while the old one drains */
+  listener_.set_reuseport();
+  listener_.bind(address);
+  listener_.listen();
+
+  cerr << "Serving metrics on http://" << address.str() << "/metrics" << endl;
+
+  poller_.add_action(Poller::Action(listener_, Direction::In,
+    [this]()->Result {
+      erase_closed_connections();
+
+      /* the scraper may have given up on the connection already */
+      optional<TCPSocket> client = listener_.try_accept();
+      if (not client) {
+        return ResultType::Continue;
+      }
+
+      const uint64_t conn_id = connections_.emplace(move(*client));
+      Connection & conn = connections_.at(conn_id);
+
+      poller_.add_action(Poller::Action(conn.socket, Direction::In,
+        [this, &conn, conn_id]()->Result {
+          const string data = conn.socket.read();
+          if (data.empty()) {
+            close_connection(conn_id);
+            return ResultType::CancelAll;
+          }
+
+          try {
+            conn.parser.parse(data);
+          } catch (const exception & e) {
+            print_exception("metrics_server", e);
+            close_connection(conn_id);
+            return ResultType::CancelAll;
+          }
+
+          if (not conn.parser.empty()) {
+            conn.response = respond(conn.parser.front()).str();
+            conn.parser.pop();
+          }
+
+          return ResultType::Continue;
+        },
+        [&conn]()->bool {
+          return conn.response.empty();
+        },
+        [this, conn_id]() { close_connection(conn_id); },
+        false /* a failed scrape must not fail the server */
+      ), "metrics_server.read");
+
+      poller_.add_action(Poller::Action(conn.socket, Direction::Out,
+        [this, &conn, conn_id]()->Result {
+          string_view response = conn.response;
+          const auto it = conn.socket.write(
+              response.substr(conn.response_offset), false);
+          conn.response_offset = it - response.cbegin();
+
+          if (conn.response_offset == response.size()) {
+            close_connection(conn_id);
+            return ResultType::CancelAll;
+          }
+
+          return ResultType::Continue;
+        },
+        [&conn]()->bool {
+          return not conn.response.empty();
+        },
+        [this, conn_id]() { close_connection(conn_id); },
+        false /* a failed scrape must not fail the server */
+      ), "metrics_server.write");
+
+      return ResultType::Continue;
+    },
+    [] { return true; },
+    []() { cerr << "Stopped serving metrics" << endl; },
+    false /* metrics are not worth failing the server */
+  ), "metrics_server.accept");
+}
+
+HTTPResponse MetricsServer::respond(const HTTPRequest & request) const
+{
+  HTTPResponse response;
+  response.set_request(request);
+
+  string body;
+  if (request.first_line().find("GET /metrics ") == 0) {
+    response.set_first_line("HTTP/1.1 200 OK");
+    response.add_header(HTTPHeader{"Content-Type",
+                                   "text/plain; version=0.0.4"});
+    body = registry_.render();
+  } else {
+    response.set_first_line("HTTP/1.1 404 Not Found");
+  }
+
+  response.add_header(HTTPHeader{"Content-Length", to_string(body.size())});
+  response.add_header(HTTPHeader{"Connection", "close"});
+  response.done_with_headers();
+  response.read_in_body(body);
+  return response;
+}
+
+void MetricsServer::close_connection(const uint64_t connection_id)
+{
+  poller_.remove_fd(connections_.at(connection_id).socket.fd_num());
+  closed_connections_.emplace_back(connection_id);
+}
+
+void MetricsServer::erase_closed_connections()
+{
+  for (const uint64_t connection_id : closed_connections_) {
+    connections_.erase(connection_id);
+  }
+
+  closed_connections_.clear();
+}
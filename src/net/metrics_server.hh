@@ -0,0 +1,54 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef METRICS_SERVER_HH
+#define METRICS_SERVER_HH
+
+#include <string>
+#include <vector>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "slot_map.hh"
+#include "metrics.hh"
+#include "http_request_parser.hh"
+#include "http_response.hh"
+
+/* Serves the metrics of a registry over HTTP ("GET /metrics") from the poller
+ * of the process; each connection is closed after its first response */
+class MetricsServer
+{
+public:
+  MetricsServer(Poller & poller, const Address & address,
+                const MetricsRegistry & registry);
+
+private:
+  struct Connection
+  {
+    TCPSocket socket;
+    HTTPRequestParser parser {};
+
+    std::string response {};
+    size_t response_offset {0};
+
+    Connection(TCPSocket && sock) : socket(std::move(sock)) {}
+  };
+
+  Poller & poller_;
+  const MetricsRegistry & registry_;
+
+  TCPSocket listener_ {};
+
+  /* key: connection ID */
+  SlotMap<Connection> connections_ {};
+
+  /* closed connections are erased upon the next accept: by then the poller
+   * has dropped their actions, as it serves the listener before them */
+  std::vector<uint64_t> closed_connections_ {};
+
+  HTTPResponse respond(const HTTPRequest & request) const;
+
+  void close_connection(const uint64_t connection_id);
+  void erase_closed_connections();
+};
+
+#endif /* METRICS_SERVER_HH */
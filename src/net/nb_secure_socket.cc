@@ -96,6 +96,13 @@ void NBSecureSocket::continue_SSL_accept()
 
 void NBSecureSocket::continue_SSL_write()
 {
+  if (write_buffer_.size() and not front_started_) {
+    front_started_ = true;
+    if (write_callback_) {
+      write_callback_(false);
+    }
+  }
+
   try {
     SecureSocket::write(write_buffer_.size() ? write_buffer_.front() : string(),
                         state_ == State::needs_ssl_read_to_write);
@@ -119,6 +126,13 @@ void NBSecureSocket::continue_SSL_write()
 
   write_buffer_.pop_front();
   state_ = State::ready;
+
+  if (front_started_) {
+    front_started_ = false;
+    if (write_callback_) {
+      write_callback_(true);
+    }
+  }
 }
 
 void NBSecureSocket::continue_SSL_read()
@@ -164,7 +178,19 @@ unsigned int NBSecureSocket::buffer_bytes() const
   return total_bytes;
 }
 
+size_t NBSecureSocket::memory_bytes() const
+{
+  size_t total_bytes = read_buffer_.capacity();
+
+  for (const auto & buffer : write_buffer_) {
+    total_bytes += buffer.capacity();
+  }
+
+  return total_bytes;
+}
+
 void NBSecureSocket::clear_buffer()
 {
   write_buffer_.clear();
+  front_started_ = false;
 }
@@ -5,6 +5,7 @@
 
 #include <string>
 #include <deque>
+#include <functional>
 
 #include "secure_socket.hh"
 
@@ -39,6 +40,10 @@ private:
   std::deque<std::string> write_buffer_ {};
   std::string read_buffer_ {};
 
+  /* whether SSL_write() has been attempted on the front of write_buffer_ */
+  bool front_started_ {false};
+  std::function<void(const bool)> write_callback_ {};
+
 public:
   NBSecureSocket(SecureSocket && sock)
     : SecureSocket(std::move(sock))
@@ -57,8 +62,18 @@ public:
   void ezwrite(std::string && msg) { write_buffer_.emplace_back(move(msg)); };
   unsigned int buffer_bytes() const;
 
+  /* memory held by the read and write buffers */
+  size_t memory_bytes() const;
+
   void clear_buffer();
 
+  /* called with false when SSL_write() is first attempted on a buffer given
+   * to ezwrite(), and with true once the buffer has been written */
+  void set_write_callback(const std::function<void(const bool)> & callback)
+  {
+    write_callback_ = callback;
+  }
+
   bool something_to_write() const { return (write_buffer_.size() > 0); }
   bool something_to_read() const { return (read_buffer_.size() > 0); }
 
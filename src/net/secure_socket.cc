@@ -4,6 +4,8 @@
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <malloc.h>
 
 #include "secure_socket.hh"
 #include "exception.hh"
@@ -53,6 +55,60 @@ public:
     }
 };
 
+/* OpenSSL may allocate from any thread */
+static atomic<size_t> openssl_heap_bytes_ { 0 };
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define OPENSSL_ALLOC_ARGS , const char *, int
+#else
+#define OPENSSL_ALLOC_ARGS
+#endif
+
+static void * counting_malloc( size_t num OPENSSL_ALLOC_ARGS )
+{
+    void * ret = malloc( num );
+    if ( ret ) {
+        openssl_heap_bytes_ += malloc_usable_size( ret );
+    }
+    return ret;
+}
+
+static void * counting_realloc( void * addr, size_t num OPENSSL_ALLOC_ARGS )
+{
+    const size_t old_size = addr ? malloc_usable_size( addr ) : 0;
+    void * ret = realloc( addr, num );
+
+    /* realloc() to zero bytes frees; otherwise a failure keeps addr */
+    if ( ret ) {
+        openssl_heap_bytes_ += malloc_usable_size( ret );
+        openssl_heap_bytes_ -= old_size;
+    } else if ( num == 0 ) {
+        openssl_heap_bytes_ -= old_size;
+    }
+    return ret;
+}
+
+static void counting_free( void * addr OPENSSL_ALLOC_ARGS )
+{
+    if ( addr ) {
+        openssl_heap_bytes_ -= malloc_usable_size( addr );
+    }
+    free( addr );
+}
+
+#undef OPENSSL_ALLOC_ARGS
+
+bool track_openssl_heap()
+{
+    return CRYPTO_set_mem_functions( counting_malloc, counting_realloc,
+                                     counting_free );
+}
+
+size_t openssl_heap_bytes()
+{
+    return openssl_heap_bytes_;
+}
+
 SSL_CTX * initialize_new_context()
 {
     OpenSSL::global_context();
@@ -65,3 +65,11 @@ public:
     void use_certificate_file( const std::string & cert_file );
     void use_private_key_file( const std::string & pkey_file );
 };
+
+/* count the heap memory of OpenSSL (TLS contexts and connections); only
+ * possible before OpenSSL allocates anything, e.g., for a TLS connection to
+ * the database, so return false if it is too late */
+bool track_openssl_heap();
+
+/* bytes allocated by OpenSSL and not freed yet, if tracked */
+size_t openssl_heap_bytes();
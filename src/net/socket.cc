@@ -3,8 +3,12 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <linux/tcp.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
 #include <linux/netfilter_ipv4.h>
 #include <cstring>
+#include <cerrno>
+#include <limits>
 
 #include "socket.hh"
 #include "exception.hh"
@@ -127,6 +131,29 @@ TCPSocket TCPSocket::accept( void )
     return TCPSocket( FileDescriptor( CheckSystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
 }
 
+/* accept a pending connection, if any, as a non-blocking socket */
+optional<TCPSocket> TCPSocket::try_accept( void )
+{
+    register_read();
+
+    while ( true ) {
+        const int fd = ::accept4( fd_num(), nullptr, nullptr,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( fd >= 0 ) {
+            return TCPSocket( FileDescriptor( fd ) );
+        }
+
+        if ( errno == EAGAIN or errno == EWOULDBLOCK ) {
+            return nullopt;
+        }
+
+        /* the peer reset the connection before it could be accepted */
+        if ( errno != ECONNABORTED and errno != EINTR ) {
+            throw unix_error( "accept4" );
+        }
+    }
+}
+
 /* get socket option */
 template <typename option_type>
 socklen_t Socket::getsockopt( const int level, const int option, option_type & option_value ) const
@@ -232,6 +259,14 @@ string TCPSocket::get_congestion_control() const
     return optval;
 }
 
+void TCPSocket::set_max_pacing_rate( const uint64_t rate )
+{
+    /* SO_MAX_PACING_RATE takes a 32-bit value; ~0U means unlimited */
+    const unsigned int optval = rate < numeric_limits<unsigned int>::max() ?
+                                rate : numeric_limits<unsigned int>::max();
+    setsockopt( SOL_SOCKET, SO_MAX_PACING_RATE, optval );
+}
+
 TCPInfo TCPSocket::get_tcp_info() const
 {
   /* get tcp_info from the kernel */
@@ -245,6 +280,14 @@ TCPInfo TCPSocket::get_tcp_info() const
   ret.min_rtt = x.tcpi_min_rtt;
   ret.rtt = x.tcpi_rtt;
   ret.delivery_rate = x.tcpi_delivery_rate;
+  ret.bytes_acked = x.tcpi_bytes_acked;
 
   return ret;
 }
+
+unsigned int TCPSocket::send_queue_bytes() const
+{
+  int bytes = 0;
+  CheckSystemCall( "ioctl SIOCOUTQ", ioctl( fd_num(), SIOCOUTQ, &bytes ) );
+  return bytes;
+}
@@ -4,6 +4,7 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <optional>
 
 #include "address.hh"
 #include "file_descriptor.hh"
@@ -73,24 +74,29 @@ struct TCPInfo
   uint32_t min_rtt;   /* minimum RTT in microsecond */
   uint32_t rtt;       /* RTT in microsecond */
   uint64_t delivery_rate;  /* bytes per second */
+  uint64_t bytes_acked;    /* cumulative bytes acked by the peer */
 };
 
 /* TCP socket */
 class TCPSocket : public Socket
 {
-protected:
-    /* constructor used by accept() and SecureSocket() */
-    TCPSocket( FileDescriptor && fd ) : Socket( std::move( fd ), AF_INET, SOCK_STREAM ) {}
-
 public:
     TCPSocket() : Socket( AF_INET, SOCK_STREAM ) {}
 
+    /* constructor used by accept(), SecureSocket(), and to adopt a socket
+     * inherited from another process (e.g., a listener on hot restart) */
+    TCPSocket( FileDescriptor && fd ) : Socket( std::move( fd ), AF_INET, SOCK_STREAM ) {}
+
     /* mark the socket as listening for incoming connections */
     void listen( const int backlog = 16 );
 
     /* accept a new incoming connection */
     TCPSocket accept( void );
 
+    /* accept a pending connection, if any, as a non-blocking socket
+       (the listening socket must be non-blocking) */
+    std::optional<TCPSocket> try_accept( void );
+
     /* original destination of a DNAT connection */
     Address original_dest( void ) const;
 
@@ -103,7 +109,13 @@ public:
     /* get the current congestion control algorithm */
     std::string get_congestion_control() const;
 
+    /* cap the pacing rate of the socket (bytes per second) */
+    void set_max_pacing_rate( const uint64_t rate );
+
     TCPInfo get_tcp_info() const;
+
+    /* bytes written to the socket but not acked yet (sent or not) */
+    unsigned int send_queue_bytes() const;
 };
 
 #endif /* SOCKET_HH */
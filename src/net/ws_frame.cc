@@ -180,6 +180,8 @@ string WSFrame::to_string() const
     for (size_t i = 0; i < payload_.length(); i++) {
       masked_payload.push_back(payload_[i] ^ mk[i % 4]);
     }
+
+    output += masked_payload;
   }
   else {
     output += payload_;
@@ -60,3 +60,14 @@ void WSMessageParser::parse(const string & buf)
     }
   }
 }
+
+size_t WSMessageParser::buffered_bytes() const
+{
+  size_t total_bytes = raw_buffer_.capacity();
+
+  for (const auto & frame : frame_buffer_) {
+    total_bytes += frame.payload().capacity();
+  }
+
+  return total_bytes;
+}
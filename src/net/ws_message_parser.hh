@@ -26,6 +26,9 @@ public:
   WSMessage & front() { return complete_messages_.front(); }
 
   void pop() { complete_messages_.pop(); }
+
+  /* memory held by incomplete frames and messages */
+  size_t buffered_bytes() const;
 };
 
 #endif /* WS_MESSAGE_PARSER_HH */
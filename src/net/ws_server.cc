@@ -2,7 +2,6 @@
 
 #include "ws_server.hh"
 
-#include <iostream>
 #include <stdexcept>
 #include <crypto++/sha.h>
 #include <crypto++/hex.h>
@@ -10,6 +9,8 @@
 
 #include "http_response.hh"
 #include "exception.hh"
+#include "timestamp.hh"
+#include "logger.hh"
 
 using namespace std;
 using namespace PollerShortNames;
@@ -22,7 +23,7 @@ bool is_valid_handshake_request(const HTTPRequest & request)
   string first_line = request.first_line();
 
   if (first_line.substr(0, 3) != "GET") {
-    cerr << "Invalid WebSocket request: method must be GET" << endl;
+    LOG_WARNING << "Invalid WebSocket request: method must be GET";
     return false;
   }
 
@@ -31,25 +32,25 @@ bool is_valid_handshake_request(const HTTPRequest & request)
 
   if (first_line.substr(last_space + 1) != "HTTP/1.1" and
       first_line.substr(last_space + 1) != "HTTP/2") {
-    cerr << "Invalid WebSocket request: only allow HTTP/1.1 and HTTP/2" << endl;
+    LOG_WARNING << "Invalid WebSocket request: only allow HTTP/1.1 and HTTP/2";
     return false;
   }
 
   if (not request.has_header("Connection") or
       request.get_header_value("Connection").find("Upgrade") == string::npos) {
-    cerr << "Invalid WebSocket request: 'Connection: Upgrade' is required" << endl;
+    LOG_WARNING << "Invalid WebSocket request: 'Connection: Upgrade' is required";
     return false;
   }
 
   if (not request.has_header("Upgrade") or
       request.get_header_value("Upgrade") != "websocket") {
-    cerr << "Invalid WebSocket request: 'Upgrade: websocket' is required" << endl;
+    LOG_WARNING << "Invalid WebSocket request: 'Upgrade: websocket' is required";
     return false;
   }
 
   /* require Sec-WebSocket-Key to protect against abuse */
   if (not request.has_header("Sec-WebSocket-Key")) {
-    cerr << "Invalid WebSocket request: 'Sec-WebSocket-Key' is required" << endl;
+    LOG_WARNING << "Invalid WebSocket request: 'Sec-WebSocket-Key' is required";
     return false;
   }
 
@@ -101,16 +102,36 @@ HTTPResponse create_handshake_response(const HTTPRequest & request)
 }
 
 template<>
-WSServer<TCPSocket>::Connection::Connection(TCPSocket && sock, SSLContext &)
-  : socket(move(sock))
+WSServer<TCPSocket>::Connection::Connection(TCPSocket && sock, SSLContext &,
+                                            size_t & server_queued_bytes_ref)
+  : socket(move(sock)), server_queued_bytes(server_queued_bytes_ref)
 {}
 
 template<>
 WSServer<NBSecureSocket>::Connection::Connection(TCPSocket && sock,
-                                                 SSLContext & ssl_context)
-  : socket(ssl_context.new_secure_socket(move(sock)))
+                                                 SSLContext & ssl_context,
+                                                 size_t & server_queued_bytes_ref)
+  : socket(ssl_context.new_secure_socket(move(sock))),
+    server_queued_bytes(server_queued_bytes_ref)
 {
   socket.accept();
+
+  socket.set_write_callback(
+    [this](const bool complete) {
+      if (socket_tags.empty()) {
+        return;
+      }
+
+      const uint64_t tag = socket_tags.front();
+      if (complete) {
+        socket_tags.pop_front();
+      }
+
+      if (tag and frame_written) {
+        frame_written(tag, complete);
+      }
+    }
+  );
 }
 
 template<>
@@ -125,37 +146,160 @@ string WSServer<NBSecureSocket>::Connection::read()
   return socket.ezread();
 }
 
+template<class SocketType>
+void WSServer<SocketType>::Connection::push_frame(string && data,
+                                                  const Priority priority,
+                                                  const uint64_t tag)
+{
+  queued_bytes += data.size();
+  server_queued_bytes += data.size();
+
+  send_queues.at(static_cast<size_t>(priority)).push_back(
+    {move(data), timestamp_us(), tag});
+}
+
+template<class SocketType>
+optional<size_t> WSServer<SocketType>::Connection::next_queue() const
+{
+  /* finish the partially written frame first */
+  if (send_buffer_offset > 0) {
+    return partial_queue;
+  }
+
+  for (size_t i = 0; i < send_queues.size(); i++) {
+    if (not send_queues[i].empty()) {
+      return i;
+    }
+  }
+
+  return nullopt;
+}
+
+template<class SocketType>
+void WSServer<SocketType>::Connection::pop_frame(const size_t queue,
+                                                 QueueDelays & delays)
+{
+  auto & frames = send_queues.at(queue);
+  const uint64_t now = timestamp_us();
+  const uint64_t delay = now - min(now, frames.front().queued_ts);
+
+  QueueDelayStats & stats = delays.at(queue);
+  stats.frames++;
+  stats.total_us += delay;
+  stats.max_us = max(stats.max_us, delay);
+
+  queued_bytes -= frames.front().data.size();
+  server_queued_bytes -= frames.front().data.size();
+  frames.pop_front();
+}
+
 template<>
-void WSServer<TCPSocket>::Connection::write()
+size_t WSServer<TCPSocket>::Connection::write(const size_t quantum,
+                                              QueueDelays & delays)
 {
-  while (not send_buffer.empty()) {
-    const string & buffer = send_buffer.front();
+  send_deficit += quantum;
+  size_t written = 0;
+
+  optional<size_t> queue;
+  while (send_deficit > 0 and (queue = next_queue())) {
+    const string & buffer = send_queues[*queue].front().data;
+    const uint64_t tag = send_queues[*queue].front().tag;
+    const bool first_write = send_buffer_offset == 0;
 
     /* need to convert to string_view iterator to avoid copy */
     string_view buffer_view = buffer;
+    string_view to_write = buffer_view.substr(send_buffer_offset, send_deficit);
 
     /* set write_all to false because socket might be unable to write all */
-    const auto view_it = socket.write(
-        buffer_view.substr(send_buffer_offset), false);
+    const auto view_it = socket.write(to_write, false);
+    send_deficit -= view_it - to_write.cbegin();
+    written += view_it - to_write.cbegin();
 
-    if (view_it != buffer_view.cend()) {
-      /* save the offset of the remaining string */
-      send_buffer_offset = view_it - buffer_view.cbegin();
+    if (tag and first_write and view_it != to_write.cbegin() and
+        frame_written) {
+      frame_written(tag, false);
+    }
+
+    if (view_it != to_write.cend()) {
+      /* socket is unable to write more; credit left unused because of a
+       * slow socket must not build up into a burst once it drains */
+      send_buffer_offset += view_it - to_write.cbegin();
+      partial_queue = *queue;
+      send_deficit = 0;
       break;
+    } else if (send_buffer_offset + to_write.size() < buffer.size()) {
+      /* out of deficit; resume from the saved offset in the next round */
+      send_buffer_offset += to_write.size();
+      partial_queue = *queue;
     } else {
-      /* move onto the next item in the deque */
+      /* move onto the next frame */
       send_buffer_offset = 0;
-      send_buffer.pop_front();
+      pop_frame(*queue, delays);
+
+      if (tag and frame_written) {
+        frame_written(tag, true);
+      }
     }
   }
+
+  /* an idle connection must not accumulate credit */
+  if (not data_to_write()) {
+    send_deficit = 0;
+  }
+
+  return written;
 }
 
 template<>
-void WSServer<NBSecureSocket>::Connection::write()
+size_t WSServer<NBSecureSocket>::Connection::write(const size_t quantum,
+                                                   QueueDelays & delays)
 {
-  while (not send_buffer.empty()) {
-    socket.ezwrite(move(send_buffer.front()));
-    send_buffer.pop_front();
+  send_deficit += quantum;
+  size_t written = 0;
+
+  /* hand whole frames to NBSecureSocket, which only asks for more data once
+   * it has written out everything it holds; it must be given at least one
+   * frame even if the frame is larger than the deficit */
+  optional<size_t> queue;
+  while ((queue = next_queue())) {
+    string & frame = send_queues[*queue].front().data;
+    if (frame.size() > send_deficit and socket.something_to_write()) {
+      break;
+    }
+
+    send_deficit -= min(frame.size(), send_deficit);
+    written += frame.size();
+    string data = move(frame);
+    socket_tags.push_back(send_queues[*queue].front().tag);
+    pop_frame(*queue, delays);
+    socket.ezwrite(move(data));
+  }
+
+  /* an idle connection must not accumulate credit, nor may one held back
+   * by NBSecureSocket bank more than a quantum, which would build up into
+   * a burst once the socket drains */
+  if (not data_to_write()) {
+    send_deficit = 0;
+  } else {
+    send_deficit = min(send_deficit, quantum);
+  }
+
+  return written;
+}
+
+template<class SocketType>
+void WSServer<SocketType>::write_connection(Connection & conn)
+{
+  const uint64_t write_start_ns =
+    socket_cpu_accounting_ ? thread_cpu_ns() : 0;
+  const size_t written = conn.write(send_quantum_, queue_delays_);
+  if (socket_cpu_accounting_) {
+    conn.socket_cpu_ns += thread_cpu_ns() - write_start_ns;
+  }
+
+  bytes_written_ += written;
+  if (bytes_sent_) {
+    bytes_sent_->inc(written);
   }
 }
 
@@ -170,184 +314,219 @@ void WSServer<SocketType>::init_listener_socket()
   listener_socket_.bind(listener_addr_);
   listener_socket_.listen();
 
+  add_accept_action();
+}
+
+template<class SocketType>
+void WSServer<SocketType>::add_accept_action()
+{
   poller_.add_action(Poller::Action(listener_socket_, Direction::In,
     [this]()->ResultType
     {
-      TCPSocket client = listener_socket_.accept();
-      client.set_blocking(false);
-
-      const uint64_t conn_id = last_connection_id_++;
-      connections_.emplace(piecewise_construct,
-                           forward_as_tuple(conn_id),
-                           forward_as_tuple(move(client), ssl_context_));
-      Connection & conn = connections_.at(conn_id);
-
-      /* add the actions for this connection */
-      poller_.add_action(Poller::Action(conn.socket, Direction::In,
-        [this, &conn, conn_id]()->ResultType
-        {
-          const string data = conn.read();
-
-          if (data.empty()) {
-            /* peer socket is gone */
+      /* drain the accept queue up to a batch per round, so that a burst of
+       * (re)connections does not overflow the backlog */
+      for (unsigned int i = 0; i < accept_batch_; i++) {
+        optional<TCPSocket> client = listener_socket_.try_accept();
+        if (not client) {
+          break;
+        }
+
+        add_connection(move(*client));
+      }
+
+      return ResultType::Continue;
+    }
+  ), "ws_server.accept");
+}
+
+template<class SocketType>
+void WSServer<SocketType>::add_connection(TCPSocket && client)
+{
+  const uint64_t conn_id = connections_.emplace(move(client), ssl_context_,
+                                                queued_bytes_);
+  Connection & conn = connections_.at(conn_id);
+  conn.accept_ts = timestamp_us();
+  conn.frame_written = [this, conn_id](const uint64_t tag,
+                                       const bool last_byte) {
+    if (frame_write_callback_) {
+      frame_write_callback_(conn_id, tag, last_byte);
+    }
+  };
+
+  /* add the actions for this connection */
+  poller_.add_action(Poller::Action(conn.socket, Direction::In,
+    [this, &conn, conn_id]()->ResultType
+    {
+      const uint64_t read_start_ns =
+        socket_cpu_accounting_ ? thread_cpu_ns() : 0;
+      const string data = conn.read();
+      if (socket_cpu_accounting_) {
+        conn.socket_cpu_ns += thread_cpu_ns() - read_start_ns;
+      }
+
+      if (data.empty()) {
+        /* peer socket is gone */
+        force_close_connection(conn_id);
+        return ResultType::CancelAll;
+      }
+
+      /* NBSecureSocket has completed the TLS handshake by now */
+      if (conn.accept_ts) {
+        if (handshake_seconds_) {
+          handshake_seconds_->observe(
+              (timestamp_us() - conn.accept_ts) / 1e6);
+        }
+        conn.accept_ts = 0;
+      }
+
+      if (conn.state == Connection::State::NotConnected) {
+        try {
+          conn.ws_handshake_parser.parse(data);
+        } catch (const exception & e) {
+          /* close the connection if received an invalid message */
+          print_exception("ws_server", e);
+          force_close_connection(conn_id);
+          return ResultType::CancelAll;
+        }
+
+        while (not conn.ws_handshake_parser.empty()) {
+          auto request = move(conn.ws_handshake_parser.front());
+          conn.ws_handshake_parser.pop();
+
+          const auto & response = create_handshake_response(request);
+          conn.push_frame(response.str(), Priority::High, 0);
+
+          /* only continue with status code of 101 */
+          if (response.status_code() != "101") {
+            /* TODO: response will not reach the client side currently */
             force_close_connection(conn_id);
             return ResultType::CancelAll;
           }
 
-          if (conn.state == Connection::State::NotConnected) {
-            try {
-              conn.ws_handshake_parser.parse(data);
-            } catch (const exception & e) {
-              /* close the connection if received an invalid message */
-              print_exception("ws_server", e);
-              force_close_connection(conn_id);
-              return ResultType::CancelAll;
-            }
-
-            while (not conn.ws_handshake_parser.empty()) {
-              auto request = move(conn.ws_handshake_parser.front());
-              conn.ws_handshake_parser.pop();
-
-              const auto & response = create_handshake_response(request);
-              conn.send_buffer.emplace_back(response.str());
-
-              /* only continue with status code of 101 */
-              if (response.status_code() != "101") {
-                /* TODO: response will not reach the client side currently */
-                force_close_connection(conn_id);
-                return ResultType::CancelAll;
-              }
-
-              conn.state = Connection::State::Connecting;
-            }
-          }
-          else if (conn.state == Connection::State::Connected) {
-            try {
-              conn.ws_message_parser.parse(data);
-            } catch (const exception & e) {
-              /* close the connection if received an invalid message */
-              print_exception("ws_server", e);
-              wait_close_connection(conn_id);
-            }
-
-            while (not conn.ws_message_parser.empty()) {
-              WSMessage message = move(conn.ws_message_parser.front());
-              conn.ws_message_parser.pop();
-
-              switch (message.type()) {
-              case WSMessage::Type::Text:
-              case WSMessage::Type::Binary:
-                message_callback_(conn_id, message);
-                break;
-
-              case WSMessage::Type::Close:
-              {
-                /* respond to client-initiated close */
-                WSFrame close_frame { true, WSFrame::OpCode::Close,
-                                      message.payload() };
-                queue_frame(conn_id, close_frame);
-                force_close_connection(conn_id);
-                return ResultType::CancelAll;
-              }
-
-              case WSMessage::Type::Ping:
-              {
-                WSFrame pong { true, WSFrame::OpCode::Pong, "" };
-                queue_frame(conn_id, pong);
-                break;
-              }
-
-              case WSMessage::Type::Pong:
-                break;
-
-              default:
-                assert(false);  /* will not happen */
-                break;
-              }
-            }
-          }
-          else if (conn.state == Connection::State::Closing) {
-            try {
-              conn.ws_message_parser.parse(data);
-            } catch (const exception & e) {
-              /* close the connection if received an invalid message */
-              print_exception("ws_server", e);
-              force_close_connection(conn_id);
-              return ResultType::CancelAll;
-            }
-
-            while (not conn.ws_message_parser.empty()) {
-              WSMessage message = move(conn.ws_message_parser.front());
-              conn.ws_message_parser.pop();
-
-              switch (message.type()) {
-              case WSMessage::Type::Close:
-                /* complete server-initiated close */
-                force_close_connection(conn_id);
-                return ResultType::CancelAll;
-
-              default:
-                /* all the other message types are ignored */
-                break;
-              }
-            }
-          } else {
-            cerr << "Invalid conn.state = " << (int) conn.state << endl;
+          conn.state = Connection::State::Connecting;
+        }
+      }
+      else if (conn.state == Connection::State::Connected) {
+        try {
+          conn.ws_message_parser.parse(data);
+        } catch (const exception & e) {
+          /* close the connection if received an invalid message */
+          print_exception("ws_server", e);
+          wait_close_connection(conn_id);
+        }
+
+        while (not conn.ws_message_parser.empty()) {
+          WSMessage message = move(conn.ws_message_parser.front());
+          conn.ws_message_parser.pop();
+
+          switch (message.type()) {
+          case WSMessage::Type::Text:
+          case WSMessage::Type::Binary:
+            message_callback_(conn_id, message);
+            break;
+
+          case WSMessage::Type::Close:
+          {
+            /* respond to client-initiated close */
+            queue_close_frame(conn_id, message.payload());
             force_close_connection(conn_id);
             return ResultType::CancelAll;
           }
 
-          return ResultType::Continue;
-        },
-        [&conn]()->bool
-        {
-          return (conn.state != Connection::State::Connecting) and
-                 (conn.state != Connection::State::Closed);
-        }
-      ));
-
-      poller_.add_action(Poller::Action(conn.socket, Direction::Out,
-        [this, &conn, conn_id]()->ResultType
-        {
-          if (conn.state == Connection::State::Connecting) {
-            if (conn.data_to_write()) {
-              conn.write();
-            }
-
-            if (not conn.data_to_write()) {
-              /* if we've sent the whole handshake response */
-              conn.state = Connection::State::Connected;
-              open_callback_(conn_id);
-            }
+          case WSMessage::Type::Ping:
+          {
+            WSFrame pong { true, WSFrame::OpCode::Pong, "" };
+            queue_frame(conn_id, pong);
+            break;
           }
-          else if ((conn.state == Connection::State::Connected or
-                    conn.state == Connection::State::Closing or
-                    conn.state == Connection::State::Closed) and
-                   conn.data_to_write()) {
-            conn.write();
+
+          case WSMessage::Type::Pong:
+            break;
+
+          default:
+            assert(false);  /* will not happen */
+            break;
           }
+        }
+      }
+      else if (conn.state == Connection::State::Closing) {
+        try {
+          conn.ws_message_parser.parse(data);
+        } catch (const exception & e) {
+          /* close the connection if received an invalid message */
+          print_exception("ws_server", e);
+          force_close_connection(conn_id);
+          return ResultType::CancelAll;
+        }
 
-          if (conn.state == Connection::State::Closed and
-              not conn.data_to_write()) {
+        while (not conn.ws_message_parser.empty()) {
+          WSMessage message = move(conn.ws_message_parser.front());
+          conn.ws_message_parser.pop();
+
+          switch (message.type()) {
+          case WSMessage::Type::Close:
+            /* complete server-initiated close */
             force_close_connection(conn_id);
             return ResultType::CancelAll;
+
+          default:
+            /* all the other message types are ignored */
+            break;
           }
+        }
+      } else {
+        LOG_ERROR << "Invalid conn.state = " << (int) conn.state;
+        force_close_connection(conn_id);
+        return ResultType::CancelAll;
+      }
 
-          return ResultType::Continue;
-        },
-        [&conn]()->bool
-        {
-          return (conn.state == Connection::State::Connecting) or
-                 ((conn.state == Connection::State::Connected or
-                   conn.state == Connection::State::Closing or
-                   conn.state == Connection::State::Closed) and
-                  conn.interested_in_sending());
+      return ResultType::Continue;
+    },
+    [&conn]()->bool
+    {
+      return (conn.state != Connection::State::Connecting) and
+             (conn.state != Connection::State::Closed);
+    }
+  ), "ws_server.read");
+
+  poller_.add_action(Poller::Action(conn.socket, Direction::Out,
+    [this, &conn, conn_id]()->ResultType
+    {
+      if (conn.state == Connection::State::Connecting) {
+        if (conn.data_to_write()) {
+          write_connection(conn);
+        }
+
+        if (not conn.data_to_write()) {
+          /* if we've sent the whole handshake response */
+          conn.state = Connection::State::Connected;
+          open_callback_(conn_id);
         }
-      ));
+      }
+      else if ((conn.state == Connection::State::Connected or
+                conn.state == Connection::State::Closing or
+                conn.state == Connection::State::Closed) and
+               conn.data_to_write()) {
+        write_connection(conn);
+      }
+
+      if (conn.state == Connection::State::Closed and
+          not conn.data_to_write()) {
+        force_close_connection(conn_id);
+        return ResultType::CancelAll;
+      }
 
       return ResultType::Continue;
+    },
+    [&conn]()->bool
+    {
+      return (conn.state == Connection::State::Connecting) or
+             ((conn.state == Connection::State::Connected or
+               conn.state == Connection::State::Closing or
+               conn.state == Connection::State::Closed) and
+              conn.interested_in_sending());
     }
-  ));
+  ), "ws_server.write");
 }
 
 template<class SocketType>
@@ -359,56 +538,129 @@ WSServer<SocketType>::WSServer(const Address & listener_addr,
   init_listener_socket();
 }
 
+template<class SocketType>
+WSServer<SocketType>::WSServer(TCPSocket && listener_socket,
+                               const string & congestion_control)
+  : listener_socket_(move(listener_socket))
+{
+  listener_addr_ = listener_socket_.local_address();
+  congestion_control_ = congestion_control;
+
+  /* the inherited listener is already bound, listening and non-blocking */
+  add_accept_action();
+}
+
+template<class SocketType>
+void WSServer<SocketType>::stop_listening()
+{
+  poller_.remove_fd(listener_socket_.fd_num());
+}
+
 template<class SocketType>
 bool WSServer<SocketType>::queue_frame(const uint64_t connection_id,
-                                       const WSFrame & frame)
+                                       const WSFrame & frame,
+                                       const Priority priority,
+                                       const uint64_t tag)
 {
   Connection & conn = connections_.at(connection_id);
 
   if (conn.state != Connection::State::Connected) {
-    cerr << connection_id << ": not connected; cannot queue frame" << endl;
+    LOG_WARNING << connection_id << ": not connected; cannot queue frame";
     return false;
   }
 
   /* frame.to_string() inevitably copies frame.payload_ into the return string,
-   * but the return string will be moved into conn.send_buffer without copy */
-  conn.send_buffer.emplace_back(frame.to_string());
+   * but the return string will be moved into conn.send_queues without copy */
+  const size_t queued_bytes_before = queued_bytes_;
+  conn.push_frame(frame.to_string(), priority, tag);
+  peak_queued_bytes_ = max(peak_queued_bytes_, queued_bytes_);
+
+  if (bytes_queued_) {
+    bytes_queued_->inc(queued_bytes_ - queued_bytes_before);
+  }
+
   return true;
 }
 
+template<class SocketType>
+size_t WSServer<SocketType>::cancel_frames(const uint64_t connection_id,
+                                           const Priority priority)
+{
+  Connection & conn = connections_.at(connection_id);
+  const size_t queue = static_cast<size_t>(priority);
+  auto & frames = conn.send_queues.at(queue);
+
+  /* a closing connection flushes everything up to its Close frame */
+  if (conn.state != Connection::State::Connected) {
+    return 0;
+  }
+
+  /* a partially written frame must be completed */
+  auto first = frames.begin();
+  if (conn.send_buffer_offset > 0 and conn.partial_queue == queue) {
+    first++;
+  }
+
+  size_t cancelled_bytes = 0;
+  for (auto it = first; it != frames.end(); it++) {
+    cancelled_bytes += it->data.size();
+  }
+
+  frames.erase(first, frames.end());
+  conn.queued_bytes -= cancelled_bytes;
+  queued_bytes_ -= cancelled_bytes;
+
+  return cancelled_bytes;
+}
+
+template<class SocketType>
+size_t WSServer<SocketType>::queued_frames(const uint64_t connection_id,
+                                           const Priority priority) const
+{
+  return connections_.at(connection_id).send_queues
+         .at(static_cast<size_t>(priority)).size();
+}
+
 template<class SocketType>
 void WSServer<SocketType>::wait_close_connection(const uint64_t connection_id)
 {
-  auto conn_it = connections_.find(connection_id);
+  Connection * conn = connections_.find(connection_id);
   /* do nothing if the connection no longer exists */
-  if (conn_it == connections_.end()) {
+  if (not conn) {
     return;
   }
 
-  auto & conn = conn_it->second;
-  if (conn.state != Connection::State::Connected) {
-    cerr << "Warning: wait_close_connection is called but not connected" << endl;
+  if (conn->state != Connection::State::Connected) {
+    LOG_WARNING << "wait_close_connection is called but not connected";
     return;
   }
 
   /* try to close the connection gracefully */
-  WSFrame close_frame { true, WSFrame::OpCode::Close, "" };
-  queue_frame(connection_id, close_frame);
-  conn.state = Connection::State::Closing;
+  queue_close_frame(connection_id, "");
+  conn->state = Connection::State::Closing;
+}
+
+template<class SocketType>
+void WSServer<SocketType>::queue_close_frame(const uint64_t connection_id,
+                                             const string & payload)
+{
+  /* no data frame may follow Close (RFC 6455, Section 5.5.1): frames of the
+   * lowest priority are sent last, and none is queued once closing */
+  WSFrame close_frame { true, WSFrame::OpCode::Close, payload };
+  queue_frame(connection_id, close_frame, Priority::Low);
 }
 
 template<class SocketType>
 void WSServer<SocketType>::force_close_connection(const uint64_t connection_id)
 {
-  auto conn_it = connections_.find(connection_id);
+  Connection * conn = connections_.find(connection_id);
   /* do nothing if the connection no longer exists */
-  if (conn_it == connections_.end()) {
+  if (not conn) {
     return;
   }
 
-  auto & conn = conn_it->second;
-  conn.state = Connection::State::Closed;
-  closed_connections_.insert(connection_id);
+  conn->state = Connection::State::Closed;
+  closed_connections_.emplace_back(connection_id);
   close_callback_(connection_id);
 }
 
@@ -421,19 +673,17 @@ void WSServer<SocketType>::close_connection(const uint64_t connection_id)
 template<class SocketType>
 void WSServer<SocketType>::clean_idle_connection(const uint64_t connection_id)
 {
-  auto conn_it = connections_.find(connection_id);
+  Connection * conn = connections_.find(connection_id);
   /* do nothing if the connection no longer exists */
-  if (conn_it == connections_.end()) {
+  if (not conn) {
     return;
   }
 
-  auto & conn = conn_it->second;
-
   /* deregister the socket in the connection from the poller */
-  poller_.remove_fd(conn.socket.fd_num());
+  poller_.remove_fd(conn->socket.fd_num());
 
-  conn.state = Connection::State::Closed;
-  closed_connections_.insert(connection_id);
+  conn->state = Connection::State::Closed;
+  closed_connections_.emplace_back(connection_id);
   close_callback_(connection_id);
 }
 
@@ -445,6 +695,30 @@ TCPInfo WSServer<SocketType>::get_tcp_info(const uint64_t connection_id) const
   return conn.socket.get_tcp_info();
 }
 
+template<class SocketType>
+uint64_t WSServer<SocketType>::take_socket_cpu_ns(const uint64_t connection_id)
+{
+  Connection & conn = connections_.at(connection_id);
+
+  const uint64_t ret = conn.socket_cpu_ns;
+  conn.socket_cpu_ns = 0;
+  return ret;
+}
+
+template<class SocketType>
+unsigned int WSServer<SocketType>::send_queue_bytes(
+    const uint64_t connection_id) const
+{
+  return connections_.at(connection_id).socket.send_queue_bytes();
+}
+
+template<class SocketType>
+void WSServer<SocketType>::set_pacing_rate(const uint64_t connection_id,
+                                           const uint64_t rate)
+{
+  connections_.at(connection_id).socket.set_max_pacing_rate(rate);
+}
+
 template<class SocketType>
 Address WSServer<SocketType>::peer_addr(const uint64_t connection_id) const
 {
@@ -456,38 +730,26 @@ Address WSServer<SocketType>::peer_addr(const uint64_t connection_id) const
 template<>
 bool WSServer<TCPSocket>::Connection::interested_in_sending() const
 {
-  return send_buffer.size() > 0;
+  return data_to_write();
 }
 
 template<>
 bool WSServer<NBSecureSocket>::Connection::interested_in_sending() const
 {
-  return send_buffer.size() > 0 or socket.something_to_write();
+  return data_to_write() or socket.something_to_write();
 }
 
 template<>
 unsigned int WSServer<TCPSocket>::Connection::buffer_bytes() const
 {
-  unsigned int total_bytes = 0;
-  for (const auto & buffer : send_buffer) {
-    total_bytes += buffer.size();
-  }
-
-  return total_bytes;
+  return queued_bytes;
 }
 
 template<>
 unsigned int WSServer<NBSecureSocket>::Connection::buffer_bytes() const
 {
-  unsigned int total_bytes = 0;
-  for (const auto & buffer : send_buffer) {
-    total_bytes += buffer.size();
-  }
-
   /* NBSecureSocket maintains another buffer by itself */
-  total_bytes += socket.buffer_bytes();
-
-  return total_bytes;
+  return queued_bytes + socket.buffer_bytes();
 }
 
 template<class SocketType>
@@ -499,14 +761,85 @@ unsigned int WSServer<SocketType>::buffer_bytes(const uint64_t conn_id) const
 template<>
 void WSServer<TCPSocket>::Connection::clear_buffer()
 {
-  send_buffer.clear();
+  /* keep the partially written frame to not corrupt the WebSocket stream */
+  for (size_t i = 0; i < send_queues.size(); i++) {
+    if (send_buffer_offset > 0 and i == partial_queue) {
+      send_queues[i].erase(send_queues[i].begin() + 1, send_queues[i].end());
+    } else {
+      send_queues[i].clear();
+    }
+  }
+
+  const size_t kept_bytes = send_buffer_offset > 0 ?
+    send_queues[partial_queue].front().data.size() : 0;
+  server_queued_bytes -= queued_bytes - kept_bytes;
+  queued_bytes = kept_bytes;
 }
 
 template<>
 void WSServer<NBSecureSocket>::Connection::clear_buffer()
 {
-  send_buffer.clear();
+  for (auto & frames : send_queues) {
+    frames.clear();
+  }
+
+  server_queued_bytes -= queued_bytes;
+  queued_bytes = 0;
+
   socket.clear_buffer();
+  socket_tags.clear();
+}
+
+template<>
+size_t WSServer<TCPSocket>::Connection::tls_buffer_bytes() const
+{
+  return 0;
+}
+
+template<>
+size_t WSServer<NBSecureSocket>::Connection::tls_buffer_bytes() const
+{
+  return socket.memory_bytes();
+}
+
+template<class SocketType>
+typename WSServer<SocketType>::MemoryUsage
+WSServer<SocketType>::memory_usage() const
+{
+  MemoryUsage ret;
+
+  for (const auto & [conn_id, conn] : connections_) {
+    ret.connections += sizeof(Connection);
+    ret.receive_buffers += conn.ws_message_parser.buffered_bytes();
+    ret.tls_buffers += conn.tls_buffer_bytes();
+
+    for (const auto & frames : conn.send_queues) {
+      for (const auto & frame : frames) {
+        ret.send_queues += frame.data.capacity();
+      }
+    }
+  }
+
+  return ret;
+}
+
+template<class SocketType>
+const typename WSServer<SocketType>::ConnectionStats &
+WSServer<SocketType>::recent_stats() const
+{
+  const uint64_t now = timestamp_ms();
+  if (stats_.ts and now - *stats_.ts < STATS_INTERVAL_MS) {
+    return stats_;
+  }
+
+  stats_ = {};
+  stats_.memory = memory_usage();
+  for (const auto & [conn_id, conn] : connections_) {
+    stats_.states.at(static_cast<size_t>(conn.state))++;
+  }
+  stats_.ts = now;
+
+  return stats_;
 }
 
 template<class SocketType>
@@ -515,12 +848,64 @@ void WSServer<SocketType>::clear_buffer(const uint64_t conn_id)
   return connections_.at(conn_id).clear_buffer();
 }
 
+template<class SocketType>
+void WSServer<SocketType>::set_metrics(MetricsRegistry & registry)
+{
+  loop_seconds_ = &registry.histogram("puffer_loop_iteration_seconds",
+    "Time spent serving the events of an iteration of the event loop",
+    latency_buckets());
+  handshake_seconds_ = &registry.histogram("puffer_tls_handshake_seconds",
+    "Time from accepting a connection to reading its first (decrypted) bytes",
+    latency_buckets());
+  bytes_queued_ = &registry.counter("puffer_bytes_queued_total",
+    "Bytes of WebSocket frames queued to send");
+  bytes_sent_ = &registry.counter("puffer_bytes_sent_total",
+    "Bytes written to sockets (to NBSecureSocket if secure)");
+
+  registry.gauge("puffer_send_queue_bytes",
+    "Bytes in the send queues of all connections",
+    [this]() { return queued_bytes_; });
+
+  const vector<pair<string, size_t MemoryUsage::*>> subsystems {
+    {"connections", &MemoryUsage::connections},
+    {"send_queues", &MemoryUsage::send_queues},
+    {"receive_buffers", &MemoryUsage::receive_buffers},
+    {"tls_buffers", &MemoryUsage::tls_buffers}};
+
+  for (const auto & [name, field] : subsystems) {
+    registry.gauge("puffer_memory_bytes", "Memory held by each subsystem",
+      [this, field = field]() { return recent_memory_usage().*field; },
+      {{"subsystem", name}});
+  }
+
+  const vector<pair<string, typename Connection::State>> states {
+    {"not_connected", Connection::State::NotConnected},
+    {"connecting", Connection::State::Connecting},
+    {"connected", Connection::State::Connected},
+    {"closing", Connection::State::Closing},
+    {"closed", Connection::State::Closed}};
+
+  for (const auto & [name, state] : states) {
+    registry.gauge("puffer_connections", "Connections by state",
+      [this, state = state]() {
+        return recent_stats().states.at(static_cast<size_t>(state));
+      },
+      {{"state", name}});
+  }
+}
+
 template<class SocketType>
 Poller::Result WSServer<SocketType>::loop_once()
 {
   auto result = poller_.poll(-1);
 
-  /* let's garbage collect the closed connections */
+  if (loop_seconds_ and result.result == Poller::Result::Type::Success) {
+    loop_seconds_->observe(
+        (timestamp_us() - poller_.last_wakeup_us()) / 1e6);
+  }
+
+  /* let's garbage collect the closed connections; a connection might be
+   * listed more than once, but its ID becomes invalid after the first erase */
   for (const uint64_t conn_id : closed_connections_) {
     connections_.erase(conn_id);
   }
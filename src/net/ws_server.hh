@@ -3,29 +3,122 @@
 #ifndef WSSERVER_HH
 #define WSSERVER_HH
 
-#include <map>
-#include <set>
+#include <vector>
 #include <functional>
 #include <deque>
+#include <array>
+#include <optional>
 
 #include "socket.hh"
 #include "nb_secure_socket.hh"
 #include "poller.hh"
 #include "address.hh"
+#include "ws_frame.hh"
 #include "http_request_parser.hh"
 #include "ws_message_parser.hh"
+#include "slot_map.hh"
+#include "metrics.hh"
+
+/* the operations on the connections of a WSServer by connection ID, which
+ * code serving them may be written against to run over other servers too
+ * (e.g., the ReplayServer of ws_media_replay) */
+class WSServerBase
+{
+public:
+  /* queued frames of a higher priority are sent first, but a frame that has
+   * been partially written is always completed before switching queues */
+  enum class Priority {
+    High = 0,  /* control messages and audio */
+    Low,       /* video */
+    Count
+  };
+
+  virtual ~WSServerBase() {}
+
+  /* cap the pacing rate (bytes per second) of a connection */
+  virtual void set_pacing_rate(const uint64_t connection_id,
+                               const uint64_t rate) = 0;
+
+  /* a nonzero tag reports the writes of the frame to FrameWriteCallback */
+  virtual bool queue_frame(const uint64_t connection_id, const WSFrame & frame,
+                           const Priority priority = Priority::High,
+                           const uint64_t tag = 0) = 0;
+
+  /* drop the frames of a priority that have not started to be written out;
+   * return the number of bytes dropped */
+  virtual size_t cancel_frames(const uint64_t connection_id,
+                               const Priority priority) = 0;
+
+  /* frames of a priority queued but not completely written out yet */
+  virtual size_t queued_frames(const uint64_t connection_id,
+                               const Priority priority) const = 0;
+
+  /* drop everything queued for a connection */
+  virtual void clear_buffer(const uint64_t connection_id) = 0;
+
+  virtual Address peer_addr(const uint64_t connection_id) const = 0;
+
+  /* bytes in the send queues of all connections */
+  virtual size_t queued_bytes() const = 0;
+
+  /* gracefully close a connection */
+  virtual void close_connection(const uint64_t connection_id) = 0;
+
+  virtual TCPInfo get_tcp_info(const uint64_t connection_id) const = 0;
+
+  /* bytes written to the kernel but not acked by the peer yet */
+  virtual unsigned int send_queue_bytes(const uint64_t connection_id) const = 0;
+
+  /* return and reset the thread CPU time (in nanoseconds) spent reading from
+   * and writing to the socket of a connection */
+  virtual uint64_t take_socket_cpu_ns(const uint64_t connection_id) = 0;
+};
 
 /* this implementation is not thread-safe. */
 template<class SocketType>
-class WSServer
+class WSServer final : public WSServerBase
 {
 public:
   using MessageCallback = std::function<void(const uint64_t, const WSMessage &)>;
   using OpenCallback = std::function<void(const uint64_t)>;
   using CloseCallback = std::function<void(const uint64_t)>;
 
+  /* a frame queued with a nonzero tag had its first (last_byte is false) or
+   * last byte written to the kernel; if secure, SSL_write() was first tried
+   * on or completed the whole frame instead */
+  using FrameWriteCallback =
+    std::function<void(const uint64_t, const uint64_t, const bool)>;
+
+  /* delay of frames between queue_frame() and leaving the send queue */
+  struct QueueDelayStats
+  {
+    uint64_t frames {0};
+    uint64_t total_us {0};
+    uint64_t max_us {0};
+  };
+
+  using QueueDelays =
+    std::array<QueueDelayStats, static_cast<size_t>(Priority::Count)>;
+
+  /* memory held for the connections, in bytes */
+  struct MemoryUsage
+  {
+    size_t connections {0};      /* the connection objects themselves */
+    size_t send_queues {0};      /* queued frames */
+    size_t receive_buffers {0};  /* incomplete requests and messages */
+    size_t tls_buffers {0};      /* buffers of NBSecureSocket */
+  };
+
 private:
-  uint64_t last_connection_id_ {0};
+  static constexpr size_t NUM_STATES = 5;  /* of Connection::State */
+  static constexpr uint64_t STATS_INTERVAL_MS = 1000;
+
+  struct QueuedFrame
+  {
+    std::string data;
+    uint64_t queued_ts;  /* microseconds */
+    uint64_t tag;        /* see FrameWriteCallback */
+  };
 
   struct Connection
   {
@@ -35,26 +128,70 @@ private:
       Connected,
       Closing,
       Closed
-    } state { State::NotConnected };
+    } state { State::NotConnected };  /* NUM_STATES in total */
 
     SocketType socket;
 
+    /* when the connection was accepted (in microseconds), until the first
+     * bytes are read from it */
+    uint64_t accept_ts {0};
+
     /* incoming messages */
     HTTPRequestParser ws_handshake_parser {};
     WSMessageParser ws_message_parser {};
 
-    /* outgoing messages */
-    std::deque<std::string> send_buffer {};
+    /* outgoing messages, one queue per priority */
+    std::array<std::deque<QueuedFrame>,
+               static_cast<size_t>(Priority::Count)> send_queues {};
+
+    /* total size of the frames in send_queues, also added to the server's */
+    size_t queued_bytes {0};
+    size_t & server_queued_bytes;
+
+    /* bytes written of the front frame of send_queues[partial_queue] */
     size_t send_buffer_offset {0};
+    size_t partial_queue {0};
+
+    /* deficit counter of the deficit round robin (DRR) egress scheduler */
+    size_t send_deficit {0};
+
+    /* reports the writes of tagged frames; set by the server */
+    std::function<void(const uint64_t, const bool)> frame_written {};
+
+    /* tags of the frames handed to NBSecureSocket, in order */
+    std::deque<uint64_t> socket_tags {};
+
+    /* thread CPU time spent reading from and writing to the socket
+     * (including TLS), since last taken */
+    uint64_t socket_cpu_ns {0};
 
-    Connection(TCPSocket && sock, SSLContext & ssl_context);
+    Connection(TCPSocket && sock, SSLContext & ssl_context,
+               size_t & server_queued_bytes);
+    ~Connection() { server_queued_bytes -= queued_bytes; }
+
+    /* forbid copying or moving Connection */
+    Connection(const Connection & other) = delete;
+    Connection & operator=(const Connection & other) = delete;
 
     std::string read();
-    void write();
+
+    /* write no more than send_deficit bytes after adding a quantum to it,
+     * and record the queueing delay of each frame that leaves the queues;
+     * return the number of bytes written */
+    size_t write(const size_t quantum, QueueDelays & delays);
+
+    void push_frame(std::string && data, const Priority priority,
+                    const uint64_t tag);
+
+    /* index of the queue to send from next, or std::nullopt if all empty */
+    std::optional<size_t> next_queue() const;
+
+    /* remove the front frame of a queue */
+    void pop_frame(const size_t queue, QueueDelays & delays);
 
     /* the connection has data to write to TCPSocket directly,
      * or write to NBSecureSocket's internal send_buffer */
-    bool data_to_write() const { return send_buffer.size() > 0; }
+    bool data_to_write() const { return next_queue().has_value(); }
 
     /* tell the poller if the connection is interested in sending
      * i.e., it or its NBSecureSocket has pending data in the send_buffer */
@@ -62,35 +199,102 @@ private:
 
     unsigned int buffer_bytes() const;
     void clear_buffer();
+
+    /* memory held by NBSecureSocket, if secure */
+    size_t tls_buffer_bytes() const;
   };
 
   SSLContext ssl_context_ {};
 
   TCPSocket listener_socket_ {};
   Address listener_addr_ {};
-  std::map<uint64_t, Connection> connections_ {};
+  /* bytes in the send queues of all connections, and its high-water mark;
+   * declared before connections_, whose destructors update it */
+  size_t queued_bytes_ {0};
+  size_t peak_queued_bytes_ {0};
+
+  /* key: connection ID */
+  SlotMap<Connection> connections_ {};
   Poller poller_ {};
 
   MessageCallback message_callback_ {};
   OpenCallback open_callback_ {};
   CloseCallback close_callback_ {};
+  FrameWriteCallback frame_write_callback_ {};
 
-  std::set<uint64_t> closed_connections_ {};
+  std::vector<uint64_t> closed_connections_ {};
 
   std::string congestion_control_ {};
 
+  /* bytes each connection may write per round of the poller */
+  size_t send_quantum_ {DEFAULT_SEND_QUANTUM};
+
+  /* connections accepted at most per round of the poller */
+  unsigned int accept_batch_ {DEFAULT_ACCEPT_BATCH};
+
+  /* bytes written to the sockets of all connections */
+  uint64_t bytes_written_ {0};
+
+  QueueDelays queue_delays_ {};
+
+  /* time reads and writes in thread CPU time, if enabled */
+  bool socket_cpu_accounting_ {false};
+
+  /* a walk of all the connections shared by the gauges of a scrape, redone
+   * at most every STATS_INTERVAL_MS */
+  struct ConnectionStats
+  {
+    MemoryUsage memory {};
+    std::array<size_t, NUM_STATES> states {};  /* connections per state */
+    std::optional<uint64_t> ts {};  /* ms */
+  };
+  mutable ConnectionStats stats_ {};
+
+  const ConnectionStats & recent_stats() const;
+
+  /* instrumentation, if set_metrics() is called */
+  Histogram * loop_seconds_ {nullptr};
+  Histogram * handshake_seconds_ {nullptr};
+  Counter * bytes_queued_ {nullptr};
+  Counter * bytes_sent_ {nullptr};
+
+  /* create, bind and listen on a new listener socket */
   void init_listener_socket();
 
+  /* start accepting connections on listener_socket_ */
+  void add_accept_action();
+
+  /* set up an accepted connection and poll on its socket */
+  void add_connection(TCPSocket && client);
+
   /* gracefully close the connection */
   void wait_close_connection(const uint64_t connection_id);
 
+  /* queue a Close frame to be sent after every frame queued so far */
+  void queue_close_frame(const uint64_t connection_id,
+                         const std::string & payload);
+
   /* force close the connection */
   void force_close_connection(const uint64_t connection_id);
 
+  /* write a quantum of the queued frames of a connection */
+  void write_connection(Connection & conn);
+
 public:
+  static constexpr size_t DEFAULT_SEND_QUANTUM = 64 * 1024;  /* 64 KB */
+  static constexpr unsigned int DEFAULT_ACCEPT_BATCH = 64;
+
   WSServer(const Address & listener_addr,
            const std::string & congestion_control = "default");
 
+  /* adopt a listening socket, e.g., one handed off by a server being replaced */
+  WSServer(TCPSocket && listener_socket,
+           const std::string & congestion_control = "default");
+
+  /* forbid copying WSServer */
+  WSServer(const WSServer & other) = delete;
+  WSServer & operator=(const WSServer & other) = delete;
+
   Poller::Result loop_once();
   int loop();
 
@@ -98,24 +302,98 @@ public:
 
   SSLContext & ssl_context() { return ssl_context_; }
 
+  TCPSocket & listener_socket() { return listener_socket_; }
+
+  /* stop accepting new connections; existing connections are still served */
+  void stop_listening();
+
+  /* resize the accept queue of the listener (also one inherited on hot
+   * restart); the kernel caps it at net.core.somaxconn */
+  void set_listen_backlog(const int backlog)
+  {
+    listener_socket_.listen(backlog);
+  }
+
+  /* set the number of connections accepted at most per round */
+  void set_accept_batch(const unsigned int batch) { accept_batch_ = batch; }
+
+  size_t num_connections() const { return connections_.size(); }
+
+  /* bytes written to the sockets of all connections since the start */
+  uint64_t bytes_written() const { return bytes_written_; }
+
   void set_message_callback(MessageCallback func) { message_callback_ = func; }
   void set_open_callback(OpenCallback func) { open_callback_ = func; }
   void set_close_callback(CloseCallback func) { close_callback_ = func; }
+  void set_frame_write_callback(FrameWriteCallback func) { frame_write_callback_ = func; }
+
+  /* set the DRR quantum shared by all connections */
+  void set_send_quantum(const size_t quantum) { send_quantum_ = quantum; }
+
+  /* cap the pacing rate (bytes per second) of a connection */
+  void set_pacing_rate(const uint64_t connection_id,
+                       const uint64_t rate) override;
+
+  /* a nonzero tag reports the writes of the frame to FrameWriteCallback */
+  bool queue_frame(const uint64_t connection_id, const WSFrame & frame,
+                   const Priority priority = Priority::High,
+                   const uint64_t tag = 0) override;
 
-  bool queue_frame(const uint64_t connection_id, const WSFrame & frame);
+  /* drop the frames of a priority that have not started to be written out;
+   * return the number of bytes dropped */
+  size_t cancel_frames(const uint64_t connection_id,
+                       const Priority priority) override;
 
-  Address peer_addr(const uint64_t connection_id) const;
+  /* frames of a priority queued but not completely written out yet */
+  size_t queued_frames(const uint64_t connection_id,
+                       const Priority priority) const override;
 
+  Address peer_addr(const uint64_t connection_id) const override;
+
+  /* bytes queued for a connection but not yet written to its TCP socket */
   unsigned int buffer_bytes(const uint64_t connection_id) const;
-  void clear_buffer(const uint64_t connection_id);
+  void clear_buffer(const uint64_t connection_id) override;
+
+  /* bytes in the send queues of all connections; excludes the (at most
+   * about a quantum of) data held by each NBSecureSocket */
+  size_t queued_bytes() const override { return queued_bytes_; }
+  size_t peak_queued_bytes() const { return peak_queued_bytes_; }
+  void reset_peak_queued_bytes() { peak_queued_bytes_ = queued_bytes_; }
 
   /* public method to gracefully close a connection */
-  void close_connection(const uint64_t connection_id);
+  void close_connection(const uint64_t connection_id) override;
 
   /* force close an idle connection and no longer poll on its socket */
   void clean_idle_connection(const uint64_t connection_id);
 
-  TCPInfo get_tcp_info(const uint64_t connection_id) const;
+  TCPInfo get_tcp_info(const uint64_t connection_id) const override;
+
+  /* bytes written to the kernel but not acked by the peer yet */
+  unsigned int send_queue_bytes(const uint64_t connection_id) const override;
+
+  /* start accumulating the CPU time spent on each socket (reading the
+   * clock is a system call) */
+  void enable_socket_cpu_accounting() { socket_cpu_accounting_ = true; }
+
+  /* return and reset the thread CPU time (in nanoseconds) spent reading from
+   * and writing to the socket of a connection */
+  uint64_t take_socket_cpu_ns(const uint64_t connection_id) override;
+
+  /* walks all the connections */
+  MemoryUsage memory_usage() const;
+
+  /* memory_usage() as of at most a second ago, e.g., for a gauge */
+  const MemoryUsage & recent_memory_usage() const
+  {
+    return recent_stats().memory;
+  }
+
+  /* record the metrics of the server in a registry */
+  void set_metrics(MetricsRegistry & registry);
+
+  /* queueing delays of all connections, accumulated since the last reset */
+  const QueueDelays & queue_delays() const { return queue_delays_; }
+  void reset_queue_delays() { queue_delays_ = {}; }
 };
 
 using WebSocketTCPServer = WSServer<TCPSocket>;
@@ -19,7 +19,8 @@ Inotify::Inotify(Poller & poller)
       [this]() {
         return handle_events();
       }
-    )
+    ),
+    "inotify"
   );
 }
 
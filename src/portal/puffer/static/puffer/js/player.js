@@ -422,6 +422,7 @@ function init_player(params_json, csrf_token) {
   const username = params.username;
   const settings_debug = params.debug;
   const port = params.port;
+  const ports = params.ports;
 
   /* assert that session_key and username exist */
   if (!session_key || !username) {
@@ -449,7 +450,8 @@ function init_player(params_json, csrf_token) {
 
   load_script('/static/puffer/js/puffer.js').onload = function() {
     var ws_client = new WebSocketClient(
-      session_key, username, settings_debug, port, csrf_token, sysinfo);
+      session_key, username, settings_debug, port, ports, csrf_token,
+      sysinfo);
 
     channel_bar.on_channel_change = function(new_channel) {
       ws_client.set_channel(new_channel);
@@ -126,6 +126,31 @@ function AVSource(ws_client, server_init) {
   var curr_audio_format = null;
   var partial_audio_chunks = null;
 
+  /* content hashes of the init segments last appended to the source buffers */
+  var last_init_hash = { video: null, audio: null };
+
+  /* cache the init segment prepended to a complete chunk; or, if the server
+   * skipped it as cached but a different init segment was appended last,
+   * prepend the cached one */
+  function resolve_init(media_type, metadata, chunk) {
+    if (metadata.initLength > 0) {
+      ws_client.cache_init(metadata.format, metadata.initHash,
+                           chunk.slice(0, metadata.initLength));
+    } else if (metadata.initHash !== last_init_hash[media_type]) {
+      const init = ws_client.get_cached_init(metadata.initHash);
+      if (init === null) {
+        console.log('error: missing cached init segment', metadata);
+        return chunk;
+      }
+
+      chunk = concat_arraybuffers([init, chunk],
+                                  init.byteLength + chunk.byteLength);
+    }
+
+    last_init_hash[media_type] = metadata.initHash;
+    return chunk;
+  }
+
   video.src = URL.createObjectURL(ms);
   video.load();
 
@@ -265,8 +290,9 @@ function AVSource(ws_client, server_init) {
       /* assemble partial chunks into a complete chunk */
       pending_video_chunks.push({
         metadata: metadata,
-        data: concat_arraybuffers(partial_video_chunks,
-                                  metadata.totalByteLength)
+        data: resolve_init('video', metadata,
+                           concat_arraybuffers(partial_video_chunks,
+                                               metadata.totalByteLength))
       });
       partial_video_chunks = [];
 
@@ -282,6 +308,17 @@ function AVSource(ws_client, server_init) {
     }
   };
 
+  /* server cancelled the rest of a video chunk and will resend it */
+  this.cancelVideo = function(metadata) {
+    if (channel !== metadata.channel) {
+      console.log('error: should have ignored data from incorrect channel');
+      return;
+    }
+
+    /* discard the fragments received so far */
+    partial_video_chunks = [];
+  };
+
   this.handleAudio = function(metadata, data, msg_ts) {
     if (channel !== metadata.channel) {
       console.log('error: should have ignored data from incorrect channel');
@@ -300,8 +337,9 @@ function AVSource(ws_client, server_init) {
       /* assemble partial chunks into a complete chunk */
       pending_audio_chunks.push({
         metadata: metadata,
-        data: concat_arraybuffers(partial_audio_chunks,
-                                  metadata.totalByteLength)
+        data: resolve_init('audio', metadata,
+                           concat_arraybuffers(partial_audio_chunks,
+                                               metadata.totalByteLength))
       });
       partial_audio_chunks = [];
 
@@ -400,7 +438,7 @@ function AVSource(ws_client, server_init) {
 }
 
 function WebSocketClient(session_key, username_in, settings_debug, port_in,
-                         csrf_token_in, sysinfo) {
+                         ports, csrf_token_in, sysinfo) {
   /* if DEBUG = True in settings.py, connect to non-secure WebSocket server */
   debug = settings_debug;
   nonsecure = settings_debug;
@@ -436,6 +474,30 @@ function WebSocketClient(session_key, username_in, settings_debug, port_in,
 
   var channel_error = false;
 
+  /* init segments received in this session, keyed by content hash, so that
+   * the server can skip them; never evicted as there are only a few of them */
+  var init_cache = {};  /* hash -> {format, data} */
+  var init_cache_changed = false;
+
+  this.cache_init = function(format, hash, data) {
+    if (!(hash in init_cache)) {
+      init_cache[hash] = { format: format, data: data };
+      init_cache_changed = true;
+    }
+  };
+
+  this.get_cached_init = function(hash) {
+    return hash in init_cache ? init_cache[hash].data : null;
+  };
+
+  function get_cached_inits() {
+    init_cache_changed = false;
+
+    return Object.keys(init_cache).map(function(hash) {
+      return { format: init_cache[hash].format, hash: hash };
+    });
+  }
+
   this.send_client_init = function(channel) {
     if (fatal_error) {
       return;
@@ -459,7 +521,8 @@ function WebSocketClient(session_key, username_in, settings_debug, port_in,
       os: sysinfo.os,
       browser: sysinfo.browser,
       screenWidth: screen_width,
-      screenHeight: screen_height
+      screenHeight: screen_height,
+      cachedInits: get_cached_inits()
     };
 
     /* try resuming if the client is already watching the same channel */
@@ -513,6 +576,11 @@ function WebSocketClient(session_key, username_in, settings_debug, port_in,
       msg.screenHeight = screen_height;
     }
 
+    /* include cached init segments if the cache has changed */
+    if (init_cache_changed) {
+      msg.cachedInits = get_cached_inits();
+    }
+
     ws.send(format_client_msg('client-info', msg));
 
     if (debug) {
@@ -599,6 +667,18 @@ function WebSocketClient(session_key, username_in, settings_debug, port_in,
         ws.close();
         return;
       }
+
+      if (metadata.errorType === 'busy') {
+        /* reconnect (with backoff) to another server picked at random */
+        const other_ports = ports.filter(function(p) { return p !== port; });
+        if (other_ports.length > 0) {
+          port = other_ports[Math.floor(Math.random() * other_ports.length)];
+        }
+
+        add_player_error(metadata.errorMessage, 'connect');
+        ws.close();
+        return;
+      }
     }
 
     /* ignore outdated messages from the server */
@@ -644,6 +724,13 @@ function WebSocketClient(session_key, username_in, settings_debug, port_in,
 
       /* note: handleVideo can buffer chunks even if !av_source.isOpen() */
       av_source.handleVideo(metadata, data, msg_ts);
+    } else if (metadata.type === 'server-cancel') {
+      if (!av_source) {
+        console.log('Error: AVSource is not initialized yet');
+        return;
+      }
+
+      av_source.cancelVideo(metadata);
     } else if (metadata.type === 'server-audio') {
       if (!av_source) {
         console.log('Error: AVSource is not initialized yet');
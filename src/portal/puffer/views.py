@@ -48,16 +48,21 @@ def player(request):
     if request.user.is_superuser:
         port = request.GET.get('port', None)
 
+    # a busy server sends the client to another one of these ports
     if port is None:
         total_servers = settings.TOTAL_SERVERS
         base_port = settings.WS_BASE_PORT
-        port = str(base_port + random.randint(1, total_servers))
+        ports = [str(base_port + i) for i in range(1, total_servers + 1)]
+        port = random.choice(ports)
+    else:
+        ports = [port]
 
     # parameters passed to Javascript stored in JSON
     params = {'session_key': request.session.session_key,
               'username': request.user.username,
               'debug': settings.DEBUG,
-              'port': port}
+              'port': port,
+              'ports': ports}
     context = {'params_json': json.dumps(params)}
 
     return render(request, 'puffer/player.html', context)
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+
+# Cross-check the C++ stream_stats against BufferStream (stream_processor.py)
+# and the SSIM averaging of plot_ssim_rebuffer.py, on a sample of logs
+
+import sys
+import json
+import argparse
+import subprocess
+from os import path
+import numpy as np
+
+from helpers import get_abr_cc, retrieve_expt_config
+from stream_processor import BufferStream
+
+
+MIN_PLAY_TIME = 5  # seconds, as in plot_ssim_rebuffer.py
+
+CLIENT_BUFFER_FIELDS = ['time', 'channel', 'server_id', 'event', 'expt_id',
+                        'user', 'first_init_id', 'init_id', 'buffer',
+                        'cum_rebuf']
+VIDEO_ACKED_FIELDS = ['time', 'channel', 'server_id', 'expt_id', 'user',
+                      'first_init_id', 'init_id', 'video_ts', 'ssim_index',
+                      'buffer', 'cum_rebuffer']
+
+
+def read_points(log_paths, prefix, fields):
+    pts = []
+
+    for log_path in log_paths:
+        if not path.basename(log_path).startswith(prefix):
+            continue
+
+        with open(log_path) as fh:
+            for line in fh:
+                values = line.rstrip('\n').split(',')
+                if len(values) != len(fields):
+                    continue
+
+                pt = dict(zip(fields, values))
+                pt['time'] = np.datetime64(int(pt['time']), 'ms')
+                pt['expt_id'] = int(pt['expt_id'])
+                pt['init_id'] = int(pt['init_id'])
+                pts.append(pt)
+
+    # InfluxDB returns the points of a measurement in time order
+    pts.sort(key=lambda pt: pt['time'])
+    return pts
+
+
+def scheme_of(expt_id, expt):
+    if expt is None:
+        return 'expt_{}'.format(expt_id)
+
+    return '{}+{}'.format(*get_abr_cc(
+        retrieve_expt_config(str(expt_id), expt, None)))
+
+
+def python_stats(log_paths, expt):
+    stats = {}
+
+    def scheme_stats(expt_id):
+        name = scheme_of(expt_id, expt)
+        if name not in stats:
+            stats[name] = {'sessions': 0, 'total_play': 0.0,
+                           'total_rebuf': 0.0, 'ssim_sum': 0.0,
+                           'ssim_chunks': 0}
+        return stats[name]
+
+    def process_session(session, s):
+        if s['play_time'] < MIN_PLAY_TIME:
+            return
+
+        d = scheme_stats(session[-1])
+        d['sessions'] += 1
+        d['total_play'] += s['play_time']
+        d['total_rebuf'] += s['cum_rebuf']
+
+    buffer_stream = BufferStream(process_session)
+    for pt in read_points(log_paths, 'client_buffer', CLIENT_BUFFER_FIELDS):
+        buffer_stream.add_data_point(pt)
+        buffer_stream.process_expired_sessions()
+    buffer_stream.expiry_list.expire_all()
+    buffer_stream.process_expired_sessions()
+
+    for pt in read_points(log_paths, 'video_acked', VIDEO_ACKED_FIELDS):
+        ssim_index = float(pt['ssim_index'])
+        if ssim_index != 1:
+            d = scheme_stats(pt['expt_id'])
+            d['ssim_sum'] += ssim_index
+            d['ssim_chunks'] += 1
+
+    return stats
+
+
+def close(a, b, rel_tol):
+    return abs(a - b) <= rel_tol * max(abs(a), abs(b), 1e-9)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('stream_stats', help='path to the stream_stats binary')
+    parser.add_argument('logs', nargs='+',
+                        help='client_buffer.*.log and video_acked.*.log')
+    parser.add_argument('--expt', help='e.g., expt_cache.json')
+    parser.add_argument('--rel-tol', type=float, default=1e-6)
+    args = parser.parse_args()
+
+    expt = None
+    cmd = [args.stream_stats, '--json']
+    if args.expt is not None:
+        with open(args.expt) as fh:
+            expt = json.load(fh)
+        cmd += ['--expt', args.expt]
+
+    cpp = json.loads(subprocess.check_output(cmd + args.logs))
+    py = python_stats(args.logs, expt)
+
+    mismatches = 0
+    for name in sorted(set(cpp) | set(py)):
+        c = cpp.get(name)
+        p = py.get(name)
+        if c is None or p is None:
+            sys.stderr.write('{}: only in {}\n'.format(
+                name, 'Python' if c is None else 'C++'))
+            mismatches += 1
+            continue
+
+        pairs = [('sessions', c['sessions'], p['sessions']),
+                 ('total_play', c['total_play'], p['total_play']),
+                 ('total_rebuf', c['total_rebuf'], p['total_rebuf']),
+                 ('ssim_chunks', c['ssim_chunks'], p['ssim_chunks'])]
+        if p['ssim_chunks'] > 0:
+            pairs.append(('ssim_index', c['ssim_index'],
+                          p['ssim_sum'] / p['ssim_chunks']))
+
+        for field, c_val, p_val in pairs:
+            if not close(c_val, p_val, args.rel_tol):
+                sys.stderr.write('{}: {} is {} in C++ but {} in Python\n'
+                                 .format(name, field, c_val, p_val))
+                mismatches += 1
+
+    if mismatches:
+        sys.exit('{} mismatches'.format(mismatches))
+
+    sys.stderr.write('C++ and Python agree on {} schemes\n'.format(len(cpp)))
+
+
+if __name__ == '__main__':
+    main()
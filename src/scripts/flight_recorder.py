@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+
+# Print the dumps of the flight recorder of ws_media_server
+# (see media-server/flight_recorder.hh) as one line per event
+
+import sys
+import struct
+import argparse
+from datetime import datetime, timezone
+
+
+MAGIC = b'PUFFFLT\0'
+VERSION = 1
+
+HEADER = struct.Struct('>8sIIQQQI')
+EVENT = struct.Struct('>QQIHH5Q')
+
+ALL_CONNECTIONS = 2**64 - 1
+
+CLIENT_INFO_EVENTS = ['timer', 'startup', 'rebuffer', 'play']
+SERVER_ERRORS = ['maintenance', 'reinit', 'unavailable', 'limit', 'busy']
+
+
+def video_format(packed):
+    return '{}x{}-{}'.format(packed >> 32, (packed >> 16) & 0xFFFF,
+                             packed & 0xFFFF)
+
+
+# type: (name, names of the fields used, formatter of aux)
+EVENT_TYPES = {
+    1: ('open', [], None),
+    2: ('close', [], None),
+    3: ('init', ['vts', 'ats'], lambda aux: 'resumed' if aux else None),
+    4: ('tcp_info', ['cwnd', 'in_flight', 'min_rtt', 'rtt',
+                     'delivery_rate'], None),
+    5: ('video_sent', ['vts', 'format', 'bytes', 'ssim', 'buffer_ms'],
+        lambda aux: 'with_init' if aux else None),
+    6: ('audio_sent', ['ats', 'kbps', 'bytes'],
+        lambda aux: 'with_init' if aux else None),
+    7: ('video_ack', ['vts', 'acked', 'total', 'buffer_ms', 'cum_rebuf_ms'],
+        None),
+    8: ('audio_ack', ['ats', 'acked', 'total', 'buffer_ms', 'cum_rebuf_ms'],
+        None),
+    9: ('client_info', ['buffer_ms', 'audio_buffer_ms', 'cum_rebuf_ms'],
+        lambda aux: CLIENT_INFO_EVENTS[aux]
+        if aux < len(CLIENT_INFO_EVENTS) else str(aux)),
+    10: ('abandon', ['vts', 'cancelled', 'acked', 'elapsed_ms'], None),
+    11: ('error', [], lambda aux: SERVER_ERRORS[aux]
+         if aux < len(SERVER_ERRORS) else str(aux)),
+}
+
+
+def read_dump(dump_path):
+    with open(dump_path, 'rb') as fh:
+        data = fh.read()
+
+    if len(data) < HEADER.size:
+        sys.exit('Error: {} is not a flight recorder dump'.format(dump_path))
+
+    (magic, version, server_id, dump_ts, connection_id, recorded,
+     num_events) = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        sys.exit('Error: {} is not a flight recorder dump'.format(dump_path))
+    if version != VERSION:
+        sys.exit('Error: {} has version {} rather than {}'.format(
+            dump_path, version, VERSION))
+    if len(data) != HEADER.size + num_events * EVENT.size:
+        sys.exit('Error: {} is truncated'.format(dump_path))
+
+    header = {'server_id': server_id, 'dump_ts': dump_ts,
+              'connection_id': connection_id, 'recorded': recorded}
+    events = [EVENT.unpack_from(data, HEADER.size + i * EVENT.size)
+              for i in range(num_events)]
+    return header, events
+
+
+def format_event(event):
+    ts_us, connection_id, init_id, event_type, aux, *fields = event
+    name, field_names, format_aux = EVENT_TYPES.get(
+        event_type, (str(event_type), ['f0', 'f1', 'f2', 'f3', 'f4'], None))
+
+    ts = datetime.fromtimestamp(ts_us / 1e6, timezone.utc)
+    columns = [ts.strftime('%H:%M:%S.%f'), str(connection_id),
+               str(init_id), name]
+
+    if format_aux is not None and format_aux(aux) is not None:
+        columns.append(format_aux(aux))
+
+    for field_name, value in zip(field_names, fields):
+        if field_name == 'format':
+            value = video_format(value)
+        elif field_name == 'ssim':
+            value = value / 1e6
+        columns.append('{}={}'.format(field_name, value))
+
+    return ' '.join(columns)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='print the events in flight recorder dumps')
+    parser.add_argument('dumps', nargs='+')
+    parser.add_argument('--connection', type=int,
+                        help='only print the events of this connection')
+    args = parser.parse_args()
+
+    for dump_path in args.dumps:
+        header, events = read_dump(dump_path)
+
+        dumped = ('all connections' if
+                  header['connection_id'] == ALL_CONNECTIONS else
+                  'connection {}'.format(header['connection_id']))
+        print('# {}: server {}, {} at {}, {} events ({} ever recorded)'.format(
+            dump_path, header['server_id'], dumped,
+            datetime.fromtimestamp(header['dump_ts'] / 1000, timezone.utc)
+            .isoformat(), len(events), header['recorded']))
+
+        for event in events:
+            if args.connection is not None and event[1] != args.connection:
+                continue
+            print(format_event(event))
+
+
+if __name__ == '__main__':
+    main()
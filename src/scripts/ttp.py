@@ -18,6 +18,7 @@ from helpers import (
     connect_to_influxdb, connect_to_postgres,
     make_sure_path_exists, retrieve_expt_config, create_time_clause,
     get_expt_id, get_user)
+import ttp_shards
 
 
 VIDEO_DURATION = 180180
@@ -257,6 +258,9 @@ def check_args(args):
         if not args.save_model:
             sys.exit('Error: specify a folder to save models\n')
 
+    if args.shards and not path.isdir(args.shards):
+        sys.exit('Error: directory {} does not exist'.format(args.shards))
+
     # want to tune hyperparameters
     if args.tune:
         if args.save_model:
@@ -470,10 +474,43 @@ def prepare_input_output(d):
     return ret
 
 
-def cl_sample(args, time_start, time_end, max_size, ret):
+# load the rows from the training shards of ws_media_server instead
+def prepare_shard_input_output(args, time_start, time_end):
+    keep_expt = None
+    if args.cc is not None:
+        with open(args.yaml_settings, 'r') as fh:
+            yaml_settings = yaml.safe_load(fh)
+        postgres_cursor = connect_to_postgres(yaml_settings).cursor()
+
+        # filter data points by congestion control
+        def keep_expt(expt_id):
+            expt_config = retrieve_expt_config(expt_id, expt_id_cache,
+                                               postgres_cursor)
+            return expt_config is not None and expt_config['cc'] == args.cc
+
+    shard_paths = ttp_shards.find_shards(args.shards)
+    server_ids, records = ttp_shards.load_shards(
+        shard_paths, time_start, time_end, keep_expt)
+    if records is None or len(records) == 0:
+        sys.exit('Error: no records in the shards of ' + args.shards)
+
+    return ttp_shards.prepare_input_output(server_ids, records,
+                                           Model.FUTURE_CHUNKS)
+
+
+def load_input_output(args, time_start, time_end):
+    if args.shards:
+        return prepare_shard_input_output(args, time_start, time_end)
+
+    # query InfluxDB and retrieve raw data
     raw_data = prepare_raw_data(args.yaml_settings,
                                 time_start, time_end, args.cc)
-    raw_in_out = prepare_input_output(raw_data)
+    # collect input and output data from raw data
+    return prepare_input_output(raw_data)
+
+
+def cl_sample(args, time_start, time_end, max_size, ret):
+    raw_in_out = load_input_output(args, time_start, time_end)
 
     ret_sample_size = None
     for i in range(Model.FUTURE_CHUNKS):
@@ -710,6 +747,8 @@ def main():
     parser.add_argument('--to', dest='time_end',
                         help='datetime in UTC conforming to RFC3339')
     parser.add_argument('--cc', help='filter input data by congestion control')
+    parser.add_argument('--shards', help='folder of training shards written '
+                        'by ws_media_server, read instead of InfluxDB')
     parser.add_argument('--load-model',
         help='folder to load {:d} models from'.format(Model.FUTURE_CHUNKS))
     parser.add_argument('--save-model',
@@ -724,11 +763,7 @@ def main():
     check_args(args)
 
     if not args.cl:
-        # query InfluxDB and retrieve raw data
-        raw_data = prepare_raw_data(args.yaml_settings,
-                                    args.time_start, args.time_end, args.cc)
-        # collect input and output data from raw data
-        raw_in_out = prepare_input_output(raw_data)
+        raw_in_out = load_input_output(args, args.time_start, args.time_end)
     else:
         # continual learning
         raw_in_out = prepare_cl_data(args)
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+
+# Load the binary training shards of the TTP written by ws_media_server
+# (see media-server/ttp_shard.hh) into the inputs and outputs of ttp.py,
+# without querying InfluxDB or joining video_sent and video_acked
+
+import sys
+import glob
+import argparse
+from os import path
+import numpy as np
+
+
+VIDEO_DURATION = 180180
+PKT_BYTES = 1500
+MILLION = 1000000
+
+MAGIC = b'PUFFTTP'  # followed by '\0', which numpy strips
+VERSION = 1
+
+HEADER_DTYPE = np.dtype([('magic', 'S8'), ('version', '>u4'),
+                         ('past_chunks', '>u4'), ('server_id', '>u4'),
+                         ('expt_id', '>u4')])
+
+CHUNK_DTYPE = np.dtype([('size', '>u4'), ('trans_time', '>u4'),
+                        ('cwnd', '>u4'), ('in_flight', '>u4'),
+                        ('min_rtt', '>u4'), ('rtt', '>u4'),
+                        ('delivery_rate', '>u8')])
+
+
+def record_dtype(past_chunks):
+    return np.dtype([('sent_ts', '>u8'), ('connection_id', '>u8'),
+                     ('video_ts', '>u8'), ('init_id', '>u4'),
+                     ('num_past', '>u4'), ('chunk', CHUNK_DTYPE),
+                     ('past', CHUNK_DTYPE, (past_chunks,))])
+
+
+def find_shards(shard_dir):
+    # ttp.<server ID>.<creation time in ms>.<PID>.shard; partial shards
+    # (with a .partial suffix) are still being written
+    return sorted(glob.glob(path.join(shard_dir, 'ttp.*.*.*.shard')))
+
+
+def read_shard(shard_path):
+    header = np.fromfile(shard_path, dtype=HEADER_DTYPE, count=1)
+    if len(header) != 1 or header['magic'][0] != MAGIC:
+        sys.exit('Error: {} is not a TTP shard'.format(shard_path))
+
+    header = header[0]
+    if header['version'] != VERSION:
+        sys.exit('Error: {} has version {} rather than {}'.format(
+            shard_path, header['version'], VERSION))
+
+    records = np.fromfile(shard_path, offset=HEADER_DTYPE.itemsize,
+                          dtype=record_dtype(int(header['past_chunks'])))
+    return header, records
+
+
+def to_ms(rfc3339):
+    # e.g., 2019-04-15T00:00:00Z
+    return np.datetime64(rfc3339.rstrip('Z'), 'ms').astype(np.int64)
+
+
+# return the records of shards with their server and experiment IDs, sent
+# in [time_start, time_end] (RFC3339) by experiments that keep_expt accepts
+def load_shards(shard_paths, time_start=None, time_end=None, keep_expt=None):
+    loaded = []
+    past_chunks = None
+
+    for shard_path in shard_paths:
+        header, records = read_shard(shard_path)
+
+        if past_chunks is None:
+            past_chunks = int(header['past_chunks'])
+        elif past_chunks != header['past_chunks']:
+            sys.exit('Error: shards differ in the number of past chunks')
+
+        if keep_expt is not None and not keep_expt(int(header['expt_id'])):
+            continue
+
+        mask = np.ones(len(records), dtype=bool)
+        if time_start is not None:
+            mask &= records['sent_ts'] >= to_ms(time_start)
+        if time_end is not None:
+            mask &= records['sent_ts'] <= to_ms(time_end)
+
+        records = records[mask]
+        loaded.append((np.full(len(records), header['server_id'],
+                               dtype=np.uint64), records))
+
+    if not loaded:
+        return None, None
+
+    server_ids = np.concatenate([s for s, _ in loaded])
+    records = np.concatenate([r for _, r in loaded])
+    return server_ids, records
+
+
+# delivery_rate, cwnd, in_flight, min_rtt, rtt, size, trans_time, in the
+# units of ttp.py
+def chunk_features(chunks):
+    return np.stack([chunks['delivery_rate'] / PKT_BYTES,
+                     chunks['cwnd'].astype(np.float64),
+                     chunks['in_flight'].astype(np.float64),
+                     chunks['min_rtt'] / MILLION,
+                     chunks['rtt'] / MILLION,
+                     chunks['size'] / PKT_BYTES,
+                     chunks['trans_time'] / 1000], axis=-1)
+
+
+# the rows of ttp.prepare_input_output() for each of future_chunks models:
+# past chunks (padded as append_past_chunks() does), the TCP info of the
+# next chunk and the size of the chunk to predict
+def prepare_input_output(server_ids, records, future_chunks):
+    ret = [{'in': np.empty((0, 0)), 'out': np.empty(0)}
+           for _ in range(future_chunks)]
+    if records is None or len(records) == 0:
+        return ret
+
+    # a session is a connection (of a server) with the same init ID
+    sessions = np.empty(len(records), dtype=[('server_id', '<u8'),
+                                             ('connection_id', '<u8'),
+                                             ('init_id', '<u4')])
+    sessions['server_id'] = server_ids
+    sessions['connection_id'] = records['connection_id']
+    sessions['init_id'] = records['init_id']
+    _, session = np.unique(sessions, return_inverse=True)
+    session = session.reshape(-1).astype(np.uint64)
+
+    # key of (session, video_ts), video_ts relative to the session's first
+    video_ts = records['video_ts'].astype(np.uint64)
+    first_vts = np.full(int(session.max()) + 1, np.iinfo(np.uint64).max,
+                        dtype=np.uint64)
+    np.minimum.at(first_vts, session, video_ts)
+    keys = (session << np.uint64(40)) | (video_ts - first_vts[session])
+
+    # keep the last of the chunks acked more than once
+    order = np.lexsort((records['sent_ts'], keys))
+    sorted_keys = keys[order]
+    last = np.append(sorted_keys[1:] != sorted_keys[:-1], True)
+    order = order[last]
+    sorted_keys = sorted_keys[last]
+    records = records[order]
+
+    # past chunks, the oldest first; missing ones are padded with the oldest
+    # past chunk, or the TCP info of the next chunk and zeros without any
+    past_chunks = records['past'].shape[1]
+    num_past = records['num_past'].astype(np.int64)
+    curr = chunk_features(records['chunk'])
+    past = chunk_features(records['past'])[:, ::-1, :]
+
+    padding = np.where(
+        (num_past > 0)[:, None],
+        chunk_features(records['past'][np.arange(len(records)),
+                                       np.maximum(num_past - 1, 0)]),
+        np.concatenate([curr[:, :5], np.zeros((len(records), 2))], axis=1))
+    valid = (past_chunks - 1 - np.arange(past_chunks))[None, :] \
+        < num_past[:, None]
+    past = np.where(valid[:, :, None], past, padding[:, None, :])
+
+    row = np.concatenate([past.reshape(len(records), -1), curr[:, :5]],
+                         axis=1)
+
+    # the i-th model predicts the transmission time of the i-th next chunk
+    for i in range(future_chunks):
+        target = sorted_keys + np.uint64(i * VIDEO_DURATION)
+        pos = np.searchsorted(sorted_keys, target)
+        pos = np.minimum(pos, len(sorted_keys) - 1)
+        found = sorted_keys[pos] == target
+
+        future = curr[pos[found]]
+        ret[i]['in'] = np.concatenate([row[found], future[:, 5:6]], axis=1)
+        ret[i]['out'] = future[:, 6]
+
+    return ret
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='summarize the TTP training shards in a directory')
+    parser.add_argument('shard_dir')
+    parser.add_argument('--from', dest='time_start',
+                        help='datetime in UTC conforming to RFC3339')
+    parser.add_argument('--to', dest='time_end',
+                        help='datetime in UTC conforming to RFC3339')
+    parser.add_argument('--future-chunks', type=int, default=5)
+    args = parser.parse_args()
+
+    shard_paths = find_shards(args.shard_dir)
+    server_ids, records = load_shards(shard_paths,
+                                      args.time_start, args.time_end)
+    print('{} shards, {} records'.format(
+        len(shard_paths), 0 if records is None else len(records)))
+
+    raw_in_out = prepare_input_output(server_ids, records, args.future_chunks)
+    for i in range(args.future_chunks):
+        print('model {}: {} rows of {} inputs'.format(
+            i, len(raw_in_out[i]['out']), raw_in_out[i]['in'].shape[1]))
+
+
+if __name__ == '__main__':
+    main()
@@ -10,6 +10,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <spawn.h>
 
 #include "child_process.hh"
 #include "system_runner.hh"
@@ -36,6 +37,39 @@ int do_fork()
     return CheckSystemCall( "fork", fork() );
 }
 
+pid_t do_spawn( const vector<string> & args )
+{
+    if ( args.empty() ) {
+        throw runtime_error( "ChildProcess: empty args" );
+    }
+
+    vector<char *> argv;
+    for ( const auto & arg : args ) {
+        argv.push_back( const_cast<char *>( arg.c_str() ) );
+    }
+    argv.push_back( nullptr );
+
+    /* like a forked child, start with no signals blocked */
+    sigset_t no_signals;
+    sigemptyset( &no_signals );
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init( &attr );
+    posix_spawnattr_setsigmask( &attr, &no_signals );
+    posix_spawnattr_setflags( &attr, POSIX_SPAWN_SETSIGMASK );
+
+    pid_t pid;
+    const int ret = posix_spawnp( &pid, args[ 0 ].c_str(), nullptr, &attr,
+                                  argv.data(), environ );
+    posix_spawnattr_destroy( &attr );
+
+    if ( ret != 0 ) {
+        throw unix_error( "posix_spawnp (" + args[ 0 ] + ")", ret );
+    }
+
+    return pid;
+}
+
 /* start up a child process running the supplied lambda */
 /* the return value of the lambda is the child's exit status */
 ChildProcess::ChildProcess( const string & name,
@@ -61,6 +95,20 @@ ChildProcess::ChildProcess( const string & name,
     }
 }
 
+/* start up a child process executing a program */
+ChildProcess::ChildProcess( const string & name,
+                            const vector<string> & args,
+                            const int termination_signal )
+    : name_( name ),
+      pid_( do_spawn( args ) ),
+      running_( true ),
+      terminated_( false ),
+      exit_status_(),
+      died_on_signal_( false ),
+      graceful_termination_signal_( termination_signal ),
+      moved_away_( false )
+{}
+
 /* is process in a waitable state? */
 bool ChildProcess::waitable( void ) const
 {
@@ -204,7 +252,8 @@ ProcessManager::ProcessManager()
       [this]() {
         return handle_signal(signal_fd_.read_signal());
       }
-    )
+    ),
+    "child_process.signal"
   );
 }
 
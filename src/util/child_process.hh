@@ -33,6 +33,12 @@ public:
                   std::function<int()> && child_procedure,
                   const int termination_signal = SIGHUP );
 
+    /* execute args[0] (searching PATH) with posix_spawn() instead of fork(),
+       which is safe in a multi-threaded program */
+    ChildProcess( const std::string & name,
+                  const std::vector<std::string> & args,
+                  const int termination_signal = SIGHUP );
+
     bool waitable( void ) const; /* is process in a waitable state? */
     void wait( const bool nonblocking = false ); /* wait for process to change state */
     void signal( const int sig ); /* send signal */
@@ -1,5 +1,7 @@
 #include "formatter.hh"
 
+#include <stdexcept>
+
 using namespace std;
 
 void Formatter::parse(const string & format_string)
@@ -16,13 +18,13 @@ void Formatter::parse(const string & format_string)
   while (pos < format_string.size()) {
     size_t lpos = format_string.find("{", pos);
     if (lpos == string::npos) {
-      fields_.emplace_back(make_unique<Literal>(format_string.substr(pos)));
+      fields_.push_back({Type::literal, format_string.substr(pos), 0});
       break;
     }
 
     if (lpos > pos) {
-      fields_.emplace_back(make_unique<Literal>(
-                           format_string.substr(pos, lpos - pos)));
+      fields_.push_back({Type::literal,
+                         format_string.substr(pos, lpos - pos), 0});
     }
     pos = lpos + 1;
 
@@ -41,7 +43,7 @@ void Formatter::parse(const string & format_string)
                             "to manual field specification");
       }
 
-      fields_.emplace_back(make_unique<Replacement>(*auto_field_index_));
+      add_replacement(*auto_field_index_);
       auto_field_index_ = *auto_field_index_ + 1;
     } else {  // {INDEX}
       if (not auto_field_numbering_) {
@@ -56,37 +58,47 @@ void Formatter::parse(const string & format_string)
         throw runtime_error("invalid negative index");
       }
 
-      fields_.emplace_back(make_unique<Replacement>(index));
+      add_replacement(index);
     }
   }
 }
 
-string Formatter::format(const vector<string> & values)
+void Formatter::add_replacement(const unsigned int index)
 {
-  string ret;
+  fields_.push_back({Type::replacement, "", index});
+  num_values_ = max(num_values_, size_t {index} + 1);
+}
 
-  for (const auto & field : fields_) {
-    if (field->type == Type::literal) {
-      ret += static_cast<Literal*>(field.get())->text;
-    } else if (field->type == Type::replacement) {
-      unsigned int index = static_cast<Replacement*>(field.get())->index;
+string Formatter::format(const vector<string> & values) const
+{
+  vector<string_view> views(values.begin(), values.end());
 
-      if (index >= values.size()) {
-        throw runtime_error("index out of range");
-      }
+  string ret;
+  format_to(ret, views);
+  return ret;
+}
+
+void Formatter::format_to(string & out,
+                          const vector<string_view> & values) const
+{
+  /* check once rather than for every field */
+  if (values.size() < num_values_) {
+    throw runtime_error("index out of range");
+  }
 
-      ret += values.at(index);
+  for (const auto & field : fields_) {
+    if (field.type == Type::literal) {
+      out += field.text;
     } else {
-      throw runtime_error("invalid field type");
+      out += values[field.index];
     }
   }
-
-  return ret;
 }
 
 void Formatter::reset()
 {
   fields_.clear();
+  num_values_ = 0;
 
   auto_field_numbering_.reset();
   auto_field_index_.reset();
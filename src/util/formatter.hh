@@ -2,48 +2,47 @@
 #define FORMATTER_HH
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
-#include <memory>
 
 /* A Formatter similar to the one in Python 3. Currently supported formats:
  * '{}': simple positional formatting
- * '{INDEX}': explicit positional formatting with integer index */
+ * '{INDEX}': explicit positional formatting with integer index
+ * parse() compiles the format string into a flat plan of fields, so that
+ * formatting a line is a single pass of appends without allocations */
 class Formatter
 {
 public:
   void parse(const std::string & format_string);
-  std::string format(const std::vector<std::string> & values);
+  std::string format(const std::vector<std::string> & values) const;
+
+  /* append the formatted values to out */
+  void format_to(std::string & out,
+                 const std::vector<std::string_view> & values) const;
+
+  /* number of values that format() requires */
+  size_t num_values() const { return num_values_; }
 
   enum class Type {literal, replacement};
 
   struct Field {
     Type type;
-
-    Field(const Type type_) : type(type_) {}
-    virtual ~Field() {}
-  };
-
-  struct Literal : Field {
-    std::string text;
-
-    Literal(const std::string & text_)
-      : Field(Type::literal), text(text_) {}
-  };
-
-  struct Replacement : Field {
-    unsigned int index;
-
-    Replacement(const unsigned int index_)
-      : Field(Type::replacement), index(index_) {}
+    std::string text;    /* literal only */
+    unsigned int index;  /* replacement only */
   };
 
 private:
-  std::vector<std::unique_ptr<Field>> fields_ {};
+  std::vector<Field> fields_ {};
+
+  /* one more than the largest replacement index */
+  size_t num_values_ {0};
 
   std::optional<bool> auto_field_numbering_ {};
   std::optional<unsigned int> auto_field_index_ {};
 
+  void add_replacement(const unsigned int index);
+
   void reset();
 };
 
@@ -4,6 +4,8 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/time.h>
+#include <cstring>
 
 #include "exception.hh"
 
@@ -46,6 +48,7 @@ void IPCSocket::listen( const int backlog )
 
 FileDescriptor IPCSocket::accept()
 {
+  register_read();
   return { CheckSystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) };
 }
 
@@ -62,3 +65,77 @@ void IPCSocket::set_reuseaddr( void )
 {
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int( true ) );
 }
+
+void send_fd( FileDescriptor & sock, const FileDescriptor & fd_to_send )
+{
+  /* at least one byte of normal data is required to carry ancillary data */
+  char byte = 0;
+  iovec iov { &byte, sizeof( byte ) };
+
+  alignas( cmsghdr ) char control[ CMSG_SPACE( sizeof( int ) ) ] {};
+
+  msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+
+  cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+  const int fd_num = fd_to_send.fd_num();
+  memcpy( CMSG_DATA( cmsg ), &fd_num, sizeof( int ) );
+
+  /* fail with EPIPE rather than raise SIGPIPE if the peer is gone */
+  CheckSystemCall( "sendmsg", ::sendmsg( sock.fd_num(), &msg, MSG_NOSIGNAL ) );
+  sock.register_write();
+}
+
+FileDescriptor recv_fd( FileDescriptor & sock )
+{
+  char byte = 0;
+  iovec iov { &byte, sizeof( byte ) };
+
+  alignas( cmsghdr ) char control[ CMSG_SPACE( sizeof( int ) ) ] {};
+
+  msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+
+  if ( CheckSystemCall( "recvmsg", ::recvmsg( sock.fd_num(), &msg, 0 ) ) == 0 ) {
+    throw runtime_error( "recv_fd: peer closed the socket" );
+  }
+  sock.register_read();
+
+  const cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+  if ( cmsg == nullptr or cmsg->cmsg_level != SOL_SOCKET
+       or cmsg->cmsg_type != SCM_RIGHTS
+       or cmsg->cmsg_len != CMSG_LEN( sizeof( int ) ) ) {
+    throw runtime_error( "recv_fd: no file descriptor received" );
+  }
+
+  int fd_num;
+  memcpy( &fd_num, CMSG_DATA( cmsg ), sizeof( int ) );
+  return { fd_num };
+}
+
+uid_t peer_uid( const FileDescriptor & sock )
+{
+  ucred cred {};
+  socklen_t len = sizeof( cred );
+  CheckSystemCall( "getsockopt", getsockopt( sock.fd_num(), SOL_SOCKET,
+                                             SO_PEERCRED, &cred, &len ) );
+  return cred.uid;
+}
+
+void set_read_timeout( FileDescriptor & sock, const unsigned int timeout_ms )
+{
+  const timeval timeout { static_cast<time_t>( timeout_ms / 1000 ),
+                          static_cast<suseconds_t>( timeout_ms % 1000 * 1000 ) };
+  CheckSystemCall( "setsockopt", setsockopt( sock.fd_num(), SOL_SOCKET,
+                                             SO_RCVTIMEO, &timeout,
+                                             sizeof( timeout ) ) );
+}
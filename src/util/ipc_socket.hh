@@ -4,6 +4,7 @@
 #define IPC_SOCKET_HH
 
 #include <string>
+#include <sys/types.h>
 
 #include "file_descriptor.hh"
 
@@ -26,4 +27,17 @@ protected:
   void setsockopt( const int level, const int option, const option_type & option_value );
 };
 
+/* pass a file descriptor over a connected Unix domain socket (SCM_RIGHTS) */
+void send_fd( FileDescriptor & sock, const FileDescriptor & fd_to_send );
+
+/* receive a file descriptor passed with send_fd() */
+FileDescriptor recv_fd( FileDescriptor & sock );
+
+/* user ID of the process at the other end of a connected Unix domain socket
+ * (SO_PEERCRED) */
+uid_t peer_uid( const FileDescriptor & sock );
+
+/* fail the reads of a blocking socket after waiting for timeout_ms */
+void set_read_timeout( FileDescriptor & sock, const unsigned int timeout_ms );
+
 #endif /* IPC_SOCKET_HH */
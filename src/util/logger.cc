@@ -0,0 +1,264 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "logger.hh"
+
+#include <unistd.h>
+#include <cerrno>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+
+#include "timestamp.hh"
+
+using namespace std;
+
+static atomic<LogLevel> min_log_level {LogLevel::Info};
+
+void set_log_level(const LogLevel level)
+{
+  min_log_level = level;
+}
+
+LogLevel log_level()
+{
+  return min_log_level.load(memory_order_relaxed);
+}
+
+LogLevel parse_log_level(const string & name)
+{
+  if (name == "debug") {
+    return LogLevel::Debug;
+  } else if (name == "info") {
+    return LogLevel::Info;
+  } else if (name == "warning") {
+    return LogLevel::Warning;
+  } else if (name == "error") {
+    return LogLevel::Error;
+  }
+
+  throw runtime_error("invalid log level: " + name);
+}
+
+static const char * level_name(const LogLevel level)
+{
+  switch (level) {
+  case LogLevel::Debug: return "DEBUG";
+  case LogLevel::Info: return "INFO";
+  case LogLevel::Warning: return "WARNING";
+  case LogLevel::Error: return "ERROR";
+  }
+
+  return "";
+}
+
+namespace {
+
+/* A bounded multi-producer single-consumer queue (after Dmitry Vyukov's
+ * bounded MPMC queue): a producer claims a slot by advancing tail_, and
+ * publishes the slot by bumping its sequence number */
+class LogQueue
+{
+public:
+  static constexpr size_t CAPACITY = 8192;  /* must be a power of 2 */
+
+  LogQueue() : slots_(make_unique<Slot[]>(CAPACITY))
+  {
+    for (size_t i = 0; i < CAPACITY; i++) {
+      slots_[i].seq.store(i, memory_order_relaxed);
+    }
+  }
+
+  /* return false if the queue is full */
+  bool push(string && line)
+  {
+    size_t pos = tail_.load(memory_order_relaxed);
+
+    for (;;) {
+      Slot & slot = slots_[pos & (CAPACITY - 1)];
+      const size_t seq = slot.seq.load(memory_order_acquire);
+
+      if (seq == pos) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        memory_order_relaxed)) {
+          slot.line = move(line);
+          slot.seq.store(pos + 1, memory_order_release);
+          return true;
+        }
+      } else if (seq < pos) {
+        /* the slot still holds the line from a lap ago */
+        return false;
+      } else {
+        pos = tail_.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  /* only called by the consumer */
+  bool pop(string & line)
+  {
+    Slot & slot = slots_[head_ & (CAPACITY - 1)];
+    if (slot.seq.load(memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+
+    line = move(slot.line);
+    slot.seq.store(head_ + CAPACITY, memory_order_release);
+    head_++;
+    return true;
+  }
+
+private:
+  struct Slot
+  {
+    atomic<size_t> seq {0};
+    string line {};
+  };
+
+  unique_ptr<Slot[]> slots_;
+  atomic<size_t> tail_ {0};
+  size_t head_ {0};
+};
+
+/* drains the queue to stderr on a background thread */
+class Logger
+{
+public:
+  Logger() : thread_(&Logger::run, this) {}
+
+  ~Logger()
+  {
+    stop_ = true;
+    thread_.join();
+  }
+
+  void push(string && line)
+  {
+    if (queue_.push(move(line))) {
+      queued_++;
+    } else {
+      dropped_++;
+    }
+  }
+
+  void flush()
+  {
+    const uint64_t queued = queued_;
+    while (written_ < queued) {
+      this_thread::sleep_for(chrono::milliseconds(1));
+    }
+  }
+
+  /* forbid copying Logger */
+  Logger(const Logger & other) = delete;
+  Logger & operator=(const Logger & other) = delete;
+
+private:
+  static constexpr size_t MAX_BATCH_BYTES = 64 * 1024;
+
+  LogQueue queue_ {};
+  atomic<uint64_t> queued_ {0};
+  atomic<uint64_t> written_ {0};
+  atomic<uint64_t> dropped_ {0};
+  atomic<bool> stop_ {false};
+  thread thread_;
+
+  void run()
+  {
+    string batch;
+    string line;
+
+    for (;;) {
+      /* check before draining, so that nothing is left behind on exit */
+      const bool stop = stop_;
+
+      batch.clear();
+      uint64_t lines = 0;
+      while (batch.size() < MAX_BATCH_BYTES and queue_.pop(line)) {
+        batch += line;
+        lines++;
+      }
+
+      const uint64_t dropped = dropped_.exchange(0);
+      if (dropped) {
+        batch += "logger: dropped " + to_string(dropped) + " messages\n";
+      }
+
+      write_stderr(batch);
+      written_ += lines;
+
+      if (batch.empty()) {
+        if (stop) {
+          return;
+        }
+
+        this_thread::sleep_for(chrono::milliseconds(2));
+      }
+    }
+  }
+
+  /* errors are ignored: there is nowhere left to report them */
+  static void write_stderr(const string & data)
+  {
+    size_t offset = 0;
+    while (offset < data.size()) {
+      const ssize_t n = ::write(STDERR_FILENO, data.data() + offset,
+                                data.size() - offset);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      offset += n;
+    }
+  }
+};
+
+}
+
+static Logger & logger()
+{
+  static Logger instance;
+  return instance;
+}
+
+void flush_log()
+{
+  logger().flush();
+}
+
+bool LogSite::admit()
+{
+  if (level_ < log_level()) {
+    return false;
+  }
+
+  const uint64_t now_s = timestamp_s();
+  uint64_t window_s = window_s_.load(memory_order_relaxed);
+  if (window_s != now_s and
+      window_s_.compare_exchange_strong(window_s, now_s)) {
+    window_count_ = 0;
+  }
+
+  if (window_count_.fetch_add(1, memory_order_relaxed) < max_per_second_) {
+    return true;
+  }
+
+  suppressed_.fetch_add(1, memory_order_relaxed);
+  return false;
+}
+
+LogLine::~LogLine()
+{
+  string line = to_string(timestamp_ms()) + " " + level_name(site_.level())
+                + " " + stream_.str();
+
+  const uint64_t suppressed = site_.take_suppressed();
+  if (suppressed) {
+    line += " (" + to_string(suppressed) + " similar messages suppressed)";
+  }
+
+  line += '\n';
+  logger().push(move(line));
+}
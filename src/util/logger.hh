@@ -0,0 +1,101 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef LOGGER_HH
+#define LOGGER_HH
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <sstream>
+
+/* Leveled logging that never blocks the calling thread on stderr: messages
+ * are queued in a bounded lock-free queue and written out by a background
+ * thread (messages are dropped, and counted, if the queue is full).
+ *
+ *   LOG_INFO << client.signature() << ": connection opened";
+ *
+ * Each call site emits at most max_per_second messages; the number of
+ * messages suppressed is appended to the next one emitted. LOG_DEBUG is
+ * compiled out unless ENABLE_DEBUG_LOG is defined (--enable-debug-log). */
+
+enum class LogLevel { Debug, Info, Warning, Error };
+
+/* messages below the level are discarded (Info by default) */
+void set_log_level(const LogLevel level);
+LogLevel log_level();
+
+/* "debug", "info", "warning" or "error" */
+LogLevel parse_log_level(const std::string & name);
+
+/* block until every message queued so far is written */
+void flush_log();
+
+/* state of a call site */
+class LogSite
+{
+public:
+  static constexpr unsigned int DEFAULT_MAX_PER_SECOND = 50;
+
+  LogSite(const LogLevel level,
+          const unsigned int max_per_second = DEFAULT_MAX_PER_SECOND)
+    : level_(level), max_per_second_(max_per_second) {}
+
+  LogLevel level() const { return level_; }
+
+  /* whether to emit a message from this site now */
+  bool admit();
+
+  /* the number of messages suppressed since the last call */
+  uint64_t take_suppressed() { return suppressed_.exchange(0); }
+
+private:
+  LogLevel level_;
+  unsigned int max_per_second_;
+
+  std::atomic<uint64_t> window_s_ {0};  /* the current one-second window */
+  std::atomic<unsigned int> window_count_ {0};
+  std::atomic<uint64_t> suppressed_ {0};
+};
+
+/* collects a message, and queues it once the statement ends */
+class LogLine
+{
+public:
+  LogLine(LogSite & site) : site_(site) {}
+  ~LogLine();
+
+  template<typename T>
+  LogLine & operator<<(const T & value)
+  {
+    stream_ << value;
+    return *this;
+  }
+
+  /* forbid copying LogLine */
+  LogLine(const LogLine & other) = delete;
+  LogLine & operator=(const LogLine & other) = delete;
+
+private:
+  LogSite & site_;
+  std::ostringstream stream_ {};
+};
+
+/* the lambda gives every call site its own LogSite */
+#define LOG_AT(level, max_per_second) \
+  if (LogSite & log_site_ = []() -> LogSite & { \
+        static LogSite site {level, max_per_second}; return site; }(); \
+      not log_site_.admit()) {} else LogLine(log_site_)
+
+#define LOG_INFO LOG_AT(LogLevel::Info, LogSite::DEFAULT_MAX_PER_SECOND)
+#define LOG_WARNING LOG_AT(LogLevel::Warning, LogSite::DEFAULT_MAX_PER_SECOND)
+#define LOG_ERROR LOG_AT(LogLevel::Error, LogSite::DEFAULT_MAX_PER_SECOND)
+
+#ifdef ENABLE_DEBUG_LOG
+#define LOG_DEBUG LOG_AT(LogLevel::Debug, LogSite::DEFAULT_MAX_PER_SECOND)
+#else
+/* still type-checked, but never evaluated */
+#define LOG_DEBUG \
+  if (true) {} else LOG_AT(LogLevel::Debug, LogSite::DEFAULT_MAX_PER_SECOND)
+#endif
+
+#endif /* LOGGER_HH */
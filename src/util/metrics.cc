@@ -0,0 +1,204 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "metrics.hh"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+Histogram::Histogram(const vector<double> & bounds)
+  : bounds_(bounds),
+    buckets_(make_unique<atomic<uint64_t>[]>(bounds.size() + 1))
+{
+  if (not is_sorted(bounds_.begin(), bounds_.end())) {
+    throw runtime_error("Histogram: bucket bounds must be sorted");
+  }
+
+  for (size_t i = 0; i <= bounds_.size(); i++) {
+    buckets_[i].store(0, memory_order_relaxed);
+  }
+}
+
+void Histogram::observe(const double value)
+{
+  /* a value equal to a bound belongs to the bucket of that bound */
+  const size_t bucket = lower_bound(bounds_.begin(), bounds_.end(), value)
+                        - bounds_.begin();
+  buckets_[bucket].fetch_add(1, memory_order_relaxed);
+
+  double sum = sum_.load(memory_order_relaxed);
+  while (not sum_.compare_exchange_weak(sum, sum + value,
+                                        memory_order_relaxed)) {}
+}
+
+uint64_t Histogram::bucket_count(const size_t bucket) const
+{
+  if (bucket > bounds_.size()) {
+    throw out_of_range("Histogram: invalid bucket");
+  }
+
+  return buckets_[bucket].load(memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const
+{
+  uint64_t count = 0;
+  for (size_t i = 0; i <= bounds_.size(); i++) {
+    count += buckets_[i].load(memory_order_relaxed);
+  }
+  return count;
+}
+
+double Histogram::sum() const
+{
+  return sum_.load(memory_order_relaxed);
+}
+
+const vector<double> & latency_buckets()
+{
+  static const vector<double> buckets {
+    0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005,
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1};
+  return buckets;
+}
+
+/* render labels as k1="v1",k2="v2" (without braces) */
+static string render_labels(const MetricLabels & labels)
+{
+  string ret;
+
+  for (const auto & [key, value] : labels) {
+    if (not ret.empty()) {
+      ret += ",";
+    }
+
+    ret += key + "=\"";
+    for (const char c : value) {
+      if (c == '\\' or c == '"') {
+        ret += '\\';
+        ret += c;
+      } else if (c == '\n') {
+        ret += "\\n";
+      } else {
+        ret += c;
+      }
+    }
+    ret += "\"";
+  }
+
+  return ret;
+}
+
+static string braced(const string & labels)
+{
+  return labels.empty() ? "" : "{" + labels + "}";
+}
+
+static string with_label(const string & labels, const string & label)
+{
+  return "{" + (labels.empty() ? label : labels + "," + label) + "}";
+}
+
+MetricsRegistry::Family & MetricsRegistry::family(const string & name,
+                                                  const string & help,
+                                                  const Type type)
+{
+  auto it = families_.find(name);
+  if (it == families_.end()) {
+    it = families_.emplace(name, Family {type, help}).first;
+  } else if (it->second.type != type) {
+    throw runtime_error("MetricsRegistry: " + name + " has another type");
+  }
+
+  return it->second;
+}
+
+Counter & MetricsRegistry::counter(const string & name, const string & help,
+                                   const MetricLabels & labels)
+{
+  Family & f = family(name, help, Type::Counter);
+  const string key = render_labels(labels);
+
+  auto it = f.counters.find(key);
+  if (it == f.counters.end()) {
+    counters_.emplace_back();
+    it = f.counters.emplace(key, &counters_.back()).first;
+  }
+
+  return *it->second;
+}
+
+Histogram & MetricsRegistry::histogram(const string & name,
+                                       const string & help,
+                                       const vector<double> & bounds,
+                                       const MetricLabels & labels)
+{
+  Family & f = family(name, help, Type::Histogram);
+  const string key = render_labels(labels);
+
+  auto it = f.histograms.find(key);
+  if (it == f.histograms.end()) {
+    histograms_.emplace_back(make_unique<Histogram>(bounds));
+    it = f.histograms.emplace(key, histograms_.back().get()).first;
+  }
+
+  return *it->second;
+}
+
+void MetricsRegistry::gauge(const string & name, const string & help,
+                            const function<double()> & read,
+                            const MetricLabels & labels)
+{
+  family(name, help, Type::Gauge).gauges[render_labels(labels)] = read;
+}
+
+string MetricsRegistry::render() const
+{
+  ostringstream out;
+
+  for (const auto & [name, f] : families_) {
+    out << "# HELP " << name << " " << f.help << "\n";
+
+    switch (f.type) {
+    case Type::Counter:
+      out << "# TYPE " << name << " counter\n";
+      for (const auto & [labels, counter] : f.counters) {
+        out << name << braced(labels) << " " << counter->value() << "\n";
+      }
+      break;
+
+    case Type::Gauge:
+      out << "# TYPE " << name << " gauge\n";
+      for (const auto & [labels, read] : f.gauges) {
+        out << name << braced(labels) << " " << read() << "\n";
+      }
+      break;
+
+    case Type::Histogram:
+      out << "# TYPE " << name << " histogram\n";
+      for (const auto & [labels, histogram] : f.histograms) {
+        /* buckets are cumulative in the exposition format */
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < histogram->bounds().size(); i++) {
+          cumulative += histogram->bucket_count(i);
+          ostringstream le;
+          le << "le=\"" << histogram->bounds()[i] << "\"";
+          out << name << "_bucket" << with_label(labels, le.str()) << " "
+              << cumulative << "\n";
+        }
+
+        cumulative += histogram->bucket_count(histogram->bounds().size());
+        out << name << "_bucket" << with_label(labels, "le=\"+Inf\"") << " "
+            << cumulative << "\n";
+        out << name << "_sum" << braced(labels) << " "
+            << histogram->sum() << "\n";
+        out << name << "_count" << braced(labels) << " " << cumulative << "\n";
+      }
+      break;
+    }
+  }
+
+  return out.str();
+}
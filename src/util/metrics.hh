@@ -0,0 +1,105 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef METRICS_HH
+#define METRICS_HH
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+
+/* Metrics in the Prometheus data model. Recording a value is a few relaxed
+ * atomic operations, cheap enough to leave on in production and safe to do
+ * from any thread; a scrape may see the fields of a histogram mid-update. */
+
+/* labels of a metric, e.g., {{"format", "1280x720-20"}} */
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/* a count that only goes up */
+class Counter
+{
+public:
+  void inc(const uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_ {0};
+};
+
+/* counts of observed values in buckets with fixed upper bounds */
+class Histogram
+{
+public:
+  explicit Histogram(const std::vector<double> & bounds);
+
+  void observe(const double value);
+
+  const std::vector<double> & bounds() const { return bounds_; }
+
+  /* the last count is of the values beyond all bounds */
+  uint64_t bucket_count(const size_t bucket) const;
+  uint64_t count() const;
+  double sum() const;
+
+  /* forbid copying Histogram */
+  Histogram(const Histogram & other) = delete;
+  Histogram & operator=(const Histogram & other) = delete;
+
+private:
+  std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<double> sum_ {0};
+};
+
+/* bucket bounds (in seconds) suited to latencies from 10 us to 1 s */
+const std::vector<double> & latency_buckets();
+
+/* Owns the metrics of a process and renders them in the Prometheus text
+ * exposition format. Metrics are created once, typically at startup; the
+ * references returned stay valid for the life of the registry. */
+class MetricsRegistry
+{
+public:
+  Counter & counter(const std::string & name, const std::string & help,
+                    const MetricLabels & labels = {});
+
+  Histogram & histogram(const std::string & name, const std::string & help,
+                        const std::vector<double> & bounds,
+                        const MetricLabels & labels = {});
+
+  /* a value that is read only when scraped */
+  void gauge(const std::string & name, const std::string & help,
+             const std::function<double()> & read,
+             const MetricLabels & labels = {});
+
+  std::string render() const;
+
+private:
+  enum class Type { Counter, Gauge, Histogram };
+
+  struct Family
+  {
+    Type type;
+    std::string help;
+
+    /* key: rendered labels, e.g., {format="360p"} */
+    std::map<std::string, Counter *> counters {};
+    std::map<std::string, Histogram *> histograms {};
+    std::map<std::string, std::function<double()>> gauges {};
+  };
+
+  std::map<std::string, Family> families_ {};
+
+  /* stable storage of the metrics */
+  std::deque<Counter> counters_ {};
+  std::deque<std::unique_ptr<Histogram>> histograms_ {};
+
+  Family & family(const std::string & name, const std::string & help,
+                  const Type type);
+};
+
+#endif /* METRICS_HH */
@@ -5,6 +5,7 @@
 
 #include "poller.hh"
 #include "exception.hh"
+#include "timestamp.hh"
 #include "nb_secure_socket.hh"
 
 using namespace std;
@@ -18,7 +19,7 @@ Poller::Action::Action( NBSecureSocket & s_socket,
                         const bool s_fail_poller )
   : fd( s_socket ), direction( s_direction ), callback(), when_interested(),
     fderror_callback( s_fderror_callback ), fail_poller ( s_fail_poller ),
-    active( true )
+    active( true ), stats_index( 0 )
 {
   if ( direction == Out ) { /* write */
     callback =
@@ -116,13 +117,56 @@ Poller::Action::Action( NBSecureSocket & s_socket,
   }
 }
 
-void Poller::add_action( Poller::Action action )
+void Poller::add_action( Poller::Action action, const string & name )
 {
+  auto it = dispatch_index_.find( name );
+  if ( it == dispatch_index_.end() ) {
+    it = dispatch_index_.emplace( name, dispatch_stats_.size() ).first;
+    dispatch_stats_.push_back( { name } );
+  }
+  action.stats_index = it->second;
+
   /* the action won't be actually added until the next poll() function call.
      this allows us to call add_action inside the callback functions */
   action_add_queue_.push( action );
 }
 
+void Poller::reset_dispatch_stats()
+{
+  for ( auto & stats : dispatch_stats_ ) {
+    stats.calls = stats.total_us = stats.max_us = 0;
+  }
+
+  dispatch_stats_start_us_ = timestamp_us();
+}
+
+template<class Callback>
+auto Poller::dispatch( const Action & action, const Callback & callback )
+{
+  DispatchStats & stats = dispatch_stats_[ action.stats_index ];
+  current_action_ = &stats.name;
+  const uint64_t start_us = timestamp_us();
+
+  /* account for the time even if the callback throws */
+  struct Accounting
+  {
+    DispatchStats & stats;
+    const uint64_t start_us;
+    std::atomic<const std::string *> & current_action;
+
+    ~Accounting()
+    {
+      const uint64_t elapsed_us = timestamp_us() - start_us;
+      stats.calls++;
+      stats.total_us += elapsed_us;
+      stats.max_us = max( stats.max_us, elapsed_us );
+      current_action = nullptr;
+    }
+  } accounting { stats, start_us, current_action_ };
+
+  return callback();
+}
+
 void Poller::remove_fd( const int fd_num )
 {
   /* the fd won't be actually removed until the end of the current poll().
@@ -178,6 +222,17 @@ Poller::Result Poller::poll( const int timeout_ms )
     return Result::Type::Timeout;
   }
 
+  last_wakeup_us_ = timestamp_us();
+  wakeups_++;
+  dispatching_ = true;
+
+  /* the watchdog only cares about the callbacks of this poll() */
+  struct DispatchingGuard
+  {
+    std::atomic<bool> & dispatching;
+    ~DispatchingGuard() { dispatching = false; }
+  } dispatching_guard { dispatching_ };
+
   it_action = actions_.begin();
   it_pollfd = pollfds_.begin();
 
@@ -185,7 +240,7 @@ Poller::Result Poller::poll( const int timeout_ms )
         ; it_action++, it_pollfd++ ) {
     assert( it_pollfd->fd == it_action->fd.fd_num() );
     if ( it_pollfd->revents & (POLLERR | POLLHUP | POLLNVAL) ) {
-      it_action->fderror_callback();
+      dispatch( *it_action, it_action->fderror_callback );
       remove_fd( it_pollfd->fd );
       continue;
     }
@@ -196,7 +251,7 @@ Poller::Result Poller::poll( const int timeout_ms )
       const auto count_before = it_action->service_count();
 
       try {
-        auto result = it_action->callback();
+        auto result = dispatch( *it_action, it_action->callback );
 
         switch ( result.result ) {
         case ResultType::Exit:
@@ -221,7 +276,7 @@ Poller::Result Poller::poll( const int timeout_ms )
           /* simply remove the fd from poller and keep the poller running */
           print_exception( "Poller: error in callback", e );
 
-          it_action->fderror_callback();
+          dispatch( *it_action, it_action->fderror_callback );
           remove_fd( it_pollfd->fd );
           continue;
         }
@@ -8,7 +8,11 @@
 #include <cassert>
 #include <list>
 #include <set>
+#include <map>
+#include <deque>
 #include <queue>
+#include <string>
+#include <atomic>
 #include <poll.h>
 
 #include "file_descriptor.hh"
@@ -42,6 +46,9 @@ public:
 
     bool active;
 
+    /* index into Poller::dispatch_stats(), set by add_action() */
+    size_t stats_index;
+
     Action( FileDescriptor & s_fd,
             const PollDirection & s_direction,
             const CallbackType & s_callback,
@@ -51,7 +58,7 @@ public:
       : fd( s_fd ), direction( s_direction ), callback( s_callback ),
         when_interested( s_when_interested ),
         fderror_callback( s_fderror_callback ), fail_poller( s_fail_poller ),
-        active( true ) {}
+        active( true ), stats_index( 0 ) {}
 
     Action( NBSecureSocket & s_socket,
             const PollDirection & s_direction,
@@ -63,12 +70,39 @@ public:
     unsigned int service_count( void ) const;
   };
 
+  /* time spent in the callbacks of the actions sharing a name */
+  struct DispatchStats
+  {
+    std::string name;
+    uint64_t calls {0};
+    uint64_t total_us {0};
+    uint64_t max_us {0};
+  };
+
 private:
   std::queue<Action> action_add_queue_ {};
   std::list<Action> actions_ {};
   std::vector<pollfd> pollfds_ {};
   std::set<int> fds_to_remove_ {};
 
+  /* when poll() last returned with events, in microseconds */
+  std::atomic<uint64_t> last_wakeup_us_ {0};
+
+  /* read by a watchdog thread: whether callbacks are being dispatched, how
+   * many times poll() has woken up, and the name of the running action */
+  std::atomic<bool> dispatching_ {false};
+  std::atomic<uint64_t> wakeups_ {0};
+  std::atomic<const std::string *> current_action_ {nullptr};
+
+  /* a deque, so that the names stay put while the watchdog reads them */
+  std::deque<DispatchStats> dispatch_stats_ {};
+  std::map<std::string, size_t> dispatch_index_ {};  /* name -> index */
+  uint64_t dispatch_stats_start_us_ {0};
+
+  /* run the callback (or fderror_callback) of an action, timing it */
+  template<class Callback>
+  auto dispatch( const Action & action, const Callback & callback );
+
   /* remove all actions for file descriptors in `fd_nums` */
   void remove_actions( const std::set<int> & fd_nums );
 
@@ -83,9 +117,28 @@ public:
 
   Poller() {}
 
-  void add_action( Action action );
+  /* forbid copying Poller */
+  Poller( const Poller & other ) = delete;
+  Poller & operator=( const Poller & other ) = delete;
+
+  /* the dispatch time of the action is accounted to its name */
+  void add_action( Action action, const std::string & name = "unnamed" );
   void remove_fd( const int fd_num );
   Result poll( const int timeout_ms );
+
+  /* the time since last_wakeup_us() is spent serving events */
+  uint64_t last_wakeup_us() const { return last_wakeup_us_; }
+
+  /* for a watchdog on another thread */
+  bool dispatching() const { return dispatching_; }
+  uint64_t wakeups() const { return wakeups_; }
+  /* name of the action whose callback is running, or nullptr */
+  const std::string * current_action() const { return current_action_; }
+
+  /* dispatch time per action name since the last reset */
+  const std::deque<DispatchStats> & dispatch_stats() const { return dispatch_stats_; }
+  uint64_t dispatch_stats_start_us() const { return dispatch_stats_start_us_; }
+  void reset_dispatch_stats();
 };
 
 namespace PollerShortNames {
@@ -0,0 +1,92 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "poller_watchdog.hh"
+
+#include <cstring>
+#include <execinfo.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "exception.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+static const int MAX_STACK_FRAMES = 64;
+
+/* runs on the poller thread; only uses functions that do not allocate */
+static void print_stack_trace(int)
+{
+  const char header[] = "Poller watchdog: stack trace of the stalled thread\n";
+  if (write(STDERR_FILENO, header, sizeof(header) - 1)) {}
+
+  void * frames[MAX_STACK_FRAMES];
+  const int num_frames = backtrace(frames, MAX_STACK_FRAMES);
+  backtrace_symbols_fd(frames, num_frames, STDERR_FILENO);
+}
+
+PollerWatchdog::PollerWatchdog(const Poller & poller,
+                               const uint64_t threshold_ms)
+  : poller_(poller), threshold_ms_(threshold_ms),
+    poller_thread_(pthread_self())
+{
+  if (threshold_ms_ == 0) {
+    throw runtime_error("PollerWatchdog: threshold must be positive");
+  }
+
+  /* backtrace() loads libgcc on its first call, which is not safe to do in
+   * a signal handler */
+  void * frames[1];
+  backtrace(frames, 1);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = print_stack_trace;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  CheckSystemCall("sigaction",
+                  sigaction(STACK_TRACE_SIGNAL, &action, nullptr));
+
+  thread_ = thread(&PollerWatchdog::run, this);
+}
+
+PollerWatchdog::~PollerWatchdog()
+{
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+
+  stop_cv_.notify_one();
+  thread_.join();
+}
+
+void PollerWatchdog::run()
+{
+  /* check a few times per threshold */
+  const auto check_interval = chrono::microseconds(threshold_ms_ * 1000 / 4);
+  uint64_t last_reported_wakeup = 0;
+
+  unique_lock<mutex> lock(mutex_);
+  while (not stop_cv_.wait_for(lock, check_interval, [this] { return stop_; })) {
+    /* read the wakeup count first: a stale start time only delays a report */
+    const uint64_t wakeup = poller_.wakeups();
+    if (not poller_.dispatching() or wakeup == last_reported_wakeup) {
+      continue;
+    }
+
+    const uint64_t start_us = poller_.last_wakeup_us();
+    const uint64_t now_us = timestamp_us();
+    if (now_us < start_us or now_us - start_us < threshold_ms_ * 1000) {
+      continue;
+    }
+
+    const string * action = poller_.current_action();
+    cerr << "Poller watchdog: iteration running for "
+         << (now_us - start_us) / 1000 << " ms, in action "
+         << (action ? *action : "(between actions)") << endl;
+
+    pthread_kill(poller_thread_, STACK_TRACE_SIGNAL);
+    last_reported_wakeup = wakeup;
+  }
+}
@@ -0,0 +1,47 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef POLLER_WATCHDOG_HH
+#define POLLER_WATCHDOG_HH
+
+#include <cstdint>
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "poller.hh"
+
+/* Watches a Poller from another thread. When the callbacks of a single
+ * poll() run longer than threshold_ms, prints the name of the running action
+ * and has the poller thread print its stack trace (via STACK_TRACE_SIGNAL).
+ * Must be constructed on the thread that calls poll(). The signal cuts short
+ * a sleep (or a poll) of the stalled callback; most other blocking system
+ * calls are restarted. Link with -rdynamic to see function names. */
+class PollerWatchdog
+{
+public:
+  static constexpr int STACK_TRACE_SIGNAL = SIGUSR2;
+
+  PollerWatchdog(const Poller & poller, const uint64_t threshold_ms);
+  ~PollerWatchdog();
+
+  /* forbid copying PollerWatchdog */
+  PollerWatchdog(const PollerWatchdog & other) = delete;
+  PollerWatchdog & operator=(const PollerWatchdog & other) = delete;
+
+private:
+  const Poller & poller_;
+  uint64_t threshold_ms_;
+  pthread_t poller_thread_;
+
+  std::mutex mutex_ {};
+  std::condition_variable stop_cv_ {};
+  bool stop_ {false};
+
+  std::thread thread_ {};
+
+  void run();
+};
+
+#endif /* POLLER_WATCHDOG_HH */
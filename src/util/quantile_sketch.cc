@@ -0,0 +1,84 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "quantile_sketch.hh"
+
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+/* values below this are counted as zeros */
+static const double MIN_VALUE = 1e-9;
+
+QuantileSketch::QuantileSketch(const double relative_accuracy)
+  : gamma_((1 + relative_accuracy) / (1 - relative_accuracy)),
+    log_gamma_(log(gamma_))
+{
+  if (relative_accuracy <= 0 or relative_accuracy >= 1) {
+    throw runtime_error("QuantileSketch: invalid relative accuracy");
+  }
+}
+
+void QuantileSketch::add(const double value)
+{
+  if (value < 0) {
+    throw runtime_error("QuantileSketch: negative value");
+  }
+
+  if (value < MIN_VALUE) {
+    zeros_++;
+  } else {
+    buckets_[static_cast<int>(ceil(log(value) / log_gamma_))]++;
+  }
+
+  count_++;
+}
+
+void QuantileSketch::merge(const QuantileSketch & other)
+{
+  if (other.gamma_ != gamma_) {
+    throw runtime_error("QuantileSketch: cannot merge different accuracies");
+  }
+
+  for (const auto & [index, count] : other.buckets_) {
+    buckets_[index] += count;
+  }
+
+  zeros_ += other.zeros_;
+  count_ += other.count_;
+}
+
+void QuantileSketch::clear()
+{
+  buckets_.clear();
+  zeros_ = 0;
+  count_ = 0;
+}
+
+double QuantileSketch::quantile(const double q) const
+{
+  if (q < 0 or q > 1) {
+    throw runtime_error("QuantileSketch: invalid quantile");
+  }
+
+  if (count_ == 0) {
+    return 0;
+  }
+
+  const uint64_t rank = static_cast<uint64_t>(q * (count_ - 1));
+  if (rank < zeros_) {
+    return 0;
+  }
+
+  uint64_t seen = zeros_;
+  for (const auto & [index, count] : buckets_) {
+    seen += count;
+    if (seen > rank) {
+      /* the value within the bucket with the least relative error */
+      return 2 * pow(gamma_, index) / (gamma_ + 1);
+    }
+  }
+
+  /* unreachable */
+  return 2 * pow(gamma_, buckets_.rbegin()->first) / (gamma_ + 1);
+}
@@ -0,0 +1,36 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef QUANTILE_SKETCH_HH
+#define QUANTILE_SKETCH_HH
+
+#include <cstdint>
+#include <map>
+
+/* A mergeable quantile sketch for nonnegative values, with a bounded relative
+ * error (as in DDSketch): values are counted in buckets whose bounds grow
+ * geometrically, so its size grows only with the log of the value range. */
+class QuantileSketch
+{
+public:
+  explicit QuantileSketch(const double relative_accuracy = 0.01);
+
+  void add(const double value);
+  void merge(const QuantileSketch & other);
+  void clear();
+
+  uint64_t count() const { return count_; }
+
+  /* estimate of the q-quantile (0 <= q <= 1); 0 if empty */
+  double quantile(const double q) const;
+
+private:
+  double gamma_;
+  double log_gamma_;
+
+  /* bucket i counts the values in (gamma^(i-1), gamma^i] */
+  std::map<int, uint64_t> buckets_ {};
+  uint64_t zeros_ {0};
+  uint64_t count_ {0};
+};
+
+#endif /* QUANTILE_SKETCH_HH */
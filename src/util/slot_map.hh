@@ -0,0 +1,209 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef SLOT_MAP_HH
+#define SLOT_MAP_HH
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <optional>
+#include <string>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+/* A slab of objects indexed by generation-tagged keys, offering O(1) lookup,
+ * stable addresses and iteration over slots stored in contiguous blocks.
+ * A key is (generation << 32 | slot index). The generation of a slot is
+ * bumped when its object is erased, so stale keys never alias a new object
+ * that reuses the slot. */
+template<class T>
+class SlotMap
+{
+public:
+  using Key = uint64_t;
+
+private:
+  struct Slot
+  {
+    uint32_t generation {0};
+    std::optional<T> value {};
+  };
+
+  /* std::deque never relocates its elements when growing at the back */
+  std::deque<Slot> slots_ {};
+  std::vector<uint32_t> free_slots_ {};
+  size_t size_ {0};
+
+  /* keys are issued by another SlotMap (see emplace_at) */
+  bool mirrored_ {false};
+
+  static uint32_t slot_index(const Key key) { return key & 0xFFFFFFFF; }
+  static uint32_t generation(const Key key) { return key >> 32; }
+
+  static Key make_key(const uint32_t generation, const uint32_t index)
+  {
+    return (static_cast<Key>(generation) << 32) | index;
+  }
+
+  template<bool Const>
+  class Iterator
+  {
+  private:
+    using SlotIt = std::conditional_t<Const,
+                                      typename std::deque<Slot>::const_iterator,
+                                      typename std::deque<Slot>::iterator>;
+    using Value = std::conditional_t<Const, const T, T>;
+
+    SlotIt it_;
+    SlotIt end_;
+    uint32_t index_;
+
+    void skip_empty()
+    {
+      while (it_ != end_ and not it_->value) {
+        ++it_;
+        ++index_;
+      }
+    }
+
+  public:
+    Iterator(const SlotIt it, const SlotIt end, const uint32_t index)
+      : it_(it), end_(end), index_(index)
+    {
+      skip_empty();
+    }
+
+    std::pair<Key, Value &> operator*() const
+    {
+      return {make_key(it_->generation, index_), *it_->value};
+    }
+
+    Iterator & operator++()
+    {
+      ++it_;
+      ++index_;
+      skip_empty();
+      return *this;
+    }
+
+    bool operator==(const Iterator & other) const { return it_ == other.it_; }
+    bool operator!=(const Iterator & other) const { return it_ != other.it_; }
+  };
+
+public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  /* construct an object in a free slot and return its key */
+  template<class... Args>
+  Key emplace(Args &&... args)
+  {
+    uint32_t index;
+
+    if (free_slots_.empty()) {
+      index = slots_.size();
+      slots_.emplace_back();
+    } else {
+      index = free_slots_.back();
+      free_slots_.pop_back();
+    }
+
+    Slot & slot = slots_[index];
+    slot.value.emplace(std::forward<Args>(args)...);
+    size_++;
+
+    return make_key(slot.generation, index);
+  }
+
+  /* construct an object under a key issued by another SlotMap, so that
+   * parallel tables share keys; do not mix with emplace() on one SlotMap */
+  template<class... Args>
+  T & emplace_at(const Key key, Args &&... args)
+  {
+    const uint32_t index = slot_index(key);
+    while (slots_.size() <= index) {
+      slots_.emplace_back();
+    }
+
+    Slot & slot = slots_[index];
+    if (slot.value) {
+      throw std::runtime_error("SlotMap: slot is already occupied");
+    }
+
+    slot.generation = generation(key);
+    slot.value.emplace(std::forward<Args>(args)...);
+    size_++;
+    mirrored_ = true;
+
+    return *slot.value;
+  }
+
+  /* return nullptr if no object exists with the key */
+  T * find(const Key key)
+  {
+    const uint32_t index = slot_index(key);
+    if (index >= slots_.size()) {
+      return nullptr;
+    }
+
+    Slot & slot = slots_[index];
+    if (not slot.value or slot.generation != generation(key)) {
+      return nullptr;
+    }
+
+    return &*slot.value;
+  }
+
+  const T * find(const Key key) const
+  {
+    return const_cast<SlotMap *>(this)->find(key);
+  }
+
+  T & at(const Key key)
+  {
+    T * value = find(key);
+    if (not value) {
+      throw std::out_of_range("SlotMap: invalid key " + std::to_string(key));
+    }
+
+    return *value;
+  }
+
+  const T & at(const Key key) const
+  {
+    return const_cast<SlotMap *>(this)->at(key);
+  }
+
+  /* destroy the object with the key; return false if it does not exist */
+  bool erase(const Key key)
+  {
+    if (not find(key)) {
+      return false;
+    }
+
+    const uint32_t index = slot_index(key);
+    Slot & slot = slots_[index];
+    slot.value.reset();
+    slot.generation++;
+    size_--;
+
+    /* slots of a mirrored SlotMap are reused only by the keys of its source */
+    if (not mirrored_) {
+      free_slots_.push_back(index);
+    }
+
+    return true;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /* iterate over (key, object) pairs in the order of slots */
+  iterator begin() { return {slots_.begin(), slots_.end(), 0}; }
+  iterator end() { return {slots_.end(), slots_.end(), 0}; }
+  const_iterator begin() const { return {slots_.cbegin(), slots_.cend(), 0}; }
+  const_iterator end() const { return {slots_.cend(), slots_.cend(), 0}; }
+};
+
+#endif /* SLOT_MAP_HH */
@@ -1,9 +1,24 @@
 #include "timestamp.hh"
 #include <ctime>
+#include <atomic>
 #include "exception.hh"
 
+using namespace std;
+
+static atomic<uint64_t> fixed_timestamp_ns {0};  /* 0: the real clock */
+
+void set_fixed_timestamp_ns(const uint64_t ts_ns)
+{
+  fixed_timestamp_ns.store(ts_ns, memory_order_relaxed);
+}
+
 uint64_t timestamp_ns()
 {
+  const uint64_t fixed_ns = fixed_timestamp_ns.load(memory_order_relaxed);
+  if (fixed_ns) {
+    return fixed_ns;
+  }
+
   timespec ts;
   CheckSystemCall("clock_gettime", clock_gettime(CLOCK_REALTIME, &ts));
 
@@ -21,9 +36,15 @@ uint64_t timestamp_ms()
 }
 
 uint64_t timestamp_s()
+{
+  return timestamp_ns() / BILLION;
+}
+
+uint64_t thread_cpu_ns()
 {
   timespec ts;
-  CheckSystemCall("clock_gettime", clock_gettime(CLOCK_REALTIME, &ts));
+  CheckSystemCall("clock_gettime",
+                  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts));
 
-  return ts.tv_sec;
+  return ts.tv_sec * BILLION + ts.tv_nsec;
 }
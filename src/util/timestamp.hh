@@ -18,4 +18,12 @@ uint64_t timestamp_ms();
 /* seconds since epoch */
 uint64_t timestamp_s();
 
+/* fix the time returned by the timestamps above at ts_ns (e.g., to replay
+ * recorded events at their recorded times), or read the real clock again if
+ * ts_ns is 0 */
+void set_fixed_timestamp_ns(const uint64_t ts_ns);
+
+/* CPU time consumed by the calling thread, in nanoseconds */
+uint64_t thread_cpu_ns();
+
 #endif /* TIMESTAMP_HH */